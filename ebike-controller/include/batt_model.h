@@ -0,0 +1,60 @@
+/******************************************************************************
+ * Filename: batt_model.h
+ * Description: Online estimate of the pack's open circuit voltage and internal
+ *              resistance, by recursive least squares on battery current and voltage.
+ *
+ ******************************************************************************
+
+ Copyright (c) 2019 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#ifndef _BATT_MODEL_H_
+#define _BATT_MODEL_H_
+
+#include "stm32f4xx.h"
+#include "project_parameters.h"
+
+/**
+ * Model: V = Voc - R * I
+ * Both Voc and R drift (charge, temperature), so old samples are forgotten
+ * at BATT_MODEL_FORGET. Only current steps tell R apart from Voc; while
+ * the current is steady the covariance would grow without bound, so its
+ * trace is capped at BATT_MODEL_P_MAX.
+ * The battery current out of power_calc is low pass filtered, and the bus
+ * voltage goes through the same filter here, so the pair stays in step.
+ */
+typedef struct _batt_model {
+    float Voc;
+    float R; // In volts per BATT_MODEL_AMP_SCALE amps, see batt_model_get_resistance
+    float P[2][2]; // Covariance
+    float Volts; // Filtered bus voltage
+    float AvgAmps; // Slow average, for spotting steps
+    uint16_t Steps; // Samples away from the average, saturates
+    uint8_t Started;
+} Batt_Model;
+
+void batt_model_init(void);
+void batt_model_update(float amps, float volts);
+uint8_t batt_model_valid(void);
+float batt_model_get_voc(void);
+float batt_model_get_resistance(void);
+
+#endif //_BATT_MODEL_H_
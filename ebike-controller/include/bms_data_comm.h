@@ -35,35 +35,85 @@
 #define R_ADDRESS               ((uint16_t)0x0001)
 
 #define MAX_BMS_BOARDS          16
+#define BMS_MAX_CELLS_PER_BOARD 4 // R_VOLT_BATT1 to R_VOLT_BATT4
+#define BMS_MAX_CELLS           (MAX_BMS_BOARDS * BMS_MAX_CELLS_PER_BOARD)
 #define BMS_TIMEOUT_MS          100 // Max time to wait for a response
 #define BMS_MAX_RETRIES         3 // Max times to retry ping before calling it a fail
+#define BMS_PIPELINE_DEPTH      4 // Refresh requests in flight at once, each to a different board
 
 typedef enum _bms_comm_state {
     BMS_STATE_IDLE,
     BMS_STATE_ADDRESSING,
-    BMS_STATE_VOLTAGES,
-    BMS_STATE_STATUSES
+    BMS_STATE_PROBING, // Finding out if the board just addressed takes GET_RAM_BATCH
+    BMS_STATE_REFRESHING
 } BMS_CommState;
 
+/**
+ * Refreshing
+ * Boards that take GET_RAM_BATCH are read with one request each, asking
+ * for two ranges (all the cell voltages, then all the statuses):
+ * - I8: Board address
+ * - I16, I16: R_VOLT_BATT1, R_VOLT_BATT1 + cells - 1
+ * - I16, I16: R_STAT_BATT1, R_STAT_BATT1 + cells - 1
+ * The board answers with GET_RAM_BATCH_RESULT, laid out the same as the
+ * controller's own (ID, status, value) but with its address in front so
+ * answers can be matched to requests:
+ * - I8: Board address
+ * - Then for each variable: I16 ID, I8 status (BATCH_STATUS_xx), and the
+ *   I32 value only if the status is BATCH_STATUS_OK
+ * Four cells come to 57 bytes, inside PACKET_MAX_DATA_LENGTH.
+ * Up to BMS_PIPELINE_DEPTH boards are asked before the first one answers,
+ * so the chain is kept busy instead of waiting out each round trip.
+ *
+ * Boards that don't know GET_RAM_BATCH are read one variable at a time as
+ * before. Those answers don't say who they're from, so only one single read
+ * is ever in flight.
+ */
+// One request in flight while refreshing
+typedef struct _bms_request {
+    uint8_t Board; // Zero means the slot is free
+    uint8_t Item; // Zero for a batch read, else which single read (1 = first voltage)
+    uint8_t RetryCount;
+    uint32_t SentTick;
+} BMS_Request_Type;
+
+// Kept up to date as each board's voltages come in
+typedef struct _bms_board_summary {
+    int16_t MinMv;
+    int16_t MaxMv;
+    int32_t SumMv;
+} BMS_Board_Summary;
+
 typedef struct _bms_type {
     uint8_t IsConnected;
     uint8_t NumConnectedBoards; // Equal to the address of the last board in the chain
     uint16_t NumTotalBatts; // Sum of all batteries on all boards
     uint16_t BattsPerBoard[MAX_BMS_BOARDS]; // Could be different on each board
-
-    float* BattVoltages; // Dynamically allocated to length = sum(BattsPerBoard)
-    uint32_t* BattStatuses; // Similar to above.
-    // When indexing the above arrays, each board's batteries are placed in
-    // sequence. So to get a particular board's battery, you need to go past
-    // the sum of all previous board's batteries. That's what the BattsPerBoard
-    // array can be used for.
-
-    // When refreshing data, the following variables are used to hold
-    // the current status of the query. When a response comes back, these
-    // variables tell the loop which battery to ping next.
-    uint8_t CurrentBoard;
-    uint8_t CurrentBatt;
-    uint8_t RetryCount;
+    uint16_t FirstBatt[MAX_BMS_BOARDS]; // Position of each board's first battery
+
+    int16_t BattMillivolts[BMS_MAX_CELLS];
+    uint32_t BattStatuses[BMS_MAX_CELLS];
+    // In the above arrays, each board's batteries are placed in sequence,
+    // starting at FirstBatt for that board.
+
+    BMS_Board_Summary Boards[MAX_BMS_BOARDS];
+    uint16_t BoardsRead; // Bit (n-1) set once all of board n's voltages are in
+    // Whole pack, valid once every board has been read
+    int16_t PackMinMv;
+    int16_t PackMaxMv;
+    int32_t PackSumMv;
+
+    uint16_t BatchBoards; // Bit (n-1) set if board n takes GET_RAM_BATCH
+
+    // When refreshing data, the following variables hold the state of the
+    // query. Answers free up a request slot, which goes to the next board.
+    BMS_Request_Type Requests[BMS_PIPELINE_DEPTH];
+    uint8_t NextBoard; // Next board to ask
+    uint32_t RefreshStart;
+    uint32_t RefreshTime; // How long the last full refresh took, ms
+    uint32_t RefreshCount; // Full refreshes finished
+
+    uint8_t RetryCount; // Addressing only
     BMS_CommState CommState; // For remembering what we're trying to do in the loop
 
     uint32_t TimeoutStart; // Capture the millisecond tick
@@ -115,10 +165,15 @@ uint8_t BMS_Is_Connected(void);
 uint16_t BMS_Get_Num_Batts(void);
 float BMS_Get_Batt_Voltage(uint16_t battnum);
 uint32_t BMS_Get_Batt_Status(uint16_t battnum);
+float BMS_Get_Min_Cell_Voltage(void);
+float BMS_Get_Max_Cell_Voltage(void);
+float BMS_Get_Avg_Cell_Voltage(void);
 void BMS_Send_One_Packet(uint8_t pktType, uint8_t* data, uint8_t datalen);
 void BMS_Restart_Chain(void);
 void BMS_Refresh_Data(void);
 uint8_t BMS_Busy(void);
+uint32_t BMS_Get_Refresh_Time(void);
+uint32_t BMS_Get_Refresh_Count(void);
 void BMS_OneByte_Check(void);
 void BMS_Periodic_Check(void); // Called frequently by main
 
@@ -0,0 +1,73 @@
+/******************************************************************************
+ * Filename: config_blob.h
+ * Description: The whole configuration as one versioned record with a CRC, kept
+ *              in two slots of the EEPROM emulation so a save is all or nothing.
+ *
+ ******************************************************************************
+
+ Copyright (c) 2019 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#ifndef _CONFIG_BLOB_H_
+#define _CONFIG_BLOB_H_
+
+#include "stm32f4xx.h"
+#include "project_parameters.h"
+
+/**
+ * Record format (packed big endian, like the data packets):
+ * Header
+ *   Version (U16)      CONFIG_BLOB_VERSION
+ *   Length (U16)       Of the whole record, CRC included
+ *   Sequence (U32)     One more than the record before it
+ *   Layout (U32)       CRC-32 of the ID (2 bytes) and type (1 byte) of each
+ *                      EEPROM variable, in registry order
+ * Values
+ *   Every EEPROM variable in the registry, in ID order, 2 or 4 bytes
+ *   depending on type
+ * CRC (U32)            CRC-32 of everything before it
+ *
+ * Slots:
+ * The record is stored a half word per EEPROM virtual address, starting at
+ * CONFIG_BLOB_SLOT_A_ADDR or CONFIG_BLOB_SLOT_B_ADDR. A save goes to the
+ * slot the newest record isn't in, inside an EEPROM batch, so after a reset
+ * the slot holds either the whole new record or the old one. At start up
+ * the valid slot with the highest sequence number is loaded; if the newest
+ * one is damaged, the record before it still is.
+ * A record from firmware with a different set of variables has another
+ * Layout and is refused, the per variable EEPROM records are used instead.
+ */
+#define CONFIG_BLOB_VERSION         (1)
+#define CONFIG_BLOB_HEADER_BYTES    (12)
+#define CONFIG_BLOB_CRC_BYTES       (4)
+
+void config_blob_init(void);
+uint16_t config_blob_fill_ee_table(uint16_t* addrTab);
+uint16_t config_blob_save(void);
+uint8_t config_blob_load(void);
+uint16_t config_blob_read(uint8_t* dest);
+uint16_t config_blob_length(void);
+uint8_t config_blob_check(uint8_t* blob, uint16_t length);
+uint16_t config_blob_store(uint8_t* blob, uint16_t length);
+uint8_t config_blob_upload(uint16_t offset, uint8_t* data, uint16_t length);
+uint32_t config_blob_get_sequence(void);
+
+#endif // _CONFIG_BLOB_H_
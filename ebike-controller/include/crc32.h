@@ -28,7 +28,28 @@
 #ifndef _CRC32_H_
 #define _CRC32_H_
 
+#include "stm32f4xx.h"
+
+// Running CRC, for checking data a byte at a time (see crc32_table.c)
+typedef struct _crc32_context {
+    uint32_t Crc;
+    uint16_t Length; // Needed for the zero padding at the end
+} CRC32_Context;
+
+#define CRC32_BENCH_BYTES       (256) // One full packet
+#define CRC32_BENCH_PASSES      (16)
+
+// Hardware CRC unit, whole buffers
 void CRC32_Init(void);
 uint32_t CRC32_Generate(uint8_t *buf, uint16_t len);
+void CRC32_Benchmark(void);
+float CRC32_GetHardwareRate(void);
+float CRC32_GetSoftwareRate(void);
+
+// Software, incremental
+void CRC32_Start(CRC32_Context* ctx);
+void CRC32_Update(CRC32_Context* ctx, uint8_t byte);
+void CRC32_UpdateBuffer(CRC32_Context* ctx, const uint8_t* buf, uint16_t len);
+uint32_t CRC32_Final(const CRC32_Context* ctx);
 
 #endif // _CRC32_H_
@@ -0,0 +1,73 @@
+/******************************************************************************
+ * Filename: dashboard.h
+ * Description: Pushes dashboard data to the handlebar display at a set
+ *              rate, and right away when a fault or limit changes. Only
+ *              the fields that moved are sent.
+ *
+ ******************************************************************************
+
+ Copyright (c) 2019 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#ifndef _DASHBOARD_H_
+#define _DASHBOARD_H_
+
+#include "stm32f4xx.h"
+#include "project_parameters.h"
+
+/**
+ * Push frame format (data field of a DASHBOARD_PUSH packet):
+ * - U8: Sequence number, a gap means a frame was lost. The display can ask
+ *       for everything with REQUEST_DASHBOARD_DATA, or wait for the next
+ *       key frame.
+ * - U16: Mask of the fields in this frame, bit 0 is Param1 (see the
+ *        Dashboard Data Format). All set in a key frame.
+ * - U8: Limit flags, DASHBOARD_LIMIT_xx, always sent
+ * - Values of each field in the mask, in order, 4 bytes each
+ */
+#define DASHBOARD_PUSH_HEADER       (4)
+#define DASHBOARD_NUM_FIELDS        (DASHBOARD_DATA_LENGTH / 4)
+#define DASHBOARD_FAULT_FIELD       (7) // Param8, compared exactly
+
+// Limit flags, set while the throttle is being trimmed for that reason
+#define DASHBOARD_LIMIT_VOLTAGE     (0x01)
+#define DASHBOARD_LIMIT_FET_TEMP    (0x02)
+#define DASHBOARD_LIMIT_MOTOR_TEMP  (0x04)
+#define DASHBOARD_LIMIT_CELL        (0x08) // Weakest battery cell, from the BMS
+
+typedef struct _dashboard_push {
+    uint16_t Period; // ms between frames, 0 when not pushing
+    uint32_t LastFrame; // Tick of the last frame sent
+    uint32_t LastKey; // Tick of the last key frame sent
+    uint8_t Sequence;
+    uint8_t Sent[DASHBOARD_DATA_LENGTH]; // Values as the display has them
+    uint8_t SentLimits;
+    uint32_t FramesSent;
+    uint32_t FieldsSkipped; // Fields left out because they hadn't moved
+} Dashboard_Push_Type;
+
+void dashboard_init(void);
+uint8_t dashboard_subscribe(uint16_t period);
+void dashboard_service(void);
+uint32_t dashboard_get_frames_sent(void);
+uint32_t dashboard_get_fields_skipped(void);
+
+#endif //_DASHBOARD_H_
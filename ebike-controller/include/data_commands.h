@@ -33,6 +33,24 @@
 #define RESULT_IS_32B				(4)
 #define RESULT_IS_FLOAT				(5)
 
+// Number of registry entries described in one GET_VARIABLE_LIST_RESULT
+#define GET_VARIABLE_LIST_MAX_ENTRIES   ((PACKET_MAX_LENGTH - PACKET_OVERHEAD_BYTES \
+                                        - PACKET_COBS_OVERHEAD_BYTES - 5) \
+                                        / DATA_REG_LIST_ENTRY_BYTES)
+
+// Bytes of the configuration record in one GET_CONFIG_BLOB_RESULT, after
+// the total length and offset, and in one SET_CONFIG_BLOB after the offset
+#define CONFIG_BLOB_GET_CHUNK       (PACKET_MAX_LENGTH - PACKET_OVERHEAD_BYTES \
+                                        - PACKET_COBS_OVERHEAD_BYTES - 4)
+#define CONFIG_BLOB_SET_CHUNK       (PACKET_MAX_DATA_LENGTH - 2)
+
+// Per-item status codes in the batch results
+#define BATCH_STATUS_OK             (0x00)
+#define BATCH_STATUS_UNKNOWN_ID     (0x01)
+#define BATCH_STATUS_READ_ONLY      (0x02)
+#define BATCH_STATUS_REJECTED       (0x03) // Out of range, or refused by the setter
+#define BATCH_STATUS_NEEDS_INDEX    (0x04) // Indexed variables can't be batched
+
 uint16_t data_process_command(Data_Packet_Type* pkt);
 uint16_t command_get_ram(uint8_t* pktdata, uint8_t* retval);
 uint16_t command_set_ram(uint8_t* pktdata);
@@ -41,5 +59,13 @@ uint16_t command_set_eeprom(uint8_t* pktdata);
 uint16_t command_enable_feature(uint8_t* pktdata);
 uint16_t command_disable_feature(uint8_t* pktdata);
 uint16_t command_run_routine(uint8_t* pktdata);
+uint16_t command_get_variable_list(uint8_t* pktdata, uint8_t* retval);
+uint16_t command_get_ram_batch(uint8_t* pktdata, uint16_t datalen,
+        uint8_t* retval);
+uint16_t command_set_ram_batch(uint8_t* pktdata, uint16_t datalen,
+        uint8_t* retval);
+uint16_t command_telemetry_subscribe(uint8_t* pktdata, uint16_t datalen);
+uint16_t command_get_config_blob(uint8_t* pktdata, uint8_t* retval);
+uint16_t command_set_config_blob(uint8_t* pktdata, uint16_t datalen);
 
 #endif //_DATA_COMMANDS_H_
@@ -27,8 +27,12 @@
 #define _DATA_PACKET_H_
 
 #include <string.h>
+#include "crc32.h"
+#include "project_parameters.h"
 
 #define DATA_PACKET_TIMEOUT_MS          50
+// Bytes taken from a port at once, enough for a whole received packet
+#define DATA_PACKET_RX_CHUNK            (PACKET_MAX_DATA_LENGTH + PACKET_OVERHEAD_BYTES)
 
 typedef enum _data_comm_state {
     // Note: each state describes the *previous* byte received.
@@ -60,18 +64,42 @@ typedef struct _data_packet {
     Data_Comm_State State; // Tracking packet reception progress
     uint16_t DataBytesRead; // Ditto
     uint32_t Remote_CRC_32;
+    CRC32_Context RxCrc; // Running CRC of the bytes received so far
+
+    uint8_t Framing; // DATA_PACKET_FRAMING_xx, both directions on this link
+    uint8_t CobsCode; // Code byte of the current COBS block, 0 at frame start
+    uint8_t CobsLeft; // Data bytes left in the current COBS block
 } Data_Packet_Type;
 
 #define DATA_PACKET_FAIL        (0)
 #define DATA_PACKET_SUCCESS     (1)
 
 #define PACKET_MAX_LENGTH       (256)
+// Size of the receive data buffers. Host tools raise it to read stream data.
+#ifndef PACKET_MAX_DATA_LENGTH
 #define PACKET_MAX_DATA_LENGTH  (64)
+#endif
 
 #define PACKET_OVERHEAD_BYTES       (10)
+// COBS code bytes (two at most for a full length packet) and the delimiter
+#define PACKET_COBS_OVERHEAD_BYTES  (3)
 #define PACKET_CRC_BYTES            (4)
 #define PACKET_NONCRC_OVHD_BYTES    (PACKET_OVERHEAD_BYTES - PACKET_CRC_BYTES)
 
+/**
+ * Framing modes, chosen per link with SET_FRAMING (one data byte, the mode).
+ * The ACK is sent in the old framing, everything after it in the new one.
+ * - SOP: packets as described in data_packet.c, found by the start bytes
+ * - COBS: the same packet bytes, COBS encoded and followed by a 0x00
+ *   delimiter. The start bytes can show up inside the data, but a zero
+ *   can't, so the receiver always resyncs at the next delimiter.
+ * A host that doesn't know the mode can get back to SOP by sending a 0x00,
+ * a COBS encoded SET_FRAMING(SOP) and then a plain one.
+ */
+#define DATA_PACKET_FRAMING_SOP     (0)
+#define DATA_PACKET_FRAMING_COBS    (1)
+#define PACKET_COBS_DELIMITER       (0x00)
+
 // SOP defines
 #define PACKET_START_0          (0x9A)
 #define PACKET_START_1          (0xCC)
@@ -85,17 +113,31 @@ typedef struct _data_packet {
 #define DISABLE_FEATURE         (0x06)
 #define RUN_ROUTINE             (0x07)
 #define HOST_STREAM_DATA        (0x08)
+#define GET_VARIABLE_LIST       (0x09)
+#define GET_RAM_BATCH           (0x0A)
+#define SET_RAM_BATCH           (0x0B)
+#define TELEMETRY_SUBSCRIBE     (0x0C)
+#define SET_FRAMING             (0x0D)
+#define SET_BAUD                (0x0E)
+#define GET_CONFIG_BLOB         (0x0F)
+#define SET_CONFIG_BLOB         (0x10)
 #define HOST_ACK                (0x11)
 #define HOST_NACK               (0x12)
 #define REQUEST_DASHBOARD_DATA  (0x27)
+#define DASHBOARD_SUBSCRIBE     (0x28)
 // Packet type defines, Controller to Host
 #define GET_RAM_RESULT          (0x81)
 #define GET_EEPROM_RESULT       (0x83)
 #define ROUTINE_RESULT          (0x87)
 #define CONTROLLER_STREAM_DATA  (0x88)
+#define GET_VARIABLE_LIST_RESULT    (0x89)
+#define GET_RAM_BATCH_RESULT    (0x8A)
+#define SET_RAM_BATCH_RESULT    (0x8B)
+#define GET_CONFIG_BLOB_RESULT  (0x8F)
 #define CONTROLLER_ACK          (0x91)
 #define CONTROLLER_NACK         (0x92)
 #define DASHBOARD_DATA_RESULT   (0xA7)
+#define DASHBOARD_PUSH          (0xA8)
 
 // Fault codes
 #define NO_FAULT                (0x00)
@@ -175,9 +217,12 @@ inline float data_packet_extract_float(uint8_t* array) {
 }
 
 void data_packet_init(void);
+uint8_t data_packet_type_size(Data_Type type);
 uint8_t data_packet_create(Data_Packet_Type* pkt, uint8_t type, uint8_t* data,
         uint16_t datalen);
 uint8_t data_packet_extract_one_byte(Data_Packet_Type *pkt, uint8_t new_byte);
+uint8_t data_packet_extract_span(Data_Packet_Type *pkt, uint8_t* buf,
+        uint16_t len, uint16_t* used);
 uint8_t data_packet_extract(Data_Packet_Type* pkt, uint8_t* buf,
         uint16_t buflen);
 
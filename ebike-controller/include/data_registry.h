@@ -0,0 +1,110 @@
+/******************************************************************************
+ * Filename: data_registry.h
+ * Description: Table of every variable that can be accessed over the data
+ *              communication channels (USB, HBD). Each entry describes the
+ *              data type, how to get/set the value, its allowed range, and
+ *              whether it is stored in EEPROM.
+ *
+ ******************************************************************************
+
+ Copyright (c) 2019 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#ifndef _DATA_REGISTRY_H_
+#define _DATA_REGISTRY_H_
+
+#include "stm32f4xx.h"
+#include "project_parameters.h"
+
+// Entry flags
+#define DATA_REG_EEPROM         (0x01) // Value is persisted in EEPROM
+#define DATA_REG_READONLY       (0x02) // No setter, SET_RAM is refused
+#define DATA_REG_INDEXED        (0x04) // Request carries an extra 16-bit index
+#define DATA_REG_RANGE          (0x08) // Min and Max are checked before setting
+
+// Shape of the getter and setter functions, matching the existing
+// module accessors so they can be referenced directly from the table.
+typedef enum _data_reg_access {
+    Data_Access_U8,         // uint8_t get(void)          uint8_t set(uint8_t)
+    Data_Access_U8_Arg,     // uint8_t get(arg)           uint8_t set(arg, uint8_t)
+    Data_Access_U16,        // uint16_t get(void)         uint8_t set(uint16_t)
+    Data_Access_I32,        // int32_t get(void)          uint8_t set(int32_t)
+    Data_Access_U32,        // uint32_t get(void)         uint8_t set(uint32_t)
+    Data_Access_U32_Index,  // uint32_t get(uint16_t index)
+    Data_Access_Float,      // float get(void)            uint8_t set(float)
+    Data_Access_Float_Arg,  // float get(arg)             uint8_t set(arg, float)
+    Data_Access_Float_Index // float get(uint16_t index)
+} Data_Reg_Access;
+
+typedef union _data_reg_getter {
+    uint8_t (*u8)(void);
+    uint8_t (*u8_arg)(uint8_t);
+    uint16_t (*u16)(void);
+    int32_t (*i32)(void);
+    uint32_t (*u32)(void);
+    uint32_t (*u32_index)(uint16_t);
+    float (*f)(void);
+    float (*f_arg)(uint8_t);
+    float (*f_index)(uint16_t);
+} Data_Reg_Getter;
+
+typedef union _data_reg_setter {
+    uint8_t (*u8)(uint8_t);
+    uint8_t (*u8_arg)(uint8_t, uint8_t);
+    uint8_t (*u16)(uint16_t);
+    uint8_t (*i32)(int32_t);
+    uint8_t (*u32)(uint32_t);
+    uint8_t (*f)(float);
+    uint8_t (*f_arg)(uint8_t, float);
+} Data_Reg_Setter;
+
+typedef struct _data_reg_entry {
+    uint16_t ID;            // CONFIG_xxx value, table is sorted by this
+    Data_Type Type;         // Type as seen on the wire
+    uint8_t Flags;          // DATA_REG_xxx
+    Data_Reg_Access Access;
+    uint8_t Arg;            // Passed to the _Arg style accessors
+    Data_Reg_Getter Get;
+    Data_Reg_Setter Set;
+    float Min;              // Only used with DATA_REG_RANGE
+    float Max;
+} Data_Reg_Entry;
+
+// Size of one entry in a GET_VARIABLE_LIST_RESULT packet
+#define DATA_REG_LIST_ENTRY_BYTES   (12)
+
+// The firmware's table is in data_registry_table.c, sorted by ID
+extern const Data_Reg_Entry data_registry[];
+extern const uint16_t data_registry_length;
+
+const Data_Reg_Entry* data_registry_find(uint16_t id);
+uint16_t data_registry_lower_bound(uint16_t id);
+uint16_t data_registry_count(void);
+const Data_Reg_Entry* data_registry_entry(uint16_t index);
+uint8_t data_registry_read(const Data_Reg_Entry* var, uint16_t index,
+        uint8_t* dest);
+uint8_t data_registry_write(const Data_Reg_Entry* var, uint8_t* src);
+uint8_t data_registry_check_range(const Data_Reg_Entry* var, uint8_t* src);
+uint16_t data_registry_save(const Data_Reg_Entry* var, uint8_t* src);
+uint16_t data_registry_fill_ee_table(uint16_t* addrTab);
+uint8_t data_registry_describe(const Data_Reg_Entry* var, uint8_t* dest);
+
+#endif //_DATA_REGISTRY_H_
@@ -148,13 +148,28 @@ typedef enum {
 #define EE_LOBYTE_FLAG            0x0000
 #define EE_HIBYTE_FLAG            0x8000
 
+/* Records that mark a batch of writes (see EE_BeginBatch). Virtual
+ * addresses of variables have to stay clear of these. */
+#define EE_BATCH_BEGIN            ((uint16_t)0x7FF0) /* Data is the record count */
+#define EE_BATCH_COMMIT           ((uint16_t)0x7FF1)
+#define EE_BATCH_ABORT            ((uint16_t)0x7FF2)
+
 
 /* Exported types ------------------------------------------------------------*/
+typedef struct {
+    uint32_t InitCycles; /* Last EE_Init */
+    uint32_t ReadCycles; /* All EE_ReadVariable calls */
+    uint32_t Reads;
+    uint32_t Writes; /* Records written to the flash */
+    uint32_t Skipped; /* Writes left out, the value was already there */
+    uint32_t EraseCycles; /* Last erase of a page transfer */
+} EE_Stats_Type;
+
 /* Exported macro ------------------------------------------------------------*/
 /* Exported functions ------------------------------------------------------- */
 uint16_t EE_Init(uint16_t* addrTab);
-void EE_Config_Addr_Table(uint16_t* addrTab);
 uint16_t EE_ReadVariable(uint16_t VirtAddress, uint16_t* Data);
+uint16_t EE_ReadBlock(uint16_t VirtAddress, uint16_t* Data, uint16_t Count);
 uint16_t EE_WriteVariable(uint16_t VirtAddress, uint16_t Data);
 uint16_t EE_SaveInt16(uint16_t VirtAddress, int16_t Data);
 uint16_t EE_SaveInt32(uint16_t VirtAddress, int32_t Data);
@@ -162,6 +177,18 @@ uint16_t EE_SaveFloat(uint16_t VirtAddress, float Data);
 int16_t EE_ReadInt16WithDefault(uint16_t VirtAddress, int16_t defalt);
 int32_t EE_ReadInt32WithDefault(uint16_t VirtAddress, int32_t defalt);
 float EE_ReadFloatWithDefault(uint16_t VirtAddress, float defalt);
+float EE_GetInitTime(void);
+float EE_GetReadTime(void);
+uint32_t EE_GetReadCount(void);
+void EE_BeginBatch(void);
+uint16_t EE_CommitBatch(void);
+uint32_t EE_GetWriteCount(void);
+uint32_t EE_GetSkipCount(void);
+uint32_t EE_GetEraseCount(void);
+uint32_t EE_GetFreeRecords(void);
+uint16_t EE_Service(uint8_t EraseAllowed);
+float EE_GetEraseTime(void);
+uint32_t EE_GetQueued(void);
 
 #endif /* EEPROM_EMULATION_H_ */
 
@@ -143,7 +143,8 @@ float HallSensor2_Get_Speedf(void);
 uint8_t HallSensor2_Get_Direction(void);
 #endif
 #ifdef TESTING_PLL
-void HallSensorPLL_Update(void);
+void HallSensorPLL_Update(uint16_t cycles);
+void HallSensorPLL_Inc_Angle(void);
 uint16_t HallSensorPLL_Get_Angle(void);
 float HallSensorPLL_Get_Anglef(void);
 uint32_t HallSensorPLL_Get_Speed(void);
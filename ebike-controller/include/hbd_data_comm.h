@@ -26,7 +26,38 @@
 #ifndef _HBD_DATA_COMM_H_
 #define _HBD_DATA_COMM_H_
 
+/**
+ * Baud rate negotiation. The link always starts at HBD_BAUDRATE.
+ * - The display sends SET_BAUD with an I32 baud rate.
+ * - Rates not in HBD_BAUD_RATES get a NACK and nothing changes. Otherwise
+ *   the controller sends an ACK at the old rate, then switches.
+ * - The display switches when it sees the ACK. It has to send a good packet
+ *   within HBD_BAUD_CONFIRM_MS or the controller goes back to the old rate.
+ * - Once confirmed, the controller falls back to HBD_BAUDRATE if
+ *   HBD_BAUD_MAX_CRC_ERRORS bad packets come in a row, or if nothing good
+ *   arrives for HBD_BAUD_IDLE_MS. A display that loses the link starts
+ *   again at HBD_BAUDRATE.
+ * Going quiet for HBD_BAUD_IDLE_MS also stops dashboard pushes, so a
+ * display that only listens (DASHBOARD_SUBSCRIBE) still has to send
+ * something, a HOST_ACK will do, more often than that.
+ */
+#define HBD_BAUD_RATES              { HBD_BAUDRATE, 115200, 460800, 1000000 }
+#define HBD_BAUD_CONFIRM_MS         (250)
+#define HBD_BAUD_IDLE_MS            (1000)
+#define HBD_BAUD_MAX_CRC_ERRORS     (3)
+
+typedef struct _hbd_link {
+    uint32_t PrevBaud; // Rate to go back to if the new one isn't confirmed
+    uint32_t LastGood; // Tick of the last good packet
+    uint8_t Trial; // Rate just changed, no good packet yet
+    uint8_t CrcErrors; // Bad packets since the last good one
+    uint32_t Fallbacks; // Times the rate was dropped
+} HBD_Link_Type;
+
 void HBD_Data_Comm_Init(void);
 void HBD_OneByte_Check(void);
+uint8_t HBD_Get_Framing(void);
+uint32_t HBD_Get_Baud(void);
+uint32_t HBD_Get_Baud_Fallbacks(void);
 
 #endif //_HBD_DATA_COMM_H_
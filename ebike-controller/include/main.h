@@ -59,10 +59,18 @@
 #include "power_calcs.h"
 #include "crc32.h"
 #include "data_packet.h"
+#include "data_registry.h"
 #include "data_commands.h"
+#include "config_blob.h"
+#include "scheduler.h"
+#include "telemetry.h"
 #include "usb_data_comm.h"
 #include "bms_data_comm.h"
 #include "hbd_data_comm.h"
+#include "dashboard.h"
+#include "soc.h"
+#include "trip.h"
+#include "batt_model.h"
 #include <stdio.h>
 #include <string.h>
 #include <math.h>
@@ -100,7 +108,12 @@ typedef enum _main_limit_type {
     Main_Limit_HardMotorTemp,
     Main_Limit_MinVoltFault,
     Main_Limit_MaxVoltFault,
-    Main_Limit_CurrentFault
+    Main_Limit_CurrentFault,
+    Main_Limit_SoftCell,
+    Main_Limit_HardCell,
+    Main_Limit_SoftCellRegen,
+    Main_Limit_HardCellRegen,
+    Main_Limit_CellResistance
 } Main_Limit_Type;
 
 typedef struct _main_config {
@@ -131,6 +144,11 @@ typedef struct _main_config {
     float MinVoltFault;
     float MaxVoltFault;
     float CurrentFault;
+    float CellSoftCap;
+    float CellHardCap;
+    float CellRegenSoftCap;
+    float CellRegenHardCap;
+    float CellResistance;
     Control_Methods ControlMethod;
     // ----- Generated constants -----
     float inv_max_phase_current;
@@ -138,6 +156,7 @@ typedef struct _main_config {
     float kv_volts_per_ehz;
     // ----- Local variables -----
     float throttle_limit_scale;
+    float regen_limit_scale; // For the regen current limits, from the highest cell
 } Config_Main;
 
 /* Exported constants --------------------------------------------------------*/
@@ -149,10 +168,6 @@ typedef struct _main_config {
 
 #define BOOTLOADER_RESET_FLAG 0xDEADBEEF
 
-#define SERIAL_DUMP_RATE        (1)
-#define TEMP_CONVERSION_RATE    (100)
-#define BMS_CHECK_RATE          (10000) // Check every 10 seconds
-
 #define MAIN_FAULT_OV               ((uint32_t)0x00000001)
 #define MAIN_FAULT_UV               ((uint32_t)0x00000002)
 #define MAIN_FAULT_OC               ((uint32_t)0x00000004)
@@ -168,13 +183,10 @@ typedef struct _main_config {
 #define MAINFLAG_SERIALDATAPRINT    ((uint32_t)0x00000001)
 #define MAINFLAG_SERIALDATAON       ((uint32_t)0x00000002)
 #define MAINFLAG_DUMPRECORD         ((uint32_t)0x00000004)
-#define MAINFLAG_DUMPDATAPRINT      ((uint32_t)0x00000008)
 #define MAINFLAG_DUMPDATAON         ((uint32_t)0x00000010)
-#define MAINFLAG_CONVERTTEMPERATURE ((uint32_t)0x00000020)
 #define MAINFLAG_HALLDETECTFAIL     ((uint32_t)0x00000040)
 #define MAINFLAG_HALLDETECTPASS     ((uint32_t)0x00000080)
 #define MAINFLAG_LASTCOMMSERIAL     ((uint32_t)0x00000100)
-#define MAINFLAG_CHECKBMS           ((uint32_t)0x00000200)
 #define MAINFLAG_DEBUG_SENDBMSRESET ((uint32_t)0x00010000)
 #define MAINFLAG_DEBUG_SETBMSADDR   ((uint32_t)0x00020000)
 #define MAINFLAG_DEBUG_ASKBMSBATTS  ((uint32_t)0x00040000)
@@ -188,6 +200,7 @@ uint32_t _ftoa(char* buf, float num, uint32_t precision);
 void SYSTICK_IRQHandler(void);
 void User_BasicTIM_IRQ(void);
 void User_PWMTIM_IRQ(void);
+void User_MidRate_IRQ(void);
 
 float MAIN_GetCurrentRampAngle(void);
 
@@ -199,6 +212,8 @@ uint8_t MAIN_SetNumUSBDebugOutputs(uint8_t numOutputs);
 uint8_t MAIN_GetNumUSBDebugOutputs(void);
 uint8_t MAIN_SetUSBDebugSpeed(uint8_t speedChoice);
 uint8_t MAIN_GetUSBDebugSpeed(void);
+void MAIN_DefaultTelemetry(void);
+float MAIN_GetLiveValue(uint8_t index);
 uint8_t MAIN_SetUSBDebugging(uint8_t on_or_off);
 uint8_t MAIN_GetUSBDebugging(void);
 float MAIN_GetRampSpeed(void);
@@ -223,6 +238,12 @@ float MAIN_GetSwitchoverEpsilon(void);
 void MAIN_SetError(uint32_t errorCode);
 void MAIN_SoftReset(uint8_t restartInBootloader);
 uint8_t MAIN_GetDashboardData(uint8_t* dataBuffer);
+uint32_t MAIN_GetFaultCode(void);
+uint32_t MAIN_GetMidRateOverruns(void);
+float MAIN_GetCellMinLoaded(void);
+float MAIN_GetCellMaxLoaded(void);
+float MAIN_GetSagVoltage(void);
+uint8_t MAIN_GetLimitFlags(void);
 uint8_t MAIN_SetLimit(Main_Limit_Type lmt, float new_lmt);
 float MAIN_GetLimit(Main_Limit_Type lmt);
 float MAIN_GetGearRatio(void);
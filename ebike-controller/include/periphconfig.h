@@ -33,7 +33,7 @@
  * TIM2 -
  * TIM3 - Hall sensors
  * TIM4 -
- * TIM5 -
+ * TIM5 - Free running microsecond timestamp
  * TIM6 - Data packet timeouts
  * TIM7 -
  * TIM8 - Hall sampling timer
@@ -70,7 +70,8 @@
  * USB OTG HS -
  *
  * *** OTHER STUFF ***
- * DMA1 -
+ * DMA1 - BMS UART receive (Stream5) and transmit (Stream6),
+ *        HBD UART receive (Stream1) and transmit (Stream3)
  * DMA2 - Hall sensor sampling (Stream1)
  * CRC - Generate CRC-32 for packet data interface
  * RNG -
@@ -129,6 +130,11 @@
 #define APP_TIMER_CLK_ENABLE()    RCC->APB1ENR |= RCC_APB1ENR_TIM12EN
 #define APP_IRQn                  TIM8_BRK_TIM12_IRQn
 
+// Microsecond timestamp, 32-bit free running counter
+#define TIMESTAMP_TIM             TIM5
+#define TIMESTAMP_CLK             TIM5_CLK
+#define TIMESTAMP_TIMER_CLK_ENABLE()    RCC->APB1ENR |= RCC_APB1ENR_TIM5EN
+
 // Data packets timeout
 #define DATA_PACKET_TIM           TIM6
 #define DATA_PACKET_CLK           TIM6_CLK
@@ -139,10 +145,37 @@
 #define BMS_UART              USART2
 #define BMS_UART_CLK_ENABLE() RCC->APB1ENR |= RCC_APB1ENR_USART2EN
 #define BMS_IRQn              USART2_IRQn
+#define BMS_RX_DMA            DMA1_Stream5
+#define BMS_RX_DMA_CHANNEL    (DMA_SxCR_CHSEL_2) // Channel 4
+#define BMS_RX_DMA_IFCR       (DMA1->HIFCR)
+#define BMS_RX_DMA_FLAGS      (DMA_HIFCR_CTCIF5 | DMA_HIFCR_CHTIF5 | DMA_HIFCR_CTEIF5 \
+                              | DMA_HIFCR_CDMEIF5 | DMA_HIFCR_CFEIF5)
+#define BMS_RX_DMA_IRQn       DMA1_Stream5_IRQn
+#define BMS_TX_DMA            DMA1_Stream6
+#define BMS_TX_DMA_CHANNEL    (DMA_SxCR_CHSEL_2) // Channel 4
+#define BMS_TX_DMA_IFCR       (DMA1->HIFCR)
+#define BMS_TX_DMA_FLAGS      (DMA_HIFCR_CTCIF6 | DMA_HIFCR_CHTIF6 | DMA_HIFCR_CTEIF6 \
+                              | DMA_HIFCR_CDMEIF6 | DMA_HIFCR_CFEIF6)
+#define BMS_TX_DMA_IRQn       DMA1_Stream6_IRQn
 
 // HBD
 #define HBD_UART              USART3
 #define HBD_UART_CLK_ENABLE() RCC->APB1ENR |= RCC_APB1ENR_USART3EN
 #define HBD_IRQn              USART3_IRQn
+#define HBD_RX_DMA            DMA1_Stream1
+#define HBD_RX_DMA_CHANNEL    (DMA_SxCR_CHSEL_2) // Channel 4
+#define HBD_RX_DMA_IFCR       (DMA1->LIFCR)
+#define HBD_RX_DMA_FLAGS      (DMA_LIFCR_CTCIF1 | DMA_LIFCR_CHTIF1 | DMA_LIFCR_CTEIF1 \
+                              | DMA_LIFCR_CDMEIF1 | DMA_LIFCR_CFEIF1)
+#define HBD_RX_DMA_IRQn       DMA1_Stream1_IRQn
+#define HBD_TX_DMA            DMA1_Stream3
+#define HBD_TX_DMA_CHANNEL    (DMA_SxCR_CHSEL_2) // Channel 4
+#define HBD_TX_DMA_IFCR       (DMA1->LIFCR)
+#define HBD_TX_DMA_FLAGS      (DMA_LIFCR_CTCIF3 | DMA_LIFCR_CHTIF3 | DMA_LIFCR_CTEIF3 \
+                              | DMA_LIFCR_CDMEIF3 | DMA_LIFCR_CFEIF3)
+#define HBD_TX_DMA_IRQn       DMA1_Stream3_IRQn
+
+// Both UARTs
+#define UART_DMA_CLK_ENABLE() RCC->AHB1ENR |= RCC_AHB1ENR_DMA1EN
 
 #endif // PERIPHCONFIG_H_
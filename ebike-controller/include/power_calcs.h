@@ -28,8 +28,10 @@
 
 #define ONE_OVER_SQRT3_F  (0.57735026918962576451f)
 // Needs some filtering on the magnitude of power and current
-// Using a simple low-pass filter, about 20Hz bandwidth
+// Using a simple low-pass filter, about 20Hz bandwidth when called at 1kHz.
+// power_calc_filter gives the multiplier for the same bandwidth at other rates.
 #define POWER_CALCS_LPF_MULTIPLIER      (0.07f)
+#define POWER_CALCS_LPF_RATE            (1000.0f)
 
 typedef struct _PowerCalcs {
     // Inputs
@@ -39,6 +41,7 @@ typedef struct _PowerCalcs {
     float Vbus;
     float Ialpha;
     float Ibeta;
+    float Filter; // Low-pass multiplier for the calling rate
     // Outputs
     float TotalPower;
     float PhaseCurrent;
@@ -46,5 +49,6 @@ typedef struct _PowerCalcs {
 } PowerCalcs;
 
 void power_calc(PowerCalcs* pc);
+float power_calc_filter(float rate_hz);
 
 #endif
@@ -134,7 +134,7 @@ typedef enum _data_type {
 
 /*** Limit Variable IDs ***/
 #define CONFIG_LMT_PREFIX           (0x0400)
-#define CONFIG_LMT_NUMVARS          (13)
+#define CONFIG_LMT_NUMVARS          (18)
 #define CONFIG_LMT_VOLT_FAULT_MIN   (0x0401) //F32: Trip fault code when voltage below this
 #define CONFIG_LMT_VOLT_FAULT_MAX   (0x0402) //F32: Fault when voltage above this
 #define CONFIG_LMT_CUR_FAULT_MAX    (0x0403) //F32: Fault when current (any phase) above this
@@ -148,6 +148,11 @@ typedef enum _data_type {
 #define CONFIG_LMT_FET_TEMP_HARDCAP (0x040B) //F32: No more current when FET temps here
 #define CONFIG_LMT_MOTOR_TEMP_SOFTCAP   (0x040C) //F32: Soften current when motor temp here
 #define CONFIG_LMT_MOTOR_TEMP_HARDCAP   (0x040D) //F32: No more current when motor temp here
+#define CONFIG_LMT_CELL_SOFTCAP     (0x040E) //F32: Soften current when the weakest cell under load is here (BMS)
+#define CONFIG_LMT_CELL_HARDCAP     (0x040F) //F32: No more current when the weakest cell under load is here
+#define CONFIG_LMT_CELL_REGEN_SOFTCAP   (0x0410) //F32: Soften regen when the highest cell under charge is here
+#define CONFIG_LMT_CELL_REGEN_HARDCAP   (0x0411) //F32: No more regen when the highest cell under charge is here
+#define CONFIG_LMT_CELL_RESISTANCE  (0x0412) //F32: Resistance of one cell (group), ohms, for the sag between BMS readings
 /*** Limit Default Values ***/
 #define DFLT_LMT_VOLT_FAULT_MIN     (44.8f) // 2.8 x 16 cells
 #define DFLT_LMT_VOLT_FAULT_MAX     (70.4f) // 4.4 x 16 cells
@@ -162,6 +167,11 @@ typedef enum _data_type {
 #define DFLT_LMT_FET_TEMP_HARDCAP   (90.0f)
 #define DFLT_LMT_MOTOR_TEMP_SOFTCAP (75.0f)
 #define DFLT_LMT_MOTOR_TEMP_HARDCAP (90.0f)
+#define DFLT_LMT_CELL_SOFTCAP       (3.2f)
+#define DFLT_LMT_CELL_HARDCAP       (3.0f)
+#define DFLT_LMT_CELL_REGEN_SOFTCAP (4.1f)
+#define DFLT_LMT_CELL_REGEN_HARDCAP (4.2f)
+#define DFLT_LMT_CELL_RESISTANCE    (0.02f)
 
 /*** Motor Configuration Variable IDs ***/
 #define CONFIG_MOTOR_PREFIX         (0x0500)
@@ -197,11 +207,123 @@ typedef enum _data_type {
 #define CONFIG_BMS_NUMBATTS         (0x0602) //I16: Total number of batteries in the chain
 #define CONFIG_BMS_GETBAT_N         (0x0603) //F32: Voltage of a particular cell (requires 2-byte cell number, zero indexed)
 #define CONFIG_BMS_GETSTATUS_N      (0x0604) //I32: Status of a particular cell (requires 2-byte cell number, zero indexed)
+#define CONFIG_BMS_REFRESH_MS       (0x0605) //I32: Time taken by the last refresh of every cell, ms
+#define CONFIG_BMS_MIN_CELL         (0x0606) //F32: Lowest cell voltage in the pack, -1 until every board is read
+#define CONFIG_BMS_MAX_CELL         (0x0607) //F32: Highest cell voltage in the pack, -1 until every board is read
+#define CONFIG_BMS_AVG_CELL         (0x0608) //F32: Average cell voltage in the pack, -1 until every board is read
+#define CONFIG_BMS_MIN_CELL_LOADED  (0x0609) //F32: Weakest cell moved to the present current, what the limiter uses
+#define CONFIG_BMS_MAX_CELL_LOADED  (0x060A) //F32: Highest cell moved to the present current
+
+/*** Live values (read only, mostly for telemetry) ***/
+// Numbered the same as the USB debugging outputs, CONFIG_LIVE_PREFIX + output
+#define CONFIG_LIVE_PREFIX          (0x0700)
+#define CONFIG_LIVE_IA              (0x0701) //F32: Phase A current
+#define CONFIG_LIVE_IB              (0x0702) //F32: Phase B current
+#define CONFIG_LIVE_IC              (0x0703) //F32: Phase C current
+#define CONFIG_LIVE_TA              (0x0704) //F32: Phase A duty cycle
+#define CONFIG_LIVE_TB              (0x0705) //F32: Phase B duty cycle
+#define CONFIG_LIVE_TC              (0x0706) //F32: Phase C duty cycle
+#define CONFIG_LIVE_THROTTLE        (0x0707) //F32: Throttle command
+#define CONFIG_LIVE_RAMP_ANGLE      (0x0708) //F32: Internally generated ramp angle
+#define CONFIG_LIVE_ROTOR_ANGLE     (0x0709) //F32: Rotor angle used by FOC
+#define CONFIG_LIVE_HALL_SPEED      (0x070A) //F32: Hall sensor speed (eHz)
+#define CONFIG_LIVE_VBUS            (0x070B) //F32: Bus voltage
+#define CONFIG_LIVE_ID              (0x070C) //F32: D-axis current
+#define CONFIG_LIVE_IQ              (0x070D) //F32: Q-axis current
+#define CONFIG_LIVE_TD              (0x070E) //F32: D-axis PI output
+#define CONFIG_LIVE_TQ              (0x070F) //F32: Q-axis PI output
+#define CONFIG_LIVE_ERROR_CODE      (0x0710) //F32: Fault code
+#define CONFIG_LIVE_FET_TEMP        (0x0711) //F32: FET temperature (degC)
+#define CONFIG_LIVE_HALL_STATE      (0x0712) //F32: Hall sensor state
+#define CONFIG_LIVE_TESTING         (0x0713) //F32: Hall2 angle or PLL validity, only when testing
+
+/*** Telemetry statistics (read only, RAM) ***/
+#define CONFIG_TLM_PREFIX           (0x0800)
+#define CONFIG_TLM_FRAMES_SENT      (0x0801) //I32: Stream frames handed to USB
+#define CONFIG_TLM_RECORDS_DROPPED  (0x0802) //I32: Records lost, both frames full
+#define CONFIG_TLM_OVERRUNS         (0x0803) //I32: Times records started being dropped
+#define CONFIG_TLM_USB_STALLS       (0x0804) //I32: USB endpoint busy when sending
+
+/*** Diagnostics (read only, RAM) ***/
+#define CONFIG_DIAG_PREFIX          (0x0900)
+#define CONFIG_DIAG_CRC_HW_RATE     (0x0901) //F32: Hardware CRC speed (bytes/us), run ROUTINE_CRC_BENCHMARK first
+#define CONFIG_DIAG_CRC_SW_RATE     (0x0902) //F32: Software CRC speed (bytes/us)
+#define CONFIG_DIAG_HBD_BAUD        (0x0903) //I32: HBD serial port baud rate
+#define CONFIG_DIAG_HBD_FALLBACKS   (0x0904) //I32: Times the HBD baud rate was dropped
+#define CONFIG_DIAG_DASH_FRAMES     (0x0905) //I32: Dashboard push frames sent
+#define CONFIG_DIAG_DASH_SKIPPED    (0x0906) //I32: Dashboard fields left out of push frames
+#define CONFIG_DIAG_EE_INIT_US      (0x0907) //F32: Time taken by EE_Init at start up (us), including reading the page into RAM
+#define CONFIG_DIAG_EE_READ_US      (0x0908) //F32: Total time spent reading EEPROM variables since start up (us)
+#define CONFIG_DIAG_EE_READS        (0x0909) //I32: EEPROM reads since start up, floats and I32s take two
+#define CONFIG_DIAG_EE_WRITES       (0x090A) //I32: EEPROM records written to flash since start up
+#define CONFIG_DIAG_EE_SKIPPED      (0x090B) //I32: EEPROM writes left out since start up, the value was already saved
+#define CONFIG_DIAG_EE_ERASES       (0x090C) //I32: EEPROM page transfers (sector erases) over the life of the unit
+#define CONFIG_DIAG_EE_FREE         (0x090D) //I32: EEPROM records left before the next page transfer
+#define CONFIG_DIAG_EE_QUEUED       (0x090E) //I32: EEPROM records waiting in RAM for the motor to stop so a page can be erased
+#define CONFIG_DIAG_EE_ERASE_US     (0x090F) //F32: Time the last EEPROM page erase stalled the CPU (us)
+#define CONFIG_DIAG_CFG_SEQ         (0x0910) //I32: Sequence number of the configuration record last loaded or saved, 0 if there is none
+#define CONFIG_DIAG_TASK_LATENCY_US (0x0911) //F32: Longest wait of main loop task [index] from ready to running (us), see TASK_xx
+#define CONFIG_DIAG_TASK_RUN_US     (0x0912) //F32: Longest run of main loop task [index] (us)
+#define CONFIG_DIAG_TASK_OVERRUNS   (0x0913) //I32: Times main loop task [index] was due again before it got to run
+#define CONFIG_DIAG_TASK_MISSES     (0x0914) //I32: Times main loop task [index] finished after its deadline
+#define CONFIG_DIAG_MIDRATE_OVERRUNS (0x0915) //I32: Times the mid-rate control loop was due again before it started
+
+/*** Battery Variable IDs ***/
+#define CONFIG_BATT_PREFIX          (0x0A00)
+#define CONFIG_BATT_NUMVARS         (5)
+#define CONFIG_BATT_SERIES_CELLS    (0x0A01) //I16: Cells in series, used when there's no BMS to count them
+#define CONFIG_BATT_RATED_AH        (0x0A02) //F32: Capacity printed on the pack (Ah), bounds the learned capacity
+#define CONFIG_BATT_LEARNED_AH      (0x0A03) //F32: Capacity learned between rested voltage readings (Ah), zero to start over
+#define CONFIG_BATT_WH_PER_KM       (0x0A04) //F32: Energy used per km, learned while riding, sets the range estimate
+#define CONFIG_BATT_SOC             (0x0A05) //F32: State of charge (%), -1 if unknown, saved in small steps while the pack is resting
+#define CONFIG_BATT_WH_LEFT         (0x0A06) //F32: Energy left in the pack (Wh), read only
+#define CONFIG_BATT_RANGE_KM        (0x0A07) //F32: Estimated range at the learned consumption (km), read only
+#define CONFIG_BATT_OCV_ANCHORS     (0x0A08) //I32: Times the SoC was corrected from the rested voltage, read only
+#define CONFIG_BATT_MODEL_VOC       (0x0A09) //F32: Pack open circuit voltage estimated while riding, read only
+#define CONFIG_BATT_MODEL_R         (0x0A0A) //F32: Pack internal resistance estimated while riding (ohms), read only
+#define CONFIG_BATT_MODEL_VALID     (0x0A0B) //I8: One once the estimate has seen enough current steps, read only
+#define CONFIG_BATT_SAG_VOLTS       (0x0A0C) //F32: Bus voltage predicted at the throttle allowed, what the voltage derate uses
+/*** Battery Default Values ***/
+#define DFLT_BATT_SERIES_CELLS      (16)
+#define DFLT_BATT_RATED_AH          (14.0f)
+#define DFLT_BATT_LEARNED_AH        (0.0f) // Start from the rated capacity
+#define DFLT_BATT_WH_PER_KM         (15.0f)
+#define DFLT_BATT_SOC               (-1.0f) // Unknown, taken from the voltage once the pack rests
+
+/*** Trip and lifetime totals (read only, backup SRAM) ***/
+#define CONFIG_TRIP_PREFIX          (0x0B00)
+#define CONFIG_TRIP_WH_OUT          (0x0B01) //F32: Energy taken from the pack this trip (Wh)
+#define CONFIG_TRIP_WH_REGEN        (0x0B02) //F32: Energy put back by regen this trip (Wh)
+#define CONFIG_TRIP_KM              (0x0B03) //F32: Distance this trip (km)
+#define CONFIG_TRIP_WH_PER_KM       (0x0B04) //F32: Net energy per km this trip
+#define CONFIG_TRIP_PEAK_WATTS      (0x0B05) //F32: Highest battery power this trip
+#define CONFIG_TRIP_PEAK_AMPS       (0x0B06) //F32: Highest battery current this trip
+#define CONFIG_TRIP_PEAK_KPH        (0x0B07) //F32: Highest speed this trip (km/h)
+#define CONFIG_TRIP_HOURS           (0x0B08) //F32: Time spent moving this trip
+#define CONFIG_TRIP_LIFE_WH_OUT     (0x0B11) //F32: Same as above, over the life of the controller
+#define CONFIG_TRIP_LIFE_WH_REGEN   (0x0B12)
+#define CONFIG_TRIP_LIFE_KM         (0x0B13)
+#define CONFIG_TRIP_LIFE_WH_PER_KM  (0x0B14)
+#define CONFIG_TRIP_LIFE_PEAK_WATTS (0x0B15)
+#define CONFIG_TRIP_LIFE_PEAK_AMPS  (0x0B16)
+#define CONFIG_TRIP_LIFE_PEAK_KPH   (0x0B17)
+#define CONFIG_TRIP_LIFE_HOURS      (0x0B18)
+#define CONFIG_TRIP_WINDOW_WH_PER_KM    (0x0B21) //F32: Energy per km over the last few km
+#define CONFIG_TRIP_RANGE_KM        (0x0B22) //F32: Energy left over the recent energy per km, -1 until the SoC is known
 
 /*** For EEPROM settings ***/
 #define TOTAL_EE_VARS   (CONFIG_ADC_NUMVARS + CONFIG_FOC_NUMVARS \
                         + CONFIG_MAIN_NUMVARS + CONFIG_THRT_NUMVARS \
-                        + CONFIG_LMT_NUMVARS + CONFIG_MOTOR_NUMVARS)
+                        + CONFIG_LMT_NUMVARS + CONFIG_MOTOR_NUMVARS \
+                        + CONFIG_BATT_NUMVARS)
+// Two copies of the whole configuration as one record (see config_blob.h),
+// stored a half word per virtual address after these bases
+#define CONFIG_BLOB_MAX_BYTES   (16 + (TOTAL_EE_VARS * 4))
+#define CONFIG_BLOB_SLOT_WORDS  (CONFIG_BLOB_MAX_BYTES / 2)
+#define CONFIG_BLOB_SLOT_A_ADDR (0x7000)
+#define CONFIG_BLOB_SLOT_B_ADDR (0x7400)
+// Every virtual address given to the EEPROM emulation
+#define TOTAL_EE_ADDRESSES      ((TOTAL_EE_VARS * 2) + (2 * CONFIG_BLOB_SLOT_WORDS))
 
 /*** Routines - set to start ***/
 #define ROUTINE_SAVE_ALL_EEPROM     (0x0101)
@@ -212,13 +334,21 @@ typedef enum _data_type {
 #define ROUTINE_SOFT_RESET          (0x0301)
 #define ROUTINE_BOOTLOADER_RESET    (0x0302)
 
+#define ROUTINE_CRC_BENCHMARK       (0x0401) // Results in CONFIG_DIAG_CRC_xx
+
+#define ROUTINE_TRIP_RESET          (0x0501) // Zero the trip totals, lifetime totals are kept
+
 /*** Features - toggle on or off ***/
 #define FEATURE_SERIAL_DATA         (0x0001)
 #define FEATURE_BLDC_MODE           (0x0002)
 #define FEATURE_DEBUG_PWM           (0x0003)
 
+/*** Telemetry ***/
+#define TELEMETRY_MAX_CHANNELS      (16) // One bit per channel in the record mask
+#define TELEMETRY_FRAME_TIMEOUT     (400) // PWM cycles before a partial frame is sent (20ms at 20kHz)
+
 /*** Dashboard Data Format ***/
-#define DASHBOARD_DATA_LENGTH       (8*4)
+#define DASHBOARD_DATA_LENGTH       (11*4)
 // Param1: F32: Throttle position (%)
 // Param2: F32: Speed (rpm)
 // Param3: F32: Phase Amps
@@ -227,6 +357,108 @@ typedef enum _data_type {
 // Param6: F32: Controller FET Temperature (degC)
 // Param7: F32: Motor Temperature (degC)
 // Param8: I32: Fault Code
+// Param9: F32: Battery state of charge (%)
+// Param10: F32: Battery energy left (Wh)
+// Param11: F32: Estimated range (km), at the energy per km of the last few km
+
+/*** Dashboard Push (see dashboard.h) ***/
+#define DASHBOARD_MIN_PERIOD_MS     (20) // Fastest push rate the display can ask for
+#define DASHBOARD_KEYFRAME_MS       (1000) // All fields at least this often
+#define DASHBOARD_EVENT_HOLDOFF_MS  (5) // Least time between frames, even for faults
+// Change needed before a field is resent: throttle (0-1), rpm, phase A,
+// battery A, battery V, FET degC, motor degC, fault code (any change),
+// SoC %, Wh left, range km
+#define DASHBOARD_DEADBANDS         { 0.01f, 5.0f, 0.5f, 0.2f, 0.1f, 0.5f, 0.5f, 0.0f, \
+                                      0.5f, 2.0f, 0.2f }
+
+/*** Battery State of Charge (see soc.h) ***/
+#define SOC_UPDATE_RATE             (1000) // Hz, soc_update is called from the app timer
+#define SOC_REST_CURRENT            (0.3f) // Battery amps below this count as resting
+#define SOC_REST_MS                 (60000) // Rest needed before trusting the voltage while riding
+#define SOC_BOOT_REST_MS            (2000) // The pack sat while powered off, only let the readings settle
+#define SOC_OCV_GAIN                (0.5f) // How far one rested reading pulls the SoC
+#define SOC_OCV_TRUST               (0.15f) // Off by more than this at power up, take the voltage (charged while off)
+#define SOC_LEARN_MIN_SPAN          (0.4f) // SoC between two rested readings before learning capacity from them
+#define SOC_LEARN_GAIN              (0.25f)
+#define SOC_LEARN_MIN_RATIO         (0.5f) // Learned capacity is kept within these fractions of rated
+#define SOC_LEARN_MAX_RATIO         (1.2f)
+#define SOC_CONSUMPTION_DIST_M      (500.0f) // Distance between updates of the learned Wh/km
+#define SOC_CONSUMPTION_GAIN        (0.1f)
+#define SOC_CONSUMPTION_MIN         (1.0f) // Wh/km, so downhill stretches can't make the range endless
+#define SOC_SAVE_STEP               (0.02f) // SoC change needed before it's written to EEPROM again
+#define SOC_SAVE_REST_MS            (5000) // Only write EEPROM while resting this long (page erase stalls the CPU)
+// Rested voltage of one cell at 0%, 10%, ... 100% charge, typical NMC cell
+#define SOC_OCV_POINTS              (11)
+#define SOC_OCV_TABLE               { 3.00f, 3.45f, 3.55f, 3.62f, 3.68f, 3.75f, \
+                                      3.82f, 3.90f, 3.98f, 4.07f, 4.18f }
+#define SOC_OCV_MARGIN              (0.3f) // Further outside the table than this isn't a battery (bench supply)
+
+/*** Battery Model (see batt_model.h) ***/
+#define BATT_MODEL_FORGET           (0.9995f) // Forgetting factor per update, about 2s of memory at 1kHz
+#define BATT_MODEL_AMP_SCALE        (10.0f) // Amps per unit, puts both parameters in volts
+#define BATT_MODEL_P_INIT           (100.0f)
+#define BATT_MODEL_P_MAX            (1000.0f) // Trace limit, stops the covariance winding up while the current is steady
+#define BATT_MODEL_R_INIT           (0.1f) // ohms
+#define BATT_MODEL_R_MIN            (0.005f) // Outside these isn't a battery, the estimate isn't used
+#define BATT_MODEL_R_MAX            (1.0f)
+#define BATT_MODEL_AVG_FILT         (0.002f) // Slow current average, steps are measured from it
+#define BATT_MODEL_STEP_AMPS        (2.0f) // Current this far from its average counts as a step
+#define BATT_MODEL_STEPS_VALID      (100) // Samples of steps before the estimate is used
+
+/*** Trip Totals (see trip.h) ***/
+#define TRIP_UPDATE_RATE            (1000) // Hz, trip_update is called from the app timer
+#define TRIP_MOVING_SPEED           (0.5f) // m/s, slower than this doesn't count as riding time
+#define TRIP_SEGMENT_M              (500.0f) // Range window is made of segments this long
+#define TRIP_WINDOW_SEGMENTS        (10) // so it covers the last 5km
+#define TRIP_WINDOW_MIN_M           (1000.0f) // Less than this in the window, use the learned Wh/km instead
+
+/*** Control Loop Rates ***/
+// The PWM interrupt runs the current loop. Every few PWM cycles it pends the
+// mid-rate loop (PLL correction, power calcs, telemetry), as often as it can
+// without going over this.
+#define MIDRATE_MAX_FREQ            (10000) // Hz
+
+/*** Main Loop Tasks (see scheduler.h) ***/
+// Task numbers, in the order a pass runs them
+#define TASK_USB_COMM               (0)
+#define TASK_BMS_COMM               (1)
+#define TASK_HBD_COMM               (2)
+#define TASK_TELEMETRY              (3)
+#define TASK_HALL_DETECT            (4)
+#define TASK_ROUTINE_RESULT         (5)
+#define TASK_DASHBOARD              (6)
+#define TASK_PUSHBUTTON             (7)
+#define TASK_BMS_REFRESH            (8)
+#define TASK_TEMPERATURE            (9)
+#define TASK_SOC_SAVE               (10)
+#define TASK_EEPROM                 (11)
+#define TASK_BMS_DEBUG              (12)
+#define TASK_DEBUG_DUMP             (13) // Only with DEBUG_DUMP_USED
+#define TASK_WATCHDOG               (14)
+#define SCHED_MAX_TASKS             (15)
+// Periods (ms, 0 = only when signalled) and deadlines (us from ready to
+// done, 0 = none). The links are also signalled by their interrupts, the
+// period picks up timeouts and transmit queues that have room again.
+#define TASK_COMM_PERIOD_MS         (1)
+#define TASK_COMM_DEADLINE_US       (1000)
+#define TASK_HALL_DETECT_PERIOD_MS  (1) // Fastest ramp is 150 Hall edges/s
+#define TASK_HALL_DETECT_DEADLINE_US (1000)
+#define TASK_RESULT_PERIOD_MS       (10) // Retries a result the link had no room for
+#define TASK_RESULT_DEADLINE_US     (10000)
+#define TASK_DASHBOARD_PERIOD_MS    (1)
+#define TASK_DASHBOARD_DEADLINE_US  (DASHBOARD_EVENT_HOLDOFF_MS * 1000)
+#define TASK_PUSHBUTTON_PERIOD_MS   (10) // Same as the debounce
+#define TASK_PUSHBUTTON_DEADLINE_US (10000)
+#define TASK_BMS_REFRESH_PERIOD_MS  (100) // Refresh the pack at 10Hz
+#define TASK_BMS_REFRESH_DEADLINE_US (10000)
+#define TASK_TEMPERATURE_PERIOD_MS  (100)
+#define TASK_TEMPERATURE_DEADLINE_US (10000)
+#define TASK_SOC_SAVE_PERIOD_MS     (100) // Writes flash, no deadline
+#define TASK_EEPROM_PERIOD_MS       (10) // Erases flash, no deadline
+#define TASK_BMS_DEBUG_PERIOD_MS    (100)
+#define TASK_DEBUG_DUMP_PERIOD_MS   (1)
+#define TASK_WATCHDOG_PERIOD_MS     (10)
+#define TASK_WATCHDOG_DEADLINE_US   (40000) // The watchdog bites at 50ms
 
 
 #if 0
@@ -360,6 +592,7 @@ typedef enum _data_type {
 #define PRIO_PWM        (0)
 #define PRIO_HALL       (1)
 #define PRIO_ADC        (2)
+#define PRIO_MIDRATE    (2) // PendSV, the mid-rate control loop
 #define PRIO_APPTIMER   (3)
 #define PRIO_HBD_UART   (4)
 #define PRIO_BMS_UART   (4)
@@ -0,0 +1,90 @@
+/******************************************************************************
+ * Filename: scheduler.h
+ * Description: Cooperative scheduler for the main loop. Periodic tasks are
+ *              released by the 1ms tick, event tasks by the interrupts that have
+ *              work for them, and the core sleeps when nothing is ready.
+ *
+ ******************************************************************************
+
+ Copyright (c) 2019 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#ifndef _SCHEDULER_H_
+#define _SCHEDULER_H_
+
+#include "stm32f4xx.h"
+#include "project_parameters.h"
+
+/**
+ * Tasks run to completion, one after the other, in the order of their IDs,
+ * so a lower ID is a higher priority. A pass runs every task that was ready
+ * when the pass got to it once. The next pass starts again from the top.
+ * Nothing preempts a task except interrupts, so a task that takes long holds
+ * up every other one: long jobs have to be split up by the module doing them
+ * and carried on next time.
+ *
+ * Times are in microseconds from the clock given to sched_init. A task is
+ * ready from the first tick or signal that released it. Latency is from
+ * ready to the task starting, the deadline is from ready to the task
+ * finishing. A periodic task released again while it is still waiting only
+ * runs once, that counts as an overrun.
+ */
+#define SCHED_NO_DEADLINE       (0)
+
+typedef struct _sched_task {
+    void (*Run)(void);
+    uint32_t PeriodMs; // 0 if only run when signalled
+    uint32_t DeadlineUs;
+    uint32_t Countdown;
+    __IO uint8_t Pending;
+    __IO uint32_t ReadyUs;
+    // Statistics, since start up or sched_clear_stats
+    uint32_t Runs;
+    uint32_t Overruns;
+    uint32_t DeadlineMisses;
+    uint32_t MaxLatencyUs;
+    uint32_t MaxRunUs;
+} Sched_Task;
+
+typedef struct _sched_state {
+    Sched_Task Tasks[SCHED_MAX_TASKS];
+    uint32_t (*NowUs)(void);
+    void (*Idle)(void); // Called with interrupts off, has to wake on one
+    uint32_t Idles;
+} Sched_State;
+
+void sched_init(uint32_t (*now_us)(void));
+void sched_set_task(uint8_t id, void (*run)(void), uint32_t period_ms,
+        uint32_t deadline_us);
+void sched_set_idle(void (*idle)(void));
+void sched_tick(void);
+void sched_signal(uint8_t id);
+uint8_t sched_run_once(void);
+void sched_run(void);
+const Sched_Task* sched_get_task(uint8_t id);
+uint32_t sched_get_idles(void);
+float sched_get_latency(uint16_t id);
+float sched_get_run_time(uint16_t id);
+uint32_t sched_get_overruns(uint16_t id);
+uint32_t sched_get_deadline_misses(uint16_t id);
+void sched_clear_stats(void);
+
+#endif //_SCHEDULER_H_
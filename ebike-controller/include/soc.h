@@ -0,0 +1,103 @@
+/******************************************************************************
+ * Filename: soc.h
+ * Description: Battery state of charge. Counts charge in and out of the pack and
+ *              corrects the count from the open circuit voltage whenever the pack
+ *              has rested. Learns the pack capacity and the energy used per km.
+ *
+ ******************************************************************************
+
+ Copyright (c) 2019 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#ifndef _SOC_H_
+#define _SOC_H_
+
+#include "stm32f4xx.h"
+#include "project_parameters.h"
+
+/**
+ * How it works:
+ * - Every call to soc_update adds up the battery current. Once a second
+ *   the sum moves the SoC by (amp hours) / (capacity).
+ * - After the current has stayed near zero for SOC_REST_MS (SOC_BOOT_REST_MS
+ *   after power up), the cell voltage is close to the open circuit voltage,
+ *   which gives the SoC from the cell's discharge curve. That reading is an
+ *   anchor, and the counted SoC is pulled towards it.
+ * - Two anchors far enough apart, and the amp hours counted between them,
+ *   measure the capacity.
+ * - The SoC is saved to EEPROM in SOC_SAVE_STEP steps, and only while the
+ *   pack is resting, so a full discharge costs about 50 writes.
+ */
+typedef struct _soc_state {
+    // Configuration
+    uint16_t SeriesCells;
+    float RatedAh;
+    float CapacityAh; // Learned, RatedAh until learned
+    float WhPerKm; // Learned
+    // State
+    float Soc; // 0-1, negative when unknown
+    float WhLeft;
+    float RangeKm;
+    float AhCount; // Net amp hours out of the pack since power up
+    // One second sums, from the timer interrupt
+    float AmpSum;
+    float WattSum;
+    float SpeedSum; // m/s
+    uint16_t Samples;
+    // Resting
+    uint32_t RestMs;
+    uint8_t Anchored; // This rest already gave an anchor
+    uint8_t FirstAnchor; // No anchor since power up
+    // Capacity learning, from the last anchor
+    uint8_t HaveAnchor;
+    float AnchorSoc;
+    float AnchorAh;
+    uint32_t Anchors;
+    // Consumption learning
+    float TripWh;
+    float TripM;
+    // EEPROM
+    float SavedSoc;
+    float SavedAh;
+    float SavedWhPerKm;
+} Soc_State;
+
+void soc_init(void);
+void soc_update(float amps, float volts, float speed);
+void soc_service(void);
+void soc_save_variables(void);
+void soc_load_variables(void);
+
+float soc_get_percent(void);
+uint8_t soc_set_percent(float percent);
+float soc_get_wh_left(void);
+float soc_get_range_km(void);
+uint32_t soc_get_anchors(void);
+uint16_t soc_get_series_cells(void);
+uint8_t soc_set_series_cells(uint16_t cells);
+float soc_get_rated_ah(void);
+uint8_t soc_set_rated_ah(float ah);
+float soc_get_learned_ah(void);
+uint8_t soc_set_learned_ah(float ah);
+float soc_get_wh_per_km(void);
+uint8_t soc_set_wh_per_km(float whkm);
+
+#endif //_SOC_H_
@@ -0,0 +1,97 @@
+/******************************************************************************
+ * Filename: telemetry.h
+ * Description: Streams any set of registry variables to the host, each
+ *              channel sampled at its own rate (a decimation of the PWM
+ *              frequency) and packed together into shared frames.
+ *
+ ******************************************************************************
+
+ Copyright (c) 2019 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#ifndef _TELEMETRY_H_
+#define _TELEMETRY_H_
+
+#include "stm32f4xx.h"
+#include "project_parameters.h"
+#include "data_packet.h"
+#include "data_registry.h"
+
+/**
+ * Frame format (data field of a CONTROLLER_STREAM_DATA packet):
+ * Header
+ * - I16: Frame sequence number, a gap means frames were lost
+ * - I32: Sample index (PWM cycle count) of the first record
+ * - I32: Timestamp of the first record in microseconds (free running, wraps)
+ * Then any number of records back to back, each one being
+ * - I16: PWM cycles since the previous record in this frame, zero for the
+ *        first record (saturates at 0xFFFF)
+ * - I16: Mask of the channels in this record, bit 0 is channel 0
+ * - Values of each channel in the mask, lowest channel first. Size of each
+ *   value depends on the type of the variable (see GET_VARIABLE_LIST).
+ */
+// Leaves room for the COBS bytes, so a full frame fits either framing
+#define TELEMETRY_FRAME_LENGTH      (PACKET_MAX_LENGTH - PACKET_OVERHEAD_BYTES \
+                                    - PACKET_COBS_OVERHEAD_BYTES)
+#define TELEMETRY_FRAME_HEADER      (10)
+#define TELEMETRY_RECORD_HEADER     (4)
+
+// Subscription modes, first byte of the TELEMETRY_SUBSCRIBE packet
+#define TELEMETRY_REPLACE           (0)
+#define TELEMETRY_APPEND            (1)
+
+typedef struct _telemetry_channel {
+    const Data_Reg_Entry* Var;
+    uint16_t Index; // For DATA_REG_INDEXED variables (e.g. which battery)
+    uint16_t Decimation; // Sample every N PWM cycles, or each mid-rate loop if that's longer
+    uint16_t Countdown;
+    uint8_t Size; // Bytes per sample
+} Telemetry_Channel;
+
+typedef struct _telemetry_frame {
+    uint8_t Data[TELEMETRY_FRAME_LENGTH];
+    uint16_t Length;
+    uint32_t LastCycle; // Sample index of the last record
+    __IO uint8_t Ready; // Frame is closed, waiting for the main loop to send it
+} Telemetry_Frame;
+
+typedef struct _telemetry_stats {
+    uint32_t FramesSent;
+    uint32_t RecordsDropped; // Records lost because both frames were full
+    uint32_t Overruns; // Number of times records started being dropped
+    uint32_t UsbStalls; // Main loop found the USB endpoint still busy
+} Telemetry_Stats;
+
+void telemetry_init(void);
+void telemetry_clear(void);
+uint8_t telemetry_check_channel(uint16_t id, uint16_t decimation);
+uint8_t telemetry_subscribe(uint16_t id, uint16_t index, uint16_t decimation);
+uint8_t telemetry_num_channels(void);
+void telemetry_sample(uint32_t cycle, uint16_t elapsed);
+uint16_t telemetry_get_frame(uint8_t** data);
+void telemetry_release_frame(void);
+void telemetry_send(void);
+uint32_t telemetry_get_frames_sent(void);
+uint32_t telemetry_get_records_dropped(void);
+uint32_t telemetry_get_overruns(void);
+uint32_t telemetry_get_usb_stalls(void);
+
+#endif //_TELEMETRY_H_
@@ -0,0 +1,108 @@
+/******************************************************************************
+ * Filename: trip.h
+ * Description: Trip and lifetime energy totals, kept in backup SRAM so that a
+ *              brown-out or reset doesn't lose them, plus a range prediction from
+ *              the energy used over the last few km.
+ *
+ ******************************************************************************
+
+ Copyright (c) 2019 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#ifndef _TRIP_H_
+#define _TRIP_H_
+
+#include "stm32f4xx.h"
+#include "project_parameters.h"
+
+/**
+ * Checkpoints:
+ * Once a second the totals are copied to one of two slots in backup SRAM,
+ * alternating, each with a sequence number and a CRC. A reset in the
+ * middle of a copy leaves the other slot whole. At power up the valid
+ * slot with the highest sequence number is restored.
+ * Backup SRAM runs from VBAT when the main supply is gone, so with a coin
+ * cell fitted the totals also survive the battery being unplugged.
+ */
+#define TRIP_CHECKPOINT_MAGIC       (0x54524950) // "TRIP"
+#define TRIP_CHECKPOINT_SLOTS       (2)
+
+// Index for trip_get_value, add Trip_Lifetime for the lifetime totals
+typedef enum _trip_value {
+    Trip_Wh_Out = 0,
+    Trip_Wh_Regen,
+    Trip_Km,
+    Trip_Wh_Per_Km,
+    Trip_Peak_Watts,
+    Trip_Peak_Amps,
+    Trip_Peak_Kph,
+    Trip_Hours,
+    Trip_Lifetime = 0x10,
+    Trip_Window_Wh_Per_Km = 0x20,
+    Trip_Range_Km
+} Trip_Value;
+
+// Doubles, so a second's worth still adds up after thousands of km
+typedef struct _trip_totals {
+    double WhOut;
+    double WhRegen;
+    double Meters;
+    double MovingSeconds;
+    float PeakWatts;
+    float PeakAmps;
+    float PeakSpeed; // m/s
+} Trip_Totals;
+
+typedef struct _trip_checkpoint {
+    uint32_t Magic;
+    uint32_t Sequence;
+    Trip_Totals Trip;
+    Trip_Totals Lifetime;
+    uint32_t Crc; // Of everything above
+} Trip_Checkpoint;
+
+typedef struct _trip_state {
+    Trip_Totals Trip;
+    Trip_Totals Lifetime;
+    // One second sums, from the timer interrupt
+    float WattOutSum;
+    float WattRegenSum;
+    float SpeedSum;
+    uint16_t MovingSamples;
+    uint16_t Samples;
+    // Range window, net Wh and distance of each segment
+    float WindowWh[TRIP_WINDOW_SEGMENTS];
+    float WindowM[TRIP_WINDOW_SEGMENTS];
+    uint8_t WindowNext; // Segment being filled
+    uint8_t WindowFull; // Completed segments, up to TRIP_WINDOW_SEGMENTS
+    float SegmentWh;
+    float SegmentM;
+    float WindowWhPerKm;
+    float RangeKm;
+    uint32_t Sequence; // Of the last checkpoint
+} Trip_State;
+
+void trip_init(void);
+void trip_update(float amps, float volts, float speed);
+void trip_reset(void);
+float trip_get_value(uint8_t which);
+
+#endif //_TRIP_H_
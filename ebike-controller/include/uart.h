@@ -32,22 +32,23 @@
 #include "periphconfig.h"
 
 #define USART_CLK				42000000
-//#define HBD_BAUDRATE			115200
-//#define HBD_USARTDIV			(22.8125f)
-//#define HBD_BRR					(22 << 4) + 13
+// Starting rates, divisors come from UART_CalcBRR. The HBD can be moved
+// to a faster rate with UART_SetBaud (see hbd_data_comm.c).
 #define HBD_BAUDRATE            38400
-#define HBD_USARTDIV            (68.375) // About 0.02% error. 42M / (16*68.375) = 38391 baud
-#define HBD_BRR                 (68<<4) + 6 // 68 for the mantissa, 6/16 for the fraction
+#define BMS_BAUDRATE            115200
 
-#define BMS_BAUDRATE			115200
-#define BMS_USARTDIV			(22.8125f)
-#define BMS_BRR					(22 << 4) + 13
+// Buffer sizes per port. Receive buffers are filled by circular DMA, so
+// they have to hold everything that can arrive between two passes of the
+// main loop. Half of a buffer has to be more than one packet for the
+// idle-line interrupt to be the only one per packet. Transmit buffers are
+// queues, writes that don't fit are refused rather than waited for.
+#define HBD_UART_RX_LENGTH      256
+#define HBD_UART_TX_LENGTH      512 // Two full length packets
+#define BMS_UART_RX_LENGTH      512 // Answers to a full BMS_PIPELINE_DEPTH of requests
+#define BMS_UART_TX_LENGTH      256
 
-#define HBD_BUFFER_LENGTH		128
-#define HBD_TXMT_TIMEOUT		3 // ms
-
-#define BMS_BUFFER_LENGTH       128
-#define BMS_TXMT_TIMEOUT        3 // ms
+// Writes that can have a completion callback pending at once, per port
+#define UART_TX_CALLBACKS       4
 
 typedef enum _uart_sel{
     SELECT_HBD_UART,
@@ -55,11 +56,51 @@ typedef enum _uart_sel{
 } UART_Sel;
 
 typedef struct _uart_buffer{
-    uint8_t Buffer[HBD_BUFFER_LENGTH];
-    uint8_t RdPos, WrPos;
-    uint8_t Done;
+    uint8_t* Buffer;
+    uint16_t Length;
+    __IO uint16_t RdPos, WrPos;
+    __IO uint8_t Done; // Bit 0: data waiting (Tx: idle), bit 1: buffer full
 } UARTBuffer_Type;
 
+// Called from the transmit DMA interrupt once the last byte of a write has
+// been handed to the UART
+typedef void (*UART_TxCallback)(void* context);
+
+// One piece of a gathered write
+typedef struct _uart_tx_segment{
+    const uint8_t* Data;
+    uint16_t Length;
+} UART_TxSegment;
+
+typedef struct _uart_tx_notify{
+    uint32_t End; // TxQueued after the write, done when TxSent reaches it
+    UART_TxCallback Callback;
+    void* Context;
+} UART_TxNotify;
+
+typedef struct _uart_port{
+    USART_TypeDef* Uart;
+    DMA_Stream_TypeDef* RxDma;
+    __IO uint32_t* RxDmaIFCR; // Flag clear register of the receive stream
+    uint32_t RxDmaFlags; // All the flags of the receive stream
+    DMA_Stream_TypeDef* TxDma;
+    __IO uint32_t* TxDmaIFCR;
+    uint32_t TxDmaFlags;
+    UARTBuffer_Type Rx;
+    UARTBuffer_Type Tx; // RdPos is the start of the run the DMA is sending
+    __IO uint16_t TxCount; // Bytes queued, including the run being sent
+    __IO uint16_t TxRun; // Length of the run being sent, 0 when idle
+    uint32_t TxQueued; // Running totals, for the callbacks
+    __IO uint32_t TxSent;
+    UART_TxNotify TxNotify[UART_TX_CALLBACKS];
+    __IO uint8_t TxNotifyRd, TxNotifyWr;
+    uint32_t Baud;
+    uint32_t PendingBaud; // Waiting for the queue to empty, 0 if none
+    uint32_t BaudAfter; // TxSent value where the new rate starts
+    uint32_t RxOverflows; // Bytes overwritten before they were read
+    uint32_t TxRejected; // Writes refused for lack of space
+} UART_Port_Type;
+
 
 uint16_t UART_CalcBRR(uint32_t fck, uint32_t baud, uint8_t over8);
 
@@ -68,7 +109,16 @@ int32_t UART_InWaiting(UART_Sel uart);
 uint8_t UART_IsFinishedTx(UART_Sel uart);
 int32_t UART_Read(UART_Sel uart, void* buf, uint32_t count);
 int32_t UART_Write(UART_Sel uart, void* buf, uint32_t count);
+int32_t UART_WriteGather(UART_Sel uart, const UART_TxSegment* segs,
+        uint8_t nsegs, UART_TxCallback callback, void* context);
+uint16_t UART_TxSpace(UART_Sel uart);
+uint8_t UART_SetBaud(UART_Sel uart, uint32_t baud);
+uint32_t UART_GetBaud(UART_Sel uart);
 
 void UART_IRQ(UART_Sel uart);
+void UART_RxDMA_IRQ(UART_Sel uart);
+void UART_TxDMA_IRQ(UART_Sel uart);
+uint32_t UART_GetRxOverflows(UART_Sel uart);
+uint32_t UART_GetTxRejected(UART_Sel uart);
 
 #endif // UART_H_
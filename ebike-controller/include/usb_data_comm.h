@@ -29,5 +29,9 @@
 void USB_Data_Comm_Init(void);
 void USB_Data_Comm_OneByte_Check(void);
 void USB_Data_Comm_Periodic_Check(void);
+uint8_t USB_Data_Comm_Get_Framing(void);
+uint8_t USB_Data_Comm_Send(const uint8_t* data, uint16_t len);
+uint16_t USB_Data_Comm_Tx_Service(void);
+uint8_t USB_Data_Comm_Tx_Busy(void);
 
 #endif //_USB_DATA_COMM_H_
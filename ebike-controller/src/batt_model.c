@@ -0,0 +1,126 @@
+/******************************************************************************
+ * Filename: batt_model.c
+ * Description: Online estimate of the pack's open circuit voltage and internal
+ *              resistance, by recursive least squares on battery current and voltage.
+ *
+ ******************************************************************************
+
+ Copyright (c) 2019 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#include "main.h"
+#include "batt_model.h"
+
+// *** Global variables ***
+Batt_Model BattModel;
+
+void batt_model_init(void) {
+    BattModel.Voc = 0.0f;
+    BattModel.R = BATT_MODEL_R_INIT * BATT_MODEL_AMP_SCALE;
+    BattModel.P[0][0] = BATT_MODEL_P_INIT;
+    BattModel.P[0][1] = 0.0f;
+    BattModel.P[1][0] = 0.0f;
+    BattModel.P[1][1] = BATT_MODEL_P_INIT;
+    BattModel.Volts = 0.0f;
+    BattModel.AvgAmps = 0.0f;
+    BattModel.Steps = 0;
+    BattModel.Started = 0;
+}
+
+/**
+ * @brief  Battery Model Update
+ *            One recursive least squares step. Call from the 1kHz task,
+ *            after power_calc.
+ * @param  amps - battery current, positive out of the pack
+ * @param  volts - bus voltage, unfiltered
+ */
+void batt_model_update(float amps, float volts) {
+    float x = -amps * (1.0f / BATT_MODEL_AMP_SCALE);
+    float pphi0, pphi1, denom, k0, k1, err, trace;
+
+    if (!BattModel.Started) {
+        // Start from the present voltage so the first steps aren't wasted
+        // pulling Voc up from zero
+        BattModel.Volts = volts;
+        BattModel.Voc = volts + (amps * BATT_MODEL_R_INIT);
+        BattModel.AvgAmps = amps;
+        BattModel.Started = 1;
+        return;
+    }
+    BattModel.Volts = (1.0f - POWER_CALCS_LPF_MULTIPLIER) * BattModel.Volts
+            + POWER_CALCS_LPF_MULTIPLIER * volts;
+
+    BattModel.AvgAmps += BATT_MODEL_AVG_FILT * (amps - BattModel.AvgAmps);
+    if ((fabsf(amps - BattModel.AvgAmps) > BATT_MODEL_STEP_AMPS)
+            && (BattModel.Steps < 0xFFFF)) {
+        BattModel.Steps++;
+    }
+
+    // Gain, regressor is [1, x]
+    pphi0 = BattModel.P[0][0] + BattModel.P[0][1] * x;
+    pphi1 = BattModel.P[1][0] + BattModel.P[1][1] * x;
+    denom = BATT_MODEL_FORGET + pphi0 + x * pphi1;
+    k0 = pphi0 / denom;
+    k1 = pphi1 / denom;
+
+    err = BattModel.Volts - (BattModel.Voc + BattModel.R * x);
+    BattModel.Voc += k0 * err;
+    BattModel.R += k1 * err;
+
+    // P = (P - K * phi' * P) / forget, kept symmetric
+    BattModel.P[0][0] = (BattModel.P[0][0] - k0 * pphi0)
+            * (1.0f / BATT_MODEL_FORGET);
+    BattModel.P[0][1] = (BattModel.P[0][1] - k0 * pphi1)
+            * (1.0f / BATT_MODEL_FORGET);
+    BattModel.P[1][1] = (BattModel.P[1][1] - k1 * pphi1)
+            * (1.0f / BATT_MODEL_FORGET);
+    BattModel.P[1][0] = BattModel.P[0][1];
+
+    trace = BattModel.P[0][0] + BattModel.P[1][1];
+    if (trace > BATT_MODEL_P_MAX) {
+        float scale = BATT_MODEL_P_MAX / trace;
+        BattModel.P[0][0] *= scale;
+        BattModel.P[0][1] *= scale;
+        BattModel.P[1][0] *= scale;
+        BattModel.P[1][1] *= scale;
+    }
+}
+
+/**
+ * @retval One if the estimate has seen enough current steps and the
+ *         resistance is believable
+ */
+uint8_t batt_model_valid(void) {
+    float r = batt_model_get_resistance();
+    return ((BattModel.Steps >= BATT_MODEL_STEPS_VALID)
+            && (r >= BATT_MODEL_R_MIN) && (r <= BATT_MODEL_R_MAX));
+}
+
+float batt_model_get_voc(void) {
+    return BattModel.Voc;
+}
+
+/**
+ * @retval Pack resistance in ohms
+ */
+float batt_model_get_resistance(void) {
+    return BattModel.R * (1.0f / BATT_MODEL_AMP_SCALE);
+}
@@ -46,7 +46,6 @@
  SOFTWARE.
  */
 
-#include <stdlib.h>
 #include "main.h"
 #include "bms_data_comm.h"
 #include "data_packet.h"
@@ -63,7 +62,18 @@ static void BMS_Process_Timeout(void);
 inline static void BMS_Start_Timeout(uint32_t timeout_ms);
 inline static void BMS_Stop_Timeout(void);
 static void BMS_Timeout_Check(void);
-static uint32_t BMS_Batt_Array_Position(uint8_t board, uint8_t batt);
+static void BMS_Chain_Found(void);
+static void BMS_Update_Summary(uint8_t board, int16_t oldMv, int16_t newMv);
+static void BMS_Address_Next(void);
+static void BMS_Probe_Batch(void);
+static void BMS_Refresh_Answer(void);
+static void BMS_Refresh_Next(void);
+static void BMS_Refresh_Timeout_Check(void);
+static uint8_t BMS_Send_Request(BMS_Request_Type* req);
+static void BMS_Retry_Request(BMS_Request_Type* req);
+static void BMS_Refresh_Fail(void);
+static void BMS_Store_Batch(uint8_t board, uint8_t* data, uint16_t len);
+static void BMS_Store_Item(uint8_t board, uint8_t item, uint32_t value);
 
 /**
  * @brief  BMS UART Data Communications Initialization
@@ -80,8 +90,11 @@ void BMS_Data_Comm_Init(void) {
 
     bms.IsConnected = 0;
     bms.NumConnectedBoards = 0;
-    bms.BattStatuses = 0; // Null pointer = unallocated
-    bms.BattVoltages = 0;
+    bms.NumTotalBatts = 0;
+    bms.BoardsRead = 0;
+    bms.BatchBoards = 0;
+    memset(bms.Requests, 0, sizeof(bms.Requests));
+    bms.RefreshTime = 0;
     bms.Timeout = 0; // Set timeout inactive
 }
 
@@ -105,6 +118,7 @@ void BMS_Send_One_Packet(uint8_t pktType, uint8_t* data, uint8_t datalen) {
  */
 void BMS_Restart_Chain(void) {
     bms.NumConnectedBoards = 0;
+    bms.BatchBoards = 0;
     memset(bms.BattsPerBoard, 0, sizeof(bms.BattsPerBoard));
     // Reinitialize boards. Set all addresses to zero. No reply from BMS boards.
     BMS_Packet.Data[0] = BROADCAST_ADDRESS;
@@ -118,18 +132,7 @@ void BMS_Restart_Chain(void) {
 
     // We can add a wait state here, but immediately going into a new packet
     // is okay. It will just be queued up anyway in the Tx buffer.
-
-    BMS_Packet.Data[0] = 0;
-    data_packet_pack_16b(&(BMS_Packet.Data[1]),R_ADDRESS);
-    BMS_Packet.Data[3] = bms.NumConnectedBoards + 1;
-    if(data_packet_create(&BMS_Packet, SET_RAM_VARIABLE, BMS_Packet.Data, 4)
-            == DATA_PACKET_SUCCESS) {
-        bms.RetryCount = 0;
-        UART_Write(SELECT_BMS_UART, BMS_Packet.TxBuffer, BMS_Packet.TxLength);
-        // Start the timeout to check if BMS has failed or disconnected
-        BMS_Start_Timeout(BMS_TIMEOUT_MS);
-        bms.CommState = BMS_STATE_ADDRESSING;
-    }
+    BMS_Address_Next();
     // Wait for response. It will show up in BMS_Periodic_Check
 }
 
@@ -141,24 +144,12 @@ void BMS_Restart_Chain(void) {
  * @retval None
  */
 void BMS_Refresh_Data(void) {
-
-    // Set up the counters
-    bms.CurrentBoard = 1;
-    bms.CurrentBatt = 1;
-
-    // Request the first battery voltage
-    BMS_Packet.Data[0] = bms.CurrentBoard;
-    data_packet_pack_16b(&(BMS_Packet.Data[1]),R_VOLT_BATT1);
-    if( data_packet_create(&BMS_Packet, GET_RAM_VARIABLE, BMS_Packet.Data, 3)
-            == DATA_PACKET_SUCCESS) {
-        bms.RetryCount = 0;
-        UART_Write(SELECT_BMS_UART, BMS_Packet.TxBuffer, BMS_Packet.TxLength);
-        bms.CommState = BMS_STATE_VOLTAGES;
-        // Start the timeout to check if BMS has failed or disconnected
-        BMS_Start_Timeout(BMS_TIMEOUT_MS);
-    }
-
-    // Wait for response. It will show up in BMS_Periodic_Check
+    memset(bms.Requests, 0, sizeof(bms.Requests));
+    bms.NextBoard = 1;
+    bms.RefreshStart = GetTick();
+    bms.CommState = BMS_STATE_REFRESHING;
+    BMS_Refresh_Next();
+    // Answers show up in BMS_OneByte_Check
 }
 
 uint8_t BMS_Busy(void) {
@@ -168,33 +159,54 @@ uint8_t BMS_Busy(void) {
     return 1;
 }
 
+uint32_t BMS_Get_Refresh_Time(void) {
+    return bms.RefreshTime;
+}
+
+uint32_t BMS_Get_Refresh_Count(void) {
+    return bms.RefreshCount;
+}
+
 /**
  * @brief  BMS Data Communications One Byte Check
  *         Handles the USB serial port incoming data. Determines
  *         if a properly encoded packet has been received, and
- *         sends to the appropriate handler if it has. Operates
- *         one byte at a time using an internal state machine.
+ *         sends to the appropriate handler if it has. Reads the
+ *         port in blocks and scans each block for whole packets,
+ *         packets split between blocks are finished off by the
+ *         state machine.
  * @param  None
  * @retval None
  */
 void BMS_OneByte_Check(void) {
     // Run the "timer" to see if we have timed out for the next packet
     BMS_Timeout_Check();
-    // Loop through each incoming byte
+    if (bms.CommState == BMS_STATE_REFRESHING) {
+        BMS_Refresh_Timeout_Check();
+        // Send anything that didn't fit in the transmit queue last time
+        BMS_Refresh_Next();
+    }
+    // Take in whatever has arrived in blocks, and find the packets in each
+    uint8_t rxbuf[DATA_PACKET_RX_CHUNK];
     int32_t numbytes = UART_InWaiting(SELECT_BMS_UART);
-    uint8_t this_byte;
     while(numbytes > 0) {
-        // Load one new byte
-        if(UART_Read(SELECT_BMS_UART, &this_byte, 1) != 1) {
-            // Check that a byte was really received
+        int32_t count = (numbytes > DATA_PACKET_RX_CHUNK) ? DATA_PACKET_RX_CHUNK : numbytes;
+        count = UART_Read(SELECT_BMS_UART, rxbuf, count);
+        if(count <= 0) {
+            // Nothing was really received
             return;
         }
-        numbytes--;
-        if(data_packet_extract_one_byte(&BMS_Packet, this_byte) == DATA_PACKET_SUCCESS) {
-            if(BMS_Packet.RxReady == 1) {
-                // Double checked and good to go
-                BMS_Process_Command();
+        numbytes -= count;
+        uint16_t place = 0;
+        while(place < count) {
+            uint16_t used;
+            if(data_packet_extract_span(&BMS_Packet, &rxbuf[place], count - place, &used) == DATA_PACKET_SUCCESS) {
+                if(BMS_Packet.RxReady == 1) {
+                    // Double checked and good to go
+                    BMS_Process_Command();
+                }
             }
+            place += used;
         }
     }
 }
@@ -204,21 +216,44 @@ uint16_t BMS_Get_Num_Batts(void) {
 }
 
 float BMS_Get_Batt_Voltage(uint16_t battnum) {
-    if(bms.BattVoltages != 0) { // Make sure it's allocated first
-        if(battnum < bms.NumTotalBatts)
-            return bms.BattVoltages[battnum];
-    }
+    if(battnum < bms.NumTotalBatts)
+        return ((float) bms.BattMillivolts[battnum]) * 0.001f;
     return -1.0f;
 }
 
 uint32_t BMS_Get_Batt_Status(uint16_t battnum) {
-    if(bms.BattStatuses != 0) {
-        if(battnum < bms.NumTotalBatts)
-            return bms.BattStatuses[battnum];
-    }
+    if(battnum < bms.NumTotalBatts)
+        return bms.BattStatuses[battnum];
     return 0xFFFFFFFF; // All status flags on means failure
 }
 
+/**
+ * @brief  BMS Get Min/Max/Avg Cell Voltage
+ *         Extremes and average of the whole pack, from the summaries kept
+ *         as answers come in.
+ * @retval Volts, or -1.0f until every board has been read
+ */
+float BMS_Get_Min_Cell_Voltage(void) {
+    if((bms.NumTotalBatts == 0)
+            || (bms.BoardsRead != ((1u << bms.NumConnectedBoards) - 1)))
+        return -1.0f;
+    return ((float) bms.PackMinMv) * 0.001f;
+}
+
+float BMS_Get_Max_Cell_Voltage(void) {
+    if((bms.NumTotalBatts == 0)
+            || (bms.BoardsRead != ((1u << bms.NumConnectedBoards) - 1)))
+        return -1.0f;
+    return ((float) bms.PackMaxMv) * 0.001f;
+}
+
+float BMS_Get_Avg_Cell_Voltage(void) {
+    if((bms.NumTotalBatts == 0)
+            || (bms.BoardsRead != ((1u << bms.NumConnectedBoards) - 1)))
+        return -1.0f;
+    return ((float) bms.PackSumMv) * 0.001f / bms.NumTotalBatts;
+}
+
 #if 0
 /**
  * @brief  BMS UART Data Communications Periodic Check
@@ -321,18 +356,12 @@ static void BMS_Process_Command(void) {
             // Now we know the number of batteries on this board.
             bms.BattsPerBoard[bms.NumConnectedBoards-1] = data_packet_extract_16b(
                     BMS_Packet.Data);
-            // See if there's another board connected by repeating the addressing
-            // command to address zero
-            BMS_Packet.Data[0] = 0;
-            data_packet_pack_16b(&(BMS_Packet.Data[1]), R_ADDRESS);
-            BMS_Packet.Data[3] = bms.NumConnectedBoards + 1;
-            if (data_packet_create(&BMS_Packet, SET_RAM_VARIABLE,
-                    BMS_Packet.Data, 4) == DATA_PACKET_SUCCESS) {
-                bms.RetryCount = 0;
-                UART_Write(SELECT_BMS_UART, BMS_Packet.TxBuffer,
-                        BMS_Packet.TxLength);
-                BMS_Start_Timeout(BMS_TIMEOUT_MS);
+            if (bms.BattsPerBoard[bms.NumConnectedBoards-1] > BMS_MAX_CELLS_PER_BOARD) {
+                // Only this many can be asked for, see R_VOLT_BATTx
+                bms.BattsPerBoard[bms.NumConnectedBoards-1] = BMS_MAX_CELLS_PER_BOARD;
             }
+            // Find out how to read it, then look for the next board
+            BMS_Probe_Batch();
 
         } else {
             // Maybe a NACK or something else. Regardless it's not supposed to happen
@@ -350,133 +379,17 @@ static void BMS_Process_Command(void) {
             }
         }
         break;
-    case BMS_STATE_VOLTAGES:
-        if (BMS_Packet.PacketType == GET_RAM_RESULT) {
-            // Should be the voltage for this cell
-            bms.BattVoltages[BMS_Batt_Array_Position(bms.CurrentBoard,
-                    bms.CurrentBatt)] = ((float) data_packet_extract_32b(
-                    BMS_Packet.Data)) / 65536.0f; // Voltage is in Q16 format
-            // What's the next one to check?
-            if (bms.CurrentBatt == bms.BattsPerBoard[bms.CurrentBoard-1]) {
-                if (bms.CurrentBoard == bms.NumConnectedBoards) {
-                    // Done! Move on to statuses
-                    bms.CurrentBoard = 1;
-                    bms.CurrentBatt = 1;
-                    BMS_Packet.Data[0] = bms.CurrentBoard;
-                    data_packet_pack_16b(&BMS_Packet.Data[1], R_STAT_BATT1);
-                    if (data_packet_create(&BMS_Packet, GET_RAM_VARIABLE,
-                            BMS_Packet.Data, 3) == DATA_PACKET_SUCCESS) {
-                        bms.RetryCount = 0;
-                        bms.CommState = BMS_STATE_STATUSES;
-                        UART_Write(SELECT_BMS_UART, BMS_Packet.TxBuffer,
-                                BMS_Packet.TxLength);
-                        BMS_Start_Timeout(BMS_TIMEOUT_MS);
-                    }
-
-                } else {
-                    // Move to the next board
-                    bms.CurrentBoard++;
-                    bms.CurrentBatt = 1;
-                    BMS_Packet.Data[0] = bms.CurrentBoard;
-                    data_packet_pack_16b(&BMS_Packet.Data[1], R_VOLT_BATT1);
-                    if (data_packet_create(&BMS_Packet, GET_RAM_VARIABLE,
-                            BMS_Packet.Data, 3) == DATA_PACKET_SUCCESS) {
-                        bms.RetryCount = 0;
-                        UART_Write(SELECT_BMS_UART, BMS_Packet.TxBuffer,
-                                BMS_Packet.TxLength);
-                        BMS_Start_Timeout(BMS_TIMEOUT_MS);
-                    }
-
-                }
-            } else {
-                // More batteries on this board
-                bms.CurrentBatt++;
-                BMS_Packet.Data[0] = bms.CurrentBoard;
-                data_packet_pack_16b(&BMS_Packet.Data[1],
-                R_VOLT_BATT1 + bms.CurrentBatt - 1);
-                if (data_packet_create(&BMS_Packet, GET_RAM_VARIABLE,
-                        BMS_Packet.Data, 3) == DATA_PACKET_SUCCESS) {
-                    bms.RetryCount = 0;
-                    UART_Write(SELECT_BMS_UART, BMS_Packet.TxBuffer,
-                            BMS_Packet.TxLength);
-                    BMS_Start_Timeout(BMS_TIMEOUT_MS);
-                }
-
-            }
-        } else {
-            // Maybe a NACK or something else. Regardless it's not supposed to happen
-            // Retry last packet, or fail if already at max retries.
-            if(bms.RetryCount >= BMS_MAX_RETRIES) {
-                bms.CommState = BMS_STATE_IDLE;
-                MAIN_SetError(MAIN_FAULT_BMS_COMM);
-                bms.IsConnected = 0;
-            } else {
-                bms.RetryCount++;
-                // Send the same packet again.
-                UART_Write(SELECT_BMS_UART, BMS_Packet.TxBuffer,
-                        BMS_Packet.TxLength);
-                BMS_Start_Timeout(BMS_TIMEOUT_MS);
-            }
+    case BMS_STATE_PROBING:
+        // Any proper answer means it knows the command. Older boards NACK
+        // it or say nothing (see BMS_Process_Timeout).
+        if ((BMS_Packet.PacketType == GET_RAM_BATCH_RESULT)
+                && (BMS_Packet.Data[0] == bms.NumConnectedBoards)) {
+            bms.BatchBoards |= (1 << (bms.NumConnectedBoards - 1));
         }
+        BMS_Address_Next();
         break;
-    case BMS_STATE_STATUSES:
-        if (BMS_Packet.PacketType == GET_RAM_RESULT) {
-            // Should be the status for this cell
-            bms.BattStatuses[BMS_Batt_Array_Position(bms.CurrentBoard,
-                    bms.CurrentBatt)] = data_packet_extract_32b(
-                    BMS_Packet.Data); // Status is raw U32
-            // What's the next one to check?
-            if (bms.CurrentBatt == bms.BattsPerBoard[bms.CurrentBoard-1]) {
-                if (bms.CurrentBoard == bms.NumConnectedBoards) {
-                    // Done!
-                    bms.CommState = BMS_STATE_IDLE;
-                    BMS_Stop_Timeout();
-                } else {
-                    // Move to the next board
-                    bms.CurrentBoard++;
-                    bms.CurrentBatt = 1;
-                    BMS_Packet.Data[0] = bms.CurrentBoard;
-                    data_packet_pack_16b(&BMS_Packet.Data[1], R_STAT_BATT1);
-                    if (data_packet_create(&BMS_Packet, GET_RAM_VARIABLE,
-                            BMS_Packet.Data, 3) == DATA_PACKET_SUCCESS) {
-                        bms.RetryCount = 0;
-                        UART_Write(SELECT_BMS_UART, BMS_Packet.TxBuffer,
-                                BMS_Packet.TxLength);
-                        BMS_Start_Timeout(BMS_TIMEOUT_MS);
-                    }
-
-                }
-            } else {
-                // More batteries on this board
-                bms.CurrentBatt++;
-                BMS_Packet.Data[0] = bms.CurrentBoard;
-                data_packet_pack_16b(&BMS_Packet.Data[1],
-                R_STAT_BATT1 + bms.CurrentBatt - 1);
-                if (data_packet_create(&BMS_Packet, GET_RAM_VARIABLE,
-                        BMS_Packet.Data, 3) == DATA_PACKET_SUCCESS) {
-                    bms.RetryCount = 0;
-                    UART_Write(SELECT_BMS_UART, BMS_Packet.TxBuffer,
-                            BMS_Packet.TxLength);
-                    BMS_Start_Timeout(BMS_TIMEOUT_MS);
-                }
-
-            }
-        } else {
-            // Maybe a NACK or something else. Regardless it's not supposed to happen
-            // Retry last packet, or fail if already at max retries.
-            if(bms.RetryCount >= BMS_MAX_RETRIES) {
-                bms.CommState = BMS_STATE_IDLE;
-                MAIN_SetError(MAIN_FAULT_BMS_COMM);
-                bms.IsConnected = 0;
-            } else {
-                bms.RetryCount++;
-                // Send the same packet again.
-                UART_Write(SELECT_BMS_UART, BMS_Packet.TxBuffer,
-                        BMS_Packet.TxLength);
-                BMS_Start_Timeout(BMS_TIMEOUT_MS);
-            }
-        }
-
+    case BMS_STATE_REFRESHING:
+        BMS_Refresh_Answer();
         break;
     }
     BMS_Packet.RxReady = 0;
@@ -503,26 +416,12 @@ static void BMS_Process_Timeout(void) {
             // That's the end of the chain. If there were no BMS boards
             // at all, this is a failure.
             bms.CommState = BMS_STATE_IDLE;
+            BMS_Stop_Timeout();
             if(bms.NumConnectedBoards == 0) {
                 MAIN_SetError(MAIN_FAULT_BMS_COMM);
                 bms.IsConnected = 0;
             } else {
-                // Need to initialize the dynamically allocated arrays
-                bms.NumTotalBatts = 0;
-                for(uint8_t i = 0; i < bms.NumConnectedBoards; i++) {
-                    bms.NumTotalBatts += bms.BattsPerBoard[i];
-                }
-                if(bms.BattVoltages != 0) {
-                    free(bms.BattVoltages);
-                    bms.BattVoltages = 0;
-                }
-                bms.BattVoltages = malloc(sizeof(float)*bms.NumTotalBatts);
-                if(bms.BattStatuses != 0) {
-                    free(bms.BattStatuses);
-                    bms.BattStatuses = 0;
-                }
-                bms.BattStatuses = malloc(sizeof(uint32_t)*bms.NumTotalBatts);
-                bms.IsConnected = 1;
+                BMS_Chain_Found();
             }
         } else {
             bms.RetryCount++;
@@ -557,21 +456,12 @@ static void BMS_Process_Timeout(void) {
             }
         }
         break;
-    case BMS_STATE_VOLTAGES:
-    case BMS_STATE_STATUSES:
-        // How many retries so far?
-        if (bms.RetryCount >= BMS_MAX_RETRIES) {
-            bms.CommState = BMS_STATE_IDLE;
-            // Failure!
-            MAIN_SetError(MAIN_FAULT_BMS_COMM);
-            bms.IsConnected = 0;
-        } else {
-            bms.RetryCount++;
-            // Retry the last packet
-            UART_Write(SELECT_BMS_UART, BMS_Packet.TxBuffer,
-                    BMS_Packet.TxLength);
-            BMS_Start_Timeout(BMS_TIMEOUT_MS);
-        }
+    case BMS_STATE_PROBING:
+        // Board ignored the batch command, it gets single reads
+        BMS_Address_Next();
+        break;
+    case BMS_STATE_REFRESHING:
+        // Each request has its own timeout, see BMS_Refresh_Timeout_Check
         break;
     }
 }
@@ -598,14 +488,381 @@ static void BMS_Timeout_Check(void) {
     }
 }
 
-static uint32_t BMS_Batt_Array_Position(uint8_t board, uint8_t batt) {
-    uint32_t battCounter = 0;
-    // What is our position in the array?
-    // Increment counter by the number of batteries on each previous board
-    for (uint8_t i = 0; i < (board - 1); i++) {
-        battCounter += bms.BattsPerBoard[i];
+/**
+ * @brief  BMS Chain Found
+ *         Lays out the cell arrays for the boards found while addressing.
+ */
+static void BMS_Chain_Found(void) {
+    bms.NumTotalBatts = 0;
+    for (uint8_t i = 0; i < bms.NumConnectedBoards; i++) {
+        bms.FirstBatt[i] = bms.NumTotalBatts;
+        bms.NumTotalBatts += bms.BattsPerBoard[i];
+    }
+    memset(bms.BattMillivolts, 0, sizeof(bms.BattMillivolts));
+    memset(bms.BattStatuses, 0, sizeof(bms.BattStatuses));
+    memset(bms.Boards, 0, sizeof(bms.Boards));
+    bms.BoardsRead = 0;
+    for (uint8_t i = 0; i < bms.NumConnectedBoards; i++) {
+        if (bms.BattsPerBoard[i] == 0) {
+            // Nothing to wait for
+            bms.BoardsRead |= (1 << i);
+        }
+    }
+    bms.IsConnected = 1;
+}
+
+/**
+ * @brief  BMS Address Next
+ *         Asks the first unaddressed board in the chain to take the next
+ *         address. No answer means the end of the chain has been found.
+ */
+static void BMS_Address_Next(void) {
+    bms.CommState = BMS_STATE_ADDRESSING;
+    bms.RetryCount = 0;
+    if (bms.NumConnectedBoards >= MAX_BMS_BOARDS) {
+        // No room for more, finish up as if the chain ended here
+        bms.RetryCount = BMS_MAX_RETRIES;
+        BMS_Process_Timeout();
+        return;
+    }
+    BMS_Packet.Data[0] = 0;
+    data_packet_pack_16b(&(BMS_Packet.Data[1]), R_ADDRESS);
+    BMS_Packet.Data[3] = bms.NumConnectedBoards + 1;
+    if (data_packet_create(&BMS_Packet, SET_RAM_VARIABLE, BMS_Packet.Data, 4)
+            == DATA_PACKET_SUCCESS) {
+        UART_Write(SELECT_BMS_UART, BMS_Packet.TxBuffer, BMS_Packet.TxLength);
+        // Start the timeout to check if BMS has failed or disconnected
+        BMS_Start_Timeout(BMS_TIMEOUT_MS);
+    }
+}
+
+/**
+ * @brief  BMS Probe Batch
+ *         Sends the newest board the batch read it would get when
+ *         refreshing, to see if it understands it.
+ */
+static void BMS_Probe_Batch(void) {
+    BMS_Request_Type probe = { bms.NumConnectedBoards, 0, 0, 0 };
+    if (bms.BattsPerBoard[probe.Board - 1] == 0) {
+        BMS_Address_Next();
+        return;
+    }
+    bms.CommState = BMS_STATE_PROBING;
+    BMS_Send_Request(&probe);
+    BMS_Start_Timeout(BMS_TIMEOUT_MS);
+}
+
+/**
+ * @brief  BMS Refresh Answer
+ *         Handles a packet that came in while refreshing. Batch answers are
+ *         matched by their address, a single read answers the one single
+ *         read that's in flight.
+ */
+static void BMS_Refresh_Answer(void) {
+    BMS_Request_Type* req = 0;
+    uint8_t pending = 0;
+
+    for (uint8_t i = 0; i < BMS_PIPELINE_DEPTH; i++) {
+        BMS_Request_Type* slot = &bms.Requests[i];
+        if (slot->Board == 0) {
+            continue;
+        }
+        pending++;
+        if ((BMS_Packet.PacketType == GET_RAM_BATCH_RESULT)
+                && (slot->Item == 0) && (BMS_Packet.DataLength > 0)
+                && (slot->Board == BMS_Packet.Data[0])) {
+            req = slot;
+        } else if ((BMS_Packet.PacketType == GET_RAM_RESULT)
+                && (slot->Item != 0)) {
+            req = slot;
+        }
+    }
+
+    if (req == 0) {
+        // A NACK can only be pinned on a request if there's just the one.
+        // Otherwise leave it to the timeouts, as with an answer to a
+        // request that has already been sent again.
+        if ((BMS_Packet.PacketType == CONTROLLER_NACK) && (pending == 1)) {
+            for (uint8_t i = 0; i < BMS_PIPELINE_DEPTH; i++) {
+                if (bms.Requests[i].Board != 0) {
+                    BMS_Retry_Request(&bms.Requests[i]);
+                }
+            }
+        }
+        return;
+    }
+
+    if (req->Item == 0) {
+        BMS_Store_Batch(req->Board, &BMS_Packet.Data[1],
+                BMS_Packet.DataLength - 1);
+        req->Board = 0;
+    } else {
+        BMS_Store_Item(req->Board, req->Item,
+                data_packet_extract_32b(BMS_Packet.Data));
+        if (req->Item < (2 * bms.BattsPerBoard[req->Board - 1])) {
+            // Same board, next variable
+            req->Item++;
+            req->RetryCount = 0;
+            if (BMS_Send_Request(req) == DATA_PACKET_FAIL) {
+                // Transmit queue is full. Let the timeout send it.
+                req->SentTick = GetTick();
+            }
+            return;
+        }
+        req->Board = 0;
+    }
+    BMS_Refresh_Next();
+}
+
+/**
+ * @brief  BMS Refresh Next
+ *         Fills free request slots with the boards still to be read, and
+ *         finishes the refresh once nothing is left in flight.
+ */
+static void BMS_Refresh_Next(void) {
+    uint8_t pending = 0;
+    uint8_t single = 0;
+
+    for (uint8_t i = 0; i < BMS_PIPELINE_DEPTH; i++) {
+        if (bms.Requests[i].Board != 0) {
+            pending++;
+            if (bms.Requests[i].Item != 0) {
+                single = 1;
+            }
+        }
+    }
+
+    while ((bms.NextBoard <= bms.NumConnectedBoards)
+            && (pending < BMS_PIPELINE_DEPTH)) {
+        uint8_t batch = (bms.BatchBoards >> (bms.NextBoard - 1)) & 1;
+        BMS_Request_Type* req = 0;
+        if (bms.BattsPerBoard[bms.NextBoard - 1] == 0) {
+            bms.NextBoard++;
+            continue;
+        }
+        if ((!batch) && single) {
+            // Wait for the single read that's in flight
+            break;
+        }
+        for (uint8_t i = 0; i < BMS_PIPELINE_DEPTH; i++) {
+            if (bms.Requests[i].Board == 0) {
+                req = &bms.Requests[i];
+                break;
+            }
+        }
+        req->Board = bms.NextBoard;
+        req->Item = batch ? 0 : 1;
+        req->RetryCount = 0;
+        if (BMS_Send_Request(req) == DATA_PACKET_FAIL) {
+            // Transmit queue is full, try again on the next pass
+            req->Board = 0;
+            break;
+        }
+        bms.NextBoard++;
+        pending++;
+        single |= !batch;
+    }
+
+    if ((pending == 0) && (bms.NextBoard > bms.NumConnectedBoards)) {
+        bms.CommState = BMS_STATE_IDLE;
+        bms.RefreshTime = GetTick() - bms.RefreshStart;
+        bms.RefreshCount++;
+    }
+}
+
+static void BMS_Refresh_Timeout_Check(void) {
+    for (uint8_t i = 0; i < BMS_PIPELINE_DEPTH; i++) {
+        BMS_Request_Type* req = &bms.Requests[i];
+        if ((req->Board != 0)
+                && ((GetTick() - req->SentTick) > BMS_TIMEOUT_MS)) {
+            BMS_Retry_Request(req);
+            if (bms.CommState != BMS_STATE_REFRESHING) {
+                return;
+            }
+        }
+    }
+}
+
+/**
+ * @brief  BMS Send Request
+ *         Builds and queues the packet for a refresh request.
+ * @retval DATA_PACKET_SUCCESS, or DATA_PACKET_FAIL if the transmit queue
+ *         had no room
+ */
+static uint8_t BMS_Send_Request(BMS_Request_Type* req) {
+    uint8_t data[9];
+    uint8_t type;
+    uint8_t len;
+    uint16_t cells = bms.BattsPerBoard[req->Board - 1];
+
+    data[0] = req->Board;
+    if (req->Item == 0) {
+        type = GET_RAM_BATCH;
+        data_packet_pack_16b(&data[1], R_VOLT_BATT1);
+        data_packet_pack_16b(&data[3], R_VOLT_BATT1 + cells - 1);
+        data_packet_pack_16b(&data[5], R_STAT_BATT1);
+        data_packet_pack_16b(&data[7], R_STAT_BATT1 + cells - 1);
+        len = 9;
+    } else {
+        type = GET_RAM_VARIABLE;
+        if (req->Item <= cells) {
+            data_packet_pack_16b(&data[1], R_VOLT_BATT1 + req->Item - 1);
+        } else {
+            data_packet_pack_16b(&data[1], R_STAT_BATT1 + req->Item - cells - 1);
+        }
+        len = 3;
+    }
+    if ((data_packet_create(&BMS_Packet, type, data, len) != DATA_PACKET_SUCCESS)
+            || (UART_Write(SELECT_BMS_UART, BMS_Packet.TxBuffer,
+                    BMS_Packet.TxLength) <= 0)) {
+        return DATA_PACKET_FAIL;
+    }
+    req->SentTick = GetTick();
+    return DATA_PACKET_SUCCESS;
+}
+
+static void BMS_Retry_Request(BMS_Request_Type* req) {
+    if (req->RetryCount >= BMS_MAX_RETRIES) {
+        BMS_Refresh_Fail();
+        return;
+    }
+    req->RetryCount++;
+    req->SentTick = GetTick();
+    BMS_Send_Request(req);
+}
+
+static void BMS_Refresh_Fail(void) {
+    memset(bms.Requests, 0, sizeof(bms.Requests));
+    bms.CommState = BMS_STATE_IDLE;
+    MAIN_SetError(MAIN_FAULT_BMS_COMM);
+    bms.IsConnected = 0;
+}
+
+/**
+ * @brief  BMS Store Batch
+ *         Copies the values from a batch answer into the cell arrays.
+ *         Every BMS variable is 32 bits, so items the board couldn't read
+ *         can be skipped over.
+ */
+static void BMS_Store_Batch(uint8_t board, uint8_t* data, uint16_t len) {
+    uint16_t cells = bms.BattsPerBoard[board - 1];
+    uint16_t place = 0;
+
+    while ((place + 3) <= len) {
+        uint16_t id = data_packet_extract_16b(&data[place]);
+        uint8_t status = data[place + 2];
+        place += 3;
+        if (status != BATCH_STATUS_OK) {
+            continue;
+        }
+        if ((place + 4) > len) {
+            break;
+        }
+        if ((id >= R_VOLT_BATT1) && (id < (R_VOLT_BATT1 + cells))) {
+            BMS_Store_Item(board, id - R_VOLT_BATT1 + 1,
+                    data_packet_extract_32b(&data[place]));
+        } else if ((id >= R_STAT_BATT1) && (id < (R_STAT_BATT1 + cells))) {
+            BMS_Store_Item(board, id - R_STAT_BATT1 + cells + 1,
+                    data_packet_extract_32b(&data[place]));
+        }
+        place += 4;
+    }
+}
+
+/**
+ * @brief  BMS Store Item
+ * @param  item - 1 to cells for voltages, then statuses, as in
+ *         BMS_Request_Type
+ */
+static void BMS_Store_Item(uint8_t board, uint8_t item, uint32_t value) {
+    uint16_t cells = bms.BattsPerBoard[board - 1];
+    uint16_t first = bms.FirstBatt[board - 1];
+    if (!bms.IsConnected) {
+        // Probing while addressing, nowhere to put it yet
+        return;
+    }
+    if (item <= cells) {
+        // Voltage is in Q16 format, keep it as millivolts (* 1000 / 65536)
+        int32_t mv = (((int32_t) value) * 125 + 4096) >> 13;
+        if (mv > INT16_MAX) {
+            mv = INT16_MAX;
+        } else if (mv < INT16_MIN) {
+            mv = INT16_MIN;
+        }
+        int16_t old = bms.BattMillivolts[first + item - 1];
+        bms.BattMillivolts[first + item - 1] = (int16_t) mv;
+        BMS_Update_Summary(board, old, (int16_t) mv);
+        if (item == cells) {
+            // Cells come in order, so that's the board's first full set
+            bms.BoardsRead |= (1 << (board - 1));
+        }
+    } else {
+        // Status is raw U32
+        bms.BattStatuses[first + item - cells - 1] = value;
+    }
+}
+
+/**
+ * @brief  BMS Update Summary
+ *         Updates a board's sum, minimum and maximum for one cell changing,
+ *         only going over its other cells when the extreme one moved away
+ *         from the edge, then the pack's from the board summaries.
+ */
+static void BMS_Update_Summary(uint8_t board, int16_t oldMv, int16_t newMv) {
+    BMS_Board_Summary* sum = &bms.Boards[board - 1];
+    uint16_t cells = bms.BattsPerBoard[board - 1];
+    int16_t* mv = &bms.BattMillivolts[bms.FirstBatt[board - 1]];
+    uint16_t all = (1u << bms.NumConnectedBoards) - 1;
+
+    sum->SumMv += newMv - oldMv;
+    if (((bms.BoardsRead & (1 << (board - 1))) == 0)
+            || ((oldMv == sum->MinMv) && (newMv > oldMv))
+            || ((oldMv == sum->MaxMv) && (newMv < oldMv))) {
+        // First time through (unread cells are zero), or the extreme cell
+        // let go of it
+        sum->MinMv = INT16_MAX;
+        sum->MaxMv = INT16_MIN;
+        for (uint16_t i = 0; i < cells; i++) {
+            if (mv[i] < sum->MinMv) {
+                sum->MinMv = mv[i];
+            }
+            if (mv[i] > sum->MaxMv) {
+                sum->MaxMv = mv[i];
+            }
+        }
+    } else {
+        if (newMv < sum->MinMv) {
+            sum->MinMv = newMv;
+        }
+        if (newMv > sum->MaxMv) {
+            sum->MaxMv = newMv;
+        }
+    }
+
+    if ((bms.BoardsRead | (1 << (board - 1))) != all) {
+        return;
+    }
+    // Built up on the side, the 1kHz limiter reads these and mustn't see
+    // them half done
+    int16_t minMv = INT16_MAX;
+    int16_t maxMv = INT16_MIN;
+    int32_t sumMv = 0;
+    for (uint8_t i = 0; i < bms.NumConnectedBoards; i++) {
+        if (bms.BattsPerBoard[i] == 0) {
+            continue;
+        }
+        if (bms.Boards[i].MinMv < minMv) {
+            minMv = bms.Boards[i].MinMv;
+        }
+        if (bms.Boards[i].MaxMv > maxMv) {
+            maxMv = bms.Boards[i].MaxMv;
+        }
+        sumMv += bms.Boards[i].SumMv;
     }
-    // Increment by the battery number for THIS board
-    battCounter += (batt - 1);
-    return battCounter;
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    bms.PackMinMv = minMv;
+    bms.PackMaxMv = maxMv;
+    bms.PackSumMv = sumMv;
+    __set_PRIMASK(primask);
 }
@@ -0,0 +1,392 @@
+/******************************************************************************
+ * Filename: config_blob.c
+ * Description: The whole configuration as one versioned record with a CRC, kept
+ *              in two slots of the EEPROM emulation so a save is all or nothing.
+ *
+ ******************************************************************************
+
+ Copyright (c) 2019 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#include "main.h"
+#include "config_blob.h"
+
+static uint16_t config_blob_build(uint8_t* dest, uint32_t sequence);
+static uint8_t config_blob_pack_value(const Data_Reg_Entry* var, uint8_t* dest);
+static uint16_t config_blob_read_slot(uint8_t slot, uint8_t* dest);
+static uint16_t config_blob_write_slot(uint8_t slot, uint8_t* blob,
+        uint16_t length);
+static uint16_t config_blob_slot_addr(uint8_t slot);
+
+// *** Global variables ***
+uint32_t ConfigBlobLayout = 0;
+uint16_t ConfigBlobLength = 0; // Of a record for this firmware
+uint32_t ConfigBlobSequence = 0; // Of the newest record, 0 if there is none
+uint8_t ConfigBlobBuffer[CONFIG_BLOB_MAX_BYTES];
+uint16_t ConfigBlobWords[CONFIG_BLOB_SLOT_WORDS];
+// SET_CONFIG_BLOB arrives in pieces
+uint8_t ConfigBlobUpload[CONFIG_BLOB_MAX_BYTES];
+uint16_t ConfigBlobUploaded = 0;
+
+/**
+ * @brief  Config Blob Init
+ *            Works out the layout of a record from the registry. Call
+ *            after CRC32_Init.
+ */
+void config_blob_init(void) {
+    CRC32_Context ctx;
+    const Data_Reg_Entry* var;
+    uint16_t length = CONFIG_BLOB_HEADER_BYTES;
+
+    CRC32_Start(&ctx);
+    for (uint16_t i = 0; (var = data_registry_entry(i)) != 0; i++) {
+        if (var->Flags & DATA_REG_EEPROM) {
+            CRC32_Update(&ctx, (uint8_t) (var->ID >> 8));
+            CRC32_Update(&ctx, (uint8_t) (var->ID & 0xFF));
+            CRC32_Update(&ctx, (uint8_t) var->Type);
+            length += data_packet_type_size(var->Type);
+        }
+    }
+    ConfigBlobLayout = CRC32_Final(&ctx);
+    ConfigBlobLength = length + CONFIG_BLOB_CRC_BYTES;
+    ConfigBlobSequence = 0;
+    ConfigBlobUploaded = 0;
+}
+
+/**
+ * @brief  Config Blob Fill EEPROM Table
+ *            Adds the virtual addresses of both slots to the table given to
+ *            EE_Init, after the ones from data_registry_fill_ee_table.
+ * @param  addrTab - room for 2 * CONFIG_BLOB_SLOT_WORDS addresses
+ * @retval Number of addresses added
+ */
+uint16_t config_blob_fill_ee_table(uint16_t* addrTab) {
+    for (uint16_t i = 0; i < CONFIG_BLOB_SLOT_WORDS; i++) {
+        addrTab[i] = CONFIG_BLOB_SLOT_A_ADDR + i;
+        addrTab[CONFIG_BLOB_SLOT_WORDS + i] = CONFIG_BLOB_SLOT_B_ADDR + i;
+    }
+    return 2 * CONFIG_BLOB_SLOT_WORDS;
+}
+
+/**
+ * @brief  Config Blob Save
+ *            Writes a record of the values saved in EEPROM to the older
+ *            slot. Call inside the batch that saved the variables, so both
+ *            go to the flash together.
+ * @retval FLASH_COMPLETE or the EEPROM emulation error
+ */
+uint16_t config_blob_save(void) {
+    uint32_t sequence = ConfigBlobSequence + 1;
+    uint16_t length = config_blob_build(ConfigBlobBuffer, sequence);
+    uint16_t status = config_blob_write_slot((uint8_t) (sequence & 1),
+            ConfigBlobBuffer, length);
+
+    if (status == FLASH_COMPLETE) {
+        ConfigBlobSequence = sequence;
+    }
+    return status;
+}
+
+/**
+ * @brief  Config Blob Load
+ *            Applies the newest valid record to RAM through the registry
+ *            setters, which work out anything derived from the values.
+ * @retval DATA_PACKET_SUCCESS, or DATA_PACKET_FAIL if there was no valid
+ *         record or a value was refused
+ */
+uint8_t config_blob_load(void) {
+    const Data_Reg_Entry* var;
+    uint8_t result = DATA_PACKET_SUCCESS;
+    uint16_t place = CONFIG_BLOB_HEADER_BYTES;
+
+    if (config_blob_read(ConfigBlobBuffer) == 0) {
+        return DATA_PACKET_FAIL;
+    }
+    for (uint16_t i = 0; (var = data_registry_entry(i)) != 0; i++) {
+        if (var->Flags & DATA_REG_EEPROM) {
+            if (data_registry_write(var, &ConfigBlobBuffer[place])
+                    != DATA_PACKET_SUCCESS) {
+                result = DATA_PACKET_FAIL;
+            }
+            place += data_packet_type_size(var->Type);
+        }
+    }
+    return result;
+}
+
+/**
+ * @brief  Config Blob Read
+ *            Copies the newest valid record out of the EEPROM.
+ * @param  dest - room for CONFIG_BLOB_MAX_BYTES
+ * @retval Length of the record, 0 if neither slot is valid
+ */
+uint16_t config_blob_read(uint8_t* dest) {
+    uint8_t best = 0xFF;
+    uint32_t best_seq = 0, seq;
+
+    for (uint8_t slot = 0; slot < 2; slot++) {
+        if (config_blob_read_slot(slot, dest) > 0) {
+            seq = data_packet_extract_32b(&dest[4]);
+            if ((best == 0xFF) || ((int32_t) (seq - best_seq) > 0)) {
+                best = slot;
+                best_seq = seq;
+            }
+        }
+    }
+    if (best == 0xFF) {
+        ConfigBlobSequence = 0;
+        return 0;
+    }
+    ConfigBlobSequence = best_seq;
+    return config_blob_read_slot(best, dest);
+}
+
+/**
+ * @brief  Length of a record for this firmware, CRC included
+ */
+uint16_t config_blob_length(void) {
+    return ConfigBlobLength;
+}
+
+/**
+ * @brief  Config Blob Check
+ *            Checks a record's version, length, layout and CRC.
+ * @retval DATA_PACKET_SUCCESS or DATA_PACKET_FAIL
+ */
+uint8_t config_blob_check(uint8_t* blob, uint16_t length) {
+    uint16_t body = length - CONFIG_BLOB_CRC_BYTES;
+
+    if ((length != ConfigBlobLength)
+            || (data_packet_extract_16b(blob) != CONFIG_BLOB_VERSION)
+            || (data_packet_extract_16b(&blob[2]) != length)
+            || (data_packet_extract_32b(&blob[8]) != ConfigBlobLayout)) {
+        return DATA_PACKET_FAIL;
+    }
+    if (data_packet_extract_32b(&blob[body]) != CRC32_Generate(blob, body)) {
+        return DATA_PACKET_FAIL;
+    }
+    return DATA_PACKET_SUCCESS;
+}
+
+/**
+ * @brief  Config Blob Store
+ *            Saves every value in a record from the host, then a record of
+ *            its own, all in one batch. Nothing is written if a value is out
+ *            of range. RAM isn't changed, same as SET_EEPROM.
+ * @param  blob - record, checked here
+ * @param  length - bytes in blob
+ * @retval FLASH_COMPLETE, FLASH_ERROR_OPERATION if the record was refused,
+ *         or the EEPROM emulation error
+ */
+uint16_t config_blob_store(uint8_t* blob, uint16_t length) {
+    const Data_Reg_Entry* var;
+    uint16_t place = CONFIG_BLOB_HEADER_BYTES;
+    uint16_t status = FLASH_COMPLETE, commit;
+
+    if (config_blob_check(blob, length) != DATA_PACKET_SUCCESS) {
+        return FLASH_ERROR_OPERATION;
+    }
+    for (uint16_t i = 0; (var = data_registry_entry(i)) != 0; i++) {
+        if (var->Flags & DATA_REG_EEPROM) {
+            if (data_registry_check_range(var, &blob[place])
+                    != DATA_PACKET_SUCCESS) {
+                return FLASH_ERROR_OPERATION;
+            }
+            place += data_packet_type_size(var->Type);
+        }
+    }
+
+    EE_BeginBatch();
+    place = CONFIG_BLOB_HEADER_BYTES;
+    for (uint16_t i = 0; ((var = data_registry_entry(i)) != 0)
+            && (status == FLASH_COMPLETE); i++) {
+        if (var->Flags & DATA_REG_EEPROM) {
+            status = data_registry_save(var, &blob[place]);
+            place += data_packet_type_size(var->Type);
+        }
+    }
+    if (status == FLASH_COMPLETE) {
+        status = config_blob_save();
+    }
+    commit = EE_CommitBatch();
+    return (status == FLASH_COMPLETE) ? commit : status;
+}
+
+/**
+ * @brief  Config Blob Upload
+ *            Collects a record sent in pieces, in order, and stores it once
+ *            the last piece is in. A piece at offset 0 starts over.
+ * @param  offset - where data goes in the record
+ * @param  data - piece of the record
+ * @param  length - bytes in data
+ * @retval DATA_PACKET_SUCCESS if the piece was taken (and the record
+ *         stored, if it was the last), DATA_PACKET_FAIL otherwise
+ */
+uint8_t config_blob_upload(uint16_t offset, uint8_t* data, uint16_t length) {
+    uint16_t total;
+
+    if (offset == 0) {
+        ConfigBlobUploaded = 0;
+    }
+    if ((offset != ConfigBlobUploaded)
+            || ((offset + length) > CONFIG_BLOB_MAX_BYTES)) {
+        ConfigBlobUploaded = 0;
+        return DATA_PACKET_FAIL;
+    }
+    memcpy(&ConfigBlobUpload[offset], data, length);
+    ConfigBlobUploaded += length;
+    if (ConfigBlobUploaded < 4) {
+        return DATA_PACKET_SUCCESS;
+    }
+
+    total = data_packet_extract_16b(&ConfigBlobUpload[2]);
+    if ((total != ConfigBlobLength) || (ConfigBlobUploaded > total)) {
+        ConfigBlobUploaded = 0;
+        return DATA_PACKET_FAIL;
+    }
+    if (ConfigBlobUploaded < total) {
+        return DATA_PACKET_SUCCESS;
+    }
+    ConfigBlobUploaded = 0;
+    if (config_blob_store(ConfigBlobUpload, total) == FLASH_COMPLETE) {
+        return DATA_PACKET_SUCCESS;
+    }
+    return DATA_PACKET_FAIL;
+}
+
+/**
+ * @brief  Sequence number of the record last loaded or saved, 0 if there
+ *         is none
+ */
+uint32_t config_blob_get_sequence(void) {
+    return ConfigBlobSequence;
+}
+
+/**
+ * @brief  Config Blob Build
+ *            Packs a record of the values saved in EEPROM.
+ * @param  dest - room for CONFIG_BLOB_MAX_BYTES
+ * @param  sequence - sequence number of the record
+ * @retval Length of the record
+ */
+static uint16_t config_blob_build(uint8_t* dest, uint32_t sequence) {
+    const Data_Reg_Entry* var;
+    uint16_t place = CONFIG_BLOB_HEADER_BYTES;
+
+    for (uint16_t i = 0; (var = data_registry_entry(i)) != 0; i++) {
+        if (var->Flags & DATA_REG_EEPROM) {
+            place += config_blob_pack_value(var, &dest[place]);
+        }
+    }
+    data_packet_pack_16b(dest, CONFIG_BLOB_VERSION);
+    data_packet_pack_16b(&dest[2], place + CONFIG_BLOB_CRC_BYTES);
+    data_packet_pack_32b(&dest[4], sequence);
+    data_packet_pack_32b(&dest[8], ConfigBlobLayout);
+    data_packet_pack_32b(&dest[place], CRC32_Generate(dest, place));
+    return place + CONFIG_BLOB_CRC_BYTES;
+}
+
+/**
+ * @brief  Packs the EEPROM value of a variable, or the RAM value if it was
+ *         never saved
+ * @retval Bytes packed
+ */
+static uint8_t config_blob_pack_value(const Data_Reg_Entry* var, uint8_t* dest) {
+    uint8_t size = data_registry_read(var, 0, dest);
+
+    switch (var->Type) {
+    case Data_Type_Int16:
+        data_packet_pack_16b(dest, EE_ReadInt16WithDefault(var->ID,
+                data_packet_extract_16b(dest)));
+        break;
+    case Data_Type_Int32:
+        data_packet_pack_32b(dest, EE_ReadInt32WithDefault(var->ID,
+                data_packet_extract_32b(dest)));
+        break;
+    case Data_Type_Float:
+        data_packet_pack_float(dest, EE_ReadFloatWithDefault(var->ID,
+                data_packet_extract_float(dest)));
+        break;
+    default:
+        break;
+    }
+    return size;
+}
+
+/**
+ * @brief  Copies a slot out of the EEPROM shadow and checks it
+ * @param  slot - 0 for A, 1 for B
+ * @param  dest - room for CONFIG_BLOB_MAX_BYTES
+ * @retval Length of the record, 0 if it isn't valid
+ */
+static uint16_t config_blob_read_slot(uint8_t slot, uint8_t* dest) {
+    uint16_t addr = config_blob_slot_addr(slot);
+    uint16_t length, words;
+
+    // Header first, for the length
+    if (EE_ReadBlock(addr, ConfigBlobWords, CONFIG_BLOB_HEADER_BYTES / 2)
+            != READ_SUCCESS) {
+        return 0;
+    }
+    length = ConfigBlobWords[1];
+    if ((length != ConfigBlobLength) || (length > CONFIG_BLOB_MAX_BYTES)) {
+        return 0;
+    }
+    words = (length + 1) / 2;
+    if (EE_ReadBlock(addr, ConfigBlobWords, words) != READ_SUCCESS) {
+        return 0;
+    }
+    for (uint16_t i = 0; i < words; i++) {
+        data_packet_pack_16b(&dest[2 * i], ConfigBlobWords[i]);
+    }
+    if (config_blob_check(dest, length) != DATA_PACKET_SUCCESS) {
+        return 0;
+    }
+    return length;
+}
+
+/**
+ * @brief  Writes a record to a slot as one batch. Half words that didn't
+ *         change since the slot was last written are left out by the EEPROM
+ *         emulation.
+ * @retval FLASH_COMPLETE or the EEPROM emulation error
+ */
+static uint16_t config_blob_write_slot(uint8_t slot, uint8_t* blob,
+        uint16_t length) {
+    uint16_t addr = config_blob_slot_addr(slot);
+    uint16_t words = (length + 1) / 2;
+    uint16_t status = FLASH_COMPLETE, commit;
+
+    if ((length & 1) != 0) {
+        blob[length] = 0;
+    }
+    EE_BeginBatch();
+    for (uint16_t i = 0; (i < words) && (status == FLASH_COMPLETE); i++) {
+        status = EE_WriteVariable(addr + i,
+                data_packet_extract_16b(&blob[2 * i]));
+    }
+    commit = EE_CommitBatch();
+    return (status == FLASH_COMPLETE) ? commit : status;
+}
+
+static uint16_t config_blob_slot_addr(uint8_t slot) {
+    return (slot == 0) ? CONFIG_BLOB_SLOT_A_ADDR : CONFIG_BLOB_SLOT_B_ADDR;
+}
@@ -11,6 +11,10 @@
  *              the end.
  *              Check with:
  *              http://www.sunshine2k.de/coding/javascript/crc/crc_js.html
+ *
+ *              The words have to be bit reversed on the way in, and the F4's
+ *              CRC unit can't do that itself (no REV_IN like on the F7/L4).
+ *              That rules out feeding it by DMA, the CPU loop has to stay.
  ******************************************************************************
 
  Copyright (c) 2019 David Miller
@@ -36,6 +40,12 @@
 
 #include "main.h"
 
+// *** Global variables ***
+// Benchmark results, bytes per microsecond
+float CRC32_HardwareRate = 0.0f;
+float CRC32_SoftwareRate = 0.0f;
+uint8_t CRC32_BenchBuffer[CRC32_BENCH_BYTES];
+
 void CRC32_Init(void) {
     // Turns on the hardware
     RCC->AHB1ENR |= RCC_AHB1ENR_CRCEN;
@@ -46,39 +56,75 @@ uint32_t CRC32_Generate(uint8_t *buf, uint16_t len) {
     CRC->CR = CRC_CR_RESET;
     uint32_t crc_input;
 
-    // Push data in blocks of 4 bytes
+    // Push data in blocks of 4 bytes. Loaded little endian, the bytes are
+    // already in the order the unit needs once the bits are reversed.
+    // memcpy becomes a single (possibly unaligned) load on the M4.
     while (len >= 4) {
-        crc_input = (((uint32_t) buf[0]) << 24) + (((uint32_t) buf[1]) << 16)
-                + (((uint32_t) buf[2]) << 8) + ((uint32_t) buf[3]);
-        crc_input = __RBIT(__REV(crc_input));
-        CRC->DR = crc_input;
+        memcpy(&crc_input, buf, 4);
+        CRC->DR = __RBIT(crc_input);
         len -= 4;
         buf += 4;
     }
-    switch (len) {
-    case 0:
-        // No more to send
-        return 0xFFFFFFFF ^ (__RBIT(CRC->DR));
-    case 1:
-        crc_input = (((uint32_t) buf[0]) << 24);
-        crc_input = __RBIT(__REV(crc_input));
-        CRC->DR = crc_input;
-        return 0xFFFFFFFF ^ (__RBIT(CRC->DR));
-    case 2:
-        crc_input = (((uint32_t) buf[0]) << 24) + (((uint32_t) buf[1]) << 16);
-        crc_input = __RBIT(__REV(crc_input));
-        CRC->DR = crc_input;
-        return 0xFFFFFFFF ^ (__RBIT(CRC->DR));
-    case 3:
-        crc_input = (((uint32_t) buf[0]) << 24) + (((uint32_t) buf[1]) << 16)
-                + (((uint32_t) buf[2]) << 8);
-        crc_input = __RBIT(__REV(crc_input));
-        CRC->DR = crc_input;
-        return 0xFFFFFFFF ^ (__RBIT(CRC->DR));
-    default:
-        // This shouldn't happen. So no special error fixing, just return what
-        // we got at this point.
-        return 0xFFFFFFFF ^ (__RBIT(CRC->DR));
+    if (len > 0) {
+        // Zero pad the last word
+        crc_input = buf[0];
+        if (len > 1) {
+            crc_input |= ((uint32_t) buf[1]) << 8;
+        }
+        if (len > 2) {
+            crc_input |= ((uint32_t) buf[2]) << 16;
+        }
+        CRC->DR = __RBIT(crc_input);
     }
+    return 0xFFFFFFFF ^ (__RBIT(CRC->DR));
+}
+
+/**
+ * @brief  CRC32 Benchmark
+ *            Times the hardware (CPU fed) and table driven CRCs over a
+ *            packet sized buffer with the core cycle counter. Interrupts
+ *            stay on, it can run with the motor going, so the best of
+ *            several passes is kept to throw out the ones that were cut in.
+ */
+void CRC32_Benchmark(void) {
+    uint32_t best_hw = 0xFFFFFFFF;
+    uint32_t best_sw = 0xFFFFFFFF;
+    uint32_t start, cycles;
+    CRC32_Context ctx;
+
+    for (uint16_t i = 0; i < CRC32_BENCH_BYTES; i++) {
+        CRC32_BenchBuffer[i] = (uint8_t) i;
+    }
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+    for (uint8_t pass = 0; pass < CRC32_BENCH_PASSES; pass++) {
+        start = DWT->CYCCNT;
+        CRC32_Generate(CRC32_BenchBuffer, CRC32_BENCH_BYTES);
+        cycles = DWT->CYCCNT - start;
+        if (cycles < best_hw) {
+            best_hw = cycles;
+        }
+
+        start = DWT->CYCCNT;
+        CRC32_Start(&ctx);
+        CRC32_UpdateBuffer(&ctx, CRC32_BenchBuffer, CRC32_BENCH_BYTES);
+        CRC32_Final(&ctx);
+        cycles = DWT->CYCCNT - start;
+        if (cycles < best_sw) {
+            best_sw = cycles;
+        }
+    }
+
+    float cycles_per_us = ((float) SystemCoreClock) / 1000000.0f;
+    CRC32_HardwareRate = ((float) CRC32_BENCH_BYTES) * cycles_per_us / best_hw;
+    CRC32_SoftwareRate = ((float) CRC32_BENCH_BYTES) * cycles_per_us / best_sw;
+}
+
+float CRC32_GetHardwareRate(void) {
+    return CRC32_HardwareRate;
+}
 
+float CRC32_GetSoftwareRate(void) {
+    return CRC32_SoftwareRate;
 }
@@ -0,0 +1,165 @@
+/******************************************************************************
+ * Filename: dashboard.c
+ * Description: Pushes dashboard data to the handlebar display at a set
+ *              rate, and right away when a fault or limit changes. Only
+ *              the fields that moved are sent.
+ *
+ *              Replaces the display polling with REQUEST_DASHBOARD_DATA,
+ *              which costs a request and a full 32 byte response each
+ *              time on a slow serial link.
+ *
+ ******************************************************************************
+
+ Copyright (c) 2019 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#include "main.h"
+#include "dashboard.h"
+
+// *** Global variables ***
+Dashboard_Push_Type DashboardPush;
+
+// How far each field has to move to be worth sending, in its own units.
+// The fault code goes on any change.
+static const float DashboardDeadband[DASHBOARD_NUM_FIELDS] = DASHBOARD_DEADBANDS;
+
+static uint8_t dashboard_build(uint8_t* data, uint8_t key);
+
+void dashboard_init(void) {
+    DashboardPush.Period = 0;
+    DashboardPush.Sequence = 0;
+    DashboardPush.FramesSent = 0;
+    DashboardPush.FieldsSkipped = 0;
+}
+
+/**
+ * @brief  Dashboard Subscribe
+ *            Starts or stops pushing. The first frame is a key frame.
+ * @param  period - ms between frames, 0 to stop
+ * @retval DATA_PACKET_SUCCESS or DATA_PACKET_FAIL (period too short)
+ */
+uint8_t dashboard_subscribe(uint16_t period) {
+    if ((period != 0) && (period < DASHBOARD_MIN_PERIOD_MS)) {
+        return DATA_PACKET_FAIL;
+    }
+    DashboardPush.Period = period;
+    // Make the first frame a key frame, due right away
+    DashboardPush.LastKey = GetTick() - DASHBOARD_KEYFRAME_MS;
+    DashboardPush.LastFrame = GetTick() - period;
+    return DATA_PACKET_SUCCESS;
+}
+
+/**
+ * @brief  Dashboard Service
+ *            Call from the main loop. Sends a frame when the period is up,
+ *            or early if the fault code or the limit flags changed. A frame
+ *            that doesn't fit in the transmit queue is tried again on the
+ *            next call, nothing counts as sent until it's queued.
+ */
+void dashboard_service(void) {
+    static uint8_t txbuf[PACKET_MAX_LENGTH];
+    uint8_t data[DASHBOARD_PUSH_HEADER + DASHBOARD_DATA_LENGTH];
+    Data_Packet_Type pkt;
+    uint32_t now = GetTick();
+    uint8_t due;
+
+    if (DashboardPush.Period == 0) {
+        return;
+    }
+    if ((now - DashboardPush.LastFrame) < DASHBOARD_EVENT_HOLDOFF_MS) {
+        return;
+    }
+    due = ((now - DashboardPush.LastFrame) >= DashboardPush.Period);
+    if ((!due)
+            && (MAIN_GetLimitFlags() == DashboardPush.SentLimits)
+            && (MAIN_GetFaultCode() == data_packet_extract_32b(
+                    &DashboardPush.Sent[DASHBOARD_FAULT_FIELD * 4]))) {
+        return;
+    }
+    uint8_t key = ((now - DashboardPush.LastKey) >= DASHBOARD_KEYFRAME_MS);
+    uint8_t len = dashboard_build(data, key);
+
+    pkt.TxBuffer = txbuf;
+    pkt.Framing = HBD_Get_Framing();
+    if (data_packet_create(&pkt, DASHBOARD_PUSH, data, len)
+            && (UART_Write(SELECT_HBD_UART, txbuf, pkt.TxLength) > 0)) {
+        // The display has it now
+        uint16_t mask = data_packet_extract_16b(&data[1]);
+        uint8_t place = DASHBOARD_PUSH_HEADER;
+        for (uint8_t i = 0; i < DASHBOARD_NUM_FIELDS; i++) {
+            if (mask & (1 << i)) {
+                memcpy(&DashboardPush.Sent[i * 4], &data[place], 4);
+                place += 4;
+            } else {
+                DashboardPush.FieldsSkipped++;
+            }
+        }
+        DashboardPush.SentLimits = data[3];
+        DashboardPush.Sequence++;
+        DashboardPush.LastFrame = now;
+        if (key) {
+            DashboardPush.LastKey = now;
+        }
+        DashboardPush.FramesSent++;
+    }
+}
+
+uint32_t dashboard_get_frames_sent(void) {
+    return DashboardPush.FramesSent;
+}
+
+uint32_t dashboard_get_fields_skipped(void) {
+    return DashboardPush.FieldsSkipped;
+}
+
+/**
+ * @brief  Dashboard Build
+ *            Packs a push frame with the fields that moved past their
+ *            deadband since they were last sent (all of them if key).
+ * @retval Length of the frame
+ */
+static uint8_t dashboard_build(uint8_t* data, uint8_t key) {
+    uint8_t now[DASHBOARD_DATA_LENGTH];
+    uint16_t mask = 0;
+    uint8_t place = DASHBOARD_PUSH_HEADER;
+
+    MAIN_GetDashboardData(now);
+    for (uint8_t i = 0; i < DASHBOARD_NUM_FIELDS; i++) {
+        uint8_t changed;
+        if (i == DASHBOARD_FAULT_FIELD) {
+            changed = (memcmp(&now[i * 4], &DashboardPush.Sent[i * 4], 4) != 0);
+        } else {
+            float diff = data_packet_extract_float(&now[i * 4])
+                    - data_packet_extract_float(&DashboardPush.Sent[i * 4]);
+            // NaN counts as a change
+            changed = !(fabsf(diff) <= DashboardDeadband[i]);
+        }
+        if (key || changed) {
+            mask |= (1 << i);
+            memcpy(&data[place], &now[i * 4], 4);
+            place += 4;
+        }
+    }
+    data[0] = DashboardPush.Sequence;
+    data_packet_pack_16b(&data[1], mask);
+    data[3] = MAIN_GetLimitFlags();
+    return place;
+}
@@ -29,8 +29,16 @@
 #include "main.h"
 #include "data_packet.h"
 #include "data_commands.h"
+#include "data_registry.h"
+#include "config_blob.h"
 
-static Data_Type command_get_datatype(uint16_t data_ID);
+static uint16_t command_result_code(Data_Type type);
+
+// *** Global variables ***
+// Holds response data that is too long for the small return buffer
+uint8_t command_txdata[PACKET_MAX_LENGTH - PACKET_OVERHEAD_BYTES];
+// Whole configuration record, sent a piece at a time
+uint8_t command_blob[CONFIG_BLOB_MAX_BYTES];
 
 /**
  * @brief  Data Process Command
@@ -122,6 +130,55 @@ uint16_t data_process_command(Data_Packet_Type* pkt) {
             errCode = data_packet_create(pkt, CONTROLLER_NACK, 0, 0);
         }
         break;
+    case GET_VARIABLE_LIST:
+        errCode = data_packet_create(pkt, GET_VARIABLE_LIST_RESULT,
+                command_txdata, command_get_variable_list(pkt->Data, command_txdata));
+        break;
+    case GET_RAM_BATCH:
+        errCode = data_packet_create(pkt, GET_RAM_BATCH_RESULT, command_txdata,
+                command_get_ram_batch(pkt->Data, pkt->DataLength, command_txdata));
+        break;
+    case SET_RAM_BATCH:
+        errCode = data_packet_create(pkt, SET_RAM_BATCH_RESULT, command_txdata,
+                command_set_ram_batch(pkt->Data, pkt->DataLength, command_txdata));
+        break;
+    case SET_FRAMING:
+        // Answer in the old framing, then switch
+        if ((pkt->DataLength == 1)
+                && (pkt->Data[0] <= DATA_PACKET_FRAMING_COBS)) {
+            errCode = data_packet_create(pkt, CONTROLLER_ACK, 0, 0);
+            pkt->Framing = pkt->Data[0];
+            pkt->CobsCode = 0;
+            pkt->CobsLeft = 0;
+        } else {
+            errCode = data_packet_create(pkt, CONTROLLER_NACK, 0, 0);
+        }
+        break;
+    case TELEMETRY_SUBSCRIBE:
+        if (command_telemetry_subscribe(pkt->Data, pkt->DataLength)
+                == DATA_COMMAND_SUCCESS) {
+            errCode = data_packet_create(pkt, CONTROLLER_ACK, 0, 0);
+        } else {
+            errCode = data_packet_create(pkt, CONTROLLER_NACK, 0, 0);
+        }
+        break;
+    case GET_CONFIG_BLOB:
+        errCode = command_get_config_blob(pkt->Data, command_txdata);
+        if (errCode > 0) {
+            errCode = data_packet_create(pkt, GET_CONFIG_BLOB_RESULT,
+                    command_txdata, errCode);
+        } else {
+            errCode = data_packet_create(pkt, CONTROLLER_NACK, 0, 0);
+        }
+        break;
+    case SET_CONFIG_BLOB:
+        if (command_set_config_blob(pkt->Data, pkt->DataLength)
+                == DATA_COMMAND_SUCCESS) {
+            errCode = data_packet_create(pkt, CONTROLLER_ACK, 0, 0);
+        } else {
+            errCode = data_packet_create(pkt, CONTROLLER_NACK, 0, 0);
+        }
+        break;
     case HOST_STREAM_DATA:
         break;
     case HOST_ACK:
@@ -142,6 +199,14 @@ uint16_t data_process_command(Data_Packet_Type* pkt) {
         break;
     case ROUTINE_RESULT:
         break;
+    case GET_VARIABLE_LIST_RESULT:
+        break;
+    case GET_RAM_BATCH_RESULT:
+        break;
+    case SET_RAM_BATCH_RESULT:
+        break;
+    case GET_CONFIG_BLOB_RESULT:
+        break;
     case CONTROLLER_STREAM_DATA:
         break;
     case CONTROLLER_ACK:
@@ -158,8 +223,8 @@ uint16_t data_process_command(Data_Packet_Type* pkt) {
 
 /**
  * @brief  Data Command: Get Ram
- *            Interprets the command in a decoded packet. Calls the appropriate
- *            sub-function for the requested command.
+ *            Looks up the requested variable in the registry and reads its
+ *            current value.
  * @param  pktdata - Data field in the incoming packet
  * @param  retval - Pointer to return value from the command request.
  *                  Regardless of the return type, it will be placed into the
@@ -174,476 +239,122 @@ uint16_t data_process_command(Data_Packet_Type* pkt) {
 uint16_t command_get_ram(uint8_t* pktdata, uint8_t* retval) {
     // Data is two bytes for value ID
     uint16_t value_ID = data_packet_extract_16b(pktdata);
-//    uint16_t value_ID = (((uint16_t)pktdata[0]) << 8) + pktdata[1];
-    float retvalf= 0.0f;
-    uint8_t retval8b = 0;
-    uint16_t retval16b = 0;
-    uint32_t retval32b = 0;
-    uint16_t errCode = DATA_COMMAND_FAIL;
-
-
-    switch (value_ID) {
-    // 8-bit integer values
-    case CONFIG_BMS_ISCONNECTED:
-        retval8b = BMS_Is_Connected();
-        break;
-    // 16-bit integer values
-    case CONFIG_MAIN_NUM_USB_OUTPUTS:
-        retval16b = MAIN_GetNumUSBDebugOutputs();
-        break;
-    case CONFIG_MAIN_USB_SPEED:
-        retval16b = MAIN_GetUSBDebugSpeed();
-        break;
-    case CONFIG_MAIN_USB_CHOICE_1:
-    case CONFIG_MAIN_USB_CHOICE_2:
-    case CONFIG_MAIN_USB_CHOICE_3:
-    case CONFIG_MAIN_USB_CHOICE_4:
-    case CONFIG_MAIN_USB_CHOICE_5:
-    case CONFIG_MAIN_USB_CHOICE_6:
-    case CONFIG_MAIN_USB_CHOICE_7:
-    case CONFIG_MAIN_USB_CHOICE_8:
-    case CONFIG_MAIN_USB_CHOICE_9:
-    case CONFIG_MAIN_USB_CHOICE_10:
-        retval16b = MAIN_GetUSBDebugOutput(value_ID - CONFIG_MAIN_USB_CHOICE_1);
-        break;
-    case CONFIG_THRT_TYPE1:
-        retval16b = throttle_get_type(1);
-        break;
-    case CONFIG_THRT_TYPE2:
-        retval16b = throttle_get_type(2);
-        break;
-    case CONFIG_MOTOR_POLEPAIRS:
-        retval16b = MAIN_GetPolePairs();
-        break;
-
-    case CONFIG_BMS_NUMBATTS:
-        retval16b = BMS_Get_Num_Batts();
-        break;
-    // 32 bit integer values
-    case CONFIG_FOC_PWM_FREQ:
-        retval32b = MAIN_GetFreq();
-        break;
-    case CONFIG_FOC_PWM_DEADTIME:
-        retval32b = MAIN_GetDeadTime();
-        break;
-    case CONFIG_MAIN_COUNTS_TO_FOC:
-        retval32b = MAIN_GetCountsToFOC();
-        break;
-    case CONFIG_BMS_GETSTATUS_N:
-        // Which battery is also in the data
-        retval32b = BMS_Get_Batt_Status(data_packet_extract_16b(&(pktdata[2])));
-        break;
-    // 32 bit float values
-    case CONFIG_ADC_INV_TIA_GAIN:
-        retvalf = adcGetInverseTIAGain();
-        break;
-    case CONFIG_ADC_VBUS_RATIO:
-        retvalf = adcGetVbusRatio();
-        break;
-    case CONFIG_ADC_THERM_FIXED_R:
-        retvalf = adcGetThermFixedR();
-        break;
-    case CONFIG_ADC_THERM_R25:
-        retvalf = adcGetThermR25();
-        break;
-    case CONFIG_ADC_THERM_B:
-        retvalf = adcGetThermBeta();
-        break;
-    case CONFIG_FOC_KP:
-        retvalf = MAIN_GetVar(0);
-        break;
-    case CONFIG_FOC_KI:
-        retvalf = MAIN_GetVar(1);
-        break;
-    case CONFIG_FOC_KD:
-        retvalf = MAIN_GetVar(2);
-        break;
-    case CONFIG_FOC_KC:
-        retvalf = MAIN_GetVar(3);
-        break;
-    case CONFIG_MAIN_RAMP_SPEED:
-        retvalf = MAIN_GetRampSpeed();
-        break;
-    case CONFIG_MAIN_SPEED_TO_FOC:
-        retvalf = MAIN_GetSpeedToFOC();
-        break;
-    case CONFIG_MAIN_SWITCH_EPS:
-        retvalf = MAIN_GetSwitchoverEpsilon();
-        break;
-    case CONFIG_THRT_MIN1:
-        retvalf = throttle_get_min(1);
-        break;
-    case CONFIG_THRT_MAX1:
-        retvalf = throttle_get_max(1);
-        break;
-    case CONFIG_THRT_HYST1:
-        retvalf = throttle_get_hyst(1);
-        break;
-    case CONFIG_THRT_FILT1:
-        retvalf = throttle_get_filt(1);
-        break;
-    case CONFIG_THRT_RISE1:
-        retvalf = throttle_get_rise(1);
-        break;
-    case CONFIG_THRT_MIN2:
-        retvalf = throttle_get_min(2);
-        break;
-    case CONFIG_THRT_MAX2:
-        retvalf = throttle_get_max(2);
-        break;
-    case CONFIG_THRT_HYST2:
-        retvalf = throttle_get_hyst(2);
-        break;
-    case CONFIG_THRT_FILT2:
-        retvalf = throttle_get_filt(2);
-        break;
-    case CONFIG_THRT_RISE2:
-        retvalf = throttle_get_rise(2);
-        break;
-    case CONFIG_LMT_VOLT_FAULT_MIN:
-        retvalf = MAIN_GetLimit(Main_Limit_MinVoltFault);
-        break;
-    case CONFIG_LMT_VOLT_FAULT_MAX:
-        retvalf = MAIN_GetLimit(Main_Limit_MaxVoltFault);
-        break;
-    case CONFIG_LMT_CUR_FAULT_MAX:
-        retvalf = MAIN_GetLimit(Main_Limit_CurrentFault);
-        break;
-    case CONFIG_LMT_VOLT_SOFTCAP:
-        retvalf = MAIN_GetLimit(Main_Limit_SoftVoltage);
-        break;
-    case CONFIG_LMT_VOLT_HARDCAP:
-        retvalf = MAIN_GetLimit(Main_Limit_HardVoltage);
-        break;
-    case CONFIG_LMT_PHASE_CUR_MAX:
-        retvalf = MAIN_GetLimit(Main_Limit_PhaseCurrent);
-        break;
-    case CONFIG_LMT_PHASE_REGEN_MAX:
-        retvalf = MAIN_GetLimit(Main_Limit_PhaseRegenCurrent);
-        break;
-    case CONFIG_LMT_BATT_CUR_MAX:
-        retvalf = MAIN_GetLimit(Main_Limit_BattCurrent);
-        break;
-    case CONFIG_LMT_BATT_REGEN_MAX:
-        retvalf = MAIN_GetLimit(Main_Limit_BattRegenCurrent);
-        break;
-    case CONFIG_LMT_FET_TEMP_SOFTCAP:
-        retvalf = MAIN_GetLimit(Main_Limit_SoftFetTemp);
-        break;
-    case CONFIG_LMT_FET_TEMP_HARDCAP:
-        retvalf = MAIN_GetLimit(Main_Limit_HardFetTemp);
-        break;
-    case CONFIG_LMT_MOTOR_TEMP_SOFTCAP:
-        retvalf = MAIN_GetLimit(Main_Limit_SoftMotorTemp);
-        break;
-    case CONFIG_LMT_MOTOR_TEMP_HARDCAP:
-        retvalf = MAIN_GetLimit(Main_Limit_HardMotorTemp);
-        break;
-    case CONFIG_MOTOR_HALL1:
-    case CONFIG_MOTOR_HALL2:
-    case CONFIG_MOTOR_HALL3:
-    case CONFIG_MOTOR_HALL4:
-    case CONFIG_MOTOR_HALL5:
-    case CONFIG_MOTOR_HALL6:
-        retvalf = HallSensor_GetAngle(value_ID - CONFIG_MOTOR_HALL1 + 1);
-        break;
-    case CONFIG_MOTOR_GEAR_RATIO:
-        retvalf = MAIN_GetGearRatio();
-        break;
-    case CONFIG_MOTOR_WHEEL_SIZE:
-        retvalf = MAIN_GetWheelSize();
-        break;
-    case CONFIG_MOTOR_KV:
-        retvalf = MAIN_GetMotorKv();
-        break;
-    case CONFIG_BMS_GETBAT_N:
-        // Which battery is also in the data
-        retvalf = BMS_Get_Batt_Voltage(data_packet_extract_16b(&(pktdata[2])));
-        break;
+    uint16_t index = 0;
 
+    const Data_Reg_Entry* var = data_registry_find(value_ID);
+    if (var == 0) {
+        return DATA_COMMAND_FAIL;
     }
-
-    switch(command_get_datatype(value_ID)) {
-    case Data_Type_None:
-    case Data_Type_Int8:
-        errCode = RESULT_IS_8B;
-        data_packet_pack_8b(retval, retval8b);
-        break;
-    case Data_Type_Int16:
-        errCode = RESULT_IS_16B;
-        data_packet_pack_16b(retval, retval16b);
-        break;
-    case Data_Type_Int32:
-        errCode = RESULT_IS_32B;
-        data_packet_pack_32b(retval, retval32b);
-        break;
-    case Data_Type_Float:
-        errCode = RESULT_IS_FLOAT;
-        data_packet_pack_float(retval, retvalf);
-        break;
+    if (var->Flags & DATA_REG_INDEXED) {
+        // Which battery (or other item) is also in the data
+        index = data_packet_extract_16b(&(pktdata[2]));
     }
-    return errCode;
+    if (data_registry_read(var, index, retval) == 0) {
+        return DATA_COMMAND_FAIL;
+    }
+    return command_result_code(var->Type);
 }
 
+/**
+ * @brief  Data Command: Set Ram
+ *            Range checks and applies a new value for a variable.
+ * @param  pktdata - Data field in the incoming packet. Two bytes of value ID
+ *                   followed by two to four bytes of value.
+ * @retval DATA_COMMAND_FAIL or DATA_COMMAND_SUCCESS
+ */
 uint16_t command_set_ram(uint8_t* pktdata) {
     // Data is two bytes for value ID
     uint16_t value_ID = data_packet_extract_16b(pktdata);
-    //uint16_t value_ID = (((uint16_t)pktdata[0]) << 8) + pktdata[1];
-    pktdata += 2;
-    // Then two to four bytes for value, depending on command
-    float valuef = 0.0f;
-    uint16_t value16b = 0;
-    uint32_t value32b = 0;
-    uint16_t errCode = DATA_COMMAND_FAIL;
 
-    switch(command_get_datatype(value_ID)) {
-    case Data_Type_None:
-    case Data_Type_Int8:
+    const Data_Reg_Entry* var = data_registry_find(value_ID);
+    if (var == 0) {
         return DATA_COMMAND_FAIL;
-        break;
-    case Data_Type_Int16:
-        value16b = data_packet_extract_16b(pktdata);
-        break;
-    case Data_Type_Int32:
-        value32b = data_packet_extract_32b(pktdata);
-        break;
-    case Data_Type_Float:
-        valuef = data_packet_extract_float(pktdata);
-        break;
     }
-
-    switch (value_ID) {
-    // 16-bit integer values
-    case CONFIG_MAIN_NUM_USB_OUTPUTS:
-        errCode = MAIN_SetNumUSBDebugOutputs((uint8_t)value16b);
-        break;
-    case CONFIG_MAIN_USB_SPEED:
-        errCode = MAIN_SetUSBDebugSpeed((uint8_t)value16b);
-        break;
-    case CONFIG_MAIN_USB_CHOICE_1:
-    case CONFIG_MAIN_USB_CHOICE_2:
-    case CONFIG_MAIN_USB_CHOICE_3:
-    case CONFIG_MAIN_USB_CHOICE_4:
-    case CONFIG_MAIN_USB_CHOICE_5:
-    case CONFIG_MAIN_USB_CHOICE_6:
-    case CONFIG_MAIN_USB_CHOICE_7:
-    case CONFIG_MAIN_USB_CHOICE_8:
-    case CONFIG_MAIN_USB_CHOICE_9:
-    case CONFIG_MAIN_USB_CHOICE_10:
-        errCode = MAIN_SetUSBDebugOutput(value_ID - CONFIG_MAIN_USB_CHOICE_1,
-                (uint8_t) value16b);
-        break;
-    case CONFIG_THRT_TYPE1:
-        errCode = throttle_set_type(1, (uint8_t) value16b);
-        break;
-    case CONFIG_THRT_TYPE2:
-        errCode = throttle_set_type(2, (uint8_t) value16b);
-        break;
-    case CONFIG_MOTOR_POLEPAIRS:
-        errCode = MAIN_SetPolePairs(value16b);
-        break;
-
-    // 32 bit integer values
-    case CONFIG_FOC_PWM_FREQ:
-        errCode = MAIN_SetFreq(value32b);
-        break;
-    case CONFIG_FOC_PWM_DEADTIME:
-        errCode = MAIN_SetDeadTime(value32b);
-        break;
-    case CONFIG_MAIN_COUNTS_TO_FOC:
-        errCode = MAIN_SetCountsToFOC(value32b);
-        break;
-
-    // 32 bit float values
-    case CONFIG_ADC_INV_TIA_GAIN:
-        errCode = adcSetInverseTIAGain(valuef);
-        break;
-    case CONFIG_ADC_VBUS_RATIO:
-        errCode = adcSetVbusRatio(valuef);
-        break;
-    case CONFIG_ADC_THERM_FIXED_R:
-        errCode = adcSetThermFixedR(valuef);
-        break;
-    case CONFIG_ADC_THERM_R25:
-        errCode = adcSetThermR25(valuef);
-        break;
-    case CONFIG_ADC_THERM_B:
-        errCode = adcSetThermBeta(valuef);
-        break;
-    case CONFIG_FOC_KP:
-        errCode = MAIN_SetVar(0, valuef);
-        break;
-    case CONFIG_FOC_KI:
-        errCode = MAIN_SetVar(1, valuef);
-        break;
-    case CONFIG_FOC_KD:
-        errCode = MAIN_SetVar(2, valuef);
-        break;
-    case CONFIG_FOC_KC:
-        errCode = MAIN_SetVar(3, valuef);
-        break;
-    case CONFIG_MAIN_RAMP_SPEED:
-        errCode = MAIN_SetRampSpeed(valuef);
-        break;
-    case CONFIG_MAIN_SPEED_TO_FOC:
-        errCode = MAIN_SetSpeedToFOC(valuef);
-        break;
-    case CONFIG_MAIN_SWITCH_EPS:
-        errCode = MAIN_SetSwitchoverEpsilon(valuef);
-        break;
-    case CONFIG_THRT_MIN1:
-        errCode = throttle_set_min(1, valuef);
-        break;
-    case CONFIG_THRT_MAX1:
-        errCode = throttle_set_max(1, valuef);
-        break;
-    case CONFIG_THRT_HYST1:
-        errCode = throttle_set_hyst(1, valuef);
-        break;
-    case CONFIG_THRT_FILT1:
-        errCode = throttle_set_filt(1, valuef);
-        break;
-    case CONFIG_THRT_RISE1:
-        errCode = throttle_set_rise(1, valuef);
-        break;
-    case CONFIG_THRT_MIN2:
-        errCode = throttle_set_min(2, valuef);
-        break;
-    case CONFIG_THRT_MAX2:
-        errCode = throttle_set_max(2, valuef);
-        break;
-    case CONFIG_THRT_HYST2:
-        errCode = throttle_set_hyst(2, valuef);
-        break;
-    case CONFIG_THRT_FILT2:
-        errCode = throttle_set_filt(2, valuef);
-        break;
-    case CONFIG_THRT_RISE2:
-        errCode = throttle_set_rise(2, valuef);
-        break;
-    case CONFIG_LMT_VOLT_FAULT_MIN:
-        errCode = MAIN_SetLimit(Main_Limit_MinVoltFault, valuef);
-        break;
-    case CONFIG_LMT_VOLT_FAULT_MAX:
-        errCode = MAIN_SetLimit(Main_Limit_MaxVoltFault, valuef);
-        break;
-    case CONFIG_LMT_CUR_FAULT_MAX:
-        errCode = MAIN_SetLimit(Main_Limit_CurrentFault, valuef);
-        break;
-    case CONFIG_LMT_VOLT_SOFTCAP:
-        errCode = MAIN_SetLimit(Main_Limit_SoftVoltage, valuef);
-        break;
-    case CONFIG_LMT_VOLT_HARDCAP:
-        errCode = MAIN_SetLimit(Main_Limit_HardVoltage, valuef);
-        break;
-    case CONFIG_LMT_PHASE_CUR_MAX:
-        errCode = MAIN_SetLimit(Main_Limit_PhaseCurrent, valuef);
-        break;
-    case CONFIG_LMT_PHASE_REGEN_MAX:
-        errCode = MAIN_SetLimit(Main_Limit_PhaseRegenCurrent, valuef);
-        break;
-    case CONFIG_LMT_BATT_CUR_MAX:
-        errCode = MAIN_SetLimit(Main_Limit_BattRegenCurrent, valuef);
-        break;
-    case CONFIG_LMT_BATT_REGEN_MAX:
-        errCode = MAIN_SetLimit(Main_Limit_SoftVoltage, valuef);
-        break;
-    case CONFIG_LMT_FET_TEMP_SOFTCAP:
-        errCode = MAIN_SetLimit(Main_Limit_SoftFetTemp, valuef);
-        break;
-    case CONFIG_LMT_FET_TEMP_HARDCAP:
-        errCode = MAIN_SetLimit(Main_Limit_HardFetTemp, valuef);
-        break;
-    case CONFIG_LMT_MOTOR_TEMP_SOFTCAP:
-        errCode = MAIN_SetLimit(Main_Limit_SoftMotorTemp, valuef);
-        break;
-    case CONFIG_LMT_MOTOR_TEMP_HARDCAP:
-        errCode = MAIN_SetLimit(Main_Limit_HardMotorTemp, valuef);
-        break;
-    case CONFIG_MOTOR_HALL1:
-    case CONFIG_MOTOR_HALL2:
-    case CONFIG_MOTOR_HALL3:
-    case CONFIG_MOTOR_HALL4:
-    case CONFIG_MOTOR_HALL5:
-    case CONFIG_MOTOR_HALL6:
-        errCode = HallSensor_SetAngle(value_ID - CONFIG_MOTOR_HALL1 + 1, valuef);
-        break;
-    case CONFIG_MOTOR_GEAR_RATIO:
-        errCode = MAIN_SetGearRatio(valuef);
-        break;
-    case CONFIG_MOTOR_WHEEL_SIZE:
-        errCode = MAIN_SetWheelSize(valuef);
-        break;
-    case CONFIG_MOTOR_KV:
-        errCode = MAIN_SetMotorKv(valuef);
-        break;
+    // Then two to four bytes for value, depending on type
+    if (data_registry_write(var, &(pktdata[2])) == DATA_PACKET_SUCCESS) {
+        return DATA_COMMAND_SUCCESS;
     }
-    return errCode;
+    return DATA_COMMAND_FAIL;
 }
 
 uint16_t command_get_eeprom(uint8_t* pktdata, uint8_t* retval) {
     uint16_t value_ID = data_packet_extract_16b(pktdata);
-    int16_t retval16;
-    int32_t retval32;
-    float retvalf;
-    uint16_t errCode = DATA_PACKET_FAIL;
-
-    Data_Type type = command_get_datatype(value_ID);
-    switch(type) {
-    case Data_Type_None:
-    case Data_Type_Int8:
-        return DATA_PACKET_FAIL;
+
+    const Data_Reg_Entry* var = data_registry_find(value_ID);
+    if ((var == 0) || !(var->Flags & DATA_REG_EEPROM)) {
+        return DATA_COMMAND_FAIL;
+    }
+    switch (var->Type) {
     case Data_Type_Int16:
-        retval16 = EE_ReadInt16WithDefault(value_ID, 0);
-        data_packet_pack_16b(retval, retval16);
-        errCode = RESULT_IS_16B;
+        data_packet_pack_16b(retval, EE_ReadInt16WithDefault(value_ID, 0));
         break;
     case Data_Type_Int32:
-        retval32 = EE_ReadInt32WithDefault(value_ID, 0);
-        data_packet_pack_32b(retval, retval32);
-        errCode = RESULT_IS_32B;
+        data_packet_pack_32b(retval, EE_ReadInt32WithDefault(value_ID, 0));
         break;
     case Data_Type_Float:
-        retvalf = EE_ReadFloatWithDefault(value_ID, 0.0f);
-        data_packet_pack_float(retval, retvalf);
-        errCode = RESULT_IS_FLOAT;
+        data_packet_pack_float(retval, EE_ReadFloatWithDefault(value_ID, 0.0f));
         break;
+    default:
+        return DATA_COMMAND_FAIL;
     }
 
-    return errCode;
+    return command_result_code(var->Type);
 }
 
 uint16_t command_set_eeprom(uint8_t* pktdata) {
     uint16_t value_ID = data_packet_extract_16b(pktdata);
     pktdata += 2;
-    uint16_t errCode = DATA_PACKET_FAIL;
+    uint16_t status, commit;
 
-    Data_Type type = command_get_datatype(value_ID);
-    switch(type) {
-    case Data_Type_None:
-    case Data_Type_Int8:
-        return DATA_PACKET_FAIL;
-    case Data_Type_Int16:
-        if (EE_SaveInt16(value_ID, data_packet_extract_16b(pktdata))
-                == FLASH_COMPLETE) {
-            errCode = DATA_COMMAND_SUCCESS;
-        }
-        break;
-    case Data_Type_Int32:
-        if (EE_SaveInt32(value_ID, data_packet_extract_32b(pktdata))
-                == FLASH_COMPLETE) {
-            errCode = DATA_COMMAND_SUCCESS;
-        }
-        break;
-    case Data_Type_Float:
-        if (EE_SaveFloat(value_ID, data_packet_extract_float(pktdata))
-                == FLASH_COMPLETE) {
-            errCode = DATA_COMMAND_SUCCESS;
-        }
-        break;
+    const Data_Reg_Entry* var = data_registry_find(value_ID);
+    if ((var == 0) || !(var->Flags & DATA_REG_EEPROM)) {
+        return DATA_COMMAND_FAIL;
+    }
+    if (data_registry_check_range(var, pktdata) != DATA_PACKET_SUCCESS) {
+        return DATA_COMMAND_FAIL;
+    }
+    // Both halves of an I32 or float are committed together, along with
+    // the configuration record
+    EE_BeginBatch();
+    status = data_registry_save(var, pktdata);
+    if (status == FLASH_COMPLETE) {
+        status = config_blob_save();
     }
+    commit = EE_CommitBatch();
 
-    return errCode;
+    if ((status == FLASH_COMPLETE) && (commit == FLASH_COMPLETE)) {
+        return DATA_COMMAND_SUCCESS;
+    }
+    return DATA_COMMAND_FAIL;
+}
+
+/**
+ * @brief  Data Command: Get Variable List
+ *            Describes a page of the variable registry so the host can
+ *            discover which variables exist, their types and limits.
+ * @param  pktdata - Data field in the incoming packet, two bytes for the
+ *                   index of the first entry to describe.
+ * @param  retval - Output buffer, at least PACKET_MAX_LENGTH - PACKET_OVERHEAD_BYTES
+ *                  Packed as: total count (2), first index (2), number of
+ *                  entries (1), then DATA_REG_LIST_ENTRY_BYTES per entry.
+ * @retval Number of bytes placed in retval
+ */
+uint16_t command_get_variable_list(uint8_t* pktdata, uint8_t* retval) {
+    uint16_t first = data_packet_extract_16b(pktdata);
+    uint16_t total = data_registry_count();
+    uint16_t place = 5;
+    uint8_t count = 0;
+    const Data_Reg_Entry* var;
+
+    while ((count < GET_VARIABLE_LIST_MAX_ENTRIES)
+            && ((var = data_registry_entry(first + count)) != 0)) {
+        place += data_registry_describe(var, &(retval[place]));
+        count++;
+    }
+    data_packet_pack_16b(retval, total);
+    data_packet_pack_16b(&(retval[2]), first);
+    data_packet_pack_8b(&(retval[4]), count);
+    return place;
 }
 
 uint16_t command_enable_feature(uint8_t* pktdata) {
@@ -708,15 +419,24 @@ uint16_t command_run_routine(uint8_t* pktdata) {
         HallSensor_Load_Variables();
         adcLoadVariables();
         throttle_load_variables();
+        soc_load_variables();
+        // Then the whole record over the top, if there's a valid one
+        config_blob_load();
         errCode = DATA_COMMAND_SUCCESS;
         break;
     case ROUTINE_SAVE_ALL_EEPROM:
-        // Run all the saving functions
+        // Run all the saving functions. Only what changed is written, all
+        // in one go when the batch is committed.
+        EE_BeginBatch();
         MAIN_SaveVariables();
         HallSensor_Save_Variables();
         adcSaveVariables();
         throttle_save_variables();
-        errCode = DATA_COMMAND_SUCCESS;
+        soc_save_variables();
+        config_blob_save();
+        if (EE_CommitBatch() == FLASH_COMPLETE) {
+            errCode = DATA_COMMAND_SUCCESS;
+        }
         break;
     case ROUTINE_HALL_DETECT:
         // Single variable float is applied current
@@ -734,92 +454,226 @@ uint16_t command_run_routine(uint8_t* pktdata) {
         // Shouldn't return from this function
         MAIN_SoftReset(1);
         break;
+    case ROUTINE_CRC_BENCHMARK:
+        CRC32_Benchmark();
+        errCode = DATA_COMMAND_SUCCESS;
+        break;
+    case ROUTINE_TRIP_RESET:
+        trip_reset();
+        errCode = DATA_COMMAND_SUCCESS;
+        break;
     }
 
     return errCode;
 }
 
-static Data_Type command_get_datatype(uint16_t data_ID) {
-    Data_Type type = Data_Type_None;
-    switch(data_ID) {
-    // 8-bit integer values
-    case CONFIG_BMS_ISCONNECTED:
-        type = Data_Type_Int8;
-        break;
-    // 16-bit integer values
-    case CONFIG_MAIN_NUM_USB_OUTPUTS:
-    case CONFIG_MAIN_USB_SPEED:
-    case CONFIG_MAIN_USB_CHOICE_1:
-    case CONFIG_MAIN_USB_CHOICE_2:
-    case CONFIG_MAIN_USB_CHOICE_3:
-    case CONFIG_MAIN_USB_CHOICE_4:
-    case CONFIG_MAIN_USB_CHOICE_5:
-    case CONFIG_MAIN_USB_CHOICE_6:
-    case CONFIG_MAIN_USB_CHOICE_7:
-    case CONFIG_MAIN_USB_CHOICE_8:
-    case CONFIG_MAIN_USB_CHOICE_9:
-    case CONFIG_MAIN_USB_CHOICE_10:
-    case CONFIG_THRT_TYPE1:
-    case CONFIG_THRT_TYPE2:
-    case CONFIG_MOTOR_POLEPAIRS:
-    case CONFIG_BMS_NUMBATTS:
-        type = Data_Type_Int16;
-        break;
-    // 32 bit integer values
-    case CONFIG_FOC_PWM_FREQ:
-    case CONFIG_FOC_PWM_DEADTIME:
-    case CONFIG_MAIN_COUNTS_TO_FOC:
-    case CONFIG_BMS_GETSTATUS_N:
-        type = Data_Type_Int32;
-        break;
-    // 32 bit float values
-    case CONFIG_ADC_INV_TIA_GAIN:
-    case CONFIG_ADC_VBUS_RATIO:
-    case CONFIG_ADC_THERM_FIXED_R:
-    case CONFIG_ADC_THERM_R25:
-    case CONFIG_ADC_THERM_B:
-    case CONFIG_FOC_KP:
-    case CONFIG_FOC_KI:
-    case CONFIG_FOC_KD:
-    case CONFIG_FOC_KC:
-    case CONFIG_MAIN_RAMP_SPEED:
-    case CONFIG_MAIN_SPEED_TO_FOC:
-    case CONFIG_MAIN_SWITCH_EPS:
-    case CONFIG_THRT_MIN1:
-    case CONFIG_THRT_MAX1:
-    case CONFIG_THRT_HYST1:
-    case CONFIG_THRT_FILT1:
-    case CONFIG_THRT_RISE1:
-    case CONFIG_THRT_MIN2:
-    case CONFIG_THRT_MAX2:
-    case CONFIG_THRT_HYST2:
-    case CONFIG_THRT_FILT2:
-    case CONFIG_THRT_RISE2:
-    case CONFIG_LMT_VOLT_FAULT_MIN:
-    case CONFIG_LMT_VOLT_FAULT_MAX:
-    case CONFIG_LMT_CUR_FAULT_MAX:
-    case CONFIG_LMT_VOLT_SOFTCAP:
-    case CONFIG_LMT_VOLT_HARDCAP:
-    case CONFIG_LMT_PHASE_CUR_MAX:
-    case CONFIG_LMT_PHASE_REGEN_MAX:
-    case CONFIG_LMT_BATT_CUR_MAX:
-    case CONFIG_LMT_BATT_REGEN_MAX:
-    case CONFIG_LMT_FET_TEMP_SOFTCAP:
-    case CONFIG_LMT_FET_TEMP_HARDCAP:
-    case CONFIG_LMT_MOTOR_TEMP_SOFTCAP:
-    case CONFIG_LMT_MOTOR_TEMP_HARDCAP:
-    case CONFIG_MOTOR_HALL1:
-    case CONFIG_MOTOR_HALL2:
-    case CONFIG_MOTOR_HALL3:
-    case CONFIG_MOTOR_HALL4:
-    case CONFIG_MOTOR_HALL5:
-    case CONFIG_MOTOR_HALL6:
-    case CONFIG_MOTOR_GEAR_RATIO:
-    case CONFIG_MOTOR_WHEEL_SIZE:
-    case CONFIG_MOTOR_KV:
-    case CONFIG_BMS_GETBAT_N:
-        type = Data_Type_Float;
-        break;
+/**
+ * @brief  Data Command: Get Config Blob
+ *            Reads part of the newest valid configuration record (see
+ *            config_blob.h). The host asks from offset 0 until it has the
+ *            total length.
+ * @param  pktdata - Data field in the incoming packet, two bytes for the
+ *                   offset into the record.
+ * @param  retval - Output buffer, at least PACKET_MAX_LENGTH - PACKET_OVERHEAD_BYTES
+ *                  Packed as: total length (2), offset (2), then up to
+ *                  CONFIG_BLOB_GET_CHUNK bytes of the record.
+ * @retval Number of bytes placed in retval, 0 if there's no valid record
+ */
+uint16_t command_get_config_blob(uint8_t* pktdata, uint8_t* retval) {
+    uint16_t offset = data_packet_extract_16b(pktdata);
+    uint16_t total = config_blob_read(command_blob);
+    uint16_t count;
+
+    if ((total == 0) || (offset >= total)) {
+        return 0;
+    }
+    count = total - offset;
+    if (count > CONFIG_BLOB_GET_CHUNK) {
+        count = CONFIG_BLOB_GET_CHUNK;
+    }
+    data_packet_pack_16b(retval, total);
+    data_packet_pack_16b(&(retval[2]), offset);
+    memcpy(&(retval[4]), &(command_blob[offset]), count);
+    return count + 4;
+}
+
+/**
+ * @brief  Data Command: Set Config Blob
+ *            Takes part of a configuration record from the host: two bytes
+ *            for the offset, then up to CONFIG_BLOB_SET_CHUNK bytes. Parts
+ *            are sent in order starting from 0. Once the last one is in,
+ *            the record is checked and every value saved to EEPROM at once,
+ *            or none of them. Like SET_EEPROM, RAM is left alone until
+ *            ROUTINE_LOAD_ALL_EEPROM or a reset.
+ * @retval DATA_COMMAND_SUCCESS or DATA_COMMAND_FAIL
+ */
+uint16_t command_set_config_blob(uint8_t* pktdata, uint16_t datalen) {
+    if (datalen < 2) {
+        return DATA_COMMAND_FAIL;
+    }
+    if (config_blob_upload(data_packet_extract_16b(pktdata), &(pktdata[2]),
+            datalen - 2) == DATA_PACKET_SUCCESS) {
+        return DATA_COMMAND_SUCCESS;
+    }
+    return DATA_COMMAND_FAIL;
+}
+
+/**
+ * @brief  Data Command: Get Ram Batch
+ *            Reads many variables with a single request. The request is a
+ *            list of ID ranges, four bytes each: first ID, then last ID
+ *            (use the same ID twice for a single variable). Every registry
+ *            variable inside each range is returned in ID order.
+ * @param  pktdata - Data field in the incoming packet
+ * @param  datalen - Length of the data field
+ * @param  retval - Output buffer, at least PACKET_MAX_LENGTH - PACKET_OVERHEAD_BYTES
+ *                  Each item is packed as ID (2), status (1), then the value
+ *                  (1 to 4 bytes) only when the status is BATCH_STATUS_OK.
+ *                  If the response would overflow a packet it is cut short
+ *                  after the last whole item, the host can ask again from
+ *                  the next ID.
+ * @retval Number of bytes placed in retval
+ */
+uint16_t command_get_ram_batch(uint8_t* pktdata, uint16_t datalen,
+        uint8_t* retval) {
+    // Has to fit in a packet with either framing
+    const uint16_t maxlen = PACKET_MAX_LENGTH - PACKET_OVERHEAD_BYTES
+            - PACKET_COBS_OVERHEAD_BYTES;
+    uint16_t place = 0;
+    const Data_Reg_Entry* var;
+
+    for (uint16_t i = 0; (i + 4) <= datalen; i += 4) {
+        uint16_t first_ID = data_packet_extract_16b(&(pktdata[i]));
+        uint16_t last_ID = data_packet_extract_16b(&(pktdata[i + 2]));
+
+        if (first_ID == last_ID && data_registry_find(first_ID) == 0) {
+            // Single variable that doesn't exist, let the host know
+            if (place + 3 > maxlen) {
+                return place;
+            }
+            data_packet_pack_16b(&(retval[place]), first_ID);
+            retval[place + 2] = BATCH_STATUS_UNKNOWN_ID;
+            place += 3;
+            continue;
+        }
+        for (uint16_t index = data_registry_lower_bound(first_ID);
+                (var = data_registry_entry(index)) != 0 && var->ID <= last_ID;
+                index++) {
+            uint8_t size = data_packet_type_size(var->Type);
+            if (place + 3 + size > maxlen) {
+                return place;
+            }
+            data_packet_pack_16b(&(retval[place]), var->ID);
+            if (var->Flags & DATA_REG_INDEXED) {
+                retval[place + 2] = BATCH_STATUS_NEEDS_INDEX;
+                place += 3;
+            } else {
+                retval[place + 2] = BATCH_STATUS_OK;
+                place += 3;
+                place += data_registry_read(var, 0, &(retval[place]));
+            }
+        }
+    }
+    return place;
+}
+
+/**
+ * @brief  Data Command: Set Ram Batch
+ *            Sets many variables with a single request. The request is a
+ *            list of ID (2 bytes) and value (size depends on the variable
+ *            type) pairs. Processing stops at an unknown ID since the size
+ *            of its value can't be known.
+ * @param  pktdata - Data field in the incoming packet
+ * @param  datalen - Length of the data field
+ * @param  retval - Output buffer, three bytes per item: ID (2), status (1)
+ * @retval Number of bytes placed in retval
+ */
+uint16_t command_set_ram_batch(uint8_t* pktdata, uint16_t datalen,
+        uint8_t* retval) {
+    uint16_t place = 0;
+    uint16_t i = 0;
+    const Data_Reg_Entry* var;
+
+    while ((i + 2) <= datalen) {
+        uint16_t value_ID = data_packet_extract_16b(&(pktdata[i]));
+        i += 2;
+        data_packet_pack_16b(&(retval[place]), value_ID);
+
+        var = data_registry_find(value_ID);
+        if ((var == 0) || (i + data_packet_type_size(var->Type) > datalen)) {
+            retval[place + 2] = BATCH_STATUS_UNKNOWN_ID;
+            place += 3;
+            break;
+        }
+        if (var->Flags & DATA_REG_READONLY) {
+            retval[place + 2] = BATCH_STATUS_READ_ONLY;
+        } else if (data_registry_write(var, &(pktdata[i])) == DATA_PACKET_SUCCESS) {
+            retval[place + 2] = BATCH_STATUS_OK;
+        } else {
+            retval[place + 2] = BATCH_STATUS_REJECTED;
+        }
+        place += 3;
+        i += data_packet_type_size(var->Type);
+    }
+    return place;
+}
+
+/**
+ * @brief  Data Command: Telemetry Subscribe
+ *            Picks the variables streamed while serial data is turned on.
+ *            First byte is TELEMETRY_REPLACE or TELEMETRY_APPEND, followed
+ *            by six bytes per channel: ID (2), index (2, only used for
+ *            indexed variables), and decimation (2, sample every N PWM
+ *            cycles). Channels are numbered in the order they're added.
+ * @param  pktdata - Data field in the incoming packet
+ * @param  datalen - Length of the data field
+ * @retval DATA_COMMAND_SUCCESS if every channel was added
+ *         DATA_COMMAND_FAIL otherwise, and the channels are left as they were
+ */
+uint16_t command_telemetry_subscribe(uint8_t* pktdata, uint16_t datalen) {
+    uint16_t count;
+
+    if (datalen < 1) {
+        return DATA_COMMAND_FAIL;
+    }
+    // Check the whole list first, so it's taken all or nothing
+    count = (datalen - 1) / 6;
+    if (pktdata[0] != TELEMETRY_REPLACE) {
+        count += telemetry_num_channels();
+    }
+    if (count > TELEMETRY_MAX_CHANNELS) {
+        return DATA_COMMAND_FAIL;
+    }
+    for (uint16_t i = 1; (i + 6) <= datalen; i += 6) {
+        if (telemetry_check_channel(data_packet_extract_16b(&(pktdata[i])),
+                data_packet_extract_16b(&(pktdata[i + 4])))
+                != DATA_PACKET_SUCCESS) {
+            return DATA_COMMAND_FAIL;
+        }
+    }
+
+    if (pktdata[0] == TELEMETRY_REPLACE) {
+        telemetry_clear();
+    }
+    for (uint16_t i = 1; (i + 6) <= datalen; i += 6) {
+        telemetry_subscribe(data_packet_extract_16b(&(pktdata[i])),
+                data_packet_extract_16b(&(pktdata[i + 2])),
+                data_packet_extract_16b(&(pktdata[i + 4])));
+    }
+    return DATA_COMMAND_SUCCESS;
+}
+
+static uint16_t command_result_code(Data_Type type) {
+    switch (type) {
+    case Data_Type_Int8:
+        return RESULT_IS_8B;
+    case Data_Type_Int16:
+        return RESULT_IS_16B;
+    case Data_Type_Int32:
+        return RESULT_IS_32B;
+    case Data_Type_Float:
+        return RESULT_IS_FLOAT;
+    default:
+        return DATA_COMMAND_FAIL;
     }
-    return type;
 }
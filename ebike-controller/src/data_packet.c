@@ -44,10 +44,6 @@
 #include "periphconfig.h"
 #include "data_packet.h"
 
-// *** Global variables ***
-// Used for creating the local CRC for comparison
-uint8_t TempPacketArray[PACKET_OVERHEAD_BYTES + PACKET_MAX_DATA_LENGTH];
-
 /**
  * Packet types:
  * - From host to controller:
@@ -59,32 +55,53 @@ uint8_t TempPacketArray[PACKET_OVERHEAD_BYTES + PACKET_MAX_DATA_LENGTH];
  * -- 0x06 - Disable feature
  * -- 0x07 - Run routine
  * -- 0x08 - Stream data
+ * -- 0x09 - Get variable list
+ * -- 0x0A - Get several variables from RAM
+ * -- 0x0B - Set several variables in RAM
+ * -- 0x0C - Subscribe to telemetry
+ * -- 0x0D - Set framing mode for this link
+ * -- 0x0E - Set baud rate (HBD serial port only)
  * -- 0x11 - ACK
  * -- 0x12 - NACK
+ * -- 0x27 - Request dashboard data
+ * -- 0x28 - Subscribe to dashboard pushes (HBD serial port only)
  * - From controller to host:
  * -- 0x81 - Requested RAM data
  * -- 0x83 - Requested EEPROM data
  * -- 0x87 - Routine result
- * -- 0x88 - Stream data
+ * -- 0x88 - Stream data (telemetry frames)
+ * -- 0x89 - Variable list
+ * -- 0x8A - Requested batch of RAM data
+ * -- 0x8B - Batch set results
  * -- 0x91 - ACK
  * -- 0x92 - NACK
+ * -- 0xA7 - Dashboard data
+ * -- 0xA8 - Dashboard push (only the fields that changed)
  */
 
-uint32_t data_packet_recreate_crc(uint8_t PacketType, uint8_t* DataBuffer, uint16_t DataLength) {
-    uint32_t crc;
-    uint16_t place = 0;
-    TempPacketArray[place++] = PACKET_START_0;
-    TempPacketArray[place++] = PACKET_START_1;
-    TempPacketArray[place++] = PacketType;
-    TempPacketArray[place++] = PacketType ^ 0xFF; // All bits flipped
-    TempPacketArray[place++] = (uint8_t)((DataLength & 0xFF00) >> 8); // Hibyte
-    TempPacketArray[place++] = (uint8_t)(DataLength & 0x00FF); // Lobyte
-    for(uint16_t i = 0; i < DataLength; i++) {
-        TempPacketArray[place++] = DataBuffer[i];
-    }
-    crc = CRC32_Generate(TempPacketArray, DataLength + PACKET_NONCRC_OVHD_BYTES);
+static uint16_t data_packet_cobs_encode(uint8_t* buf, uint16_t len);
+static uint8_t data_packet_cobs_extract(Data_Packet_Type *pkt, uint8_t* buf,
+        uint16_t len, uint32_t now, uint16_t* used);
 
-    return crc;
+/**
+ * @brief  Data Packet Type Size
+ *            Number of bytes a value of the given type takes in a packet.
+ *            Shared with the host tools, which read telemetry with it.
+ * @param  type - Data_Type of the value
+ * @retval Size in bytes, zero for an unknown type
+ */
+uint8_t data_packet_type_size(Data_Type type) {
+    switch (type) {
+    case Data_Type_Int8:
+        return 1;
+    case Data_Type_Int16:
+        return 2;
+    case Data_Type_Int32:
+    case Data_Type_Float:
+        return 4;
+    default:
+        return 0;
+    }
 }
 
 /**
@@ -106,7 +123,10 @@ uint8_t data_packet_create(Data_Packet_Type* pkt, uint8_t type, uint8_t* data,
     uint32_t crc;
 
     // Fail out if the packet can't fit in the buffer
-    if (datalen + PACKET_OVERHEAD_BYTES > PACKET_MAX_LENGTH) {
+    if ((datalen + PACKET_OVERHEAD_BYTES > PACKET_MAX_LENGTH)
+            || ((pkt->Framing == DATA_PACKET_FRAMING_COBS)
+                    && (datalen + PACKET_OVERHEAD_BYTES
+                            + PACKET_COBS_OVERHEAD_BYTES > PACKET_MAX_LENGTH))) {
         pkt->TxReady = 0;
         return DATA_PACKET_FAIL;
     }
@@ -126,6 +146,10 @@ uint8_t data_packet_create(Data_Packet_Type* pkt, uint8_t type, uint8_t* data,
     pkt->TxBuffer[place++] = (uint8_t) ((crc & 0x00FF0000) >> 16);
     pkt->TxBuffer[place++] = (uint8_t) ((crc & 0x0000FF00) >> 8);
     pkt->TxBuffer[place++] = (uint8_t) (crc & 0x000000FF);
+    if (pkt->Framing == DATA_PACKET_FRAMING_COBS) {
+        place = data_packet_cobs_encode(pkt->TxBuffer, place);
+        pkt->TxBuffer[place++] = PACKET_COBS_DELIMITER;
+    }
     pkt->TxReady = 1;
     pkt->TxLength = place;
     return DATA_PACKET_SUCCESS;
@@ -133,31 +157,25 @@ uint8_t data_packet_create(Data_Packet_Type* pkt, uint8_t type, uint8_t* data,
 }
 
 /**
- * @brief  Data Packet Extract One Byte Method
- *         Decodes a data packet coming in from any data channel. Discovers
- *         the packet type, pulls out the packet data, and checks the CRC
- *         field for transmission errors.
- *         Processed one byte at a time using an internal state machine.
- * @param  pkt - pointer to the Data_Packet_Type which will hold the
- *               decoded packet
- * @param  new_byte - raw data byte coming in from any comm channel. Simply
- *                    pass in the incoming bytes one at a time, this function
- *                    takes care of keeping track of past bytes.
+ * @brief  Data Packet Step
+ *         The byte at a time state machine behind both extraction methods.
+ *         Timeouts are checked by the callers, once per call rather than
+ *         once per byte.
+ * @param  pkt - packet being received
+ * @param  buf - incoming bytes
+ * @param  len - number of bytes available, at least one
+ * @param  now - current tick, marks the start of a new packet
+ * @param  used - set to how many bytes were consumed. Usually one, but the
+ *                data field is taken in as large a piece as is available.
  * @retval DATA_PACKET_FAIL - no new packet found (yet!)
  *         DATA_PACKET_SUCCESS - the packet was valid and was decoded
  */
-uint8_t data_packet_extract_one_byte(Data_Packet_Type *pkt, uint8_t new_byte) {
+static uint8_t data_packet_step(Data_Packet_Type *pkt, uint8_t* buf,
+        uint16_t len, uint32_t now, uint16_t* used) {
     uint8_t retval = DATA_PACKET_FAIL;
+    uint8_t new_byte = buf[0];
 
-    // First check for timeout
-    if(pkt->State != DATA_COMM_IDLE) {
-        // Every other state can time out
-        if(GetTick() - pkt->TimerStart > DATA_PACKET_TIMEOUT_MS) {
-            // Reset back to beginning
-            pkt->State = DATA_COMM_IDLE;
-        }
-    }
-
+    *used = 1;
     // Now everything is determined based on the state
     switch (pkt->State) {
     case DATA_COMM_IDLE:
@@ -166,13 +184,22 @@ uint8_t data_packet_extract_one_byte(Data_Packet_Type *pkt, uint8_t new_byte) {
         if (new_byte == PACKET_START_0) {
             pkt->State = DATA_COMM_START_0;
             // Start timeout. Packet must be received fairly quickly or else comm is reset.
-            pkt->TimerStart = GetTick();
+            pkt->TimerStart = now;
+            // The CRC is built up as the bytes come in
+            CRC32_Start(&(pkt->RxCrc));
+            CRC32_Update(&(pkt->RxCrc), new_byte);
         }
         break;
     case DATA_COMM_START_0:
         // Must be second start byte, otherwise reset
         if (new_byte == PACKET_START_1) {
             pkt->State = DATA_COMM_START_1;
+            CRC32_Update(&(pkt->RxCrc), new_byte);
+        } else if (new_byte == PACKET_START_0) {
+            // Stray start byte just before a real one, start over from here
+            pkt->TimerStart = now;
+            CRC32_Start(&(pkt->RxCrc));
+            CRC32_Update(&(pkt->RxCrc), new_byte);
         } else {
             // Back to idle since we didn't get the expected sequence
             pkt->State = DATA_COMM_IDLE;
@@ -183,9 +210,11 @@ uint8_t data_packet_extract_one_byte(Data_Packet_Type *pkt, uint8_t new_byte) {
         // Next byte is packet type. Just read it, can't error check until next one
         pkt->PacketType = new_byte;
         pkt->State = DATA_COMM_PKT_TYPE;
+        CRC32_Update(&(pkt->RxCrc), new_byte);
         break;
     case DATA_COMM_PKT_TYPE:
         // This should be the inverted packet type. Now we can error check
+        CRC32_Update(&(pkt->RxCrc), new_byte);
         new_byte = new_byte^0xFF; // Invert this one
         if (new_byte != pkt->PacketType) {
             pkt->State = DATA_COMM_IDLE;
@@ -198,20 +227,35 @@ uint8_t data_packet_extract_one_byte(Data_Packet_Type *pkt, uint8_t new_byte) {
         // Ready to read the first byte of data length
         pkt->DataLength = ((uint16_t) new_byte) << 8;
         pkt->State = DATA_COMM_DATALEN_0;
+        CRC32_Update(&(pkt->RxCrc), new_byte);
         break;
     case DATA_COMM_DATALEN_0:
         // And the second byte
         pkt->DataLength += new_byte;
         pkt->DataBytesRead = 0;
-        pkt->State = DATA_COMM_DATALEN_1;
+        CRC32_Update(&(pkt->RxCrc), new_byte);
+        if (pkt->DataLength > PACKET_MAX_DATA_LENGTH) {
+            // Won't fit in the data buffer, drop the packet
+            pkt->State = DATA_COMM_IDLE;
+            pkt->FaultCode = INVALID_PACKET_LENGTH;
+        } else {
+            pkt->State = DATA_COMM_DATALEN_1;
+        }
         break;
     case DATA_COMM_DATALEN_1:
         // Now we got to keep track of how much data has been collected
         // Count to DataLen bytes, then shift in the 4 bytes of CRC-32
         // Using the packet's data buffer, we don't need to make our own.
         if (pkt->DataBytesRead < pkt->DataLength) {
-            pkt->Data[pkt->DataBytesRead++] =
-                    new_byte;
+            // Take as much of the data as we have in one go
+            uint16_t count = pkt->DataLength - pkt->DataBytesRead;
+            if (count > len) {
+                count = len;
+            }
+            memcpy(&(pkt->Data[pkt->DataBytesRead]), buf, count);
+            CRC32_UpdateBuffer(&(pkt->RxCrc), buf, count);
+            pkt->DataBytesRead += count;
+            *used = count;
         } else {
             // Now onto the CRC
             pkt->Remote_CRC_32 = ((uint32_t) new_byte) << 24;
@@ -229,10 +273,8 @@ uint8_t data_packet_extract_one_byte(Data_Packet_Type *pkt, uint8_t new_byte) {
     case DATA_COMM_CRC_2:
         // Finally at the end. If this CRC matches, we have a good packet.
         pkt->Remote_CRC_32 += ((uint32_t) new_byte);
-        // Calculate our own CRC
-        if (pkt->Remote_CRC_32
-                == data_packet_recreate_crc(pkt->PacketType,
-                        pkt->Data, pkt->DataLength)) {
+        // Our own CRC has been running since the start byte
+        if (pkt->Remote_CRC_32 == CRC32_Final(&(pkt->RxCrc))) {
             // Good packet!
             pkt->RxReady = 1;
             pkt->FaultCode = NO_FAULT;
@@ -247,6 +289,246 @@ uint8_t data_packet_extract_one_byte(Data_Packet_Type *pkt, uint8_t new_byte) {
     return retval;
 }
 
+/**
+ * @brief  Data Packet Extract One Byte Method
+ *         Decodes a data packet coming in from any data channel. Discovers
+ *         the packet type, pulls out the packet data, and checks the CRC
+ *         field for transmission errors.
+ *         Processed one byte at a time using an internal state machine.
+ * @param  pkt - pointer to the Data_Packet_Type which will hold the
+ *               decoded packet
+ * @param  new_byte - raw data byte coming in from any comm channel. Simply
+ *                    pass in the incoming bytes one at a time, this function
+ *                    takes care of keeping track of past bytes.
+ * @retval DATA_PACKET_FAIL - no new packet found (yet!)
+ *         DATA_PACKET_SUCCESS - the packet was valid and was decoded
+ */
+uint8_t data_packet_extract_one_byte(Data_Packet_Type *pkt, uint8_t new_byte) {
+    uint32_t now = GetTick();
+    uint16_t used;
+
+    if (pkt->Framing == DATA_PACKET_FRAMING_COBS) {
+        return data_packet_cobs_extract(pkt, &new_byte, 1, now, &used);
+    }
+
+    // First check for timeout
+    if(pkt->State != DATA_COMM_IDLE) {
+        // Every other state can time out
+        if(now - pkt->TimerStart > DATA_PACKET_TIMEOUT_MS) {
+            // Reset back to beginning
+            pkt->State = DATA_COMM_IDLE;
+        }
+    }
+    return data_packet_step(pkt, &new_byte, 1, now, &used);
+}
+
+/**
+ * @brief  Data Packet Extract Span Method
+ *         Same as the one byte method, but takes in a whole block of
+ *         received bytes. Whole packets inside the block are found and
+ *         checked in place: a memchr for the start byte, one CRC pass and
+ *         one copy of the data. Packets split across blocks fall back to
+ *         the state machine, which picks up where the last block left off.
+ *         Returns as soon as a packet is found so it can be handled before
+ *         the next one overwrites it. Call again with the rest of the block.
+ * @param  pkt - pointer to the Data_Packet_Type which will hold the
+ *               decoded packet
+ * @param  buf - received bytes
+ * @param  len - number of received bytes
+ * @param  used - set to how many bytes of the block were consumed
+ * @retval DATA_PACKET_FAIL - no new packet found (yet!)
+ *         DATA_PACKET_SUCCESS - the packet was valid and was decoded
+ */
+uint8_t data_packet_extract_span(Data_Packet_Type *pkt, uint8_t* buf,
+        uint16_t len, uint16_t* used) {
+    uint32_t now = GetTick();
+    uint16_t place = 0;
+    uint16_t step;
+    uint8_t retval = DATA_PACKET_FAIL;
+
+    if (pkt->Framing == DATA_PACKET_FRAMING_COBS) {
+        return data_packet_cobs_extract(pkt, buf, len, now, used);
+    }
+
+    if(pkt->State != DATA_COMM_IDLE) {
+        if(now - pkt->TimerStart > DATA_PACKET_TIMEOUT_MS) {
+            pkt->State = DATA_COMM_IDLE;
+        }
+    }
+
+    while ((place < len) && (retval == DATA_PACKET_FAIL)) {
+        if (pkt->State != DATA_COMM_IDLE) {
+            // Finishing a packet that started in an earlier block
+            retval = data_packet_step(pkt, &buf[place], len - place, now, &step);
+            place += step;
+            continue;
+        }
+
+        // Search forward to find SOP
+        uint8_t* sop = memchr(&buf[place], PACKET_START_0, len - place);
+        if (sop == 0) {
+            place = len;
+            break;
+        }
+        place = sop - buf;
+        uint16_t remaining = len - place;
+        if (remaining < PACKET_OVERHEAD_BYTES) {
+            // Can't be a whole packet, let the state machine hold on to it
+            retval = data_packet_step(pkt, &buf[place], remaining, now, &step);
+            place += step;
+            continue;
+        }
+
+        // Check the header in place
+        uint8_t packet_type = sop[2];
+        uint8_t npacket_type = sop[3] ^ 0xFF;
+        uint16_t data_length = data_packet_extract_16b(&sop[4]);
+        if (sop[1] != PACKET_START_1) {
+            pkt->FaultCode = NO_START_DETECTED;
+            place++;
+            continue;
+        }
+        if (npacket_type != packet_type) {
+            pkt->FaultCode = BAD_PACKET_TYPE;
+            place++;
+            continue;
+        }
+        if (data_length > PACKET_MAX_DATA_LENGTH) {
+            pkt->FaultCode = INVALID_PACKET_LENGTH;
+            place++;
+            continue;
+        }
+        if ((data_length + PACKET_OVERHEAD_BYTES) > remaining) {
+            // Split packet, rest comes in a later block
+            retval = data_packet_step(pkt, &buf[place], remaining, now, &step);
+            place += step;
+            continue;
+        }
+
+        // Whole packet is here
+        CRC32_Start(&(pkt->RxCrc));
+        CRC32_UpdateBuffer(&(pkt->RxCrc), sop,
+                data_length + PACKET_NONCRC_OVHD_BYTES);
+        pkt->Remote_CRC_32 = data_packet_extract_32b(
+                &sop[data_length + PACKET_NONCRC_OVHD_BYTES]);
+        if (pkt->Remote_CRC_32 != CRC32_Final(&(pkt->RxCrc))) {
+            // Could be a false start inside some other data, keep looking
+            // from the next byte
+            pkt->FaultCode = BAD_CRC;
+            place++;
+            continue;
+        }
+        pkt->PacketType = packet_type;
+        pkt->DataLength = data_length;
+        memcpy(pkt->Data, &sop[PACKET_NONCRC_OVHD_BYTES], data_length);
+        pkt->RxReady = 1;
+        pkt->FaultCode = NO_FAULT;
+        place += data_length + PACKET_OVERHEAD_BYTES;
+        retval = DATA_PACKET_SUCCESS;
+    }
+    *used = place;
+    return retval;
+}
+
+/**
+ * @brief  Data Packet COBS Encode
+ *         Encodes a finished packet in place. The packet is first moved up
+ *         by the number of code bytes that could be needed, then encoded
+ *         back down from the start of the buffer. The write position never
+ *         passes the read position so nothing is overwritten before use.
+ * @param  buf - packet to encode, must have room for the code bytes
+ * @param  len - length of the packet
+ * @retval Length of the encoded packet, without the delimiter
+ */
+static uint16_t data_packet_cobs_encode(uint8_t* buf, uint16_t len) {
+    uint16_t shift = (len / 254) + 1;
+    uint8_t* src = &buf[shift];
+    uint16_t code_place = 0;
+    uint16_t place = 1;
+    uint8_t code = 1;
+
+    memmove(src, buf, len);
+    for (uint16_t i = 0; i < len; i++) {
+        uint8_t this_byte = src[i];
+        if (this_byte == 0) {
+            buf[code_place] = code;
+            code_place = place++;
+            code = 1;
+        } else {
+            buf[place++] = this_byte;
+            code++;
+            if (code == 0xFF) {
+                // Longest block, no zero implied after it
+                buf[code_place] = code;
+                code_place = place++;
+                code = 1;
+            }
+        }
+    }
+    buf[code_place] = code;
+    return place;
+}
+
+/**
+ * @brief  Data Packet COBS Extract
+ *         Undoes the COBS encoding on the fly and feeds the packet bytes to
+ *         the usual state machine. A delimiter always ends the frame, so a
+ *         corrupted frame costs only itself.
+ * @retval DATA_PACKET_FAIL - no new packet found (yet!)
+ *         DATA_PACKET_SUCCESS - the packet was valid and was decoded
+ */
+static uint8_t data_packet_cobs_extract(Data_Packet_Type *pkt, uint8_t* buf,
+        uint16_t len, uint32_t now, uint16_t* used) {
+    uint16_t place = 0;
+    uint16_t step;
+    uint8_t zero = 0;
+    uint8_t retval = DATA_PACKET_FAIL;
+
+    if(pkt->State != DATA_COMM_IDLE) {
+        if(now - pkt->TimerStart > DATA_PACKET_TIMEOUT_MS) {
+            pkt->State = DATA_COMM_IDLE;
+        }
+    }
+
+    while ((place < len) && (retval == DATA_PACKET_FAIL)) {
+        if (buf[place] == PACKET_COBS_DELIMITER) {
+            // End of frame, whatever happened inside it
+            if (pkt->State != DATA_COMM_IDLE) {
+                pkt->FaultCode = INVALID_PACKET_LENGTH;
+                pkt->State = DATA_COMM_IDLE;
+            }
+            pkt->CobsCode = 0;
+            pkt->CobsLeft = 0;
+            place++;
+        } else if (pkt->CobsLeft == 0) {
+            // Code byte. The block before it ended in a zero, unless it was
+            // the first block or a full one.
+            if ((pkt->CobsCode != 0) && (pkt->CobsCode != 0xFF)) {
+                retval = data_packet_step(pkt, &zero, 1, now, &step);
+            }
+            pkt->CobsCode = buf[place];
+            pkt->CobsLeft = buf[place] - 1;
+            place++;
+        } else {
+            // Data bytes, up to the end of the block or the next delimiter
+            uint16_t count = len - place;
+            if (count > pkt->CobsLeft) {
+                count = pkt->CobsLeft;
+            }
+            uint8_t* delim = memchr(&buf[place], PACKET_COBS_DELIMITER, count);
+            if (delim != 0) {
+                // Short frame, the delimiter is handled on the next pass
+                count = delim - &buf[place];
+            }
+            retval = data_packet_step(pkt, &buf[place], count, now, &step);
+            place += step;
+            pkt->CobsLeft -= step;
+        }
+    }
+    *used = place;
+    return retval;
+}
+
 #if 0
 /**
  * @brief  Data Packet Extract
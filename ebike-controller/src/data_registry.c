@@ -0,0 +1,296 @@
+/******************************************************************************
+ * Filename: data_registry.c
+ * Description: Lookups in the table of variables (data_registry_table.c)
+ *              and packing of their values for the data communication
+ *              channels. Lookups are done by binary search on the variable
+ *              ID, so the table must stay sorted.
+ *
+ ******************************************************************************
+
+ Copyright (c) 2019 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#include "main.h"
+#include "data_packet.h"
+#include "data_registry.h"
+
+/**
+ * @brief  Data Registry Find
+ *            Looks up a variable in the registry by its ID
+ * @param  id - CONFIG_xxx value of the variable
+ * @retval Pointer to the registry entry, or null if the ID isn't known
+ */
+const Data_Reg_Entry* data_registry_find(uint16_t id) {
+    uint16_t index = data_registry_lower_bound(id);
+    if ((index < data_registry_length) && (data_registry[index].ID == id)) {
+        return &data_registry[index];
+    }
+    return 0;
+}
+
+/**
+ * @brief  Data Registry Lower Bound
+ *            Finds the first entry with an ID at or above the requested one
+ * @param  id - CONFIG_xxx value to search for
+ * @retval Table index of that entry, or data_registry_count() if none
+ */
+uint16_t data_registry_lower_bound(uint16_t id) {
+    uint16_t lo = 0;
+    uint16_t hi = data_registry_length;
+    while (lo < hi) {
+        uint16_t mid = (lo + hi) >> 1;
+        if (data_registry[mid].ID < id) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+uint16_t data_registry_count(void) {
+    return data_registry_length;
+}
+
+const Data_Reg_Entry* data_registry_entry(uint16_t index) {
+    if (index >= data_registry_length) {
+        return 0;
+    }
+    return &data_registry[index];
+}
+
+/**
+ * @brief  Data Registry Read
+ *            Calls the getter of a variable and packs the result
+ * @param  var - registry entry to read
+ * @param  index - extra index for DATA_REG_INDEXED variables, ignored otherwise
+ * @param  dest - where to pack the value (big endian, size depends on type)
+ * @retval Number of bytes packed into dest, zero on failure
+ */
+uint8_t data_registry_read(const Data_Reg_Entry* var, uint16_t index,
+        uint8_t* dest) {
+    uint32_t value = 0;
+    float valuef = 0.0f;
+
+    switch (var->Access) {
+    case Data_Access_U8:
+        value = var->Get.u8();
+        break;
+    case Data_Access_U8_Arg:
+        value = var->Get.u8_arg(var->Arg);
+        break;
+    case Data_Access_U16:
+        value = var->Get.u16();
+        break;
+    case Data_Access_I32:
+        value = (uint32_t) var->Get.i32();
+        break;
+    case Data_Access_U32:
+        value = var->Get.u32();
+        break;
+    case Data_Access_U32_Index:
+        value = var->Get.u32_index(index);
+        break;
+    case Data_Access_Float:
+        valuef = var->Get.f();
+        break;
+    case Data_Access_Float_Arg:
+        valuef = var->Get.f_arg(var->Arg);
+        break;
+    case Data_Access_Float_Index:
+        valuef = var->Get.f_index(index);
+        break;
+    }
+
+    switch (var->Type) {
+    case Data_Type_Int8:
+        data_packet_pack_8b(dest, (uint8_t) value);
+        break;
+    case Data_Type_Int16:
+        data_packet_pack_16b(dest, (uint16_t) value);
+        break;
+    case Data_Type_Int32:
+        data_packet_pack_32b(dest, value);
+        break;
+    case Data_Type_Float:
+        data_packet_pack_float(dest, valuef);
+        break;
+    default:
+        return 0;
+    }
+    return data_packet_type_size(var->Type);
+}
+
+/**
+ * @brief  Data Registry Check Range
+ *            Verifies a packed value is within the limits of the variable
+ * @param  var - registry entry
+ * @param  src - packed value (big endian, size depends on type)
+ * @retval DATA_PACKET_SUCCESS if in range (or not range checked)
+ *         DATA_PACKET_FAIL otherwise
+ */
+uint8_t data_registry_check_range(const Data_Reg_Entry* var, uint8_t* src) {
+    float valuef;
+
+    if (!(var->Flags & DATA_REG_RANGE)) {
+        return DATA_PACKET_SUCCESS;
+    }
+    switch (var->Type) {
+    case Data_Type_Int8:
+        valuef = (float) data_packet_extract_8b(src);
+        break;
+    case Data_Type_Int16:
+        valuef = (float) data_packet_extract_16b(src);
+        break;
+    case Data_Type_Int32:
+        valuef = (float) ((int32_t) data_packet_extract_32b(src));
+        break;
+    case Data_Type_Float:
+        valuef = data_packet_extract_float(src);
+        break;
+    default:
+        return DATA_PACKET_FAIL;
+    }
+    // Written so that NaN fails the check
+    if ((valuef >= var->Min) && (valuef <= var->Max)) {
+        return DATA_PACKET_SUCCESS;
+    }
+    return DATA_PACKET_FAIL;
+}
+
+/**
+ * @brief  Data Registry Write
+ *            Range checks a packed value, then passes it to the setter
+ * @param  var - registry entry to write
+ * @param  src - packed value (big endian, size depends on type)
+ * @retval DATA_PACKET_SUCCESS or DATA_PACKET_FAIL
+ */
+uint8_t data_registry_write(const Data_Reg_Entry* var, uint8_t* src) {
+    uint32_t value = 0;
+    float valuef = 0.0f;
+
+    if (var->Flags & DATA_REG_READONLY) {
+        return DATA_PACKET_FAIL;
+    }
+    if (data_registry_check_range(var, src) != DATA_PACKET_SUCCESS) {
+        return DATA_PACKET_FAIL;
+    }
+
+    switch (var->Type) {
+    case Data_Type_Int8:
+        value = data_packet_extract_8b(src);
+        break;
+    case Data_Type_Int16:
+        value = data_packet_extract_16b(src);
+        break;
+    case Data_Type_Int32:
+        value = data_packet_extract_32b(src);
+        break;
+    case Data_Type_Float:
+        valuef = data_packet_extract_float(src);
+        break;
+    default:
+        return DATA_PACKET_FAIL;
+    }
+
+    switch (var->Access) {
+    case Data_Access_U8:
+        return var->Set.u8((uint8_t) value);
+    case Data_Access_U8_Arg:
+        return var->Set.u8_arg(var->Arg, (uint8_t) value);
+    case Data_Access_U16:
+        return var->Set.u16((uint16_t) value);
+    case Data_Access_I32:
+        return var->Set.i32((int32_t) value);
+    case Data_Access_U32:
+        return var->Set.u32(value);
+    case Data_Access_Float:
+        return var->Set.f(valuef);
+    case Data_Access_Float_Arg:
+        return var->Set.f_arg(var->Arg, valuef);
+    default:
+        break;
+    }
+    return DATA_PACKET_FAIL;
+}
+
+/**
+ * @brief  Data Registry Save
+ *            Writes a packed value to the variable's EEPROM record. The
+ *            value isn't applied to RAM or range checked here.
+ * @param  var - registry entry, must have DATA_REG_EEPROM
+ * @param  src - packed value (big endian, size depends on type)
+ * @retval FLASH_COMPLETE or the EEPROM emulation error
+ */
+uint16_t data_registry_save(const Data_Reg_Entry* var, uint8_t* src) {
+    if (!(var->Flags & DATA_REG_EEPROM)) {
+        return FLASH_ERROR_OPERATION;
+    }
+    switch (var->Type) {
+    case Data_Type_Int16:
+        return EE_SaveInt16(var->ID, data_packet_extract_16b(src));
+    case Data_Type_Int32:
+        return EE_SaveInt32(var->ID, data_packet_extract_32b(src));
+    case Data_Type_Float:
+        return EE_SaveFloat(var->ID, data_packet_extract_float(src));
+    default:
+        break;
+    }
+    return FLASH_ERROR_OPERATION;
+}
+
+/**
+ * @brief  Data Registry Describe
+ *            Packs the description of a variable for the host:
+ *            ID (2 bytes), type (1), flags (1), min (float), max (float)
+ * @param  var - registry entry
+ * @param  dest - buffer with at least DATA_REG_LIST_ENTRY_BYTES of space
+ * @retval Number of bytes packed
+ */
+uint8_t data_registry_describe(const Data_Reg_Entry* var, uint8_t* dest) {
+    data_packet_pack_16b(dest, var->ID);
+    data_packet_pack_8b(&dest[2], (uint8_t) var->Type);
+    data_packet_pack_8b(&dest[3], var->Flags);
+    data_packet_pack_float(&dest[4], var->Min);
+    data_packet_pack_float(&dest[8], var->Max);
+    return DATA_REG_LIST_ENTRY_BYTES;
+}
+
+/**
+ * @brief  Data Registry Fill EEPROM Table
+ *            Generates the virtual address table used by the EEPROM
+ *            emulation. Each variable takes two slots (low and high half).
+ * @param  addrTab - table with room for TOTAL_EE_VARS * 2 addresses, the
+ *                    configuration record slots follow (see config_blob.h)
+ * @retval Number of variables added to the table
+ */
+uint16_t data_registry_fill_ee_table(uint16_t* addrTab) {
+    uint16_t numvars = 0;
+    for (uint16_t i = 0; i < data_registry_length; i++) {
+        if ((data_registry[i].Flags & DATA_REG_EEPROM)
+                && (numvars < TOTAL_EE_VARS)) {
+            addrTab[numvars * 2] = data_registry[i].ID | EE_LOBYTE_FLAG;
+            addrTab[numvars * 2 + 1] = data_registry[i].ID | EE_HIBYTE_FLAG;
+            numvars++;
+        }
+    }
+    return numvars;
+}
@@ -0,0 +1,372 @@
+/******************************************************************************
+ * Filename: data_registry_table.c
+ * Description: Table of every variable that can be accessed over the data
+ *              communication channels. Lookups are done by binary search on
+ *              the variable ID, so the table must stay sorted.
+ *
+ ******************************************************************************
+
+ Copyright (c) 2019 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#include "main.h"
+#include "data_registry.h"
+
+static float registry_get_limit(uint8_t lmt);
+static uint8_t registry_set_limit(uint8_t lmt, float new_lmt);
+
+// Shorthand for the flags used on the configuration variables
+#define EE          (DATA_REG_EEPROM)
+#define EE_RNG      (DATA_REG_EEPROM | DATA_REG_RANGE)
+#define RO          (DATA_REG_READONLY)
+#define RO_IDX      (DATA_REG_READONLY | DATA_REG_INDEXED)
+
+/**
+ * Every variable accessible by GET/SET_RAM and GET/SET_EEPROM.
+ * !! Must be sorted by ID !!
+ */
+const Data_Reg_Entry data_registry[] = {
+    // ADC
+    { CONFIG_ADC_INV_TIA_GAIN, Data_Type_Float, EE_RNG, Data_Access_Float, 0,
+        { .f = adcGetInverseTIAGain }, { .f = adcSetInverseTIAGain }, 0.1f, 1000.0f },
+    { CONFIG_ADC_VBUS_RATIO, Data_Type_Float, EE_RNG, Data_Access_Float, 0,
+        { .f = adcGetVbusRatio }, { .f = adcSetVbusRatio }, 1.0f, 1000.0f },
+    { CONFIG_ADC_THERM_FIXED_R, Data_Type_Float, EE_RNG, Data_Access_Float, 0,
+        { .f = adcGetThermFixedR }, { .f = adcSetThermFixedR }, 1.0f, 1000000.0f },
+    { CONFIG_ADC_THERM_R25, Data_Type_Float, EE_RNG, Data_Access_Float, 0,
+        { .f = adcGetThermR25 }, { .f = adcSetThermR25 }, 1.0f, 1000000.0f },
+    { CONFIG_ADC_THERM_B, Data_Type_Float, EE_RNG, Data_Access_Float, 0,
+        { .f = adcGetThermBeta }, { .f = adcSetThermBeta }, 1.0f, 100000.0f },
+    // FOC
+    { CONFIG_FOC_KP, Data_Type_Float, EE, Data_Access_Float_Arg, 0,
+        { .f_arg = MAIN_GetVar }, { .f_arg = MAIN_SetVar }, 0.0f, 0.0f },
+    { CONFIG_FOC_KI, Data_Type_Float, EE, Data_Access_Float_Arg, 1,
+        { .f_arg = MAIN_GetVar }, { .f_arg = MAIN_SetVar }, 0.0f, 0.0f },
+    { CONFIG_FOC_KD, Data_Type_Float, EE, Data_Access_Float_Arg, 2,
+        { .f_arg = MAIN_GetVar }, { .f_arg = MAIN_SetVar }, 0.0f, 0.0f },
+    { CONFIG_FOC_KC, Data_Type_Float, EE, Data_Access_Float_Arg, 3,
+        { .f_arg = MAIN_GetVar }, { .f_arg = MAIN_SetVar }, 0.0f, 0.0f },
+    { CONFIG_FOC_PWM_FREQ, Data_Type_Int32, EE_RNG, Data_Access_I32, 0,
+        { .i32 = MAIN_GetFreq }, { .i32 = MAIN_SetFreq }, PWM_MIN_FREQ, PWM_MAX_FREQ },
+    { CONFIG_FOC_PWM_DEADTIME, Data_Type_Int32, EE_RNG, Data_Access_I32, 0,
+        { .i32 = MAIN_GetDeadTime }, { .i32 = MAIN_SetDeadTime }, 0, DT_RANGE4_MAX },
+    // MAIN
+    { CONFIG_MAIN_RAMP_SPEED, Data_Type_Float, EE_RNG, Data_Access_Float, 0,
+        { .f = MAIN_GetRampSpeed }, { .f = MAIN_SetRampSpeed }, MIN_RAMP_SPEED, MAX_RAMP_SPEED },
+    { CONFIG_MAIN_COUNTS_TO_FOC, Data_Type_Int32, EE, Data_Access_U32, 0,
+        { .u32 = MAIN_GetCountsToFOC }, { .u32 = MAIN_SetCountsToFOC }, 0.0f, 0.0f },
+    { CONFIG_MAIN_SPEED_TO_FOC, Data_Type_Float, EE, Data_Access_Float, 0,
+        { .f = MAIN_GetSpeedToFOC }, { .f = MAIN_SetSpeedToFOC }, 0.0f, 0.0f },
+    { CONFIG_MAIN_SWITCH_EPS, Data_Type_Float, EE_RNG, Data_Access_Float, 0,
+        { .f = MAIN_GetSwitchoverEpsilon }, { .f = MAIN_SetSwitchoverEpsilon }, 0.0f, 1.0f },
+    { CONFIG_MAIN_NUM_USB_OUTPUTS, Data_Type_Int16, EE_RNG, Data_Access_U8, 0,
+        { .u8 = MAIN_GetNumUSBDebugOutputs }, { .u8 = MAIN_SetNumUSBDebugOutputs }, 0, MAX_USB_OUTPUTS },
+    { CONFIG_MAIN_USB_SPEED, Data_Type_Int16, EE_RNG, Data_Access_U8, 0,
+        { .u8 = MAIN_GetUSBDebugSpeed }, { .u8 = MAIN_SetUSBDebugSpeed }, 0, (MAX_USB_SPEED_CHOICES - 1) },
+    { CONFIG_MAIN_USB_CHOICE_1, Data_Type_Int16, EE_RNG, Data_Access_U8_Arg, 0,
+        { .u8_arg = MAIN_GetUSBDebugOutput }, { .u8_arg = MAIN_SetUSBDebugOutput }, 0, MAX_USB_VALS },
+    { CONFIG_MAIN_USB_CHOICE_2, Data_Type_Int16, EE_RNG, Data_Access_U8_Arg, 1,
+        { .u8_arg = MAIN_GetUSBDebugOutput }, { .u8_arg = MAIN_SetUSBDebugOutput }, 0, MAX_USB_VALS },
+    { CONFIG_MAIN_USB_CHOICE_3, Data_Type_Int16, EE_RNG, Data_Access_U8_Arg, 2,
+        { .u8_arg = MAIN_GetUSBDebugOutput }, { .u8_arg = MAIN_SetUSBDebugOutput }, 0, MAX_USB_VALS },
+    { CONFIG_MAIN_USB_CHOICE_4, Data_Type_Int16, EE_RNG, Data_Access_U8_Arg, 3,
+        { .u8_arg = MAIN_GetUSBDebugOutput }, { .u8_arg = MAIN_SetUSBDebugOutput }, 0, MAX_USB_VALS },
+    { CONFIG_MAIN_USB_CHOICE_5, Data_Type_Int16, EE_RNG, Data_Access_U8_Arg, 4,
+        { .u8_arg = MAIN_GetUSBDebugOutput }, { .u8_arg = MAIN_SetUSBDebugOutput }, 0, MAX_USB_VALS },
+    { CONFIG_MAIN_USB_CHOICE_6, Data_Type_Int16, EE_RNG, Data_Access_U8_Arg, 5,
+        { .u8_arg = MAIN_GetUSBDebugOutput }, { .u8_arg = MAIN_SetUSBDebugOutput }, 0, MAX_USB_VALS },
+    { CONFIG_MAIN_USB_CHOICE_7, Data_Type_Int16, EE_RNG, Data_Access_U8_Arg, 6,
+        { .u8_arg = MAIN_GetUSBDebugOutput }, { .u8_arg = MAIN_SetUSBDebugOutput }, 0, MAX_USB_VALS },
+    { CONFIG_MAIN_USB_CHOICE_8, Data_Type_Int16, EE_RNG, Data_Access_U8_Arg, 7,
+        { .u8_arg = MAIN_GetUSBDebugOutput }, { .u8_arg = MAIN_SetUSBDebugOutput }, 0, MAX_USB_VALS },
+    { CONFIG_MAIN_USB_CHOICE_9, Data_Type_Int16, EE_RNG, Data_Access_U8_Arg, 8,
+        { .u8_arg = MAIN_GetUSBDebugOutput }, { .u8_arg = MAIN_SetUSBDebugOutput }, 0, MAX_USB_VALS },
+    { CONFIG_MAIN_USB_CHOICE_10, Data_Type_Int16, EE_RNG, Data_Access_U8_Arg, 9,
+        { .u8_arg = MAIN_GetUSBDebugOutput }, { .u8_arg = MAIN_SetUSBDebugOutput }, 0, MAX_USB_VALS },
+    // THRT
+    { CONFIG_THRT_TYPE1, Data_Type_Int16, EE_RNG, Data_Access_U8_Arg, 1,
+        { .u8_arg = throttle_get_type }, { .u8_arg = throttle_set_type }, THROTTLE_TYPE_NONE, THROTTLE_TYPE_PAS },
+    { CONFIG_THRT_MIN1, Data_Type_Float, EE_RNG, Data_Access_Float_Arg, 1,
+        { .f_arg = throttle_get_min }, { .f_arg = throttle_set_min }, 0.0f, 3.3f },
+    { CONFIG_THRT_MAX1, Data_Type_Float, EE_RNG, Data_Access_Float_Arg, 1,
+        { .f_arg = throttle_get_max }, { .f_arg = throttle_set_max }, 0.0f, 3.3f },
+    { CONFIG_THRT_HYST1, Data_Type_Float, EE_RNG, Data_Access_Float_Arg, 1,
+        { .f_arg = throttle_get_hyst }, { .f_arg = throttle_set_hyst }, THROTTLE_HYST_MIN, THROTTLE_HYST_MAX },
+    { CONFIG_THRT_FILT1, Data_Type_Float, EE_RNG, Data_Access_Float_Arg, 1,
+        { .f_arg = throttle_get_filt }, { .f_arg = throttle_set_filt }, THROTTLE_FILT_MIN, THROTTLE_FILT_MAX },
+    { CONFIG_THRT_RISE1, Data_Type_Float, EE_RNG, Data_Access_Float_Arg, 1,
+        { .f_arg = throttle_get_rise }, { .f_arg = throttle_set_rise }, THROTTLE_RISE_MIN, THROTTLE_RISE_MAX },
+    { CONFIG_THRT_TYPE2, Data_Type_Int16, EE_RNG, Data_Access_U8_Arg, 2,
+        { .u8_arg = throttle_get_type }, { .u8_arg = throttle_set_type }, THROTTLE_TYPE_NONE, THROTTLE_TYPE_PAS },
+    { CONFIG_THRT_MIN2, Data_Type_Float, EE_RNG, Data_Access_Float_Arg, 2,
+        { .f_arg = throttle_get_min }, { .f_arg = throttle_set_min }, 0.0f, 3.3f },
+    { CONFIG_THRT_MAX2, Data_Type_Float, EE_RNG, Data_Access_Float_Arg, 2,
+        { .f_arg = throttle_get_max }, { .f_arg = throttle_set_max }, 0.0f, 3.3f },
+    { CONFIG_THRT_HYST2, Data_Type_Float, EE_RNG, Data_Access_Float_Arg, 2,
+        { .f_arg = throttle_get_hyst }, { .f_arg = throttle_set_hyst }, THROTTLE_HYST_MIN, THROTTLE_HYST_MAX },
+    { CONFIG_THRT_FILT2, Data_Type_Float, EE_RNG, Data_Access_Float_Arg, 2,
+        { .f_arg = throttle_get_filt }, { .f_arg = throttle_set_filt }, THROTTLE_FILT_MIN, THROTTLE_FILT_MAX },
+    { CONFIG_THRT_RISE2, Data_Type_Float, EE_RNG, Data_Access_Float_Arg, 2,
+        { .f_arg = throttle_get_rise }, { .f_arg = throttle_set_rise }, THROTTLE_RISE_MIN, THROTTLE_RISE_MAX },
+    // LMT
+    { CONFIG_LMT_VOLT_FAULT_MIN, Data_Type_Float, EE_RNG, Data_Access_Float_Arg, Main_Limit_MinVoltFault,
+        { .f_arg = registry_get_limit }, { .f_arg = registry_set_limit }, 0.0f, 100.0f },
+    { CONFIG_LMT_VOLT_FAULT_MAX, Data_Type_Float, EE_RNG, Data_Access_Float_Arg, Main_Limit_MaxVoltFault,
+        { .f_arg = registry_get_limit }, { .f_arg = registry_set_limit }, 0.0f, 100.0f },
+    { CONFIG_LMT_CUR_FAULT_MAX, Data_Type_Float, EE_RNG, Data_Access_Float_Arg, Main_Limit_CurrentFault,
+        { .f_arg = registry_get_limit }, { .f_arg = registry_set_limit }, 0.0f, 100.0f },
+    { CONFIG_LMT_VOLT_SOFTCAP, Data_Type_Float, EE_RNG, Data_Access_Float_Arg, Main_Limit_SoftVoltage,
+        { .f_arg = registry_get_limit }, { .f_arg = registry_set_limit }, 0.0f, 100.0f },
+    { CONFIG_LMT_VOLT_HARDCAP, Data_Type_Float, EE_RNG, Data_Access_Float_Arg, Main_Limit_HardVoltage,
+        { .f_arg = registry_get_limit }, { .f_arg = registry_set_limit }, 0.0f, 100.0f },
+    { CONFIG_LMT_PHASE_CUR_MAX, Data_Type_Float, EE_RNG, Data_Access_Float_Arg, Main_Limit_PhaseCurrent,
+        { .f_arg = registry_get_limit }, { .f_arg = registry_set_limit }, 0.1f, 100.0f },
+    { CONFIG_LMT_PHASE_REGEN_MAX, Data_Type_Float, EE_RNG, Data_Access_Float_Arg, Main_Limit_PhaseRegenCurrent,
+        { .f_arg = registry_get_limit }, { .f_arg = registry_set_limit }, 0.0f, 100.0f },
+    { CONFIG_LMT_BATT_CUR_MAX, Data_Type_Float, EE_RNG, Data_Access_Float_Arg, Main_Limit_BattCurrent,
+        { .f_arg = registry_get_limit }, { .f_arg = registry_set_limit }, 0.0f, 100.0f },
+    { CONFIG_LMT_BATT_REGEN_MAX, Data_Type_Float, EE_RNG, Data_Access_Float_Arg, Main_Limit_BattRegenCurrent,
+        { .f_arg = registry_get_limit }, { .f_arg = registry_set_limit }, 0.0f, 100.0f },
+    { CONFIG_LMT_FET_TEMP_SOFTCAP, Data_Type_Float, EE_RNG, Data_Access_Float_Arg, Main_Limit_SoftFetTemp,
+        { .f_arg = registry_get_limit }, { .f_arg = registry_set_limit }, 0.0f, 150.0f },
+    { CONFIG_LMT_FET_TEMP_HARDCAP, Data_Type_Float, EE_RNG, Data_Access_Float_Arg, Main_Limit_HardFetTemp,
+        { .f_arg = registry_get_limit }, { .f_arg = registry_set_limit }, 0.0f, 150.0f },
+    { CONFIG_LMT_MOTOR_TEMP_SOFTCAP, Data_Type_Float, EE_RNG, Data_Access_Float_Arg, Main_Limit_SoftMotorTemp,
+        { .f_arg = registry_get_limit }, { .f_arg = registry_set_limit }, 0.0f, 200.0f },
+    { CONFIG_LMT_MOTOR_TEMP_HARDCAP, Data_Type_Float, EE_RNG, Data_Access_Float_Arg, Main_Limit_HardMotorTemp,
+        { .f_arg = registry_get_limit }, { .f_arg = registry_set_limit }, 0.0f, 200.0f },
+    { CONFIG_LMT_CELL_SOFTCAP, Data_Type_Float, EE_RNG, Data_Access_Float_Arg, Main_Limit_SoftCell,
+        { .f_arg = registry_get_limit }, { .f_arg = registry_set_limit }, 0.0f, 5.0f },
+    { CONFIG_LMT_CELL_HARDCAP, Data_Type_Float, EE_RNG, Data_Access_Float_Arg, Main_Limit_HardCell,
+        { .f_arg = registry_get_limit }, { .f_arg = registry_set_limit }, 0.0f, 5.0f },
+    { CONFIG_LMT_CELL_REGEN_SOFTCAP, Data_Type_Float, EE_RNG, Data_Access_Float_Arg, Main_Limit_SoftCellRegen,
+        { .f_arg = registry_get_limit }, { .f_arg = registry_set_limit }, 0.0f, 5.0f },
+    { CONFIG_LMT_CELL_REGEN_HARDCAP, Data_Type_Float, EE_RNG, Data_Access_Float_Arg, Main_Limit_HardCellRegen,
+        { .f_arg = registry_get_limit }, { .f_arg = registry_set_limit }, 0.0f, 5.0f },
+    { CONFIG_LMT_CELL_RESISTANCE, Data_Type_Float, EE_RNG, Data_Access_Float_Arg, Main_Limit_CellResistance,
+        { .f_arg = registry_get_limit }, { .f_arg = registry_set_limit }, 0.0f, 1.0f },
+    // MOTOR
+    { CONFIG_MOTOR_HALL1, Data_Type_Float, EE_RNG, Data_Access_Float_Arg, 1,
+        { .f_arg = HallSensor_GetAngle }, { .f_arg = HallSensor_SetAngle }, 0.0f, 1.0f },
+    { CONFIG_MOTOR_HALL2, Data_Type_Float, EE_RNG, Data_Access_Float_Arg, 2,
+        { .f_arg = HallSensor_GetAngle }, { .f_arg = HallSensor_SetAngle }, 0.0f, 1.0f },
+    { CONFIG_MOTOR_HALL3, Data_Type_Float, EE_RNG, Data_Access_Float_Arg, 3,
+        { .f_arg = HallSensor_GetAngle }, { .f_arg = HallSensor_SetAngle }, 0.0f, 1.0f },
+    { CONFIG_MOTOR_HALL4, Data_Type_Float, EE_RNG, Data_Access_Float_Arg, 4,
+        { .f_arg = HallSensor_GetAngle }, { .f_arg = HallSensor_SetAngle }, 0.0f, 1.0f },
+    { CONFIG_MOTOR_HALL5, Data_Type_Float, EE_RNG, Data_Access_Float_Arg, 5,
+        { .f_arg = HallSensor_GetAngle }, { .f_arg = HallSensor_SetAngle }, 0.0f, 1.0f },
+    { CONFIG_MOTOR_HALL6, Data_Type_Float, EE_RNG, Data_Access_Float_Arg, 6,
+        { .f_arg = HallSensor_GetAngle }, { .f_arg = HallSensor_SetAngle }, 0.0f, 1.0f },
+    { CONFIG_MOTOR_POLEPAIRS, Data_Type_Int16, EE_RNG, Data_Access_U16, 0,
+        { .u16 = MAIN_GetPolePairs }, { .u16 = MAIN_SetPolePairs }, 1, 100 },
+    { CONFIG_MOTOR_GEAR_RATIO, Data_Type_Float, EE_RNG, Data_Access_Float, 0,
+        { .f = MAIN_GetGearRatio }, { .f = MAIN_SetGearRatio }, 0.01f, 100.0f },
+    { CONFIG_MOTOR_WHEEL_SIZE, Data_Type_Float, EE_RNG, Data_Access_Float, 0,
+        { .f = MAIN_GetWheelSize }, { .f = MAIN_SetWheelSize }, 1.0f, 5000.0f },
+    { CONFIG_MOTOR_KV, Data_Type_Float, EE_RNG, Data_Access_Float, 0,
+        { .f = MAIN_GetMotorKv }, { .f = MAIN_SetMotorKv }, 0.0f, 1000.0f },
+    // BMS
+    { CONFIG_BMS_ISCONNECTED, Data_Type_Int8, RO, Data_Access_U8, 0,
+        { .u8 = BMS_Is_Connected }, { .u8 = 0 }, 0.0f, 0.0f },
+    { CONFIG_BMS_NUMBATTS, Data_Type_Int16, RO, Data_Access_U16, 0,
+        { .u16 = BMS_Get_Num_Batts }, { .u8 = 0 }, 0.0f, 0.0f },
+    { CONFIG_BMS_GETBAT_N, Data_Type_Float, RO_IDX, Data_Access_Float_Index, 0,
+        { .f_index = BMS_Get_Batt_Voltage }, { .u8 = 0 }, 0.0f, 0.0f },
+    { CONFIG_BMS_GETSTATUS_N, Data_Type_Int32, RO_IDX, Data_Access_U32_Index, 0,
+        { .u32_index = BMS_Get_Batt_Status }, { .u8 = 0 }, 0.0f, 0.0f },
+    { CONFIG_BMS_REFRESH_MS, Data_Type_Int32, RO, Data_Access_U32, 0,
+        { .u32 = BMS_Get_Refresh_Time }, { .u8 = 0 }, 0.0f, 0.0f },
+    { CONFIG_BMS_MIN_CELL, Data_Type_Float, RO, Data_Access_Float, 0,
+        { .f = BMS_Get_Min_Cell_Voltage }, { .u8 = 0 }, 0.0f, 0.0f },
+    { CONFIG_BMS_MAX_CELL, Data_Type_Float, RO, Data_Access_Float, 0,
+        { .f = BMS_Get_Max_Cell_Voltage }, { .u8 = 0 }, 0.0f, 0.0f },
+    { CONFIG_BMS_AVG_CELL, Data_Type_Float, RO, Data_Access_Float, 0,
+        { .f = BMS_Get_Avg_Cell_Voltage }, { .u8 = 0 }, 0.0f, 0.0f },
+    { CONFIG_BMS_MIN_CELL_LOADED, Data_Type_Float, RO, Data_Access_Float, 0,
+        { .f = MAIN_GetCellMinLoaded }, { .u8 = 0 }, 0.0f, 0.0f },
+    { CONFIG_BMS_MAX_CELL_LOADED, Data_Type_Float, RO, Data_Access_Float, 0,
+        { .f = MAIN_GetCellMaxLoaded }, { .u8 = 0 }, 0.0f, 0.0f },
+    // LIVE
+    { CONFIG_LIVE_IA, Data_Type_Float, RO, Data_Access_Float_Arg, 0,
+        { .f_arg = MAIN_GetLiveValue }, { .u8 = 0 }, 0.0f, 0.0f },
+    { CONFIG_LIVE_IB, Data_Type_Float, RO, Data_Access_Float_Arg, 1,
+        { .f_arg = MAIN_GetLiveValue }, { .u8 = 0 }, 0.0f, 0.0f },
+    { CONFIG_LIVE_IC, Data_Type_Float, RO, Data_Access_Float_Arg, 2,
+        { .f_arg = MAIN_GetLiveValue }, { .u8 = 0 }, 0.0f, 0.0f },
+    { CONFIG_LIVE_TA, Data_Type_Float, RO, Data_Access_Float_Arg, 3,
+        { .f_arg = MAIN_GetLiveValue }, { .u8 = 0 }, 0.0f, 0.0f },
+    { CONFIG_LIVE_TB, Data_Type_Float, RO, Data_Access_Float_Arg, 4,
+        { .f_arg = MAIN_GetLiveValue }, { .u8 = 0 }, 0.0f, 0.0f },
+    { CONFIG_LIVE_TC, Data_Type_Float, RO, Data_Access_Float_Arg, 5,
+        { .f_arg = MAIN_GetLiveValue }, { .u8 = 0 }, 0.0f, 0.0f },
+    { CONFIG_LIVE_THROTTLE, Data_Type_Float, RO, Data_Access_Float_Arg, 6,
+        { .f_arg = MAIN_GetLiveValue }, { .u8 = 0 }, 0.0f, 0.0f },
+    { CONFIG_LIVE_RAMP_ANGLE, Data_Type_Float, RO, Data_Access_Float_Arg, 7,
+        { .f_arg = MAIN_GetLiveValue }, { .u8 = 0 }, 0.0f, 0.0f },
+    { CONFIG_LIVE_ROTOR_ANGLE, Data_Type_Float, RO, Data_Access_Float_Arg, 8,
+        { .f_arg = MAIN_GetLiveValue }, { .u8 = 0 }, 0.0f, 0.0f },
+    { CONFIG_LIVE_HALL_SPEED, Data_Type_Float, RO, Data_Access_Float_Arg, 9,
+        { .f_arg = MAIN_GetLiveValue }, { .u8 = 0 }, 0.0f, 0.0f },
+    { CONFIG_LIVE_VBUS, Data_Type_Float, RO, Data_Access_Float_Arg, 10,
+        { .f_arg = MAIN_GetLiveValue }, { .u8 = 0 }, 0.0f, 0.0f },
+    { CONFIG_LIVE_ID, Data_Type_Float, RO, Data_Access_Float_Arg, 11,
+        { .f_arg = MAIN_GetLiveValue }, { .u8 = 0 }, 0.0f, 0.0f },
+    { CONFIG_LIVE_IQ, Data_Type_Float, RO, Data_Access_Float_Arg, 12,
+        { .f_arg = MAIN_GetLiveValue }, { .u8 = 0 }, 0.0f, 0.0f },
+    { CONFIG_LIVE_TD, Data_Type_Float, RO, Data_Access_Float_Arg, 13,
+        { .f_arg = MAIN_GetLiveValue }, { .u8 = 0 }, 0.0f, 0.0f },
+    { CONFIG_LIVE_TQ, Data_Type_Float, RO, Data_Access_Float_Arg, 14,
+        { .f_arg = MAIN_GetLiveValue }, { .u8 = 0 }, 0.0f, 0.0f },
+    { CONFIG_LIVE_ERROR_CODE, Data_Type_Float, RO, Data_Access_Float_Arg, 15,
+        { .f_arg = MAIN_GetLiveValue }, { .u8 = 0 }, 0.0f, 0.0f },
+    { CONFIG_LIVE_FET_TEMP, Data_Type_Float, RO, Data_Access_Float_Arg, 16,
+        { .f_arg = MAIN_GetLiveValue }, { .u8 = 0 }, 0.0f, 0.0f },
+    { CONFIG_LIVE_HALL_STATE, Data_Type_Float, RO, Data_Access_Float_Arg, 17,
+        { .f_arg = MAIN_GetLiveValue }, { .u8 = 0 }, 0.0f, 0.0f },
+    { CONFIG_LIVE_TESTING, Data_Type_Float, RO, Data_Access_Float_Arg, 18,
+        { .f_arg = MAIN_GetLiveValue }, { .u8 = 0 }, 0.0f, 0.0f },
+    // Telemetry statistics
+    { CONFIG_TLM_FRAMES_SENT, Data_Type_Int32, RO, Data_Access_U32, 0,
+        { .u32 = telemetry_get_frames_sent }, { .u8 = 0 }, 0.0f, 0.0f },
+    { CONFIG_TLM_RECORDS_DROPPED, Data_Type_Int32, RO, Data_Access_U32, 0,
+        { .u32 = telemetry_get_records_dropped }, { .u8 = 0 }, 0.0f, 0.0f },
+    { CONFIG_TLM_OVERRUNS, Data_Type_Int32, RO, Data_Access_U32, 0,
+        { .u32 = telemetry_get_overruns }, { .u8 = 0 }, 0.0f, 0.0f },
+    { CONFIG_TLM_USB_STALLS, Data_Type_Int32, RO, Data_Access_U32, 0,
+        { .u32 = telemetry_get_usb_stalls }, { .u8 = 0 }, 0.0f, 0.0f },
+    // Diagnostics
+    { CONFIG_DIAG_CRC_HW_RATE, Data_Type_Float, RO, Data_Access_Float, 0,
+        { .f = CRC32_GetHardwareRate }, { .u8 = 0 }, 0.0f, 0.0f },
+    { CONFIG_DIAG_CRC_SW_RATE, Data_Type_Float, RO, Data_Access_Float, 0,
+        { .f = CRC32_GetSoftwareRate }, { .u8 = 0 }, 0.0f, 0.0f },
+    { CONFIG_DIAG_HBD_BAUD, Data_Type_Int32, RO, Data_Access_U32, 0,
+        { .u32 = HBD_Get_Baud }, { .u8 = 0 }, 0.0f, 0.0f },
+    { CONFIG_DIAG_HBD_FALLBACKS, Data_Type_Int32, RO, Data_Access_U32, 0,
+        { .u32 = HBD_Get_Baud_Fallbacks }, { .u8 = 0 }, 0.0f, 0.0f },
+    { CONFIG_DIAG_DASH_FRAMES, Data_Type_Int32, RO, Data_Access_U32, 0,
+        { .u32 = dashboard_get_frames_sent }, { .u8 = 0 }, 0.0f, 0.0f },
+    { CONFIG_DIAG_DASH_SKIPPED, Data_Type_Int32, RO, Data_Access_U32, 0,
+        { .u32 = dashboard_get_fields_skipped }, { .u8 = 0 }, 0.0f, 0.0f },
+    { CONFIG_DIAG_EE_INIT_US, Data_Type_Float, RO, Data_Access_Float, 0,
+        { .f = EE_GetInitTime }, { .u8 = 0 }, 0.0f, 0.0f },
+    { CONFIG_DIAG_EE_READ_US, Data_Type_Float, RO, Data_Access_Float, 0,
+        { .f = EE_GetReadTime }, { .u8 = 0 }, 0.0f, 0.0f },
+    { CONFIG_DIAG_EE_READS, Data_Type_Int32, RO, Data_Access_U32, 0,
+        { .u32 = EE_GetReadCount }, { .u8 = 0 }, 0.0f, 0.0f },
+    { CONFIG_DIAG_EE_WRITES, Data_Type_Int32, RO, Data_Access_U32, 0,
+        { .u32 = EE_GetWriteCount }, { .u8 = 0 }, 0.0f, 0.0f },
+    { CONFIG_DIAG_EE_SKIPPED, Data_Type_Int32, RO, Data_Access_U32, 0,
+        { .u32 = EE_GetSkipCount }, { .u8 = 0 }, 0.0f, 0.0f },
+    { CONFIG_DIAG_EE_ERASES, Data_Type_Int32, RO, Data_Access_U32, 0,
+        { .u32 = EE_GetEraseCount }, { .u8 = 0 }, 0.0f, 0.0f },
+    { CONFIG_DIAG_EE_FREE, Data_Type_Int32, RO, Data_Access_U32, 0,
+        { .u32 = EE_GetFreeRecords }, { .u8 = 0 }, 0.0f, 0.0f },
+    { CONFIG_DIAG_EE_QUEUED, Data_Type_Int32, RO, Data_Access_U32, 0,
+        { .u32 = EE_GetQueued }, { .u8 = 0 }, 0.0f, 0.0f },
+    { CONFIG_DIAG_EE_ERASE_US, Data_Type_Float, RO, Data_Access_Float, 0,
+        { .f = EE_GetEraseTime }, { .u8 = 0 }, 0.0f, 0.0f },
+    { CONFIG_DIAG_CFG_SEQ, Data_Type_Int32, RO, Data_Access_U32, 0,
+        { .u32 = config_blob_get_sequence }, { .u8 = 0 }, 0.0f, 0.0f },
+    { CONFIG_DIAG_TASK_LATENCY_US, Data_Type_Float, RO_IDX, Data_Access_Float_Index, 0,
+        { .f_index = sched_get_latency }, { .u8 = 0 }, 0.0f, 0.0f },
+    { CONFIG_DIAG_TASK_RUN_US, Data_Type_Float, RO_IDX, Data_Access_Float_Index, 0,
+        { .f_index = sched_get_run_time }, { .u8 = 0 }, 0.0f, 0.0f },
+    { CONFIG_DIAG_TASK_OVERRUNS, Data_Type_Int32, RO_IDX, Data_Access_U32_Index, 0,
+        { .u32_index = sched_get_overruns }, { .u8 = 0 }, 0.0f, 0.0f },
+    { CONFIG_DIAG_TASK_MISSES, Data_Type_Int32, RO_IDX, Data_Access_U32_Index, 0,
+        { .u32_index = sched_get_deadline_misses }, { .u8 = 0 }, 0.0f, 0.0f },
+    { CONFIG_DIAG_MIDRATE_OVERRUNS, Data_Type_Int32, RO, Data_Access_U32, 0,
+        { .u32 = MAIN_GetMidRateOverruns }, { .u8 = 0 }, 0.0f, 0.0f },
+    // Battery
+    { CONFIG_BATT_SERIES_CELLS, Data_Type_Int16, EE_RNG, Data_Access_U16, 0,
+        { .u16 = soc_get_series_cells }, { .u16 = soc_set_series_cells }, 1, 255 },
+    { CONFIG_BATT_RATED_AH, Data_Type_Float, EE_RNG, Data_Access_Float, 0,
+        { .f = soc_get_rated_ah }, { .f = soc_set_rated_ah }, 0.1f, 1000.0f },
+    { CONFIG_BATT_LEARNED_AH, Data_Type_Float, EE_RNG, Data_Access_Float, 0,
+        { .f = soc_get_learned_ah }, { .f = soc_set_learned_ah }, 0.0f, 1000.0f },
+    { CONFIG_BATT_WH_PER_KM, Data_Type_Float, EE_RNG, Data_Access_Float, 0,
+        { .f = soc_get_wh_per_km }, { .f = soc_set_wh_per_km }, SOC_CONSUMPTION_MIN, 200.0f },
+    { CONFIG_BATT_SOC, Data_Type_Float, EE_RNG, Data_Access_Float, 0,
+        { .f = soc_get_percent }, { .f = soc_set_percent }, -1.0f, 100.0f },
+    { CONFIG_BATT_WH_LEFT, Data_Type_Float, RO, Data_Access_Float, 0,
+        { .f = soc_get_wh_left }, { .u8 = 0 }, 0.0f, 0.0f },
+    { CONFIG_BATT_RANGE_KM, Data_Type_Float, RO, Data_Access_Float, 0,
+        { .f = soc_get_range_km }, { .u8 = 0 }, 0.0f, 0.0f },
+    { CONFIG_BATT_OCV_ANCHORS, Data_Type_Int32, RO, Data_Access_U32, 0,
+        { .u32 = soc_get_anchors }, { .u8 = 0 }, 0.0f, 0.0f },
+    { CONFIG_BATT_MODEL_VOC, Data_Type_Float, RO, Data_Access_Float, 0,
+        { .f = batt_model_get_voc }, { .u8 = 0 }, 0.0f, 0.0f },
+    { CONFIG_BATT_MODEL_R, Data_Type_Float, RO, Data_Access_Float, 0,
+        { .f = batt_model_get_resistance }, { .u8 = 0 }, 0.0f, 0.0f },
+    { CONFIG_BATT_MODEL_VALID, Data_Type_Int8, RO, Data_Access_U8, 0,
+        { .u8 = batt_model_valid }, { .u8 = 0 }, 0.0f, 0.0f },
+    { CONFIG_BATT_SAG_VOLTS, Data_Type_Float, RO, Data_Access_Float, 0,
+        { .f = MAIN_GetSagVoltage }, { .u8 = 0 }, 0.0f, 0.0f },
+    // Trip
+    { CONFIG_TRIP_WH_OUT, Data_Type_Float, RO, Data_Access_Float_Arg, Trip_Wh_Out,
+        { .f_arg = trip_get_value }, { .u8 = 0 }, 0.0f, 0.0f },
+    { CONFIG_TRIP_WH_REGEN, Data_Type_Float, RO, Data_Access_Float_Arg, Trip_Wh_Regen,
+        { .f_arg = trip_get_value }, { .u8 = 0 }, 0.0f, 0.0f },
+    { CONFIG_TRIP_KM, Data_Type_Float, RO, Data_Access_Float_Arg, Trip_Km,
+        { .f_arg = trip_get_value }, { .u8 = 0 }, 0.0f, 0.0f },
+    { CONFIG_TRIP_WH_PER_KM, Data_Type_Float, RO, Data_Access_Float_Arg, Trip_Wh_Per_Km,
+        { .f_arg = trip_get_value }, { .u8 = 0 }, 0.0f, 0.0f },
+    { CONFIG_TRIP_PEAK_WATTS, Data_Type_Float, RO, Data_Access_Float_Arg, Trip_Peak_Watts,
+        { .f_arg = trip_get_value }, { .u8 = 0 }, 0.0f, 0.0f },
+    { CONFIG_TRIP_PEAK_AMPS, Data_Type_Float, RO, Data_Access_Float_Arg, Trip_Peak_Amps,
+        { .f_arg = trip_get_value }, { .u8 = 0 }, 0.0f, 0.0f },
+    { CONFIG_TRIP_PEAK_KPH, Data_Type_Float, RO, Data_Access_Float_Arg, Trip_Peak_Kph,
+        { .f_arg = trip_get_value }, { .u8 = 0 }, 0.0f, 0.0f },
+    { CONFIG_TRIP_HOURS, Data_Type_Float, RO, Data_Access_Float_Arg, Trip_Hours,
+        { .f_arg = trip_get_value }, { .u8 = 0 }, 0.0f, 0.0f },
+    { CONFIG_TRIP_LIFE_WH_OUT, Data_Type_Float, RO, Data_Access_Float_Arg, Trip_Lifetime + Trip_Wh_Out,
+        { .f_arg = trip_get_value }, { .u8 = 0 }, 0.0f, 0.0f },
+    { CONFIG_TRIP_LIFE_WH_REGEN, Data_Type_Float, RO, Data_Access_Float_Arg, Trip_Lifetime + Trip_Wh_Regen,
+        { .f_arg = trip_get_value }, { .u8 = 0 }, 0.0f, 0.0f },
+    { CONFIG_TRIP_LIFE_KM, Data_Type_Float, RO, Data_Access_Float_Arg, Trip_Lifetime + Trip_Km,
+        { .f_arg = trip_get_value }, { .u8 = 0 }, 0.0f, 0.0f },
+    { CONFIG_TRIP_LIFE_WH_PER_KM, Data_Type_Float, RO, Data_Access_Float_Arg, Trip_Lifetime + Trip_Wh_Per_Km,
+        { .f_arg = trip_get_value }, { .u8 = 0 }, 0.0f, 0.0f },
+    { CONFIG_TRIP_LIFE_PEAK_WATTS, Data_Type_Float, RO, Data_Access_Float_Arg, Trip_Lifetime + Trip_Peak_Watts,
+        { .f_arg = trip_get_value }, { .u8 = 0 }, 0.0f, 0.0f },
+    { CONFIG_TRIP_LIFE_PEAK_AMPS, Data_Type_Float, RO, Data_Access_Float_Arg, Trip_Lifetime + Trip_Peak_Amps,
+        { .f_arg = trip_get_value }, { .u8 = 0 }, 0.0f, 0.0f },
+    { CONFIG_TRIP_LIFE_PEAK_KPH, Data_Type_Float, RO, Data_Access_Float_Arg, Trip_Lifetime + Trip_Peak_Kph,
+        { .f_arg = trip_get_value }, { .u8 = 0 }, 0.0f, 0.0f },
+    { CONFIG_TRIP_LIFE_HOURS, Data_Type_Float, RO, Data_Access_Float_Arg, Trip_Lifetime + Trip_Hours,
+        { .f_arg = trip_get_value }, { .u8 = 0 }, 0.0f, 0.0f },
+    { CONFIG_TRIP_WINDOW_WH_PER_KM, Data_Type_Float, RO, Data_Access_Float_Arg, Trip_Window_Wh_Per_Km,
+        { .f_arg = trip_get_value }, { .u8 = 0 }, 0.0f, 0.0f },
+    { CONFIG_TRIP_RANGE_KM, Data_Type_Float, RO, Data_Access_Float_Arg, Trip_Range_Km,
+        { .f_arg = trip_get_value }, { .u8 = 0 }, 0.0f, 0.0f },
+};
+
+const uint16_t data_registry_length =
+        sizeof(data_registry) / sizeof(data_registry[0]);
+
+static float registry_get_limit(uint8_t lmt) {
+    return MAIN_GetLimit((Main_Limit_Type) lmt);
+}
+
+static uint8_t registry_set_limit(uint8_t lmt, float new_lmt) {
+    return MAIN_SetLimit((Main_Limit_Type) lmt, new_lmt);
+}
@@ -7,6 +7,11 @@
  *              performed when a page becomes completely full. The most recent
  *              saved value for each variable is transferred to the alternate
  *              storage page, and the alternate page is marked as active.
+ *
+ *              Erasing the old page stalls the CPU for the whole sector
+ *              erase, so it waits for EE_Service to be called from the main
+ *              loop at a time that's safe. Until then new records go to the
+ *              alternate page, or wait in RAM if that fills up too.
  ******************************************************************************
 
  Copyright (c) 2019 David Miller
@@ -31,12 +36,27 @@
  */
 
 /* Includes ------------------------------------------------------------------*/
+#include <string.h>
 #include "eeprom_emulation.h"
 #include "project_parameters.h"
 #include "wdt.h"
 
 /* Private typedef -----------------------------------------------------------*/
 /* Private define ------------------------------------------------------------*/
+/* The last value of each virtual address is kept in RAM, so reads don't have
+ to search the flash. Virtual addresses are found in EE_VirtAddVarTab
+ through an open addressing hash table that's kept under half full. */
+#define EE_SHADOW_BITS        (10)
+#define EE_SHADOW_SLOTS       (1 << EE_SHADOW_BITS)
+#define EE_SHADOW_NONE        ((uint16_t)0xFFFF)
+/* Fibonacci hashing of the 16 bit virtual address */
+#define EE_SHADOW_HASH(a)     ((uint16_t)(((a) * (uint32_t)40503) & 0xFFFF) \
+                                >> (16 - EE_SHADOW_BITS))
+
+#if (TOTAL_EE_ADDRESSES > (EE_SHADOW_SLOTS/2))
+#error "Too many EEPROM variables for the RAM shadow"
+#endif
+
 /* Private macro -------------------------------------------------------------*/
 /* Private variables ---------------------------------------------------------*/
 
@@ -46,6 +66,23 @@ uint16_t DataVar = 0;
 /* Virtual address defined by the user: 0xFFFF value is prohibited */
 uint16_t* EE_VirtAddVarTab;
 
+/* RAM shadow of the valid page, indexed like EE_VirtAddVarTab */
+uint16_t EE_ShadowData[TOTAL_EE_ADDRESSES];
+uint8_t EE_ShadowFound[TOTAL_EE_ADDRESSES];
+uint8_t EE_ShadowDirty[TOTAL_EE_ADDRESSES]; /* Changed in a batch or queued, not yet in flash */
+uint16_t EE_ShadowSlots[EE_SHADOW_SLOTS];
+uint8_t EE_ShadowReady = 0;
+
+/* Batch of writes (see EE_BeginBatch) */
+uint8_t EE_BatchDepth = 0;
+uint8_t EE_BatchTorn = 0; /* Valid page ends in a batch that was cut short */
+
+/* The old page of a page transfer is still to be erased (see EE_Service) */
+uint8_t EE_ErasePending = 0;
+
+/* Time spent starting up and reading, and flash writes */
+EE_Stats_Type EE_Stats;
+
 /* Private function prototypes -----------------------------------------------*/
 /* Private functions ---------------------------------------------------------*/
 
@@ -65,42 +102,19 @@ static FLASH_Status EE_Format(void);
 static uint16_t EE_FindValidPage(uint8_t Operation);
 static uint16_t EE_VerifyPageFullWriteVariable(uint16_t VirtAddress,
         uint16_t Data);
-static uint16_t EE_PageTransfer(uint16_t VirtAddress, uint16_t Data);
-
-void EE_Config_Addr_Table(uint16_t* addrTab) {
-    uint32_t tabptr = 0;
-
-    // Add ADC variables
-    for (uint32_t i = 0; i < (CONFIG_ADC_NUMVARS); i++) {
-        addrTab[tabptr++] = (CONFIG_ADC_PREFIX + i) | EE_LOBYTE_FLAG;
-        addrTab[tabptr++] = (CONFIG_ADC_PREFIX + i) | EE_HIBYTE_FLAG;
-    }
-    // Add FOC variables
-    for (uint32_t i = 0; i < (CONFIG_FOC_NUMVARS); i++) {
-        addrTab[tabptr++] = (CONFIG_FOC_PREFIX + i) | EE_LOBYTE_FLAG;
-        addrTab[tabptr++] = (CONFIG_FOC_PREFIX + i) | EE_HIBYTE_FLAG;
-    }
-    // Add MAIN variables
-    for (uint32_t i = 0; i < (CONFIG_MAIN_NUMVARS); i++) {
-        addrTab[tabptr++] = (CONFIG_MAIN_PREFIX + i) | EE_LOBYTE_FLAG;
-        addrTab[tabptr++] = (CONFIG_MAIN_PREFIX + i) | EE_HIBYTE_FLAG;
-    }
-    // Add THRT variables
-    for (uint32_t i = 0; i < (CONFIG_THRT_NUMVARS); i++) {
-        addrTab[tabptr++] = (CONFIG_THRT_PREFIX + i) | EE_LOBYTE_FLAG;
-        addrTab[tabptr++] = (CONFIG_THRT_PREFIX + i) | EE_HIBYTE_FLAG;
-    }
-    // Add LMT variables
-    for (uint32_t i = 0; i < (CONFIG_LMT_NUMVARS); i++) {
-        addrTab[tabptr++] = (CONFIG_LMT_PREFIX + i) | EE_LOBYTE_FLAG;
-        addrTab[tabptr++] = (CONFIG_LMT_PREFIX + i) | EE_HIBYTE_FLAG;
-    }
-    // Add MOTOR variables
-    for (uint32_t i = 0; i < (CONFIG_MOTOR_NUMVARS); i++) {
-        addrTab[tabptr++] = (CONFIG_MOTOR_PREFIX + i) | EE_LOBYTE_FLAG;
-        addrTab[tabptr++] = (CONFIG_MOTOR_PREFIX + i) | EE_HIBYTE_FLAG;
-    }
-}
+static uint16_t EE_PageTransfer(void);
+static uint16_t EE_TransferCopy(void);
+static uint8_t EE_TransferCopied(uint16_t Page);
+static uint16_t EE_FinishTransfer(void);
+static uint16_t EE_WriteDirty(void);
+static uint16_t EE_ScanVariable(uint16_t VirtAddress, uint16_t* Data);
+static uint16_t EE_ShadowIndex(uint16_t VirtAddress);
+static void EE_ShadowApply(uint32_t Record);
+static void EE_ShadowBuild(void);
+static uint8_t EE_ShadowScan(uint16_t Page);
+static void EE_CloseTornBatch(void);
+static uint32_t EE_FindFreeRecord(uint16_t Page);
+static uint16_t EE_PageTransfers(uint32_t PageAddress);
 
 /**
  * @brief  Restore the pages to a known good state in case of page's status
@@ -113,10 +127,16 @@ uint16_t EE_Init(uint16_t* addrTab) {
     EE_VirtAddVarTab = addrTab;
 
     uint16_t PageStatus0 = 6, PageStatus1 = 6;
-    uint16_t VarIdx = 0;
-    uint16_t EepromStatus = 0, ReadStatus = 0;
-    int16_t x = -1;
     uint16_t FlashStatus;
+    uint32_t StartCycles;
+
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    StartCycles = DWT->CYCCNT;
+
+    /* Any page transfer below copies what's in the shadow */
+    EE_BatchDepth = 0;
+    EE_ShadowBuild();
 
     /* Get Page0 status */
     PageStatus0 = (*(__IO uint16_t*) PAGE0_BASE_ADDRESS);
@@ -168,37 +188,9 @@ uint16_t EE_Init(uint16_t* addrTab) {
     case RECEIVE_DATA:
         if (PageStatus1 == VALID_PAGE) /* Page0 receive, Page1 valid */
         {
-            /* Transfer data from Page1 to Page0 */
-            for (VarIdx = 0; VarIdx < (TOTAL_EE_VARS*2); VarIdx++) {
-                if ((*(__IO uint16_t*) (PAGE0_BASE_ADDRESS + 6))
-                        == EE_VirtAddVarTab[VarIdx]) {
-                    x = VarIdx;
-                }
-                if (VarIdx != x) {
-                    /* Read the last variables' updates */
-                    ReadStatus = EE_ReadVariable(EE_VirtAddVarTab[VarIdx],
-                            &DataVar);
-                    /* In case variable corresponding to the virtual address was found */
-                    if (ReadStatus != 0x1) {
-                        /* Transfer the variable to the Page0 */
-                        EepromStatus = EE_VerifyPageFullWriteVariable(
-                                EE_VirtAddVarTab[VarIdx], DataVar);
-                        /* If program operation was failed, a Flash error code is returned */
-                        if (EepromStatus != FLASH_COMPLETE) {
-                            return EepromStatus;
-                        }
-                    }
-                }
-            }
-            /* Mark Page0 as valid */
-            FlashStatus = FLASH_ProgramHalfWord(PAGE0_BASE_ADDRESS, VALID_PAGE);
-            /* If program operation was failed, a Flash error code is returned */
-            if (FlashStatus != FLASH_COMPLETE) {
-                return FlashStatus;
-            }
-            /* Erase Page1 */
-            FlashStatus = FLASH_EraseSector(PAGE1_ID, VOLTAGE_RANGE);
-            /* If erase operation was failed, a Flash error code is returned */
+            /* Finish the transfer from Page1 to Page0 */
+            FlashStatus = EE_FinishTransfer();
+            /* If erase/program operation was failed, a Flash error code is returned */
             if (FlashStatus != FLASH_COMPLETE) {
                 return FlashStatus;
             }
@@ -252,37 +244,9 @@ uint16_t EE_Init(uint16_t* addrTab) {
             }
         } else /* Page0 valid, Page1 receive */
         {
-            /* Transfer data from Page0 to Page1 */
-            for (VarIdx = 0; VarIdx < (TOTAL_EE_VARS*2); VarIdx++) {
-                if ((*(__IO uint16_t*) (PAGE1_BASE_ADDRESS + 6))
-                        == EE_VirtAddVarTab[VarIdx]) {
-                    x = VarIdx;
-                }
-                if (VarIdx != x) {
-                    /* Read the last variables' updates */
-                    ReadStatus = EE_ReadVariable(EE_VirtAddVarTab[VarIdx],
-                            &DataVar);
-                    /* In case variable corresponding to the virtual address was found */
-                    if (ReadStatus != 0x1) {
-                        /* Transfer the variable to the Page1 */
-                        EepromStatus = EE_VerifyPageFullWriteVariable(
-                                EE_VirtAddVarTab[VarIdx], DataVar);
-                        /* If program operation was failed, a Flash error code is returned */
-                        if (EepromStatus != FLASH_COMPLETE) {
-                            return EepromStatus;
-                        }
-                    }
-                }
-            }
-            /* Mark Page1 as valid */
-            FlashStatus = FLASH_ProgramHalfWord(PAGE1_BASE_ADDRESS, VALID_PAGE);
-            /* If program operation was failed, a Flash error code is returned */
-            if (FlashStatus != FLASH_COMPLETE) {
-                return FlashStatus;
-            }
-            /* Erase Page0 */
-            FlashStatus = FLASH_EraseSector(PAGE0_ID, VOLTAGE_RANGE);
-            /* If erase operation was failed, a Flash error code is returned */
+            /* Finish the transfer from Page0 to Page1 */
+            FlashStatus = EE_FinishTransfer();
+            /* If erase/program operation was failed, a Flash error code is returned */
             if (FlashStatus != FLASH_COMPLETE) {
                 return FlashStatus;
             }
@@ -299,12 +263,18 @@ uint16_t EE_Init(uint16_t* addrTab) {
         break;
     }
 
+    /* One pass over the valid page fills in the RAM shadow */
+    EE_ShadowBuild();
+    EE_CloseTornBatch();
+    EE_Stats.InitCycles = DWT->CYCCNT - StartCycles;
+
     return FLASH_COMPLETE;
 }
 
 /**
  * @brief  Returns the last stored variable data, if found, which correspond to
- *   the passed virtual address
+ *   the passed virtual address. Addresses in the table given to EE_Init come
+ *   from the RAM shadow, anything else is searched for in the flash.
  * @param  VirtAddress: Variable virtual address
  * @param  Data: Global variable contains the read variable value
  * @retval Success or error status:
@@ -313,6 +283,72 @@ uint16_t EE_Init(uint16_t* addrTab) {
  *           - NO_VALID_PAGE: if no valid page was found.
  */
 uint16_t EE_ReadVariable(uint16_t VirtAddress, uint16_t* Data) {
+    uint16_t ReadStatus = READ_NOT_FOUND;
+    uint16_t Idx = EE_SHADOW_NONE;
+    uint32_t StartCycles = DWT->CYCCNT;
+
+    if (EE_ShadowReady) {
+        Idx = EE_ShadowIndex(VirtAddress);
+    }
+    if (Idx != EE_SHADOW_NONE) {
+        if (EE_ShadowFound[Idx]) {
+            *Data = EE_ShadowData[Idx];
+            ReadStatus = READ_SUCCESS;
+        }
+    } else {
+        ReadStatus = EE_ScanVariable(VirtAddress, Data);
+    }
+    EE_Stats.ReadCycles += DWT->CYCCNT - StartCycles;
+    EE_Stats.Reads++;
+    return ReadStatus;
+}
+
+/**
+ * @brief  Reads Count variables at consecutive virtual addresses. When they
+ *   sit next to each other in the table given to EE_Init, it's one copy out
+ *   of the RAM shadow.
+ * @param  VirtAddress: Virtual address of the first variable
+ * @param  Data: Room for Count half words
+ * @param  Count: Number of variables
+ * @retval Same as EE_ReadVariable, READ_SUCCESS only if all were found
+ */
+uint16_t EE_ReadBlock(uint16_t VirtAddress, uint16_t* Data, uint16_t Count) {
+    uint16_t ReadStatus = READ_SUCCESS;
+    uint16_t Idx = EE_SHADOW_NONE, VarIdx = 0;
+    uint32_t StartCycles = DWT->CYCCNT;
+
+    if (EE_ShadowReady && (Count > 0)) {
+        Idx = EE_ShadowIndex(VirtAddress);
+    }
+    if ((Idx != EE_SHADOW_NONE) && ((Idx + Count) <= TOTAL_EE_ADDRESSES)
+            && (EE_VirtAddVarTab[Idx + Count - 1]
+                    == (uint16_t) (VirtAddress + Count - 1))) {
+        for (VarIdx = Idx; VarIdx < (Idx + Count); VarIdx++) {
+            if (!EE_ShadowFound[VarIdx]) {
+                ReadStatus = READ_NOT_FOUND;
+            }
+        }
+        memcpy(Data, &EE_ShadowData[Idx], Count * sizeof(uint16_t));
+        EE_Stats.ReadCycles += DWT->CYCCNT - StartCycles;
+        EE_Stats.Reads += Count;
+        return ReadStatus;
+    }
+
+    for (VarIdx = 0; (VarIdx < Count) && (ReadStatus == READ_SUCCESS);
+            VarIdx++) {
+        ReadStatus = EE_ReadVariable(VirtAddress + VarIdx, &Data[VarIdx]);
+    }
+    return ReadStatus;
+}
+
+/**
+ * @brief  Searches the valid page in flash for the last stored data of the
+ *   passed virtual address, starting from the end of the page.
+ * @param  VirtAddress: Variable virtual address
+ * @param  Data: Global variable contains the read variable value
+ * @retval Same as EE_ReadVariable
+ */
+static uint16_t EE_ScanVariable(uint16_t VirtAddress, uint16_t* Data) {
     uint16_t ValidPage = PAGE0;
     uint16_t AddressValue = 0x5555, ReadStatus = READ_NOT_FOUND;
     uint32_t Address = EEPROM_START_ADDRESS, PageStartAddress =
@@ -359,7 +395,9 @@ uint16_t EE_ReadVariable(uint16_t VirtAddress, uint16_t* Data) {
 }
 
 /**
- * @brief  Writes/upadtes variable data in EEPROM.
+ * @brief  Writes/upadtes variable data in EEPROM. Nothing is written if the
+ *   variable already holds the value, and inside a batch variables in the
+ *   table are only written by EE_CommitBatch.
  * @param  VirtAddress: Variable virtual address
  * @param  Data: 16 bit data to be written
  * @retval Success or error status:
@@ -370,20 +408,269 @@ uint16_t EE_ReadVariable(uint16_t VirtAddress, uint16_t* Data) {
  */
 uint16_t EE_WriteVariable(uint16_t VirtAddress, uint16_t Data) {
     uint16_t Status = 0;
+    uint16_t Idx = EE_SHADOW_NONE;
+
+    if (EE_ShadowReady) {
+        Idx = EE_ShadowIndex(VirtAddress);
+    }
+    if (Idx != EE_SHADOW_NONE) {
+        /* Save the flash if the value is already there */
+        if (EE_ShadowFound[Idx] && (EE_ShadowData[Idx] == Data)) {
+            EE_Stats.Skipped++;
+            return FLASH_COMPLETE;
+        }
+        if (EE_BatchDepth > 0) {
+            EE_ShadowData[Idx] = Data;
+            EE_ShadowFound[Idx] = 1;
+            EE_ShadowDirty[Idx] = 1;
+            return FLASH_COMPLETE;
+        }
+    }
 
     /* Write the variable virtual address and value in the EEPROM */
     Status = EE_VerifyPageFullWriteVariable(VirtAddress, Data);
 
     /* In case the EEPROM active page is full */
-    if (Status == PAGE_FULL) {
-        /* Perform Page transfer */
-        Status = EE_PageTransfer(VirtAddress, Data);
+    if ((Status == PAGE_FULL) && EE_ErasePending && (Idx != EE_SHADOW_NONE)) {
+        /* Both pages are in use until EE_Service erases the old one, so
+         the write waits in the shadow */
+        EE_ShadowData[Idx] = Data;
+        EE_ShadowFound[Idx] = 1;
+        EE_ShadowDirty[Idx] = 1;
+        return FLASH_COMPLETE;
+    } else if (Status == PAGE_FULL) {
+        /* Perform Page transfer, then write to the new page */
+        Status = EE_PageTransfer();
+        if (Status == FLASH_COMPLETE) {
+            Status = EE_VerifyPageFullWriteVariable(VirtAddress, Data);
+        }
+    }
+
+    if (!EE_ShadowReady) {
+        /* Nothing to keep up to date until EE_Init has built it */
+    } else if (Status == FLASH_COMPLETE) {
+        /* Keep the RAM shadow up to date */
+        if (Idx != EE_SHADOW_NONE) {
+            EE_ShadowData[Idx] = Data;
+            EE_ShadowFound[Idx] = 1;
+            EE_ShadowDirty[Idx] = 0;
+        }
+    } else {
+        /* Don't guess at what made it to the flash */
+        EE_ShadowBuild();
+        EE_CloseTornBatch();
     }
 
     /* Return last operation status */
     return Status;
 }
 
+/**
+ * @brief  Starts a batch of writes. Until the matching EE_CommitBatch,
+ *   writes to variables in the table only change the RAM shadow, and reads
+ *   return the new values. Batches can be nested, only the outermost commit
+ *   writes to the flash.
+ * @param  None
+ * @retval None
+ */
+void EE_BeginBatch(void) {
+    /* Without a shadow, writes go straight to the flash */
+    if (EE_ShadowReady) {
+        EE_BatchDepth++;
+    }
+}
+
+/**
+ * @brief  Writes the variables that changed in the batch, all in the same
+ *   page between an EE_BATCH_BEGIN and an EE_BATCH_COMMIT record. If power
+ *   is lost before the commit record, none of them take effect. When the
+ *   page doesn't have room for the whole batch, the page transfer writes it
+ *   instead, or if the transfer is waiting on its erase the batch stays
+ *   queued in the shadow until EE_Service.
+ * @param  None
+ * @retval Success or error status, same as EE_WriteVariable
+ */
+uint16_t EE_CommitBatch(void) {
+    if (EE_BatchDepth == 0) {
+        return FLASH_COMPLETE;
+    }
+    if ((--EE_BatchDepth) > 0) {
+        return FLASH_COMPLETE;
+    }
+    return EE_WriteDirty();
+}
+
+/**
+ * @brief  Call from the main loop. Finishes a page transfer by erasing the
+ *   old page, which stalls the flash (and everything running from it) for
+ *   the whole sector erase, then writes anything that was queued while both
+ *   pages were in use.
+ * @param  EraseAllowed: Nonzero when nothing minds the stall, e.g. the motor
+ *   is off
+ * @retval Success or error status, same as EE_WriteVariable
+ */
+uint16_t EE_Service(uint8_t EraseAllowed) {
+    uint16_t Status = FLASH_COMPLETE;
+
+    if ((!EE_ErasePending) || (!EraseAllowed) || (EE_BatchDepth > 0)) {
+        return FLASH_COMPLETE;
+    }
+    Status = EE_FinishTransfer();
+    if (Status == FLASH_COMPLETE) {
+        Status = EE_WriteDirty();
+    } else {
+        /* Back to what's really in the flash */
+        EE_ShadowBuild();
+        EE_CloseTornBatch();
+    }
+    return Status;
+}
+
+/**
+ * @brief  Writes every variable changed in the shadow as one batch
+ * @param  None
+ * @retval Success or error status, same as EE_WriteVariable
+ */
+static uint16_t EE_WriteDirty(void) {
+    uint16_t Status = FLASH_COMPLETE;
+    uint16_t VarIdx = 0, Changed = 0;
+
+    for (VarIdx = 0; VarIdx < TOTAL_EE_ADDRESSES; VarIdx++) {
+        Changed += EE_ShadowDirty[VarIdx];
+    }
+    if (Changed == 0) {
+        return FLASH_COMPLETE;
+    }
+
+    if (EE_GetFreeRecords() < (uint32_t) (Changed + 2)) {
+        if (EE_ErasePending) {
+            /* Stays queued */
+            return FLASH_COMPLETE;
+        }
+        /* The transfer copies every variable from the shadow */
+        Status = EE_PageTransfer();
+    } else {
+        Status = EE_VerifyPageFullWriteVariable(EE_BATCH_BEGIN, Changed);
+        for (VarIdx = 0; (VarIdx < TOTAL_EE_ADDRESSES)
+                && (Status == FLASH_COMPLETE); VarIdx++) {
+            if (EE_ShadowDirty[VarIdx]) {
+                Status = EE_VerifyPageFullWriteVariable(
+                        EE_VirtAddVarTab[VarIdx], EE_ShadowData[VarIdx]);
+            }
+        }
+        if (Status == FLASH_COMPLETE) {
+            Status = EE_VerifyPageFullWriteVariable(EE_BATCH_COMMIT, Changed);
+        }
+    }
+
+    for (VarIdx = 0; VarIdx < TOTAL_EE_ADDRESSES; VarIdx++) {
+        EE_ShadowDirty[VarIdx] = 0;
+    }
+    if (Status != FLASH_COMPLETE) {
+        /* Back to what's really in the flash */
+        EE_ShadowBuild();
+        EE_CloseTornBatch();
+    }
+    return Status;
+}
+
+/**
+ * @brief  Time taken by EE_Init, including building the RAM shadow
+ * @retval Microseconds
+ */
+float EE_GetInitTime(void) {
+    return ((float) EE_Stats.InitCycles) * 1000000.0f
+            / ((float) SystemCoreClock);
+}
+
+/**
+ * @brief  Total time spent in EE_ReadVariable since start up
+ * @retval Microseconds
+ */
+float EE_GetReadTime(void) {
+    return ((float) EE_Stats.ReadCycles) * 1000000.0f
+            / ((float) SystemCoreClock);
+}
+
+/**
+ * @brief  Number of EE_ReadVariable calls since start up. Floats and int32s
+ *   take two each.
+ */
+uint32_t EE_GetReadCount(void) {
+    return EE_Stats.Reads;
+}
+
+/**
+ * @brief  Number of records (a value and its virtual address) written to
+ *   the flash since start up, including page transfers and batch markers
+ */
+uint32_t EE_GetWriteCount(void) {
+    return EE_Stats.Writes;
+}
+
+/**
+ * @brief  Number of writes since start up that were left out because the
+ *   variable already held the value
+ */
+uint32_t EE_GetSkipCount(void) {
+    return EE_Stats.Skipped;
+}
+
+/**
+ * @brief  Time taken by the last sector erase of a page transfer, during
+ *   which the CPU can't fetch from the flash
+ * @retval Microseconds
+ */
+float EE_GetEraseTime(void) {
+    return ((float) EE_Stats.EraseCycles) * 1000000.0f
+            / ((float) SystemCoreClock);
+}
+
+/**
+ * @brief  Number of records waiting in the shadow for EE_Service to erase
+ *   the old page
+ */
+uint32_t EE_GetQueued(void) {
+    uint16_t VarIdx = 0;
+    uint32_t Queued = 0;
+
+    if (EE_BatchDepth > 0) {
+        /* Can't tell them from the batch */
+        return 0;
+    }
+    for (VarIdx = 0; VarIdx < TOTAL_EE_ADDRESSES; VarIdx++) {
+        Queued += EE_ShadowDirty[VarIdx];
+    }
+    return Queued;
+}
+
+/**
+ * @brief  Number of page transfers over the life of the EEPROM, each of
+ *   which erases a sector. Kept in the second half word of the page header.
+ */
+uint32_t EE_GetEraseCount(void) {
+    uint16_t ValidPage = EE_FindValidPage(WRITE_IN_VALID_PAGE);
+
+    if (ValidPage == NO_VALID_PAGE) {
+        return 0;
+    }
+    return EE_PageTransfers(EEPROM_START_ADDRESS + (ValidPage * PAGE_SIZE));
+}
+
+/**
+ * @brief  Number of records that can still be written before the next page
+ *   transfer
+ */
+uint32_t EE_GetFreeRecords(void) {
+    uint16_t ValidPage = EE_FindValidPage(WRITE_IN_VALID_PAGE);
+
+    if (ValidPage == NO_VALID_PAGE) {
+        return 0;
+    }
+    return ((EEPROM_START_ADDRESS + ((1 + ValidPage) * PAGE_SIZE))
+            - EE_FindFreeRecord(ValidPage)) / 4;
+}
+
 uint16_t EE_SaveInt16(uint16_t VirtAddress, int16_t Data) {
     uint16_t* DataPtr = (uint16_t*) (&Data);
     return EE_WriteVariable(VirtAddress, *DataPtr);
@@ -776,32 +1063,26 @@ static uint16_t EE_VerifyPageFullWriteVariable(uint16_t VirtAddress,
         return NO_VALID_PAGE;
     }
 
-    /* Get the valid Page start Address */
-    Address = (uint32_t) (EEPROM_START_ADDRESS
-            + (uint32_t) (ValidPage * PAGE_SIZE ));
+    /* Get the first erased record, where Address and Address+2 contents
+     are 0xFFFFFFFF */
+    Address = EE_FindFreeRecord(ValidPage);
 
     /* Get the valid Page end Address */
-    PageEndAddress = (uint32_t) ((EEPROM_START_ADDRESS - 2)
+    PageEndAddress = (uint32_t) (EEPROM_START_ADDRESS
             + (uint32_t) ((1 + ValidPage) * PAGE_SIZE ));
 
-    /* Check each active page address starting from begining */
-    while (Address < PageEndAddress) {
-        /* Verify if Address and Address+2 contents are 0xFFFFFFFF */
-        if ((*(__IO uint32_t*) Address) == 0xFFFFFFFF) {
-            /* Set variable data */
-            FlashStatus = FLASH_ProgramHalfWord(Address, Data);
-            /* If program operation was failed, a Flash error code is returned */
-            if (FlashStatus != FLASH_COMPLETE) {
-                return FlashStatus;
-            }
-            /* Set variable virtual address */
-            FlashStatus = FLASH_ProgramHalfWord(Address + 2, VirtAddress);
-            /* Return program operation status */
+    if (Address < PageEndAddress) {
+        /* Set variable data */
+        FlashStatus = FLASH_ProgramHalfWord(Address, Data);
+        /* If program operation was failed, a Flash error code is returned */
+        if (FlashStatus != FLASH_COMPLETE) {
             return FlashStatus;
-        } else {
-            /* Next address location */
-            Address = Address + 4;
         }
+        /* Set variable virtual address */
+        FlashStatus = FLASH_ProgramHalfWord(Address + 2, VirtAddress);
+        EE_Stats.Writes++;
+        /* Return program operation status */
+        return FlashStatus;
     }
 
     /* Return PAGE_FULL in case the valid page is full */
@@ -809,22 +1090,65 @@ static uint16_t EE_VerifyPageFullWriteVariable(uint16_t VirtAddress,
 }
 
 /**
- * @brief  Transfers last updated variables data from the full Page to
- *   an empty one.
- * @param  VirtAddress: 16 bit virtual address of the variable
- * @param  Data: 16 bit data to be written as variable value
+ * @brief  Finds the first erased record in a page. Records are only ever
+ *   written at the first erased one, so all of them before it are in use
+ *   and all after it are erased, and a binary search will do.
+ * @param  Page: PAGE0 or PAGE1
+ * @retval Address of the first erased record, or the end of the page if
+ *   it's full
+ */
+static uint32_t EE_FindFreeRecord(uint16_t Page) {
+    uint32_t PageStartAddress = (uint32_t) (EEPROM_START_ADDRESS
+            + (uint32_t) (Page * PAGE_SIZE ));
+    /* Record 0 is the page header */
+    uint32_t Lo = 1, Hi = PAGE_SIZE / 4, Mid;
+
+    while (Lo < Hi) {
+        Mid = (Lo + Hi) / 2;
+        if ((*(__IO uint32_t*) (PageStartAddress + (Mid * 4))) == 0xFFFFFFFF) {
+            Hi = Mid;
+        } else {
+            Lo = Mid + 1;
+        }
+    }
+    return PageStartAddress + (Lo * 4);
+}
+
+/**
+ * @brief  Reads the count of page transfers from a page header
+ * @param  PageAddress: PAGE0_BASE_ADDRESS or PAGE1_BASE_ADDRESS
+ * @retval Page transfers before this page was written, zero if the page
+ *   was never given a count
+ */
+static uint16_t EE_PageTransfers(uint32_t PageAddress) {
+    uint16_t Count = (*(__IO uint16_t*) (PageAddress + 2));
+
+    if (Count == 0xFFFF) {
+        return 0;
+    }
+    return Count;
+}
+
+/**
+ * @brief  Starts moving the last updated variables data from the full Page
+ *   to the empty one. The old page is only erased by EE_FinishTransfer, and
+ *   until then new records go to the new page.
+ * @param  None
  * @retval Success or error status:
  *           - FLASH_COMPLETE: on success
- *           - PAGE_FULL: if valid page is full
+ *           - PAGE_FULL: if both pages are in use, the old one not erased yet
  *           - NO_VALID_PAGE: if no valid page was found
  *           - Flash error code: on write Flash error
  */
-static uint16_t EE_PageTransfer(uint16_t VirtAddress, uint16_t Data) {
+static uint16_t EE_PageTransfer(void) {
     FLASH_Status FlashStatus = FLASH_COMPLETE;
     uint32_t NewPageAddress = EEPROM_START_ADDRESS;
-    uint16_t OldPageId = 0;
-    uint16_t ValidPage = PAGE0, VarIdx = 0;
-    uint16_t EepromStatus = 0, ReadStatus = 0;
+    uint16_t ValidPage = PAGE0;
+    uint16_t Transfers = 0;
+
+    if (EE_ErasePending) {
+        return PAGE_FULL;
+    }
 
     /* Get active Page for read operation */
     ValidPage = EE_FindValidPage(READ_FROM_VALID_PAGE);
@@ -833,16 +1157,10 @@ static uint16_t EE_PageTransfer(uint16_t VirtAddress, uint16_t Data) {
     {
         /* New page address where variable will be moved to */
         NewPageAddress = PAGE0_BASE_ADDRESS;
-
-        /* Old page ID where variable will be taken from */
-        OldPageId = PAGE1_ID;
     } else if (ValidPage == PAGE0) /* Page0 valid */
     {
         /* New page address  where variable will be moved to */
         NewPageAddress = PAGE1_BASE_ADDRESS;
-
-        /* Old page ID where variable will be taken from */
-        OldPageId = PAGE0_ID;
     } else {
         return NO_VALID_PAGE; /* No valid Page */
     }
@@ -853,51 +1171,285 @@ static uint16_t EE_PageTransfer(uint16_t VirtAddress, uint16_t Data) {
     if (FlashStatus != FLASH_COMPLETE) {
         return FlashStatus;
     }
+    EE_ErasePending = 1;
 
-    /* Write the variable passed as parameter in the new active page */
-    EepromStatus = EE_VerifyPageFullWriteVariable(VirtAddress, Data);
-    /* If program operation was failed, a Flash error code is returned */
-    if (EepromStatus != FLASH_COMPLETE) {
-        return EepromStatus;
+    /* Count this transfer in the new page's header */
+    Transfers = EE_PageTransfers(
+            EEPROM_START_ADDRESS + (ValidPage * PAGE_SIZE));
+    if (Transfers < 0xFFFE) {
+        Transfers++;
+    }
+    FlashStatus = FLASH_ProgramHalfWord(NewPageAddress + 2, Transfers);
+    if (FlashStatus != FLASH_COMPLETE) {
+        return FlashStatus;
     }
 
     /* Transfer process: transfer variables from old to the new active page */
-    for (VarIdx = 0; VarIdx < (TOTAL_EE_VARS*2); VarIdx++) {
-        if (EE_VirtAddVarTab[VarIdx] != VirtAddress) /* Check each variable except the one passed as parameter */
-        {
-            /* Read the other last variable updates */
-            ReadStatus = EE_ReadVariable(EE_VirtAddVarTab[VarIdx], &DataVar);
-            /* In case variable corresponding to the virtual address was found */
-            if (ReadStatus != 0x1) {
-                /* Transfer the variable to the new active page */
-                EepromStatus = EE_VerifyPageFullWriteVariable(
-                        EE_VirtAddVarTab[VarIdx], DataVar);
-                /* If program operation was failed, a Flash error code is returned */
-                if (EepromStatus != FLASH_COMPLETE) {
-                    return EepromStatus;
-                }
-            }
+    return EE_TransferCopy();
+}
+
+/**
+ * @brief  Copies the last value of every variable to the page receiving
+ *   data, as one batch that starts at its first record
+ * @param  None
+ * @retval Success or error status, same as EE_WriteVariable
+ */
+static uint16_t EE_TransferCopy(void) {
+    uint16_t VarIdx = 0, Count = 0;
+    uint16_t EepromStatus = FLASH_COMPLETE;
+
+    for (VarIdx = 0; VarIdx < TOTAL_EE_ADDRESSES; VarIdx++) {
+        if (EE_ReadVariable(EE_VirtAddVarTab[VarIdx], &DataVar)
+                == READ_SUCCESS) {
+            Count++;
+        }
+    }
+
+    EepromStatus = EE_VerifyPageFullWriteVariable(EE_BATCH_BEGIN, Count);
+    for (VarIdx = 0; (VarIdx < TOTAL_EE_ADDRESSES)
+            && (EepromStatus == FLASH_COMPLETE); VarIdx++) {
+        /* Read the last variables' updates */
+        if (EE_ReadVariable(EE_VirtAddVarTab[VarIdx], &DataVar)
+                == READ_SUCCESS) {
+            /* Transfer the variable to the new page */
+            EepromStatus = EE_VerifyPageFullWriteVariable(
+                    EE_VirtAddVarTab[VarIdx], DataVar);
+        }
+    }
+    if (EepromStatus == FLASH_COMPLETE) {
+        EepromStatus = EE_VerifyPageFullWriteVariable(EE_BATCH_COMMIT, Count);
+    }
+    if (EepromStatus == FLASH_COMPLETE) {
+        /* Everything is in the new page now */
+        for (VarIdx = 0; VarIdx < TOTAL_EE_ADDRESSES; VarIdx++) {
+            EE_ShadowDirty[VarIdx] = 0;
+        }
+    }
+    return EepromStatus;
+}
+
+/**
+ * @brief  Checks whether the copy made by EE_TransferCopy was committed
+ * @param  Page: Page receiving data
+ * @retval Nonzero if it was
+ */
+static uint8_t EE_TransferCopied(uint16_t Page) {
+    uint32_t PageStartAddress = (uint32_t) (EEPROM_START_ADDRESS
+            + (uint32_t) (Page * PAGE_SIZE ));
+    uint32_t Begin = (*(__IO uint32_t*) (PageStartAddress + 4));
+    uint32_t CommitAddress = PageStartAddress + 8 + ((Begin & 0xFFFF) * 4);
+
+    if ((uint16_t) (Begin >> 16) != EE_BATCH_BEGIN) {
+        return 0;
+    }
+    if (CommitAddress >= (PageStartAddress + PAGE_SIZE)) {
+        return 0;
+    }
+    return ((*(__IO uint16_t*) (CommitAddress + 2)) == EE_BATCH_COMMIT);
+}
+
+/**
+ * @brief  Erases the old page of a page transfer and marks the new one
+ *   valid. The erase stalls instruction fetch from the flash until it's
+ *   done, so the caller has to make sure nothing minds. If the copy to the
+ *   new page didn't make it (power lost, or a flash error), it's made again
+ *   first.
+ * @param  None
+ * @retval Success or error status:
+ *           - FLASH_COMPLETE: on success, or no transfer to finish
+ *           - Flash error code: on write Flash error
+ */
+static uint16_t EE_FinishTransfer(void) {
+    FLASH_Status FlashStatus = FLASH_COMPLETE;
+    uint16_t ValidPage = EE_FindValidPage(READ_FROM_VALID_PAGE);
+    uint16_t NewPage = EE_FindValidPage(WRITE_IN_VALID_PAGE);
+    uint16_t EepromStatus = FLASH_COMPLETE;
+    uint32_t StartCycles;
+
+    if ((ValidPage == NO_VALID_PAGE) || (NewPage == ValidPage)) {
+        EE_ErasePending = 0;
+        return FLASH_COMPLETE;
+    }
+    if (!EE_TransferCopied(NewPage)) {
+        EE_CloseTornBatch();
+        EepromStatus = EE_TransferCopy();
+        if (EepromStatus != FLASH_COMPLETE) {
+            return EepromStatus;
         }
     }
 
     /* Erase the old Page: Set old Page status to ERASED status */
-    FlashStatus = FLASH_EraseSector(OldPageId, VOLTAGE_RANGE);
+    StartCycles = DWT->CYCCNT;
+    FlashStatus = FLASH_EraseSector((ValidPage == PAGE0) ? PAGE0_ID : PAGE1_ID,
+            VOLTAGE_RANGE);
+    EE_Stats.EraseCycles = DWT->CYCCNT - StartCycles;
     /* If erase operation was failed, a Flash error code is returned */
     if (FlashStatus != FLASH_COMPLETE) {
         return FlashStatus;
     }
 
     /* Set new Page status to VALID_PAGE status */
-    FlashStatus = FLASH_ProgramHalfWord(NewPageAddress, VALID_PAGE);
+    FlashStatus = FLASH_ProgramHalfWord(
+            EEPROM_START_ADDRESS + (NewPage * PAGE_SIZE), VALID_PAGE);
     /* If program operation was failed, a Flash error code is returned */
     if (FlashStatus != FLASH_COMPLETE) {
         return FlashStatus;
     }
+    EE_ErasePending = 0;
 
     /* Return last operation flash status */
     return FlashStatus;
 }
 
+/**
+ * @brief  Finds where a virtual address is in EE_VirtAddVarTab
+ * @param  VirtAddress: Variable virtual address
+ * @retval Index in EE_VirtAddVarTab, or EE_SHADOW_NONE if it isn't there
+ */
+static uint16_t EE_ShadowIndex(uint16_t VirtAddress) {
+    uint16_t Slot = EE_SHADOW_HASH(VirtAddress);
+
+    while (EE_ShadowSlots[Slot] != EE_SHADOW_NONE) {
+        if (EE_VirtAddVarTab[EE_ShadowSlots[Slot]] == VirtAddress) {
+            return EE_ShadowSlots[Slot];
+        }
+        Slot = (Slot + 1) & (EE_SHADOW_SLOTS - 1);
+    }
+    return EE_SHADOW_NONE;
+}
+
+/**
+ * @brief  Builds the hash table of virtual addresses, then copies the valid
+ *   page into the RAM shadow in one pass from the start, followed by the
+ *   page receiving data if a transfer is under way. Later records of a
+ *   variable overwrite earlier ones, and the pass stops at the first erased
+ *   record, since that's where the next write goes.
+ * @param  None
+ * @retval None
+ */
+static void EE_ShadowBuild(void) {
+    uint16_t ValidPage = PAGE0, NewPage = PAGE0;
+    uint16_t VarIdx = 0, Idx = 0;
+    uint16_t Slot = 0;
+
+    EE_ShadowReady = 0;
+    EE_BatchTorn = 0;
+    EE_ErasePending = 0;
+    for (Idx = 0; Idx < EE_SHADOW_SLOTS; Idx++) {
+        EE_ShadowSlots[Idx] = EE_SHADOW_NONE;
+    }
+    for (VarIdx = 0; VarIdx < TOTAL_EE_ADDRESSES; VarIdx++) {
+        EE_ShadowFound[VarIdx] = 0;
+        EE_ShadowDirty[VarIdx] = 0;
+        /* A repeated address keeps its first place in the table */
+        if (EE_ShadowIndex(EE_VirtAddVarTab[VarIdx]) == EE_SHADOW_NONE) {
+            Slot = EE_SHADOW_HASH(EE_VirtAddVarTab[VarIdx]);
+            while (EE_ShadowSlots[Slot] != EE_SHADOW_NONE) {
+                Slot = (Slot + 1) & (EE_SHADOW_SLOTS - 1);
+            }
+            EE_ShadowSlots[Slot] = VarIdx;
+        }
+    }
+
+    /* Get active Page for read operation */
+    ValidPage = EE_FindValidPage(READ_FROM_VALID_PAGE);
+
+    /* Check if there is no valid page, reads will report it */
+    if (ValidPage == NO_VALID_PAGE) {
+        return;
+    }
+    EE_BatchTorn = EE_ShadowScan(ValidPage);
+
+    /* During a page transfer, the page receiving data has the latest */
+    NewPage = EE_FindValidPage(WRITE_IN_VALID_PAGE);
+    EE_ErasePending = (NewPage != ValidPage);
+    if (EE_ErasePending) {
+        EE_BatchTorn = EE_ShadowScan(NewPage);
+    }
+    EE_ShadowReady = 1;
+}
+
+/**
+ * @brief  Copies a page into the RAM shadow in one pass from the start
+ * @param  Page: PAGE0 or PAGE1
+ * @retval Nonzero if the page ends in a batch that was cut short
+ */
+static uint8_t EE_ShadowScan(uint16_t Page) {
+    uint16_t VirtAddress = 0;
+    uint32_t Address = EEPROM_START_ADDRESS, PageEndAddress =
+            EEPROM_START_ADDRESS + PAGE_SIZE;
+    uint32_t Record = 0, BatchAddress = 0;
+
+    /* First record is after the page status */
+    Address = (uint32_t) (EEPROM_START_ADDRESS + 4
+            + (uint32_t) (Page * PAGE_SIZE ));
+    PageEndAddress = (uint32_t) (EEPROM_START_ADDRESS
+            + (uint32_t) ((1 + Page) * PAGE_SIZE ));
+
+    while (Address < PageEndAddress) {
+        /* Variable value in the low half word, virtual address in the high */
+        Record = (*(__IO uint32_t*) Address);
+        if (Record == 0xFFFFFFFF) {
+            break;
+        }
+        VirtAddress = (uint16_t) (Record >> 16);
+        if (VirtAddress == EE_BATCH_BEGIN) {
+            /* Records of a batch only count once it's committed. A batch
+             left open before this one is dropped. */
+            BatchAddress = Address + 4;
+        } else if ((VirtAddress == EE_BATCH_COMMIT)
+                || (VirtAddress == EE_BATCH_ABORT)) {
+            if ((BatchAddress != 0) && (VirtAddress == EE_BATCH_COMMIT)) {
+                while (BatchAddress < Address) {
+                    EE_ShadowApply(*(__IO uint32_t*) BatchAddress);
+                    BatchAddress = BatchAddress + 4;
+                }
+            }
+            BatchAddress = 0;
+        } else if (BatchAddress == 0) {
+            EE_ShadowApply(Record);
+        }
+        Address = Address + 4;
+    }
+    return (BatchAddress != 0);
+}
+
+/**
+ * @brief  Puts one record from the flash in the RAM shadow
+ * @param  Record: Value in the low half word, virtual address in the high
+ * @retval None
+ */
+static void EE_ShadowApply(uint32_t Record) {
+    uint16_t Idx = EE_ShadowIndex((uint16_t) (Record >> 16));
+
+    if (Idx != EE_SHADOW_NONE) {
+        EE_ShadowData[Idx] = (uint16_t) Record;
+        EE_ShadowFound[Idx] = 1;
+    }
+}
+
+/**
+ * @brief  Closes a batch that was cut short (power lost before the commit
+ *   record), so records written after it aren't taken as part of it.
+ * @param  None
+ * @retval None
+ */
+static void EE_CloseTornBatch(void) {
+    uint16_t Status = 0;
+
+    if (!EE_BatchTorn) {
+        return;
+    }
+    Status = EE_VerifyPageFullWriteVariable(EE_BATCH_ABORT, 0);
+    if (Status == PAGE_FULL) {
+        /* The new page only gets what's in the shadow */
+        Status = EE_PageTransfer();
+    }
+    if (Status == FLASH_COMPLETE) {
+        EE_BatchTorn = 0;
+    }
+}
+
 /**
  * @}
  */
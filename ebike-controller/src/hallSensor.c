@@ -326,9 +326,16 @@ void HallSensor2_Inc_Angle(void) {
 }
 #endif
 #ifdef TESTING_PLL
-void HallSensorPLL_Update(void) {
+/** HallSensorPLL_Update
+ * Corrects the PLL towards the Hall angle, every few PWM cycles from the
+ * mid-rate loop. The gains are per PWM cycle, so they're scaled up by the
+ * cycles since the last update. The angle itself moves on every PWM cycle,
+ * see HallSensorPLL_Inc_Angle.
+ */
+void HallSensorPLL_Update(uint16_t cycles) {
     // Run the PLL to create a smoothed angle output
     float phase_difference;
+    float steps = (float) cycles;
     phase_difference =  HallSensor.Angle - HallSensorPLL.Phase;
     while(phase_difference > 0.5f) {
         phase_difference -= 1.0f;
@@ -336,31 +343,45 @@ void HallSensorPLL_Update(void) {
     while(phase_difference < -0.5f) {
         phase_difference += 1.0f;
     }
-    HallSensorPLL.Frequency += HallSensorPLL.Beta*phase_difference;
-    HallSensorPLL.Phase += HallSensorPLL.Alpha*phase_difference + HallSensorPLL.Frequency;
+    // The PWM interrupt moves the phase on, don't lose one of its steps
+    __disable_irq();
+    HallSensorPLL.Frequency += steps*HallSensorPLL.Beta*phase_difference;
+    HallSensorPLL.Phase += steps*HallSensorPLL.Alpha*phase_difference;
     HallSensorPLL.Phase = HallSensor_ClipToOne(HallSensorPLL.Phase);
+    __enable_irq();
 
-    // Check for phase lock
+    // Check for phase lock, counting PWM cycles
 
     if(phase_difference < 0.0f) {
         phase_difference = -phase_difference; // Absolute value of phase error
     }
     if(phase_difference < PLL_LOCKED_PHASE_ERROR) {
         if(HallSensorPLL.ValidCounter < PLL_LOCKED_COUNTS) {
-            HallSensorPLL.ValidCounter++;
+            HallSensorPLL.ValidCounter += cycles;
         }
         if(HallSensorPLL.ValidCounter >= PLL_LOCKED_COUNTS) {
+            HallSensorPLL.ValidCounter = PLL_LOCKED_COUNTS;
             HallSensorPLL.Valid = PLL_LOCKED;
         }
     } else {
-        if(HallSensorPLL.ValidCounter > 0) {
-            HallSensorPLL.ValidCounter--;
+        if(HallSensorPLL.ValidCounter > cycles) {
+            HallSensorPLL.ValidCounter -= cycles;
+        } else {
+            HallSensorPLL.ValidCounter = 0;
         }
         if(HallSensorPLL.ValidCounter == 0) {
             HallSensorPLL.Valid = PLL_UNLOCKED;
         }
     }
 }
+
+/** HallSensorPLL_Inc_Angle
+ * Moves the PLL angle on by one PWM cycle at the PLL frequency.
+ */
+void HallSensorPLL_Inc_Angle(void) {
+    HallSensorPLL.Phase = HallSensor_ClipToOne(HallSensorPLL.Phase
+            + HallSensorPLL.Frequency);
+}
 #endif
 
 /** HallSensor_Get_Angle
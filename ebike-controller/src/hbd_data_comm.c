@@ -30,12 +30,21 @@
 #include "hbd_data_comm.h"
 #include "data_packet.h"
 #include "data_commands.h"
+#include "uart.h"
 
 uint8_t HBD_Data_Comm_TxBuffer[PACKET_MAX_LENGTH];
 uint8_t HBD_Data_Comm_DataBuffer[PACKET_MAX_DATA_LENGTH];
 Data_Packet_Type HBD_Data_Comm_Packet;
+HBD_Link_Type HBD_Link;
+
+static const uint32_t HBD_Baud_Rates[] = HBD_BAUD_RATES;
+#define HBD_NUM_BAUD_RATES  (sizeof(HBD_Baud_Rates) / sizeof(HBD_Baud_Rates[0]))
 
 static void HBD_Data_Comm_Process_Command(void);
+static void HBD_Set_Baud(void);
+static void HBD_Dashboard_Subscribe(void);
+static void HBD_Link_Check(void);
+static void HBD_Link_Fallback(uint32_t baud);
 
 /**
  * @brief  HBD Data Communications Initialization
@@ -49,37 +58,78 @@ void HBD_Data_Comm_Init(void) {
     HBD_Data_Comm_Packet.TxBuffer = HBD_Data_Comm_TxBuffer;
     HBD_Data_Comm_Packet.TxReady = 0;
     HBD_Data_Comm_Packet.RxReady = 0;
+    HBD_Data_Comm_Packet.Framing = DATA_PACKET_FRAMING_SOP;
+    HBD_Link.PrevBaud = HBD_BAUDRATE;
+    HBD_Link.LastGood = GetTick();
+    HBD_Link.Trial = 0;
+    HBD_Link.CrcErrors = 0;
+    HBD_Link.Fallbacks = 0;
 }
 
 /**
  * @brief  HBD Data Communications One Byte Check
  *         Handles the HBD serial port incoming data. Determines
  *         if a properly encoded packet has been received, and
- *         sends to the appropriate handler if it has. Operates
- *         one byte at a time using an internal state machine.
+ *         sends to the appropriate handler if it has. Reads the
+ *         port in blocks and scans each block for whole packets,
+ *         packets split between blocks are finished off by the
+ *         state machine.
  * @param  None
  * @retval None
  */
 void HBD_OneByte_Check(void) {
-    // Loop through each incoming byte
-    int32_t numbytes = UART_InWaiting(SELECT_HBD_UART);
-    uint8_t this_byte;
+    // Take in whatever has arrived in blocks, and find the packets in each
+    uint8_t rxbuf[DATA_PACKET_RX_CHUNK];
+    int32_t numbytes;
+
+    HBD_Link_Check();
+    numbytes = UART_InWaiting(SELECT_HBD_UART);
     while(numbytes > 0) {
-        // Load one new byte
-        if(UART_Read(SELECT_HBD_UART, &this_byte, 1) != 1) {
-            // Check that a byte was really received
+        // Leave the commands in the receive buffer until there's room in
+        // the transmit queue for at least a full length response
+        if(UART_TxSpace(SELECT_HBD_UART) < PACKET_MAX_LENGTH) {
+            return;
+        }
+        int32_t count = (numbytes > DATA_PACKET_RX_CHUNK) ? DATA_PACKET_RX_CHUNK : numbytes;
+        count = UART_Read(SELECT_HBD_UART, rxbuf, count);
+        if(count <= 0) {
+            // Nothing was really received
             return;
         }
-        numbytes--;
-        if(data_packet_extract_one_byte(&HBD_Data_Comm_Packet, this_byte) == DATA_PACKET_SUCCESS) {
-            if(HBD_Data_Comm_Packet.RxReady == 1) {
-                // Double checked and good to go
-                HBD_Data_Comm_Process_Command();
+        numbytes -= count;
+        uint16_t place = 0;
+        while(place < count) {
+            uint16_t used;
+            if(data_packet_extract_span(&HBD_Data_Comm_Packet, &rxbuf[place], count - place, &used) == DATA_PACKET_SUCCESS) {
+                if(HBD_Data_Comm_Packet.RxReady == 1) {
+                    // Double checked and good to go. Also confirms the baud rate.
+                    HBD_Link.LastGood = GetTick();
+                    HBD_Link.Trial = 0;
+                    HBD_Link.CrcErrors = 0;
+                    HBD_Data_Comm_Process_Command();
+                }
+            } else if(HBD_Data_Comm_Packet.FaultCode == BAD_CRC) {
+                HBD_Data_Comm_Packet.FaultCode = NO_FAULT;
+                if((++HBD_Link.CrcErrors) >= HBD_BAUD_MAX_CRC_ERRORS) {
+                    HBD_Link.CrcErrors = 0;
+                    HBD_Link_Fallback(HBD_BAUDRATE);
+                }
             }
+            place += used;
         }
     }
 }
 
+/**
+ * @brief  HBD Data Communications Get Framing
+ *         Framing mode the host picked for this link (SET_FRAMING). Other
+ *         packets sent on the link have to use the same one.
+ * @retval DATA_PACKET_FRAMING_SOP or DATA_PACKET_FRAMING_COBS
+ */
+uint8_t HBD_Get_Framing(void) {
+    return HBD_Data_Comm_Packet.Framing;
+}
+
 /**
  * @brief  HBD Data Communications Process Command
  *         Calls the command processor when a packet has been successfully
@@ -89,16 +139,112 @@ void HBD_OneByte_Check(void) {
  * @retval None
  */
 static void HBD_Data_Comm_Process_Command(void) {
+    if (HBD_Data_Comm_Packet.PacketType == SET_BAUD) {
+        HBD_Set_Baud();
+        return;
+    }
+    if (HBD_Data_Comm_Packet.PacketType == DASHBOARD_SUBSCRIBE) {
+        HBD_Dashboard_Subscribe();
+        return;
+    }
     uint16_t errCode = data_process_command(&HBD_Data_Comm_Packet);
     if ((errCode == DATA_PACKET_SUCCESS) && HBD_Data_Comm_Packet.TxReady) {
-        uint8_t* send_buffer = HBD_Data_Comm_Packet.TxBuffer;
-        uint16_t len_to_send = HBD_Data_Comm_Packet.TxLength;
-        uint16_t actually_sent = 0;
-        while (len_to_send > 0) {
-            actually_sent = UART_Write(SELECT_HBD_UART, send_buffer, len_to_send);
-            len_to_send -= actually_sent;
-            send_buffer += actually_sent;
-        }
+        // Queued in the background. If it doesn't fit the host hears
+        // nothing and asks again, UART_GetTxRejected counts these.
+        UART_Write(SELECT_HBD_UART, HBD_Data_Comm_Packet.TxBuffer,
+                HBD_Data_Comm_Packet.TxLength);
         HBD_Data_Comm_Packet.TxReady = 0;
     }
 }
+
+uint32_t HBD_Get_Baud(void) {
+    return UART_GetBaud(SELECT_HBD_UART);
+}
+
+uint32_t HBD_Get_Baud_Fallbacks(void) {
+    return HBD_Link.Fallbacks;
+}
+
+/**
+ * @brief  HBD Set Baud
+ *         Answers a SET_BAUD request at the current rate and switches
+ *         once the answer is out. The new rate is on trial until the
+ *         display sends a good packet at it.
+ */
+static void HBD_Set_Baud(void) {
+    Data_Packet_Type* pkt = &HBD_Data_Comm_Packet;
+    uint32_t baud = 0;
+    uint8_t supported = 0;
+
+    if (pkt->DataLength == 4) {
+        baud = data_packet_extract_32b(pkt->Data);
+        for (uint8_t i = 0; i < HBD_NUM_BAUD_RATES; i++) {
+            if (HBD_Baud_Rates[i] == baud) {
+                supported = 1;
+            }
+        }
+    }
+    if (!supported) {
+        data_packet_create(pkt, CONTROLLER_NACK, 0, 0);
+    } else {
+        data_packet_create(pkt, CONTROLLER_ACK, 0, 0);
+    }
+    if (UART_Write(SELECT_HBD_UART, pkt->TxBuffer, pkt->TxLength) == 0) {
+        // The display didn't hear an ACK, so it mustn't change either
+        supported = 0;
+    }
+    pkt->TxReady = 0;
+    if (supported && (baud != UART_GetBaud(SELECT_HBD_UART))) {
+        HBD_Link.PrevBaud = UART_GetBaud(SELECT_HBD_UART);
+        UART_SetBaud(SELECT_HBD_UART, baud);
+        HBD_Link.Trial = 1;
+        HBD_Link.LastGood = GetTick();
+    }
+}
+
+/**
+ * @brief  HBD Dashboard Subscribe
+ *         DASHBOARD_SUBSCRIBE carries an I16 period in ms, 0 to stop.
+ */
+static void HBD_Dashboard_Subscribe(void) {
+    Data_Packet_Type* pkt = &HBD_Data_Comm_Packet;
+    if ((pkt->DataLength == 2) && (dashboard_subscribe(
+            data_packet_extract_16b(pkt->Data)) == DATA_PACKET_SUCCESS)) {
+        data_packet_create(pkt, CONTROLLER_ACK, 0, 0);
+    } else {
+        data_packet_create(pkt, CONTROLLER_NACK, 0, 0);
+    }
+    UART_Write(SELECT_HBD_UART, pkt->TxBuffer, pkt->TxLength);
+    pkt->TxReady = 0;
+}
+
+/**
+ * @brief  HBD Link Check
+ *         Drops the baud rate if the display hasn't confirmed a new rate
+ *         in time, or has gone quiet at a raised rate.
+ */
+static void HBD_Link_Check(void) {
+    uint32_t quiet = GetTick() - HBD_Link.LastGood;
+    if (HBD_Link.Trial) {
+        if (quiet > HBD_BAUD_CONFIRM_MS) {
+            HBD_Link_Fallback(HBD_Link.PrevBaud);
+        }
+    } else if (quiet > HBD_BAUD_IDLE_MS) {
+        // Display's gone
+        dashboard_subscribe(0);
+        if (UART_GetBaud(SELECT_HBD_UART) != HBD_BAUDRATE) {
+            HBD_Link_Fallback(HBD_BAUDRATE);
+        }
+    }
+}
+
+static void HBD_Link_Fallback(uint32_t baud) {
+    if (UART_GetBaud(SELECT_HBD_UART) != baud) {
+        UART_SetBaud(SELECT_HBD_UART, baud);
+        HBD_Link.Fallbacks++;
+    }
+    HBD_Link.Trial = 0;
+    HBD_Link.LastGood = GetTick();
+    // Half a packet at the old rate is no use
+    HBD_Data_Comm_Packet.State = DATA_COMM_IDLE;
+}
@@ -41,6 +41,11 @@ typedef struct _HallDetectHelperStruct {
 
 /* Private variables ---------------------------------------------------------*/
 __IO uint32_t g_MainSysTick;
+uint32_t g_PWMCycleCount; // Sample index for telemetry
+uint32_t g_MidRateDecimation = 1; // PWM cycles per mid-rate loop
+uint32_t g_MidRateCount;
+uint32_t g_MidRateLastCycle;
+uint32_t g_MidRateOverruns;
 
 float g_rampAngle;
 float g_rampInc;
@@ -63,9 +68,23 @@ FOC_StateVariables Mfoc;
 float g_FetTemp;
 float g_MotorTemp;
 
-PowerCalcs Mpc;
+// Battery current while the last BMS refresh was going on, see MAIN_CellLimit
+float g_CellCurrentSum;
+uint32_t g_CellCurrentCount;
+float g_CellReadCurrent;
+uint32_t g_CellRefreshSeen;
+float g_CellMinLoaded = -1.0f;
+float g_CellMaxLoaded = -1.0f;
 
-uint16_t VirtAddVarTab[(TOTAL_EE_VARS * 2)];
+// Battery current per unit of throttle, and the sag expected from it, see
+// MAIN_SagLimit
+float g_AmpsPerThrottle;
+float g_SagVoltage = -1.0f;
+float g_SagScale = 1.0f;
+
+PowerCalcs Mpc = { .Filter = POWER_CALCS_LPF_MULTIPLIER };
+
+uint16_t VirtAddVarTab[TOTAL_EE_ADDRESSES];
 float g_hallDetectTable[6 * HALL_DETECT_TRANSITIONS_TO_AVG];
 
 HallDetectHelperStruct hdhs;
@@ -95,8 +114,14 @@ HallDetectHelperStruct hdhs;
  *
  *
  * These debugging outputs can be monitored over the USB debug using the
- * "USB" series of commands, or by the data dump (which records at the full
- * 20kHz rate) using the "DUMP" command series.
+ * "USB" series of commands, or by the data dump using the "DUMP" command
+ * series. The dump is recorded from User_MidRate_IRQ, so it is decimated
+ * like the rest of the mid-rate work: one sample every g_MidRateDecimation
+ * PWM cycles, at most MIDRATE_MAX_FREQ.
+ *
+ * They are also registry variables (CONFIG_LIVE_PREFIX + output number), so
+ * the host can subscribe to any of them at its own rate with telemetry.
+ * The "USB" settings only pick the default telemetry subscription.
  *
  */
 
@@ -107,9 +132,8 @@ uint8_t usb_debug_buffer[PACKET_MAX_LENGTH];
 
 Data_Packet_Type usb_debug_packet;
 uint8_t usb_debug_data_buffer[PACKET_MAX_DATA_LENGTH];
-__IO uint32_t usb_debug_buffer_pos = 0;
-__IO uint32_t usb_debug_countdown_timer;
-uint32_t usb_debug_countdown_reload;
+
+// Telemetry frames are wrapped into packets here by the main loop
 
 float usbdacvals[MAX_USB_VALS];
 
@@ -132,9 +156,24 @@ static void User_PB_Init(void);
 static void User_LED_Init(void);
 static void User_DAC_Init(void);
 static void User_BasicTim_Init(void);
+static void User_TimestampTim_Init(void);
 static void RunHallDetectRoutine(void);
-static void VCP_SendWrapper(char* buf, uint32_t len);
-static void HBD_SendWrapper(char* buf, uint32_t len);
+static uint32_t MAIN_GetMicros(void);
+static void Task_Telemetry(void);
+static void Task_HallDetect(void);
+static void Task_RoutineResult(void);
+static void Task_Pushbutton(void);
+static void Task_BmsRefresh(void);
+static void Task_Temperature(void);
+static void Task_Eeprom(void);
+static void Task_BmsDebug(void);
+#ifdef DEBUG_DUMP_USED
+static void Task_DebugDump(void);
+#endif // DEBUG_DUMP_USED
+static uint8_t VCP_SendWrapper(char* buf, uint32_t len);
+static uint8_t HBD_SendWrapper(char* buf, uint32_t len);
+static void MAIN_CellLimit(void);
+static float MAIN_SagLimit(float demand);
 
 /* Private functions ---------------------------------------------------------*/
 
@@ -218,11 +257,6 @@ static void BootloaderStartup(void) {
  * @retval None
  */
 int main(void) {
-#ifdef DEBUG_USED
-    char string[32];
-    char usbstring[64];
-#endif // DEBUG_USED
-
     BootloaderStartup(); // Load bootloader if certain conditions are met
     // Also initializes the user pushbutton
 
@@ -233,10 +267,12 @@ int main(void) {
     SystemClock_Config();
 
     // Start up the EEPROM emulation, and fetch stored values from it
-    EE_Config_Addr_Table(VirtAddVarTab);
+    data_registry_fill_ee_table(VirtAddVarTab);
+    config_blob_fill_ee_table(&VirtAddVarTab[TOTAL_EE_VARS * 2]);
     EE_Init(VirtAddVarTab);
 
     // Load all variables from EEPROM
+    telemetry_init();
     MAIN_LoadVariables();
 
     /* Default initialization:
@@ -258,6 +294,7 @@ int main(void) {
 
     SysTick_Config(SystemCoreClock / 1000);
     NVIC_SetPriority(SysTick_IRQn, PRIO_SYSTICK);
+    NVIC_SetPriority(PendSV_IRQn, PRIO_MIDRATE);
 
     g_errorCode = 0;
 
@@ -267,8 +304,12 @@ int main(void) {
     GLED_PORT->ODR |= (1 << GLED_PIN);
     adcInit();
     throttle_init();
+    soc_init();
+    trip_init();
+    batt_model_init();
     User_DAC_Init();
     User_BasicTim_Init();
+    User_TimestampTim_Init();
     PWM_Init(config_main.PWMFrequency);
     HallSensor_Init_NoHal(config_main.PWMFrequency);
     PWM_SetDeadTime(config_main.PWMDeadTime);
@@ -296,6 +337,11 @@ int main(void) {
     CRC32_Init();
     USB_Data_Comm_Init();
 
+    /* The whole configuration record, if there's a valid one, replaces the
+     * values the modules loaded one at a time */
+    config_blob_init();
+    config_blob_load();
+
     /* Enable FOC mode */
     config_main.ControlMethod = Control_FOC;
 
@@ -305,187 +351,198 @@ int main(void) {
 
     /* Start connection with handle bar display */
     HBD_Data_Comm_Init();
+    dashboard_init();
 
 
     /* Run Application (Interrupt mode) */
-    while (1) {
-        // Feed the watchdog!
-        WDT_feed();
-
-        // Check USB serial for data
-        USB_Data_Comm_OneByte_Check();
-        // Check BMS serial for data
-        BMS_OneByte_Check();
-        // Check HBD serial for data
-        HBD_OneByte_Check();
+    sched_init(MAIN_GetMicros);
+    sched_set_task(TASK_USB_COMM, USB_Data_Comm_OneByte_Check,
+            TASK_COMM_PERIOD_MS, TASK_COMM_DEADLINE_US);
+    sched_set_task(TASK_BMS_COMM, BMS_OneByte_Check,
+            TASK_COMM_PERIOD_MS, TASK_COMM_DEADLINE_US);
+    sched_set_task(TASK_HBD_COMM, HBD_OneByte_Check,
+            TASK_COMM_PERIOD_MS, TASK_COMM_DEADLINE_US);
+    sched_set_task(TASK_TELEMETRY, Task_Telemetry,
+            TASK_COMM_PERIOD_MS, TASK_COMM_DEADLINE_US);
+    sched_set_task(TASK_HALL_DETECT, Task_HallDetect,
+            TASK_HALL_DETECT_PERIOD_MS, TASK_HALL_DETECT_DEADLINE_US);
+    sched_set_task(TASK_ROUTINE_RESULT, Task_RoutineResult,
+            TASK_RESULT_PERIOD_MS, TASK_RESULT_DEADLINE_US);
+    // Push dashboard data if the display asked for it
+    sched_set_task(TASK_DASHBOARD, dashboard_service,
+            TASK_DASHBOARD_PERIOD_MS, TASK_DASHBOARD_DEADLINE_US);
+    sched_set_task(TASK_PUSHBUTTON, Task_Pushbutton,
+            TASK_PUSHBUTTON_PERIOD_MS, TASK_PUSHBUTTON_DEADLINE_US);
+    sched_set_task(TASK_BMS_REFRESH, Task_BmsRefresh,
+            TASK_BMS_REFRESH_PERIOD_MS, TASK_BMS_REFRESH_DEADLINE_US);
+    sched_set_task(TASK_TEMPERATURE, Task_Temperature,
+            TASK_TEMPERATURE_PERIOD_MS, TASK_TEMPERATURE_DEADLINE_US);
+    // Save the state of charge while the pack rests
+    sched_set_task(TASK_SOC_SAVE, soc_service,
+            TASK_SOC_SAVE_PERIOD_MS, SCHED_NO_DEADLINE);
+    sched_set_task(TASK_EEPROM, Task_Eeprom,
+            TASK_EEPROM_PERIOD_MS, SCHED_NO_DEADLINE);
+    sched_set_task(TASK_BMS_DEBUG, Task_BmsDebug,
+            TASK_BMS_DEBUG_PERIOD_MS, SCHED_NO_DEADLINE);
+#ifdef DEBUG_DUMP_USED
+    sched_set_task(TASK_DEBUG_DUMP, Task_DebugDump,
+            TASK_DEBUG_DUMP_PERIOD_MS, SCHED_NO_DEADLINE);
+#endif // DEBUG_DUMP_USED
+    // Last, so it's only fed when every task ahead of it gets to run
+    sched_set_task(TASK_WATCHDOG, WDT_feed,
+            TASK_WATCHDOG_PERIOD_MS, TASK_WATCHDOG_DEADLINE_US);
+    // Keep the debugger connected while the core sleeps
+    DBGMCU->CR |= DBGMCU_CR_DBG_SLEEP;
+    sched_run();
+}
 
+static uint32_t MAIN_GetMicros(void) {
+    return TIMESTAMP_TIM->CNT;
+}
 
-        if (pb_state == PB_PRESSED) {
-            // Wait until release
-            while (pb_state == PB_PRESSED) {
-            }
-            // Change data output state
-            g_MainFlags ^= MAINFLAG_SERIALDATAON;
-        }
+static void Task_Telemetry(void) {
+    if (g_MainFlags & MAINFLAG_SERIALDATAON) {
+        telemetry_send();
+    }
+}
 
-        if(g_MainFlags & MAINFLAG_CHECKBMS) {
-            g_MainFlags &= ~MAINFLAG_CHECKBMS;
-            if((!BMS_Busy()) && BMS_Is_Connected()) {
-                if((g_errorCode & MAIN_FAULT_BMS_COMM) == 0) {
-                    BMS_Refresh_Data();
-                }
-            }
-        }
+static void Task_HallDetect(void) {
+    if (Mctrl.state == Motor_OpenLoop) {
+        RunHallDetectRoutine();
+    }
+}
 
-        if (g_MainFlags & MAINFLAG_CONVERTTEMPERATURE) {
-            g_MainFlags &= ~MAINFLAG_CONVERTTEMPERATURE;
-            g_FetTemp = adcGetTempDegC();
-            g_MotorTemp = 25.0f;
-        }
-        if (g_MainFlags & MAINFLAG_SERIALDATAON) {
-            if (usb_debug_buffer_pos > 0) {
-                if (VCP_Write(usb_debug_buffer, usb_debug_buffer_pos) != -1) {
-                    usb_debug_buffer_pos = 0;
-                }
-            }
+// Sends the result of the Hall detect routine to the link that started it.
+// If there's no room this time, it goes on the next retry.
+static void Task_RoutineResult(void) {
+    uint32_t flag;
+    uint8_t sent;
+
+    if (g_MainFlags & MAINFLAG_HALLDETECTFAIL) {
+        flag = MAINFLAG_HALLDETECTFAIL;
+        // Create a response packet, all angles are NaN
+        memset(usb_debug_data_buffer, 0xFF, 6*sizeof(float));
+    } else if (g_MainFlags & MAINFLAG_HALLDETECTPASS) {
+        flag = MAINFLAG_HALLDETECTPASS;
+        // Create a response packet with the six Hall angles
+        for(uint8_t ii = 0; ii < 6; ii++) {
+            data_packet_pack_float(&(usb_debug_data_buffer[ii*sizeof(float)]), g_hallDetectTable[ii]);
         }
-        if (g_MainFlags & MAINFLAG_HALLDETECTFAIL) {
-            // Create a response packet, all angles are NaN
-            memset(usb_debug_data_buffer, 0xFF, 6*sizeof(float));
-            usb_debug_packet.TxBuffer = usb_debug_buffer;
-            if (data_packet_create(&usb_debug_packet,
-                    ROUTINE_RESULT, usb_debug_data_buffer,
-                    6 * sizeof(float))) {
-                if(g_MainFlags & MAINFLAG_LASTCOMMSERIAL) {
-                    HBD_SendWrapper((char*)usb_debug_buffer, usb_debug_packet.TxLength);
-                } else {
-                    VCP_SendWrapper((char*)usb_debug_buffer, usb_debug_packet.TxLength);
-                }
-                g_MainFlags &= ~(MAINFLAG_HALLDETECTFAIL);
-            }
+    } else {
+        return;
+    }
+    usb_debug_packet.TxBuffer = usb_debug_buffer;
+    usb_debug_packet.Framing = (g_MainFlags & MAINFLAG_LASTCOMMSERIAL) ?
+            HBD_Get_Framing() : USB_Data_Comm_Get_Framing();
+    if (data_packet_create(&usb_debug_packet,
+            ROUTINE_RESULT, usb_debug_data_buffer,
+            6 * sizeof(float))) {
+        if(g_MainFlags & MAINFLAG_LASTCOMMSERIAL) {
+            sent = HBD_SendWrapper((char*)usb_debug_buffer, usb_debug_packet.TxLength);
+        } else {
+            sent = VCP_SendWrapper((char*)usb_debug_buffer, usb_debug_packet.TxLength);
         }
-        if (g_MainFlags & MAINFLAG_HALLDETECTPASS) {
-            // Create a response packet with the six Hall angles
-            for(uint8_t ii = 0; ii < 6; ii++) {
-                data_packet_pack_float(&(usb_debug_data_buffer[ii*sizeof(float)]), g_hallDetectTable[ii]);
-            }
-            usb_debug_packet.TxBuffer = usb_debug_buffer;
-            if(data_packet_create(&usb_debug_packet, ROUTINE_RESULT, usb_debug_data_buffer, 6*sizeof(float))) {
-                if(g_MainFlags & MAINFLAG_LASTCOMMSERIAL) {
-                    HBD_SendWrapper((char*)usb_debug_buffer, usb_debug_packet.TxLength);
-                } else {
-                    VCP_SendWrapper((char*)usb_debug_buffer, usb_debug_packet.TxLength);
-                }
-                g_MainFlags &= ~(MAINFLAG_HALLDETECTPASS);
-            }
+        if (sent) {
+            g_MainFlags &= ~flag;
         }
+    }
+}
 
-        // DEBUG STUFF
-        if(g_MainFlags & MAINFLAG_DEBUG_SENDBMSRESET) {
-            g_MainFlags &= ~MAINFLAG_DEBUG_SENDBMSRESET;
-            uint8_t mydata[4];
-            mydata[0] = BROADCAST_ADDRESS;
-            mydata[1] = 0x00;
-            mydata[2] = 0x01;
-            mydata[3] = 0;
-            BMS_Send_One_Packet(SET_RAM_VARIABLE, mydata, 4);
-        }
-        if(g_MainFlags & MAINFLAG_DEBUG_SETBMSADDR) {
-            g_MainFlags &= ~MAINFLAG_DEBUG_SETBMSADDR;
-            uint8_t mydata1[4];
-            mydata1[0] = 0;
-            mydata1[1] = 0x00;
-            mydata1[2] = 0x01;
-            mydata1[3] = 1;
-            BMS_Send_One_Packet(SET_RAM_VARIABLE, mydata1, 4);
-        }
-        if(g_MainFlags & MAINFLAG_DEBUG_ASKBMSBATTS) {
-            g_MainFlags &= ~MAINFLAG_DEBUG_ASKBMSBATTS;
-            uint8_t mydata2[3];
-            mydata2[0] = 1;
-            mydata2[1] = 0x01;
-            mydata2[2] = 0x21;
-            BMS_Send_One_Packet(GET_RAM_VARIABLE, mydata2, 3);
-        }
+// Change data output state when the button is let go
+static void Task_Pushbutton(void) {
+    static PB_TypeDef last_state = PB_RELEASED;
 
+    if ((last_state == PB_PRESSED) && (pb_state == PB_RELEASED)) {
+        g_MainFlags ^= MAINFLAG_SERIALDATAON;
+    }
+    last_state = pb_state;
+}
 
-        if (Mctrl.state == Motor_OpenLoop) {
-            RunHallDetectRoutine();
+static void Task_BmsRefresh(void) {
+    if((!BMS_Busy()) && BMS_Is_Connected()) {
+        if((g_errorCode & MAIN_FAULT_BMS_COMM) == 0) {
+            BMS_Refresh_Data();
         }
+    }
+}
 
-#ifdef DEBUG_DUMP_USED
-        if(g_MainFlags & MAINFLAG_DUMPDATAON)
-        {
-            if(g_MainFlags & MAINFLAG_DUMPDATAPRINT)
-            {
-                g_MainFlags &= ~(MAINFLAG_DUMPDATAPRINT);
-                usbstring[0] = 0;
-                for(uint8_t i = 0; i < 4; i++)
-                {
-                    _itoa(string, (int32_t)GetDumpData(), 0);
-                    strcat(usbstring,string);
-                    strcat(usbstring," ");
-                }
-                strcat(usbstring,"\r\n");
-                VCP_Write(usbstring,strlen(usbstring));
-                if(DumpDone())
-                {
-                    DumpReset();
-                    g_MainFlags &= ~(MAINFLAG_DUMPDATAON);
-                }
-            }
-        }
-#endif // DEBUG_DUMP_USED
+static void Task_Temperature(void) {
+    g_FetTemp = adcGetTempDegC();
+    g_MotorTemp = 25.0f;
+}
 
-    }
+// Finish an EEPROM page transfer. The erase stalls every fetch from
+// flash, interrupts included, so it waits until the motor is off.
+static void Task_Eeprom(void) {
+    EE_Service(Mctrl.state == Motor_Off);
 }
 
-static void VCP_SendWrapper(char* buf, uint32_t len) {
-    if (len <= CDC_DATA_FS_MAX_PACKET_SIZE) {
-        while (VCP_Write(buf, len) < 0)
-            ;
-    } else {
-        uint32_t vcp_pointer = 0;
-        while (len > 0) {
-            if (len > (CDC_DATA_FS_MAX_PACKET_SIZE - 4)) {
-                while (VCP_Write(&(buf[vcp_pointer]),
-                        (CDC_DATA_FS_MAX_PACKET_SIZE - 4)) < 0)
-                    ;
-                vcp_pointer += (CDC_DATA_FS_MAX_PACKET_SIZE - 4);
-                len -= (CDC_DATA_FS_MAX_PACKET_SIZE - 4);
-            } else {
-                while (VCP_Write(&(buf[vcp_pointer]), len) < 0)
-                    ;
-                len = 0;
-            }
-        }
+// DEBUG STUFF
+static void Task_BmsDebug(void) {
+    if(g_MainFlags & MAINFLAG_DEBUG_SENDBMSRESET) {
+        g_MainFlags &= ~MAINFLAG_DEBUG_SENDBMSRESET;
+        uint8_t mydata[4];
+        mydata[0] = BROADCAST_ADDRESS;
+        mydata[1] = 0x00;
+        mydata[2] = 0x01;
+        mydata[3] = 0;
+        BMS_Send_One_Packet(SET_RAM_VARIABLE, mydata, 4);
+    }
+    if(g_MainFlags & MAINFLAG_DEBUG_SETBMSADDR) {
+        g_MainFlags &= ~MAINFLAG_DEBUG_SETBMSADDR;
+        uint8_t mydata1[4];
+        mydata1[0] = 0;
+        mydata1[1] = 0x00;
+        mydata1[2] = 0x01;
+        mydata1[3] = 1;
+        BMS_Send_One_Packet(SET_RAM_VARIABLE, mydata1, 4);
+    }
+    if(g_MainFlags & MAINFLAG_DEBUG_ASKBMSBATTS) {
+        g_MainFlags &= ~MAINFLAG_DEBUG_ASKBMSBATTS;
+        uint8_t mydata2[3];
+        mydata2[0] = 1;
+        mydata2[1] = 0x01;
+        mydata2[2] = 0x21;
+        BMS_Send_One_Packet(GET_RAM_VARIABLE, mydata2, 3);
     }
 }
 
-static void HBD_SendWrapper(char *buf, uint32_t len) {
-    if (len <= HBD_BUFFER_LENGTH) {
-        while (UART_IsFinishedTx(SELECT_HBD_UART) == 0)
-            ;
-        UART_Write(SELECT_HBD_UART, buf, len);
-    } else {
-        uint32_t hbd_pointer = 0;
-        while (len > 0) {
-            if (len > (HBD_BUFFER_LENGTH)) {
-                while (UART_IsFinishedTx(SELECT_HBD_UART) == 0)
-                    ;
-               UART_Write(SELECT_HBD_UART, &(buf[hbd_pointer]),
-                        HBD_BUFFER_LENGTH);
-                hbd_pointer += HBD_BUFFER_LENGTH;
-                len -= HBD_BUFFER_LENGTH;
-            } else {
-                while (UART_IsFinishedTx(SELECT_HBD_UART) == 0)
-                    ;
-                UART_Write(SELECT_HBD_UART, &(buf[hbd_pointer]), len);
-                len = 0;
-            }
+#ifdef DEBUG_DUMP_USED
+static void Task_DebugDump(void) {
+    char string[32];
+    char usbstring[64];
+
+    // Wait until the link is free, it would end up inside another packet
+    if((g_MainFlags & MAINFLAG_DUMPDATAON) && (!USB_Data_Comm_Tx_Busy()))
+    {
+        usbstring[0] = 0;
+        for(uint8_t i = 0; i < 4; i++)
+        {
+            _itoa(string, (int32_t)GetDumpData(), 0);
+            strcat(usbstring,string);
+            strcat(usbstring," ");
+        }
+        strcat(usbstring,"\r\n");
+        VCP_Write(usbstring,strlen(usbstring));
+        if(DumpDone())
+        {
+            DumpReset();
+            g_MainFlags &= ~(MAINFLAG_DUMPDATAON);
         }
     }
 }
+#endif // DEBUG_DUMP_USED
+
+// One try, so a busy USB link can't hold up the loop. Taken whole or
+// not at all, it can't land in the middle of another packet.
+static uint8_t VCP_SendWrapper(char* buf, uint32_t len) {
+    return USB_Data_Comm_Send((uint8_t*) buf, (uint16_t) len);
+}
+
+// Queued as a whole or dropped, the debug output can't hold up the loop
+static uint8_t HBD_SendWrapper(char *buf, uint32_t len) {
+    return (UART_Write(SELECT_HBD_UART, buf, len) > 0);
+}
 /**
  * @brief  System Clock Configuration
  *         The system Clock is configured as follow :
@@ -634,18 +691,20 @@ static void User_BasicTim_Init(void) {
 
 }
 
+// Free running 1MHz counter, timestamps telemetry frames
+static void User_TimestampTim_Init(void) {
+    TIMESTAMP_TIMER_CLK_ENABLE();
+
+    TIMESTAMP_TIM->PSC = (TIMESTAMP_CLK / 1000000) - 1; // 1MHz count
+    TIMESTAMP_TIM->ARR = 0xFFFFFFFF; // 32-bit counter, wraps after ~71 minutes
+    TIMESTAMP_TIM->EGR = TIM_EGR_UG; // Load the prescaler
+    TIMESTAMP_TIM->CR1 = TIM_CR1_CEN;
+}
+
 void SYSTICK_IRQHandler(void) {
     g_MainSysTick++;
-
-    if ((g_MainSysTick % SERIAL_DUMP_RATE) == 0) {
-        g_MainFlags |= MAINFLAG_DUMPDATAPRINT;
-    }
-    if ((g_MainSysTick % TEMP_CONVERSION_RATE) == 0) {
-        g_MainFlags |= MAINFLAG_CONVERTTEMPERATURE;
-    }
-    if((g_MainSysTick % BMS_CHECK_RATE) == 0) {
-        g_MainFlags |= MAINFLAG_CHECKBMS;
-    }
+    // Release the main loop tasks that are due
+    sched_tick();
 }
 
 // TIM1 overflow / update IRQ (20kHz)
@@ -666,7 +725,7 @@ void User_PWMTIM_IRQ(void) {
     HallSensor2_Inc_Angle();
 #endif
 #ifdef TESTING_PLL
-    HallSensorPLL_Update();
+    HallSensorPLL_Inc_Angle();
 #endif
     dfsl_rampgenf(&g_rampAngle, g_rampInc);
     Mctrl.RampAngle = g_rampAngle;
@@ -711,6 +770,82 @@ void User_PWMTIM_IRQ(void) {
 
     PWM_SetDuty(tA, tB, tC);
 
+    // Everything that can wait a few cycles goes in the mid-rate loop
+    g_PWMCycleCount++;
+    if (++g_MidRateCount >= g_MidRateDecimation) {
+        g_MidRateCount = 0;
+        if (SCB->ICSR & SCB_ICSR_PENDSVSET_Msk) {
+            // Last one hasn't even started
+            g_MidRateOverruns++;
+        }
+        SCB->ICSR = SCB_ICSR_PENDSVSET_Msk;
+    }
+
+    RLED_PORT->BSRR = (1 << (RLED_PIN + 16));
+
+}
+
+// PendSV, every g_MidRateDecimation PWM cycles (see MIDRATE_MAX_FREQ).
+// Below the PWM and Hall interrupts, above the app timer and the links.
+// Runs what doesn't have to keep up with the PWM: the PLL correction,
+// power calcs, the live values and telemetry.
+void User_MidRate_IRQ(void) {
+    uint32_t cycle = g_PWMCycleCount;
+    uint32_t elapsed = cycle - g_MidRateLastCycle;
+    g_MidRateLastCycle = cycle;
+    if (elapsed > 0xFFFF) {
+        elapsed = 0xFFFF;
+    }
+
+#ifdef TESTING_PLL
+    HallSensorPLL_Update((uint16_t) elapsed);
+#endif
+
+    // Power calcs
+    if (config_main.ControlMethod == Control_BLDC) {
+        // Different method for six-step
+        // Choose just one current, whichever has the low-side fet turned on
+        switch(Mobv.HallState){
+        case 2:
+        case 6:
+            // Phase A is low
+            Mpc.PhaseCurrent = (1.0f-Mpc.Filter)*Mpc.PhaseCurrent
+                                - (Mpc.Filter*Mobv.iA);
+            break;
+        case 4:
+        case 5:
+            // Phase B is low
+            Mpc.PhaseCurrent = (1.0f-Mpc.Filter)*Mpc.PhaseCurrent
+                                - (Mpc.Filter*Mobv.iB);
+            break;
+        case 1:
+        case 3:
+            // Phase C is low
+            Mpc.PhaseCurrent = (1.0f-Mpc.Filter)*Mpc.PhaseCurrent
+                                - (Mpc.Filter*Mobv.iC);
+            break;
+        default:
+            Mpc.PhaseCurrent = 0.0f;
+            break;
+        }
+        // Battery current is just phase current scaled to duty cycle
+        // All duty cycles (tA, tB, tC) are the same in six-step, so
+        // we can pick any one.
+        Mpc.BatteryCurrent = (Mpwm.tA) * (Mpc.PhaseCurrent);
+        Mpc.Vbus = Mctrl.BusVoltage;
+        // Total power is battery volts * battery amps
+        Mpc.TotalPower = (Mpc.Vbus) * (Mpc.BatteryCurrent);
+
+    } else {
+        Mpc.Ta = Mpwm.tA;
+        Mpc.Tb = Mpwm.tB;
+        Mpc.Tc = Mpwm.tC;
+        Mpc.Vbus = Mctrl.BusVoltage;
+        Mpc.Ialpha = Mfoc.Clarke_Alpha;
+        Mpc.Ibeta = Mfoc.Clarke_Beta;
+        power_calc(&Mpc);
+    }
+
     // USB Debugging outputs
     usbdacvals[0] = Mobv.iA;
     usbdacvals[1] = Mobv.iB;
@@ -746,25 +881,9 @@ void User_PWMTIM_IRQ(void) {
 //        usbdacvals[18] = (float) HallSensor_Get_State();
 #endif
 
-    // Load up the output buffer
+    // Sample the telemetry channels, main loop sends the frames
     if (g_MainFlags & MAINFLAG_SERIALDATAON) {
-        if ((--usb_debug_countdown_timer) == 0) {
-            for (uint8_t i = 0; i < config_main.Num_USB_Outputs; i++) {
-                data_packet_pack_float(
-                        &(usb_debug_data_buffer[i * sizeof(float)]),
-                        usbdacvals[config_main.USB_Choices[i] - 1]);
-            }
-            usb_debug_packet.TxBuffer = usb_debug_buffer;
-            if (data_packet_create(&usb_debug_packet,
-            CONTROLLER_STREAM_DATA, usb_debug_data_buffer,
-                    config_main.Num_USB_Outputs * sizeof(float))) {
-                usb_debug_buffer_pos = usb_debug_packet.TxLength;
-            } else {
-                usb_debug_buffer_pos = 0;
-            }
-
-            usb_debug_countdown_timer = usb_debug_countdown_reload;
-        }
+        telemetry_sample(cycle, elapsed);
     }
 
 #ifdef DEBUG_DUMP_USED
@@ -777,14 +896,11 @@ void User_PWMTIM_IRQ(void) {
         }
     }
 #endif // DEBUG_DUMP_USED
-
-    RLED_PORT->BSRR = (1 << (RLED_PIN + 16));
-
 }
 
 // Simple application timer (1kHz)
 // Does all the throttle processing
-// Calculates power usage
+// Keeps the energy totals
 void User_BasicTIM_IRQ(void) {
 
     // Use a temporary holding variable. Only set the real throttle once!
@@ -805,18 +921,25 @@ void User_BasicTIM_IRQ(void) {
     config_main.throttle_limit_scale = 1.0f;
 
     // Voltage limit
+    float volt_scale = 1.0f;
     if (Mctrl.BusVoltage < config_main.VoltageSoftCap) {
         if (Mctrl.BusVoltage < config_main.VoltageHardCap) {
             // Completely shut off!
-            config_main.throttle_limit_scale = 0.0f;
+            volt_scale = 0.0f;
             g_errorCode |= MAIN_FAULT_UV;
         } else {
             // Trim by scaling
-            config_main.throttle_limit_scale *= (Mctrl.BusVoltage
-                    - config_main.VoltageHardCap)
+            volt_scale = (Mctrl.BusVoltage - config_main.VoltageHardCap)
                     / (config_main.VoltageSoftCap - config_main.VoltageHardCap);
         }
     }
+    // Same limit, but before the bus sags. Both describe the same sag, so
+    // only the lower of the two applies.
+    float sag_scale = MAIN_SagLimit(temp_throttle_command);
+    if (sag_scale < volt_scale) {
+        volt_scale = sag_scale;
+    }
+    config_main.throttle_limit_scale *= volt_scale;
     // FET temperature limit
     if (g_FetTemp > config_main.FetTempSoftCap) {
         if (g_FetTemp > config_main.FetTempHardCap) {
@@ -841,12 +964,14 @@ void User_BasicTIM_IRQ(void) {
                             - config_main.MotorTempSoftCap);
         }
     }
+    // Battery cell limits, when there's a BMS
+    MAIN_CellLimit();
 
     // Is there a fault state from previously?
-    if((g_errorCode & (MAIN_FAULT_UV|MAIN_FAULT_FETTEMP|MAIN_FAULT_MOTORTEMP))!= 0) {
+    if((g_errorCode & (MAIN_FAULT_UV|MAIN_FAULT_FETTEMP|MAIN_FAULT_MOTORTEMP|MAIN_FAULT_BMS_UV))!= 0) {
         // We can reset if the throttle position is back to zero
         if(temp_throttle_command <= 0.0f) {
-            g_errorCode &= ~(MAIN_FAULT_UV|MAIN_FAULT_FETTEMP|MAIN_FAULT_MOTORTEMP);
+            g_errorCode &= ~(MAIN_FAULT_UV|MAIN_FAULT_FETTEMP|MAIN_FAULT_MOTORTEMP|MAIN_FAULT_BMS_UV);
         }
         // Otherwise, keep that motor disabled
         else {
@@ -906,51 +1031,121 @@ void User_BasicTIM_IRQ(void) {
         }
     }
 
-    // Power calcs
-    if (config_main.ControlMethod == Control_BLDC) {
-        // Different method for six-step
-        // Choose just one current, whichever has the low-side fet turned on
-        switch(Mobv.HallState){
-        case 2:
-        case 6:
-            // Phase A is low
-            Mpc.PhaseCurrent = (1.0f-POWER_CALCS_LPF_MULTIPLIER)*Mpc.PhaseCurrent
-                                - (POWER_CALCS_LPF_MULTIPLIER*Mobv.iA);
-            break;
-        case 4:
-        case 5:
-            // Phase B is low
-            Mpc.PhaseCurrent = (1.0f-POWER_CALCS_LPF_MULTIPLIER)*Mpc.PhaseCurrent
-                                - (POWER_CALCS_LPF_MULTIPLIER*Mobv.iB);
-            break;
-        case 1:
-        case 3:
-            // Phase C is low
-            Mpc.PhaseCurrent = (1.0f-POWER_CALCS_LPF_MULTIPLIER)*Mpc.PhaseCurrent
-                                - (POWER_CALCS_LPF_MULTIPLIER*Mobv.iC);
-            break;
-        default:
-            Mpc.PhaseCurrent = 0.0f;
-            break;
-        }
-        // Battery current is just phase current scaled to duty cycle
-        // All duty cycles (tA, tB, tC) are the same in six-step, so
-        // we can pick any one.
-        Mpc.BatteryCurrent = (Mpwm.tA) * (Mpc.PhaseCurrent);
-        Mpc.Vbus = Mctrl.BusVoltage;
-        // Total power is battery volts * battery amps
-        Mpc.TotalPower = (Mpc.Vbus) * (Mpc.BatteryCurrent);
+    // State of charge and trip totals, wheel speed in m/s
+    float wheel_speed = fabsf(HallSensor_Get_Speedf())
+            * config_main.inv_pole_pairs * PI * config_main.WheelSizeMM
+            * 0.001f / config_main.GearRatio;
+    soc_update(Mpc.BatteryCurrent, Mpc.Vbus, wheel_speed);
+    trip_update(Mpc.BatteryCurrent, Mpc.Vbus, wheel_speed);
+    // Pack resistance, for MAIN_SagLimit
+    batt_model_update(Mpc.BatteryCurrent, Mctrl.BusVoltage);
+}
 
-    } else {
-        Mpc.Ta = Mpwm.tA;
-        Mpc.Tb = Mpwm.tB;
-        Mpc.Tc = Mpwm.tC;
-        Mpc.Vbus = Mctrl.BusVoltage;
-        Mpc.Ialpha = Mfoc.Clarke_Alpha;
-        Mpc.Ibeta = Mfoc.Clarke_Beta;
-        power_calc(&Mpc);
+/**
+ * @brief  Main Cell Limit
+ *         Trims the throttle on the weakest battery cell, and regen on the
+ *         highest, instead of only on the pack voltage, which hides one
+ *         cell sagging below the rest. A cell's reading is only as fresh as
+ *         the last BMS refresh, so it's moved to the present battery
+ *         current with the cell resistance:
+ *         V = Vread - (I - Iread) * R
+ *         where Iread is the average current over the refresh interval the
+ *         reading came from.
+ */
+static void MAIN_CellLimit(void) {
+    float vmin = BMS_Get_Min_Cell_Voltage();
+    float vmax = BMS_Get_Max_Cell_Voltage();
+    float amps = Mpc.BatteryCurrent;
+    uint32_t refresh = BMS_Get_Refresh_Count();
+
+    config_main.regen_limit_scale = 1.0f;
+    if ((!BMS_Is_Connected()) || (vmin < 0.0f) || (vmax < 0.0f)) {
+        g_CellMinLoaded = -1.0f;
+        g_CellMaxLoaded = -1.0f;
+        return;
+    }
+
+    g_CellCurrentSum += amps;
+    g_CellCurrentCount++;
+    if (refresh != g_CellRefreshSeen) {
+        g_CellRefreshSeen = refresh;
+        g_CellReadCurrent = g_CellCurrentSum / g_CellCurrentCount;
+        g_CellCurrentSum = 0.0f;
+        g_CellCurrentCount = 0;
+    }
+    float sag = (amps - g_CellReadCurrent) * config_main.CellResistance;
+    g_CellMinLoaded = vmin - sag;
+    g_CellMaxLoaded = vmax - sag;
+
+    if (g_CellMinLoaded < config_main.CellSoftCap) {
+        if (g_CellMinLoaded < config_main.CellHardCap) {
+            // Completely shut off!
+            config_main.throttle_limit_scale = 0.0f;
+            g_errorCode |= MAIN_FAULT_BMS_UV;
+        } else {
+            config_main.throttle_limit_scale *= (g_CellMinLoaded
+                    - config_main.CellHardCap)
+                    / (config_main.CellSoftCap - config_main.CellHardCap);
+        }
+    }
+    // Charging raises the cell, so regen is cut before it goes over
+    if (g_CellMaxLoaded > config_main.CellRegenSoftCap) {
+        if (g_CellMaxLoaded > config_main.CellRegenHardCap) {
+            config_main.regen_limit_scale = 0.0f;
+        } else {
+            config_main.regen_limit_scale = (config_main.CellRegenHardCap
+                    - g_CellMaxLoaded)
+                    / (config_main.CellRegenHardCap - config_main.CellRegenSoftCap);
+        }
     }
+}
 
+/**
+ * @brief  Main Sag Limit
+ *         The voltage limit only acts once the bus has already sagged. With
+ *         the pack's open circuit voltage and resistance from the battery
+ *         model, the sag can be seen coming. At full demand the battery
+ *         would draw Idem, scaled from the present current per unit of
+ *         throttle. The throttle scale s that puts the predicted voltage on
+ *         the same soft cap ramp as the measured limit,
+ *         s = (V - Vhard) / (Vsoft - Vhard), where V = Voc - R * Idem * s
+ *         works out to
+ *         s = (Voc - Vhard) / ((Vsoft - Vhard) + R * Idem)
+ *         The caller takes the lower of this and the measured limit, they
+ *         are two views of the same sag. Faults are still left to the
+ *         measured voltage.
+ * @param  demand - throttle asked for, before any limits
+ * @retval Predicted throttle scale, 1 if there's no battery model
+ */
+static float MAIN_SagLimit(float demand) {
+    float applied = Mctrl.ThrottleCommand; // From the last period
+    float band = config_main.VoltageSoftCap - config_main.VoltageHardCap;
+    float voc, r, idem, scale;
+
+    if (applied > 0.05f) {
+        g_AmpsPerThrottle += POWER_CALCS_LPF_MULTIPLIER
+                * ((Mpc.BatteryCurrent / applied) - g_AmpsPerThrottle);
+    }
+    g_SagScale = 1.0f;
+    if ((!batt_model_valid()) || (band <= 0.0f)) {
+        g_SagVoltage = -1.0f;
+        return 1.0f;
+    }
+    voc = batt_model_get_voc();
+    r = batt_model_get_resistance();
+    idem = g_AmpsPerThrottle * demand;
+    if (idem < 0.0f) {
+        idem = 0.0f;
+    }
+    scale = (voc - config_main.VoltageHardCap) / (band + (r * idem));
+    if (scale < 1.0f) {
+        if (scale < 0.0f) {
+            scale = 0.0f;
+        }
+        g_SagScale = scale;
+    }
+    g_SagVoltage = voc - (r * idem * g_SagScale);
+    return g_SagScale;
 }
 
 float MAIN_GetCurrentRampAngle(void) {
@@ -1000,6 +1195,7 @@ static void RunHallDetectRoutine(void) {
             Mctrl.ThrottleCommand = 0.0f;
             Mctrl.state = Motor_Off;
             g_MainFlags |= MAINFLAG_HALLDETECTFAIL;
+            sched_signal(TASK_ROUTINE_RESULT);
         }
 
         if (HallSensor_Get_State() != hdhs.old_state) {
@@ -1022,6 +1218,7 @@ static void RunHallDetectRoutine(void) {
             Mctrl.ThrottleCommand = 0.0f;
             Mctrl.state = Motor_Off;
             g_MainFlags |= MAINFLAG_HALLDETECTFAIL;
+            sched_signal(TASK_ROUTINE_RESULT);
         }
         if (HallSensor_Get_State() != hdhs.old_state) {
             hdhs.transitions_seen++;
@@ -1046,6 +1243,7 @@ static void RunHallDetectRoutine(void) {
             }
 
             g_MainFlags |= MAINFLAG_HALLDETECTPASS;
+            sched_signal(TASK_ROUTINE_RESULT);
         }
     }
 }
@@ -1055,6 +1253,7 @@ uint8_t MAIN_SetUSBDebugOutput(uint8_t outputnum, uint8_t valuenum) {
     if ((outputnum >= MAX_USB_OUTPUTS) || (valuenum > MAX_USB_VALS))
         return DATA_PACKET_FAIL;
     config_main.USB_Choices[outputnum] = valuenum;
+    MAIN_DefaultTelemetry();
     return DATA_PACKET_SUCCESS;
 }
 
@@ -1065,6 +1264,7 @@ uint8_t MAIN_GetUSBDebugOutput(uint8_t outputnum) {
 uint8_t MAIN_SetNumUSBDebugOutputs(uint8_t numOutputs) {
     if (numOutputs <= MAX_USB_OUTPUTS) {
         config_main.Num_USB_Outputs = numOutputs;
+        MAIN_DefaultTelemetry();
         return DATA_PACKET_SUCCESS;
     }
     return DATA_PACKET_FAIL;
@@ -1077,8 +1277,7 @@ uint8_t MAIN_GetNumUSBDebugOutputs(void) {
 uint8_t MAIN_SetUSBDebugSpeed(uint8_t speedChoice) {
     if (speedChoice < MAX_USB_SPEED_CHOICES) {
         config_main.USB_Speed = speedChoice;
-        usb_debug_countdown_reload = usb_speed_choices[config_main.USB_Speed];
-        usb_debug_countdown_timer = usb_debug_countdown_reload;
+        MAIN_DefaultTelemetry();
         return DATA_PACKET_SUCCESS;
     }
     return DATA_PACKET_FAIL;
@@ -1088,6 +1287,32 @@ uint8_t MAIN_GetUSBDebugSpeed(void) {
     return config_main.USB_Speed;
 }
 
+/**
+ * @brief  Subscribes telemetry to the "USB" debugging outputs, all at the
+ *         "USB" speed. Replaces whatever the host had subscribed to.
+ */
+void MAIN_DefaultTelemetry(void) {
+    telemetry_clear();
+    for (uint8_t i = 0; i < config_main.Num_USB_Outputs; i++) {
+        // Zero is "none"
+        if (config_main.USB_Choices[i] > 0) {
+            telemetry_subscribe(CONFIG_LIVE_PREFIX + config_main.USB_Choices[i],
+                    0, usb_speed_choices[config_main.USB_Speed]);
+        }
+    }
+}
+
+/**
+ * @brief  Gets one of the debugging outputs, zero indexed (so output 1, Ia,
+ *         is index 0).
+ */
+float MAIN_GetLiveValue(uint8_t index) {
+    if (index < MAX_USB_VALS) {
+        return usbdacvals[index];
+    }
+    return 0.0f;
+}
+
 uint8_t MAIN_SetUSBDebugging(uint8_t on_or_off) {
     if (on_or_off == 0)
         g_MainFlags &= ~(MAINFLAG_SERIALDATAON);
@@ -1171,6 +1396,12 @@ uint8_t MAIN_SetFreq(int32_t newfreq) {
     if(PWM_SetFreq(newfreq) == DATA_PACKET_SUCCESS) {
         HallSensor_Change_Frequency(newfreq);
         config_main.PWMFrequency = newfreq;
+        // Mid-rate loop as fast as it's allowed to go
+        g_MidRateDecimation = (newfreq + MIDRATE_MAX_FREQ - 1) / MIDRATE_MAX_FREQ;
+        if (g_MidRateDecimation == 0) {
+            g_MidRateDecimation = 1;
+        }
+        Mpc.Filter = power_calc_filter((float) newfreq / g_MidRateDecimation);
         return DATA_PACKET_SUCCESS;
     }
     return DATA_PACKET_FAIL;
@@ -1281,6 +1512,9 @@ uint8_t MAIN_GetDashboardData(uint8_t* dataBuffer) {
     // Param6: F32: Controller FET Temperature (degC)
     // Param7: F32: Motor Temperature (degC)
     // Param8: I32: Fault Code
+    // Param9: F32: Battery state of charge (%)
+    // Param10: F32: Battery energy left (Wh)
+    // Param11: F32: Estimated range (km), at the energy per km of the last few km
 
     // MPH = eHz * wheel circ *3600 / polepairs
     // RPM = eHz * 60 / polepairs
@@ -1305,10 +1539,64 @@ uint8_t MAIN_GetDashboardData(uint8_t* dataBuffer) {
     data_packet_pack_float(dataBuffer, g_MotorTemp);
     dataBuffer+=4;
     data_packet_pack_32b(dataBuffer, g_errorCode);
+    dataBuffer+=4;
+    data_packet_pack_float(dataBuffer, soc_get_percent());
+    dataBuffer+=4;
+    data_packet_pack_float(dataBuffer, soc_get_wh_left());
+    dataBuffer+=4;
+    data_packet_pack_float(dataBuffer, trip_get_value(Trip_Range_Km));
 
     return DATA_PACKET_SUCCESS;
 }
 
+uint32_t MAIN_GetMidRateOverruns(void) {
+    return g_MidRateOverruns;
+}
+
+uint32_t MAIN_GetFaultCode(void) {
+    return g_errorCode;
+}
+
+float MAIN_GetCellMinLoaded(void) {
+    return g_CellMinLoaded;
+}
+
+/**
+ * @retval Bus voltage expected at the throttle allowed, -1 until the
+ *         battery model is ready
+ */
+float MAIN_GetSagVoltage(void) {
+    return g_SagVoltage;
+}
+
+float MAIN_GetCellMaxLoaded(void) {
+    return g_CellMaxLoaded;
+}
+
+/**
+ * @brief  Main Get Limit Flags
+ *         Which limits are trimming the throttle, as DASHBOARD_LIMIT_xx.
+ *         Same tests as the limit code in User_BasicTIM_IRQ.
+ */
+uint8_t MAIN_GetLimitFlags(void) {
+    uint8_t flags = 0;
+    if ((Mctrl.BusVoltage < config_main.VoltageSoftCap)
+            || (g_SagScale < 1.0f)) {
+        flags |= DASHBOARD_LIMIT_VOLTAGE;
+    }
+    if (g_FetTemp > config_main.FetTempSoftCap) {
+        flags |= DASHBOARD_LIMIT_FET_TEMP;
+    }
+    if (g_MotorTemp > config_main.MotorTempSoftCap) {
+        flags |= DASHBOARD_LIMIT_MOTOR_TEMP;
+    }
+    if ((g_CellMinLoaded >= 0.0f)
+            && (g_CellMinLoaded < config_main.CellSoftCap)) {
+        flags |= DASHBOARD_LIMIT_CELL;
+    }
+    return flags;
+}
+
 uint8_t MAIN_SetLimit(Main_Limit_Type lmt, float new_lmt) {
     uint8_t errCode = DATA_PACKET_SUCCESS;
     switch(lmt) {
@@ -1352,6 +1640,21 @@ uint8_t MAIN_SetLimit(Main_Limit_Type lmt, float new_lmt) {
     case Main_Limit_CurrentFault:
         config_main.CurrentFault = new_lmt;
         break;
+    case Main_Limit_SoftCell:
+        config_main.CellSoftCap = new_lmt;
+        break;
+    case Main_Limit_HardCell:
+        config_main.CellHardCap = new_lmt;
+        break;
+    case Main_Limit_SoftCellRegen:
+        config_main.CellRegenSoftCap = new_lmt;
+        break;
+    case Main_Limit_HardCellRegen:
+        config_main.CellRegenHardCap = new_lmt;
+        break;
+    case Main_Limit_CellResistance:
+        config_main.CellResistance = new_lmt;
+        break;
     default:
         errCode = DATA_PACKET_FAIL;
         break;
@@ -1400,6 +1703,21 @@ float MAIN_GetLimit(Main_Limit_Type lmt) {
     case Main_Limit_CurrentFault:
         retval = config_main.CurrentFault;
         break;
+    case Main_Limit_SoftCell:
+        retval = config_main.CellSoftCap;
+        break;
+    case Main_Limit_HardCell:
+        retval = config_main.CellHardCap;
+        break;
+    case Main_Limit_SoftCellRegen:
+        retval = config_main.CellRegenSoftCap;
+        break;
+    case Main_Limit_HardCellRegen:
+        retval = config_main.CellRegenHardCap;
+        break;
+    case Main_Limit_CellResistance:
+        retval = config_main.CellResistance;
+        break;
     default:
         retval = 0.0f;
         break;
@@ -1601,6 +1919,11 @@ void MAIN_SaveVariables(void) {
     EE_SaveFloat(CONFIG_LMT_VOLT_FAULT_MIN, config_main.MinVoltFault);
     EE_SaveFloat(CONFIG_LMT_VOLT_FAULT_MAX, config_main.MaxVoltFault);
     EE_SaveFloat(CONFIG_LMT_CUR_FAULT_MAX, config_main.CurrentFault);
+    EE_SaveFloat(CONFIG_LMT_CELL_SOFTCAP, config_main.CellSoftCap);
+    EE_SaveFloat(CONFIG_LMT_CELL_HARDCAP, config_main.CellHardCap);
+    EE_SaveFloat(CONFIG_LMT_CELL_REGEN_SOFTCAP, config_main.CellRegenSoftCap);
+    EE_SaveFloat(CONFIG_LMT_CELL_REGEN_HARDCAP, config_main.CellRegenHardCap);
+    EE_SaveFloat(CONFIG_LMT_CELL_RESISTANCE, config_main.CellResistance);
 
     EE_SaveFloat(CONFIG_MOTOR_WHEEL_SIZE, config_main.WheelSizeMM);
     EE_SaveFloat(CONFIG_MOTOR_GEAR_RATIO, config_main.GearRatio);
@@ -1673,6 +1996,11 @@ void MAIN_LoadVariables(void) {
     config_main.MinVoltFault = EE_ReadFloatWithDefault(CONFIG_LMT_VOLT_FAULT_MIN, DFLT_LMT_VOLT_FAULT_MIN);
     config_main.MaxVoltFault = EE_ReadFloatWithDefault(CONFIG_LMT_VOLT_FAULT_MAX, DFLT_LMT_VOLT_FAULT_MAX);
     config_main.CurrentFault = EE_ReadFloatWithDefault(CONFIG_LMT_CUR_FAULT_MAX, DFLT_LMT_CUR_FAULT_MAX);
+    config_main.CellSoftCap = EE_ReadFloatWithDefault(CONFIG_LMT_CELL_SOFTCAP, DFLT_LMT_CELL_SOFTCAP);
+    config_main.CellHardCap = EE_ReadFloatWithDefault(CONFIG_LMT_CELL_HARDCAP, DFLT_LMT_CELL_HARDCAP);
+    config_main.CellRegenSoftCap = EE_ReadFloatWithDefault(CONFIG_LMT_CELL_REGEN_SOFTCAP, DFLT_LMT_CELL_REGEN_SOFTCAP);
+    config_main.CellRegenHardCap = EE_ReadFloatWithDefault(CONFIG_LMT_CELL_REGEN_HARDCAP, DFLT_LMT_CELL_REGEN_HARDCAP);
+    config_main.CellResistance = EE_ReadFloatWithDefault(CONFIG_LMT_CELL_RESISTANCE, DFLT_LMT_CELL_RESISTANCE);
 
     config_main.GearRatio = EE_ReadFloatWithDefault(CONFIG_MOTOR_GEAR_RATIO, DFLT_MOTOR_GEAR_RATIO);
     config_main.WheelSizeMM = EE_ReadFloatWithDefault(CONFIG_MOTOR_WHEEL_SIZE, DFLT_MOTOR_WHEEL_SIZE);
@@ -1686,8 +2014,7 @@ void MAIN_LoadVariables(void) {
             DFLT_FOC_PWM_DEADTIME);
     MAIN_SetDeadTime(config_main.PWMDeadTime);
 
-    usb_debug_countdown_timer = usb_speed_choices[config_main.USB_Speed];
-    usb_debug_countdown_reload = usb_speed_choices[config_main.USB_Speed];
+    MAIN_DefaultTelemetry();
 
     g_rampInc = dfsl_rampctrlf((float) config_main.PWMFrequency,
             config_main.RampSpeed);
@@ -52,8 +52,8 @@ void power_calc(PowerCalcs* pc) {
     Vbeta = (2.0f * Vbn + Van) * (ONE_OVER_SQRT3_F);
 
     // Calculate total power
-    pc->TotalPower = (1.0f - POWER_CALCS_LPF_MULTIPLIER) * (pc->TotalPower) +
-            POWER_CALCS_LPF_MULTIPLIER * ( (1.5f)*((pc->Ialpha)*Van + (pc->Ibeta)*Vbeta) );
+    pc->TotalPower = (1.0f - pc->Filter) * (pc->TotalPower) +
+            pc->Filter * ( (1.5f)*((pc->Ialpha)*Van + (pc->Ibeta)*Vbeta) );
 
     // Calculate battery current using Pin = Pout, and Pin = Vbattery*Ibattery
     if(pc->Vbus > 0.01f) {
@@ -64,7 +64,16 @@ void power_calc(PowerCalcs* pc) {
     }
 
     // Also calculate the phase current using the magnitude of Ialpha & Ibeta
-    pc->PhaseCurrent = (1.0f - POWER_CALCS_LPF_MULTIPLIER) * (pc->PhaseCurrent) +
-            POWER_CALCS_LPF_MULTIPLIER * sqrtf(((pc->Ialpha) * (pc->Ialpha)) + ((pc->Ibeta) * (pc->Ibeta)));
+    pc->PhaseCurrent = (1.0f - pc->Filter) * (pc->PhaseCurrent) +
+            pc->Filter * sqrtf(((pc->Ialpha) * (pc->Ialpha)) + ((pc->Ibeta) * (pc->Ibeta)));
 
 }
+
+// Same time constant as POWER_CALCS_LPF_MULTIPLIER at POWER_CALCS_LPF_RATE
+float power_calc_filter(float rate_hz) {
+    if (rate_hz <= 0.0f) {
+        return POWER_CALCS_LPF_MULTIPLIER;
+    }
+    return 1.0f - powf(1.0f - POWER_CALCS_LPF_MULTIPLIER,
+            POWER_CALCS_LPF_RATE / rate_hz);
+}
@@ -0,0 +1,244 @@
+/******************************************************************************
+ * Filename: scheduler.c
+ * Description: Cooperative scheduler for the main loop. Periodic tasks are
+ *              released by the 1ms tick, event tasks by the interrupts that have
+ *              work for them, and the core sleeps when nothing is ready.
+ *
+ ******************************************************************************
+
+ Copyright (c) 2019 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#include <stddef.h>
+#include <string.h>
+#include "scheduler.h"
+
+// *** Global variables ***
+Sched_State Sched;
+
+static void sched_release(Sched_Task* task, uint8_t periodic);
+static void sched_wfi(void);
+
+/**
+ * @brief  Scheduler Init
+ *         Clears the task table. Tasks are added with sched_set_task.
+ * @param  now_us - free running microsecond clock, for the statistics
+ */
+void sched_init(uint32_t (*now_us)(void)) {
+    memset(&Sched, 0, sizeof(Sched));
+    Sched.NowUs = now_us;
+    Sched.Idle = sched_wfi;
+}
+
+/**
+ * @brief  Scheduler Set Task
+ * @param  id - task number, also its priority (lower runs first)
+ * @param  run - the task, has to return quickly
+ * @param  period_ms - runs this often, or 0 to only run when signalled
+ * @param  deadline_us - time from ready to finished that counts as a miss,
+ *         or SCHED_NO_DEADLINE
+ */
+void sched_set_task(uint8_t id, void (*run)(void), uint32_t period_ms,
+        uint32_t deadline_us) {
+    Sched_Task* task;
+
+    if (id >= SCHED_MAX_TASKS) {
+        return;
+    }
+    task = &Sched.Tasks[id];
+    task->PeriodMs = period_ms;
+    task->DeadlineUs = deadline_us;
+    task->Countdown = period_ms;
+    task->Run = run;
+}
+
+/**
+ * @brief  Scheduler Set Idle
+ *         Replaces what the main loop does when no task is ready, which is
+ *         a WFI by default. Runs with interrupts off and has to return once
+ *         one is pending.
+ */
+void sched_set_idle(void (*idle)(void)) {
+    Sched.Idle = (idle == NULL) ? sched_wfi : idle;
+}
+
+/**
+ * @brief  Scheduler Tick
+ *         Releases the periodic tasks that are due. Call from the 1ms
+ *         system tick interrupt.
+ */
+void sched_tick(void) {
+    for (uint8_t id = 0; id < SCHED_MAX_TASKS; id++) {
+        Sched_Task* task = &Sched.Tasks[id];
+        if ((task->Run == NULL) || (task->PeriodMs == 0)) {
+            continue;
+        }
+        if (--task->Countdown == 0) {
+            task->Countdown = task->PeriodMs;
+            sched_release(task, 1);
+        }
+    }
+}
+
+/**
+ * @brief  Scheduler Signal
+ *         Has a task run on the next pass, whatever its period. Safe to
+ *         call from any interrupt. Signals that arrive before the task gets
+ *         to run are handled by that one run.
+ */
+void sched_signal(uint8_t id) {
+    if ((id < SCHED_MAX_TASKS) && (Sched.Tasks[id].Run != NULL)) {
+        sched_release(&Sched.Tasks[id], 0);
+    }
+}
+
+/**
+ * @brief  Scheduler Run Once
+ *         One pass of the main loop: every task that is ready, in order,
+ *         then the idle hook if nothing has become ready in the meantime.
+ * @retval Number of tasks that ran
+ */
+uint8_t sched_run_once(void) {
+    uint8_t ran = 0;
+    uint8_t pending = 0;
+
+    for (uint8_t id = 0; id < SCHED_MAX_TASKS; id++) {
+        Sched_Task* task = &Sched.Tasks[id];
+        if (!task->Pending) {
+            continue;
+        }
+        __disable_irq();
+        uint32_t ready = task->ReadyUs;
+        task->Pending = 0;
+        __enable_irq();
+
+        uint32_t start = Sched.NowUs();
+        task->Run();
+        uint32_t end = Sched.NowUs();
+
+        task->Runs++;
+        if ((start - ready) > task->MaxLatencyUs) {
+            task->MaxLatencyUs = start - ready;
+        }
+        if ((end - start) > task->MaxRunUs) {
+            task->MaxRunUs = end - start;
+        }
+        if ((task->DeadlineUs != SCHED_NO_DEADLINE)
+                && ((end - ready) > task->DeadlineUs)) {
+            task->DeadlineMisses++;
+        }
+        ran++;
+    }
+
+    // An interrupt between the check and the WFI would be slept through
+    // until the next one, so check with them held off. WFI still wakes up.
+    __disable_irq();
+    for (uint8_t id = 0; id < SCHED_MAX_TASKS; id++) {
+        pending |= Sched.Tasks[id].Pending;
+    }
+    if (!pending) {
+        Sched.Idles++;
+        Sched.Idle();
+    }
+    __enable_irq();
+    return ran;
+}
+
+/**
+ * @brief  Scheduler Run
+ *         The main loop, never returns.
+ */
+void sched_run(void) {
+    while (1) {
+        sched_run_once();
+    }
+}
+
+const Sched_Task* sched_get_task(uint8_t id) {
+    if (id >= SCHED_MAX_TASKS) {
+        return NULL;
+    }
+    return &Sched.Tasks[id];
+}
+
+uint32_t sched_get_idles(void) {
+    return Sched.Idles;
+}
+
+float sched_get_latency(uint16_t id) {
+    if (id >= SCHED_MAX_TASKS) {
+        return 0.0f;
+    }
+    return (float) Sched.Tasks[id].MaxLatencyUs;
+}
+
+float sched_get_run_time(uint16_t id) {
+    if (id >= SCHED_MAX_TASKS) {
+        return 0.0f;
+    }
+    return (float) Sched.Tasks[id].MaxRunUs;
+}
+
+uint32_t sched_get_overruns(uint16_t id) {
+    if (id >= SCHED_MAX_TASKS) {
+        return 0;
+    }
+    return Sched.Tasks[id].Overruns;
+}
+
+uint32_t sched_get_deadline_misses(uint16_t id) {
+    if (id >= SCHED_MAX_TASKS) {
+        return 0;
+    }
+    return Sched.Tasks[id].DeadlineMisses;
+}
+
+void sched_clear_stats(void) {
+    for (uint8_t id = 0; id < SCHED_MAX_TASKS; id++) {
+        Sched_Task* task = &Sched.Tasks[id];
+        task->Runs = 0;
+        task->Overruns = 0;
+        task->DeadlineMisses = 0;
+        task->MaxLatencyUs = 0;
+        task->MaxRunUs = 0;
+    }
+    Sched.Idles = 0;
+}
+
+// The tick and the signals come from interrupts at different priorities
+static void sched_release(Sched_Task* task, uint8_t periodic) {
+    uint32_t primask = __get_PRIMASK();
+
+    __disable_irq();
+    if (task->Pending) {
+        if (periodic) {
+            task->Overruns++;
+        }
+    } else {
+        task->ReadyUs = Sched.NowUs();
+        task->Pending = 1;
+    }
+    __set_PRIMASK(primask);
+}
+
+static void sched_wfi(void) {
+    __WFI();
+}
@@ -0,0 +1,421 @@
+/******************************************************************************
+ * Filename: soc.c
+ * Description: Battery state of charge. Counts charge in and out of the pack and
+ *              corrects the count from the open circuit voltage whenever the pack
+ *              has rested. Learns the pack capacity and the energy used per km.
+ *
+ *              Counting runs in the app timer interrupt, EEPROM writes are left to
+ *              the main loop.
+ *
+ ******************************************************************************
+
+ Copyright (c) 2019 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#include "main.h"
+#include "soc.h"
+
+// *** Global variables ***
+Soc_State BattSoc;
+
+static const float SocOcvTable[SOC_OCV_POINTS] = SOC_OCV_TABLE;
+
+static void soc_second(float volts);
+static void soc_anchor(float volts);
+static float soc_cell_voltage(float volts);
+static uint16_t soc_cells(void);
+static float soc_from_ocv(float cell);
+static float soc_energy_left(float soc);
+
+void soc_init(void) {
+    BattSoc.AhCount = 0.0f;
+    BattSoc.AmpSum = 0.0f;
+    BattSoc.WattSum = 0.0f;
+    BattSoc.SpeedSum = 0.0f;
+    BattSoc.Samples = 0;
+    BattSoc.RestMs = 0;
+    BattSoc.Anchored = 0;
+    BattSoc.FirstAnchor = 1;
+    BattSoc.HaveAnchor = 0;
+    BattSoc.Anchors = 0;
+    BattSoc.TripWh = 0.0f;
+    BattSoc.TripM = 0.0f;
+    soc_load_variables();
+    BattSoc.WhLeft = soc_energy_left(BattSoc.Soc);
+    BattSoc.RangeKm = (BattSoc.WhLeft < 0.0f) ?
+            -1.0f : (BattSoc.WhLeft / BattSoc.WhPerKm);
+}
+
+/**
+ * @brief  SoC Update
+ *            Call at SOC_UPDATE_RATE with the battery readings.
+ * @param  amps - battery current, positive out of the pack
+ * @param  volts - battery voltage
+ * @param  speed - wheel speed in m/s
+ */
+void soc_update(float amps, float volts, float speed) {
+    BattSoc.AmpSum += amps;
+    BattSoc.WattSum += amps * volts;
+    BattSoc.SpeedSum += speed;
+    if (fabsf(amps) < SOC_REST_CURRENT) {
+        BattSoc.RestMs += (1000 / SOC_UPDATE_RATE);
+    } else {
+        BattSoc.RestMs = 0;
+        BattSoc.Anchored = 0;
+    }
+    if ((++BattSoc.Samples) >= SOC_UPDATE_RATE) {
+        soc_second(volts);
+    }
+}
+
+/**
+ * @brief  SoC Service
+ *            Call from the main loop. Writes whatever moved far enough to
+ *            EEPROM, only while resting, since a page transfer stops the
+ *            CPU long enough to upset the motor.
+ */
+void soc_service(void) {
+    float soc = BattSoc.Soc;
+    uint8_t saved = 0;
+
+    if (BattSoc.RestMs < SOC_SAVE_REST_MS) {
+        return;
+    }
+    EE_BeginBatch();
+    if ((soc >= 0.0f) && (fabsf(soc - BattSoc.SavedSoc) >= SOC_SAVE_STEP)) {
+        EE_SaveFloat(CONFIG_BATT_SOC, soc * 100.0f);
+        BattSoc.SavedSoc = soc;
+        saved = 1;
+    }
+    if (fabsf(BattSoc.CapacityAh - BattSoc.SavedAh)
+            >= (0.01f * BattSoc.CapacityAh)) {
+        EE_SaveFloat(CONFIG_BATT_LEARNED_AH, BattSoc.CapacityAh);
+        BattSoc.SavedAh = BattSoc.CapacityAh;
+        saved = 1;
+    }
+    if (fabsf(BattSoc.WhPerKm - BattSoc.SavedWhPerKm)
+            >= (0.05f * BattSoc.WhPerKm)) {
+        EE_SaveFloat(CONFIG_BATT_WH_PER_KM, BattSoc.WhPerKm);
+        BattSoc.SavedWhPerKm = BattSoc.WhPerKm;
+        saved = 1;
+    }
+    if (saved) {
+        // Or the configuration record would bring back the old values
+        config_blob_save();
+    }
+    EE_CommitBatch();
+}
+
+void soc_save_variables(void) {
+    EE_SaveInt16(CONFIG_BATT_SERIES_CELLS, BattSoc.SeriesCells);
+    EE_SaveFloat(CONFIG_BATT_RATED_AH, BattSoc.RatedAh);
+    EE_SaveFloat(CONFIG_BATT_LEARNED_AH, BattSoc.CapacityAh);
+    BattSoc.SavedAh = BattSoc.CapacityAh;
+    EE_SaveFloat(CONFIG_BATT_WH_PER_KM, BattSoc.WhPerKm);
+    BattSoc.SavedWhPerKm = BattSoc.WhPerKm;
+    if (BattSoc.Soc >= 0.0f) {
+        EE_SaveFloat(CONFIG_BATT_SOC, BattSoc.Soc * 100.0f);
+        BattSoc.SavedSoc = BattSoc.Soc;
+    }
+}
+
+void soc_load_variables(void) {
+    float percent;
+
+    BattSoc.SeriesCells = EE_ReadInt16WithDefault(CONFIG_BATT_SERIES_CELLS,
+            DFLT_BATT_SERIES_CELLS);
+    BattSoc.RatedAh = EE_ReadFloatWithDefault(CONFIG_BATT_RATED_AH,
+            DFLT_BATT_RATED_AH);
+    BattSoc.SavedAh = EE_ReadFloatWithDefault(CONFIG_BATT_LEARNED_AH,
+            DFLT_BATT_LEARNED_AH);
+    soc_set_learned_ah(BattSoc.SavedAh);
+    BattSoc.WhPerKm = EE_ReadFloatWithDefault(CONFIG_BATT_WH_PER_KM,
+            DFLT_BATT_WH_PER_KM);
+    BattSoc.SavedWhPerKm = BattSoc.WhPerKm;
+    percent = EE_ReadFloatWithDefault(CONFIG_BATT_SOC, DFLT_BATT_SOC);
+    BattSoc.Soc = (percent < 0.0f) ? -1.0f : (percent * 0.01f);
+    BattSoc.SavedSoc = BattSoc.Soc;
+}
+
+/**
+ * @retval State of charge in %, -1 until known
+ */
+float soc_get_percent(void) {
+    return (BattSoc.Soc < 0.0f) ? -1.0f : (BattSoc.Soc * 100.0f);
+}
+
+/**
+ * @brief  SoC Set Percent
+ *            Overrides the SoC, e.g. right after charging. Capacity
+ *            learning starts again from the next rested reading.
+ *            -1 means unknown, as read back before the first anchor, and
+ *            the SoC is taken from the voltage once the pack rests.
+ */
+uint8_t soc_set_percent(float percent) {
+    if ((percent < -1.0f) || (percent > 100.0f)) {
+        return DATA_PACKET_FAIL;
+    }
+    BattSoc.Soc = (percent < 0.0f) ? -1.0f : (percent * 0.01f);
+    BattSoc.HaveAnchor = 0;
+    return DATA_PACKET_SUCCESS;
+}
+
+/**
+ * @retval Energy left in Wh, -1 until the SoC is known
+ */
+float soc_get_wh_left(void) {
+    return BattSoc.WhLeft;
+}
+
+/**
+ * @retval Range in km, -1 until the SoC is known
+ */
+float soc_get_range_km(void) {
+    return BattSoc.RangeKm;
+}
+
+uint32_t soc_get_anchors(void) {
+    return BattSoc.Anchors;
+}
+
+uint16_t soc_get_series_cells(void) {
+    return BattSoc.SeriesCells;
+}
+
+uint8_t soc_set_series_cells(uint16_t cells) {
+    if (cells == 0) {
+        return DATA_PACKET_FAIL;
+    }
+    BattSoc.SeriesCells = cells;
+    return DATA_PACKET_SUCCESS;
+}
+
+float soc_get_rated_ah(void) {
+    return BattSoc.RatedAh;
+}
+
+uint8_t soc_set_rated_ah(float ah) {
+    if (ah <= 0.0f) {
+        return DATA_PACKET_FAIL;
+    }
+    BattSoc.RatedAh = ah;
+    // Keep the learned capacity inside the new bounds
+    return soc_set_learned_ah(BattSoc.CapacityAh);
+}
+
+float soc_get_learned_ah(void) {
+    return BattSoc.CapacityAh;
+}
+
+/**
+ * @brief  SoC Set Learned Ah
+ *            Zero (or less) starts over from the rated capacity.
+ */
+uint8_t soc_set_learned_ah(float ah) {
+    if (ah <= 0.0f) {
+        ah = BattSoc.RatedAh;
+    }
+    if (ah < (SOC_LEARN_MIN_RATIO * BattSoc.RatedAh)) {
+        ah = SOC_LEARN_MIN_RATIO * BattSoc.RatedAh;
+    }
+    if (ah > (SOC_LEARN_MAX_RATIO * BattSoc.RatedAh)) {
+        ah = SOC_LEARN_MAX_RATIO * BattSoc.RatedAh;
+    }
+    BattSoc.CapacityAh = ah;
+    return DATA_PACKET_SUCCESS;
+}
+
+float soc_get_wh_per_km(void) {
+    return BattSoc.WhPerKm;
+}
+
+uint8_t soc_set_wh_per_km(float whkm) {
+    if (whkm < SOC_CONSUMPTION_MIN) {
+        return DATA_PACKET_FAIL;
+    }
+    BattSoc.WhPerKm = whkm;
+    return DATA_PACKET_SUCCESS;
+}
+
+/**
+ * @brief  SoC Second
+ *            Folds one second of sums into the counts. Summing first keeps
+ *            the tiny per-sample charge from vanishing into the float.
+ */
+static void soc_second(float volts) {
+    const float to_hours = 1.0f / (3600.0f * SOC_UPDATE_RATE);
+    float ah = BattSoc.AmpSum * to_hours;
+    float wh = BattSoc.WattSum * to_hours;
+    float meters = BattSoc.SpeedSum * (1.0f / SOC_UPDATE_RATE);
+
+    BattSoc.AmpSum = 0.0f;
+    BattSoc.WattSum = 0.0f;
+    BattSoc.SpeedSum = 0.0f;
+    BattSoc.Samples = 0;
+
+    BattSoc.AhCount += ah;
+    if (BattSoc.Soc >= 0.0f) {
+        BattSoc.Soc -= ah / BattSoc.CapacityAh;
+        if (BattSoc.Soc < 0.0f) {
+            BattSoc.Soc = 0.0f;
+        }
+        if (BattSoc.Soc > 1.0f) {
+            BattSoc.Soc = 1.0f;
+        }
+    }
+
+    // Consumption, over a long enough stretch to even out hills
+    BattSoc.TripWh += wh;
+    BattSoc.TripM += meters;
+    if (BattSoc.TripM >= SOC_CONSUMPTION_DIST_M) {
+        float whkm = BattSoc.TripWh / (BattSoc.TripM * 0.001f);
+        if (whkm < SOC_CONSUMPTION_MIN) {
+            whkm = SOC_CONSUMPTION_MIN;
+        }
+        BattSoc.WhPerKm += SOC_CONSUMPTION_GAIN * (whkm - BattSoc.WhPerKm);
+        BattSoc.TripWh = 0.0f;
+        BattSoc.TripM = 0.0f;
+    }
+
+    if ((!BattSoc.Anchored) && (BattSoc.RestMs >= (BattSoc.FirstAnchor ?
+            SOC_BOOT_REST_MS : SOC_REST_MS))) {
+        soc_anchor(volts);
+    }
+
+    BattSoc.WhLeft = soc_energy_left(BattSoc.Soc);
+    BattSoc.RangeKm = (BattSoc.WhLeft < 0.0f) ?
+            -1.0f : (BattSoc.WhLeft / BattSoc.WhPerKm);
+}
+
+/**
+ * @brief  SoC Anchor
+ *            The pack has rested, so its voltage gives the SoC. Pulls the
+ *            counted SoC towards it, and learns the capacity when the last
+ *            anchor is far enough away.
+ */
+static void soc_anchor(float volts) {
+    float ocv_soc = soc_from_ocv(soc_cell_voltage(volts));
+
+    if (ocv_soc < 0.0f) {
+        // No reading yet, try again next second
+        return;
+    }
+    BattSoc.Anchored = 1;
+    BattSoc.Anchors++;
+
+    // Straight after power up, a big difference means it was charged
+    // (or ran down) while off
+    if ((BattSoc.Soc < 0.0f) || (BattSoc.FirstAnchor
+            && (fabsf(ocv_soc - BattSoc.Soc) > SOC_OCV_TRUST))) {
+        BattSoc.Soc = ocv_soc;
+    } else {
+        BattSoc.Soc += SOC_OCV_GAIN * (ocv_soc - BattSoc.Soc);
+    }
+    BattSoc.FirstAnchor = 0;
+
+    // Capacity = amp hours counted / SoC used, between two anchors. The
+    // voltage curve is flat in the middle, so the anchors need to be far
+    // apart for the error in each to stay small.
+    if (BattSoc.HaveAnchor) {
+        float span = BattSoc.AnchorSoc - ocv_soc;
+        if (fabsf(span) < SOC_LEARN_MIN_SPAN) {
+            return;
+        }
+        float cap = (BattSoc.AhCount - BattSoc.AnchorAh) / span;
+        // Charging while on isn't counted, that makes nonsense here
+        if ((cap >= (SOC_LEARN_MIN_RATIO * BattSoc.RatedAh))
+                && (cap <= (SOC_LEARN_MAX_RATIO * BattSoc.RatedAh))) {
+            BattSoc.CapacityAh += SOC_LEARN_GAIN * (cap - BattSoc.CapacityAh);
+        }
+    }
+    BattSoc.AnchorSoc = ocv_soc;
+    BattSoc.AnchorAh = BattSoc.AhCount;
+    BattSoc.HaveAnchor = 1;
+}
+
+/**
+ * @brief  SoC Cell Voltage
+ *            Average cell voltage from the BMS when there is one, from the
+ *            pack voltage otherwise.
+ * @retval Volts, negative if not known yet
+ */
+static float soc_cell_voltage(float volts) {
+    if (BMS_Is_Connected()) {
+        return BMS_Get_Avg_Cell_Voltage();
+    }
+    return volts / BattSoc.SeriesCells;
+}
+
+static uint16_t soc_cells(void) {
+    if (BMS_Is_Connected() && (BMS_Get_Num_Batts() > 0)) {
+        return BMS_Get_Num_Batts();
+    }
+    return BattSoc.SeriesCells;
+}
+
+/**
+ * @retval SoC (0-1) of a rested cell at this voltage, -1 if it's too far
+ *         outside the table to be a cell
+ */
+static float soc_from_ocv(float cell) {
+    if ((cell < (SocOcvTable[0] - SOC_OCV_MARGIN))
+            || (cell > (SocOcvTable[SOC_OCV_POINTS - 1] + SOC_OCV_MARGIN))) {
+        return -1.0f;
+    }
+    if (cell <= SocOcvTable[0]) {
+        return 0.0f;
+    }
+    for (uint8_t i = 0; i < (SOC_OCV_POINTS - 1); i++) {
+        if (cell < SocOcvTable[i + 1]) {
+            float frac = (cell - SocOcvTable[i])
+                    / (SocOcvTable[i + 1] - SocOcvTable[i]);
+            return (i + frac) / (SOC_OCV_POINTS - 1);
+        }
+    }
+    return 1.0f;
+}
+
+/**
+ * @brief  SoC Energy Left
+ *            Amp hours left times the voltage they come out at, which is
+ *            the area under the OCV curve from empty up to this SoC.
+ * @retval Wh, -1 if the SoC isn't known
+ */
+static float soc_energy_left(float soc) {
+    const float step = 1.0f / (SOC_OCV_POINTS - 1);
+    float area = 0.0f;
+    float pos;
+    uint8_t i;
+
+    if (soc < 0.0f) {
+        return -1.0f;
+    }
+    pos = soc * (SOC_OCV_POINTS - 1);
+    for (i = 0; ((i + 1) <= pos) && (i < (SOC_OCV_POINTS - 1)); i++) {
+        area += 0.5f * (SocOcvTable[i] + SocOcvTable[i + 1]) * step;
+    }
+    if (i < (SOC_OCV_POINTS - 1)) {
+        float frac = pos - i;
+        float v = SocOcvTable[i] + frac * (SocOcvTable[i + 1] - SocOcvTable[i]);
+        area += 0.5f * (SocOcvTable[i] + v) * frac * step;
+    }
+    return area * soc_cells() * BattSoc.CapacityAh;
+}
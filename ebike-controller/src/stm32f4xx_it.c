@@ -131,6 +131,7 @@ void DebugMon_Handler(void) {
  * @retval None
  */
 void PendSV_Handler(void) {
+    User_MidRate_IRQ();
 }
 
 /**
@@ -174,6 +175,9 @@ void OTG_HS_IRQHandler(void)
 {
     /*  HAL_PCD_IRQHandler(&hpcd);  */
     USB_IRQ();
+    // Data in, or the endpoint is free for more
+    sched_signal(TASK_USB_COMM);
+    sched_signal(TASK_TELEMETRY);
 }
 
 void TIM1_UP_TIM10_IRQHandler(void) {
@@ -236,10 +240,32 @@ void ADC_IRQHandler(void) {
 
 void USART2_IRQHandler(void) {
     UART_IRQ(SELECT_BMS_UART);
+    sched_signal(TASK_BMS_COMM);
 }
 
 void USART3_IRQHandler(void) {
     UART_IRQ(SELECT_HBD_UART);
+    sched_signal(TASK_HBD_COMM);
+}
+
+void DMA1_Stream5_IRQHandler(void) {
+    UART_RxDMA_IRQ(SELECT_BMS_UART);
+    sched_signal(TASK_BMS_COMM);
+}
+
+void DMA1_Stream1_IRQHandler(void) {
+    UART_RxDMA_IRQ(SELECT_HBD_UART);
+    sched_signal(TASK_HBD_COMM);
+}
+
+void DMA1_Stream6_IRQHandler(void) {
+    UART_TxDMA_IRQ(SELECT_BMS_UART);
+    sched_signal(TASK_BMS_COMM);
+}
+
+void DMA1_Stream3_IRQHandler(void) {
+    UART_TxDMA_IRQ(SELECT_HBD_UART);
+    sched_signal(TASK_HBD_COMM);
 }
 
 void EXTI0_IRQHandler(void) {
@@ -0,0 +1,290 @@
+/******************************************************************************
+ * Filename: telemetry.c
+ * Description: Streams any set of registry variables to the host, each
+ *              channel sampled at its own rate (a decimation of the PWM
+ *              frequency) and packed together into shared frames.
+ *
+ *              Sampling runs in the PWM interrupt and only copies values
+ *              into one of two frame buffers. The main loop wraps a closed
+ *              frame into a packet (CRC and all) and hands it to the USB
+ *              link, which sends it whole before anything else.
+ *
+ ******************************************************************************
+
+ Copyright (c) 2019 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#include "main.h"
+#include "telemetry.h"
+#include "periphconfig.h"
+
+// *** Global variables ***
+Telemetry_Channel TelemetryChannels[TELEMETRY_MAX_CHANNELS];
+__IO uint8_t TelemetryNumChannels = 0;
+
+Telemetry_Frame TelemetryFrames[2];
+__IO uint8_t TelemetryActiveFrame = 0;
+uint8_t TelemetrySendFrame = 0; // Frame handed to the main loop
+uint16_t TelemetryFrameAge = 0; // PWM cycles since the first record in the frame
+uint16_t TelemetryFrameSeq = 0;
+uint8_t TelemetryDropping = 0; // Last record was dropped
+Telemetry_Stats TelemetryStats;
+
+// Packet being sent by the main loop
+uint8_t TelemetryTxBuffer[PACKET_MAX_LENGTH];
+Data_Packet_Type TelemetryTxPacket;
+
+static void telemetry_close_frame(void);
+static void telemetry_start_frame(Telemetry_Frame* frame, uint32_t cycle);
+
+void telemetry_init(void) {
+    telemetry_clear();
+    TelemetryActiveFrame = 0;
+    TelemetryFrameSeq = 0;
+    TelemetryDropping = 0;
+    TelemetryStats.FramesSent = 0;
+    TelemetryStats.RecordsDropped = 0;
+    TelemetryStats.Overruns = 0;
+    TelemetryStats.UsbStalls = 0;
+}
+
+/**
+ * @brief  Telemetry Clear
+ *            Removes all channels. Streaming stops until new channels are
+ *            subscribed. Records already taken are dropped too, their masks
+ *            refer to the old channel list and the host would read them
+ *            with the new one.
+ */
+void telemetry_clear(void) {
+    uint32_t primask = __get_PRIMASK();
+
+    __disable_irq();
+    TelemetryNumChannels = 0;
+    TelemetryFrames[0].Length = 0;
+    TelemetryFrames[0].Ready = 0;
+    TelemetryFrames[1].Length = 0;
+    TelemetryFrames[1].Ready = 0;
+    __set_PRIMASK(primask);
+}
+
+/**
+ * @brief  Telemetry Check Channel
+ *            Finds out if a channel would be accepted, without adding it.
+ * @param  id - registry ID of the variable
+ * @param  decimation - sample once every N PWM cycles
+ * @retval DATA_PACKET_SUCCESS or DATA_PACKET_FAIL (unknown ID, bad rate)
+ */
+uint8_t telemetry_check_channel(uint16_t id, uint16_t decimation) {
+    if ((data_registry_find(id) == 0) || (decimation == 0)) {
+        return DATA_PACKET_FAIL;
+    }
+    return DATA_PACKET_SUCCESS;
+}
+
+/**
+ * @brief  Telemetry Subscribe
+ *            Adds a channel to the stream.
+ * @param  id - registry ID of the variable
+ * @param  index - extra index for DATA_REG_INDEXED variables, ignored otherwise
+ * @param  decimation - sample once every N PWM cycles (1 = every cycle)
+ * @retval DATA_PACKET_SUCCESS or DATA_PACKET_FAIL (unknown ID, no room)
+ */
+uint8_t telemetry_subscribe(uint16_t id, uint16_t index, uint16_t decimation) {
+    const Data_Reg_Entry* var = data_registry_find(id);
+    uint8_t num = TelemetryNumChannels;
+
+    if ((telemetry_check_channel(id, decimation) != DATA_PACKET_SUCCESS)
+            || (num >= TELEMETRY_MAX_CHANNELS)) {
+        return DATA_PACKET_FAIL;
+    }
+    TelemetryChannels[num].Var = var;
+    TelemetryChannels[num].Index = index;
+    TelemetryChannels[num].Decimation = decimation;
+    TelemetryChannels[num].Countdown = 1; // Sample on the next cycle
+    TelemetryChannels[num].Size = data_packet_type_size(var->Type);
+    // Only now can the interrupt see it
+    TelemetryNumChannels = num + 1;
+    return DATA_PACKET_SUCCESS;
+}
+
+uint8_t telemetry_num_channels(void) {
+    return TelemetryNumChannels;
+}
+
+/**
+ * @brief  Telemetry Sample
+ *            Call from the mid-rate loop. Samples every channel that is due
+ *            and appends a record to the active frame. Channels that want
+ *            samples more often than the loop runs get one every time.
+ * @param  cycle - PWM cycle count, used as the sample index
+ * @param  elapsed - PWM cycles since the last call
+ */
+void telemetry_sample(uint32_t cycle, uint16_t elapsed) {
+    uint16_t mask = 0;
+    uint16_t reclen = TELEMETRY_RECORD_HEADER;
+    uint8_t num = TelemetryNumChannels;
+    Telemetry_Frame* frame;
+
+    for (uint8_t i = 0; i < num; i++) {
+        Telemetry_Channel* ch = &TelemetryChannels[i];
+        if (ch->Countdown <= elapsed) {
+            // Keeps the average rate when the decimation isn't a multiple
+            int32_t left = (int32_t) ch->Countdown - elapsed + ch->Decimation;
+            ch->Countdown = (left > 0) ? (uint16_t) left : 1;
+            mask |= (1 << i);
+            reclen += ch->Size;
+        } else {
+            ch->Countdown -= elapsed;
+        }
+    }
+
+    frame = &TelemetryFrames[TelemetryActiveFrame];
+    if (mask) {
+        if ((!frame->Ready)
+                && ((frame->Length + reclen) > TELEMETRY_FRAME_LENGTH)) {
+            telemetry_close_frame();
+            frame = &TelemetryFrames[TelemetryActiveFrame];
+        }
+        // If the main loop hasn't sent this buffer yet, the samples are lost
+        if (!frame->Ready) {
+            uint32_t gap = 0;
+            if (frame->Length == 0) {
+                telemetry_start_frame(frame, cycle);
+            } else {
+                gap = cycle - frame->LastCycle;
+                if (gap > 0xFFFF) {
+                    gap = 0xFFFF;
+                }
+            }
+            uint8_t* dest = &(frame->Data[frame->Length]);
+            data_packet_pack_16b(dest, (uint16_t) gap);
+            data_packet_pack_16b(&dest[2], mask);
+            dest += TELEMETRY_RECORD_HEADER;
+            for (uint8_t i = 0; i < num; i++) {
+                if (mask & (1 << i)) {
+                    dest += data_registry_read(TelemetryChannels[i].Var,
+                            TelemetryChannels[i].Index, dest);
+                }
+            }
+            frame->Length += reclen;
+            frame->LastCycle = cycle;
+            TelemetryDropping = 0;
+        } else {
+            TelemetryStats.RecordsDropped++;
+            if (!TelemetryDropping) {
+                TelemetryStats.Overruns++;
+                TelemetryDropping = 1;
+            }
+        }
+    }
+
+    // Don't hold on to slow channels for too long
+    if ((frame->Length > 0) && (!frame->Ready)) {
+        TelemetryFrameAge += elapsed;
+        if (TelemetryFrameAge >= TELEMETRY_FRAME_TIMEOUT) {
+            telemetry_close_frame();
+        }
+    }
+}
+
+/**
+ * @brief  Telemetry Get Frame
+ *            Called from the main loop to find a frame that's ready to send.
+ *            When finished with it, call telemetry_release_frame.
+ * @param  data - set to point at the frame data
+ * @retval Length of the frame, zero if nothing is ready
+ */
+uint16_t telemetry_get_frame(uint8_t** data) {
+    // The active frame can only be ready if both are full, and then it's
+    // the older of the two.
+    uint8_t which = TelemetryActiveFrame;
+    if (!TelemetryFrames[which].Ready) {
+        which ^= 1;
+        if (!TelemetryFrames[which].Ready) {
+            return 0;
+        }
+    }
+    TelemetrySendFrame = which;
+    *data = TelemetryFrames[which].Data;
+    return TelemetryFrames[which].Length;
+}
+
+void telemetry_release_frame(void) {
+    TelemetryFrames[TelemetrySendFrame].Length = 0;
+    TelemetryFrames[TelemetrySendFrame].Ready = 0;
+}
+
+/**
+ * @brief  Telemetry Send
+ *            Call from the main loop while streaming. Moves the packet
+ *            that's going out along, and once the link is free packs the
+ *            next ready frame and starts it. The buffer can't be reused
+ *            until the link is done with it.
+ */
+void telemetry_send(void) {
+    if (USB_Data_Comm_Tx_Busy()) {
+        if (USB_Data_Comm_Tx_Service() == 0) {
+            TelemetryStats.UsbStalls++;
+        }
+        return;
+    }
+    uint8_t* framedata;
+    uint16_t framelen = telemetry_get_frame(&framedata);
+    if (framelen > 0) {
+        TelemetryTxPacket.TxBuffer = TelemetryTxBuffer;
+        TelemetryTxPacket.Framing = USB_Data_Comm_Get_Framing();
+        if (data_packet_create(&TelemetryTxPacket,
+                CONTROLLER_STREAM_DATA, framedata, framelen)) {
+            USB_Data_Comm_Send(TelemetryTxBuffer, TelemetryTxPacket.TxLength);
+            TelemetryStats.FramesSent++;
+        }
+        telemetry_release_frame();
+    }
+}
+
+uint32_t telemetry_get_frames_sent(void) {
+    return TelemetryStats.FramesSent;
+}
+
+uint32_t telemetry_get_records_dropped(void) {
+    return TelemetryStats.RecordsDropped;
+}
+
+uint32_t telemetry_get_overruns(void) {
+    return TelemetryStats.Overruns;
+}
+
+uint32_t telemetry_get_usb_stalls(void) {
+    return TelemetryStats.UsbStalls;
+}
+
+static void telemetry_start_frame(Telemetry_Frame* frame, uint32_t cycle) {
+    data_packet_pack_16b(frame->Data, TelemetryFrameSeq++);
+    data_packet_pack_32b(&(frame->Data[2]), cycle);
+    data_packet_pack_32b(&(frame->Data[6]), TIMESTAMP_TIM->CNT);
+    frame->Length = TELEMETRY_FRAME_HEADER;
+    TelemetryFrameAge = 0;
+}
+
+static void telemetry_close_frame(void) {
+    TelemetryFrames[TelemetryActiveFrame].Ready = 1;
+    TelemetryActiveFrame ^= 1;
+}
@@ -0,0 +1,286 @@
+/******************************************************************************
+ * Filename: trip.c
+ * Description: Trip and lifetime energy totals, kept in backup SRAM so that a
+ *              brown-out or reset doesn't lose them, plus a range prediction from
+ *              the energy used over the last few km.
+ *
+ ******************************************************************************
+
+ Copyright (c) 2019 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#include <stddef.h>
+#include "main.h"
+#include "trip.h"
+
+// *** Global variables ***
+Trip_State TripState;
+
+#define TRIP_BACKUP     ((Trip_Checkpoint*) BKPSRAM_BASE)
+
+static void trip_second(void);
+static void trip_add(Trip_Totals* totals, float wh_out, float wh_regen,
+        float meters, float moving);
+static void trip_window(float wh, float meters);
+static void trip_checkpoint(void);
+static uint32_t trip_checkpoint_crc(const Trip_Checkpoint* cp);
+
+/**
+ * @brief  Trip Init
+ *            Turns on backup SRAM and restores the last checkpoint. Call
+ *            before the app timer starts.
+ */
+void trip_init(void) {
+    const Trip_Checkpoint* best = 0;
+    uint32_t timeout = 100000;
+
+    // Write access to the backup domain, then the SRAM clock, and keep it
+    // running from VBAT
+    RCC->APB1ENR |= RCC_APB1ENR_PWREN;
+    PWR->CR |= PWR_CR_DBP;
+    RCC->AHB1ENR |= RCC_AHB1ENR_BKPSRAMEN;
+    PWR->CSR |= PWR_CSR_BRE;
+    while (((PWR->CSR & PWR_CSR_BRR) == 0) && (timeout > 0)) {
+        timeout--;
+    }
+
+    memset(&TripState, 0, sizeof(TripState));
+    for (uint8_t i = 0; i < TRIP_CHECKPOINT_SLOTS; i++) {
+        const Trip_Checkpoint* cp = &TRIP_BACKUP[i];
+        if ((cp->Magic == TRIP_CHECKPOINT_MAGIC)
+                && (cp->Crc == trip_checkpoint_crc(cp))
+                && ((best == 0) || ((int32_t) (cp->Sequence - best->Sequence) > 0))) {
+            best = cp;
+        }
+    }
+    if (best != 0) {
+        TripState.Trip = best->Trip;
+        TripState.Lifetime = best->Lifetime;
+        TripState.Sequence = best->Sequence;
+    }
+    TripState.WindowWhPerKm = soc_get_wh_per_km();
+    TripState.RangeKm = -1.0f;
+}
+
+/**
+ * @brief  Trip Update
+ *            Call at TRIP_UPDATE_RATE with the battery readings.
+ * @param  amps - battery current, positive out of the pack
+ * @param  volts - battery voltage
+ * @param  speed - wheel speed in m/s
+ */
+void trip_update(float amps, float volts, float speed) {
+    float watts = amps * volts;
+
+    if (watts >= 0.0f) {
+        TripState.WattOutSum += watts;
+    } else {
+        TripState.WattRegenSum -= watts;
+    }
+    TripState.SpeedSum += speed;
+    if (speed >= TRIP_MOVING_SPEED) {
+        TripState.MovingSamples++;
+    }
+
+    if (watts > TripState.Trip.PeakWatts) {
+        TripState.Trip.PeakWatts = watts;
+        if (watts > TripState.Lifetime.PeakWatts) {
+            TripState.Lifetime.PeakWatts = watts;
+        }
+    }
+    if (amps > TripState.Trip.PeakAmps) {
+        TripState.Trip.PeakAmps = amps;
+        if (amps > TripState.Lifetime.PeakAmps) {
+            TripState.Lifetime.PeakAmps = amps;
+        }
+    }
+    if (speed > TripState.Trip.PeakSpeed) {
+        TripState.Trip.PeakSpeed = speed;
+        if (speed > TripState.Lifetime.PeakSpeed) {
+            TripState.Lifetime.PeakSpeed = speed;
+        }
+    }
+
+    if ((++TripState.Samples) >= TRIP_UPDATE_RATE) {
+        trip_second();
+    }
+}
+
+/**
+ * @brief  Trip Reset
+ *            Zeros the trip totals. Lifetime totals and the range window
+ *            carry on.
+ */
+void trip_reset(void) {
+    __disable_irq();
+    memset(&TripState.Trip, 0, sizeof(TripState.Trip));
+    __enable_irq();
+}
+
+/**
+ * @brief  Trip Get Value
+ * @param  which - Trip_Value, plus Trip_Lifetime for the lifetime totals
+ * @retval The value, in the units of its CONFIG_TRIP_xx
+ */
+float trip_get_value(uint8_t which) {
+    const Trip_Totals* totals = &TripState.Trip;
+    float km;
+
+    if (which == Trip_Window_Wh_Per_Km) {
+        return TripState.WindowWhPerKm;
+    }
+    if (which == Trip_Range_Km) {
+        return TripState.RangeKm;
+    }
+    if (which & Trip_Lifetime) {
+        totals = &TripState.Lifetime;
+        which &= ~Trip_Lifetime;
+    }
+    km = (float) (totals->Meters * 0.001);
+    switch (which) {
+    case Trip_Wh_Out:
+        return (float) totals->WhOut;
+    case Trip_Wh_Regen:
+        return (float) totals->WhRegen;
+    case Trip_Km:
+        return km;
+    case Trip_Wh_Per_Km:
+        if (km < 0.01f) {
+            return 0.0f;
+        }
+        return (float) (totals->WhOut - totals->WhRegen) / km;
+    case Trip_Peak_Watts:
+        return totals->PeakWatts;
+    case Trip_Peak_Amps:
+        return totals->PeakAmps;
+    case Trip_Peak_Kph:
+        return totals->PeakSpeed * 3.6f;
+    case Trip_Hours:
+        return (float) (totals->MovingSeconds * (1.0 / 3600.0));
+    }
+    return 0.0f;
+}
+
+/**
+ * @brief  Trip Second
+ *            Folds one second of sums into the totals, moves the range
+ *            window along and checkpoints.
+ */
+static void trip_second(void) {
+    const float to_hours = 1.0f / (3600.0f * TRIP_UPDATE_RATE);
+    float wh_out = TripState.WattOutSum * to_hours;
+    float wh_regen = TripState.WattRegenSum * to_hours;
+    float meters = TripState.SpeedSum * (1.0f / TRIP_UPDATE_RATE);
+    float moving = TripState.MovingSamples * (1.0f / TRIP_UPDATE_RATE);
+
+    TripState.WattOutSum = 0.0f;
+    TripState.WattRegenSum = 0.0f;
+    TripState.SpeedSum = 0.0f;
+    TripState.MovingSamples = 0;
+    TripState.Samples = 0;
+
+    trip_add(&TripState.Trip, wh_out, wh_regen, meters, moving);
+    trip_add(&TripState.Lifetime, wh_out, wh_regen, meters, moving);
+    trip_window(wh_out - wh_regen, meters);
+    trip_checkpoint();
+}
+
+static void trip_add(Trip_Totals* totals, float wh_out, float wh_regen,
+        float meters, float moving) {
+    totals->WhOut += wh_out;
+    totals->WhRegen += wh_regen;
+    totals->Meters += meters;
+    totals->MovingSeconds += moving;
+}
+
+/**
+ * @brief  Trip Window
+ *            Energy per km over the last TRIP_WINDOW_SEGMENTS segments and
+ *            the one being ridden, which follows hills and headwinds much
+ *            faster than the learned Wh/km. Until the window has enough
+ *            distance in it, the learned value stands in.
+ */
+static void trip_window(float wh, float meters) {
+    float sum_wh;
+    float sum_m;
+    float whkm;
+    float wh_left;
+
+    TripState.SegmentWh += wh;
+    TripState.SegmentM += meters;
+    if (TripState.SegmentM >= TRIP_SEGMENT_M) {
+        TripState.WindowWh[TripState.WindowNext] = TripState.SegmentWh;
+        TripState.WindowM[TripState.WindowNext] = TripState.SegmentM;
+        TripState.WindowNext++;
+        if (TripState.WindowNext >= TRIP_WINDOW_SEGMENTS) {
+            TripState.WindowNext = 0;
+        }
+        if (TripState.WindowFull < TRIP_WINDOW_SEGMENTS) {
+            TripState.WindowFull++;
+        }
+        TripState.SegmentWh = 0.0f;
+        TripState.SegmentM = 0.0f;
+    }
+
+    sum_wh = TripState.SegmentWh;
+    sum_m = TripState.SegmentM;
+    for (uint8_t i = 0; i < TripState.WindowFull; i++) {
+        sum_wh += TripState.WindowWh[i];
+        sum_m += TripState.WindowM[i];
+    }
+    if (sum_m >= TRIP_WINDOW_MIN_M) {
+        whkm = sum_wh / (sum_m * 0.001f);
+        if (whkm < SOC_CONSUMPTION_MIN) {
+            whkm = SOC_CONSUMPTION_MIN;
+        }
+    } else {
+        whkm = soc_get_wh_per_km();
+    }
+    TripState.WindowWhPerKm = whkm;
+
+    wh_left = soc_get_wh_left();
+    TripState.RangeKm = (wh_left < 0.0f) ? -1.0f : (wh_left / whkm);
+}
+
+/**
+ * @brief  Trip Checkpoint
+ *            Copies the totals into the older of the two backup slots.
+ */
+static void trip_checkpoint(void) {
+    Trip_Checkpoint cp;
+
+    // Padding is covered by the CRC too, so it has to be known
+    memset(&cp, 0, sizeof(cp));
+    cp.Magic = TRIP_CHECKPOINT_MAGIC;
+    cp.Sequence = ++TripState.Sequence;
+    cp.Trip = TripState.Trip;
+    cp.Lifetime = TripState.Lifetime;
+    cp.Crc = trip_checkpoint_crc(&cp);
+    memcpy(&TRIP_BACKUP[cp.Sequence % TRIP_CHECKPOINT_SLOTS], &cp, sizeof(cp));
+}
+
+static uint32_t trip_checkpoint_crc(const Trip_Checkpoint* cp) {
+    CRC32_Context ctx;
+    CRC32_Start(&ctx);
+    CRC32_UpdateBuffer(&ctx, (const uint8_t*) cp,
+            offsetof(Trip_Checkpoint, Crc));
+    return CRC32_Final(&ctx);
+}
@@ -2,6 +2,14 @@
  * Filename: uart.c
  * Description: Low level hardware driver for the Universal Asynchronous
  *              Receiver/Transmitter (UART).
+ *              Reception runs on circular DMA. The idle-line interrupt tells
+ *              the driver a packet has finished arriving, so there is one
+ *              interrupt per packet rather than one per byte. The DMA half
+ *              and full transfer interrupts catch long bursts with no idle
+ *              time in them.
+ *              Transmission is a queue: writes are copied in and the DMA
+ *              sends them in the background, one contiguous run at a time.
+ *              Nothing here ever waits for the UART.
  ******************************************************************************
 
  Copyright (c) 2019 David Miller
@@ -25,17 +33,27 @@
  SOFTWARE.
  */
 
+#include <string.h>
 #include "uart.h"
 #include "gpio.h"
 #include "pinconfig.h"
 #include "project_parameters.h"
 #include "main.h"
 
-UARTBuffer_Type BMSRxBuffer;
-UARTBuffer_Type BMSTxBuffer;
+// *** Global variables ***
+uint8_t BMSRxData[BMS_UART_RX_LENGTH];
+uint8_t BMSTxData[BMS_UART_TX_LENGTH];
+uint8_t HBDRxData[HBD_UART_RX_LENGTH];
+uint8_t HBDTxData[HBD_UART_TX_LENGTH];
 
-UARTBuffer_Type HBDRxBuffer;
-UARTBuffer_Type HBDTxBuffer;
+UART_Port_Type BMSPort;
+UART_Port_Type HBDPort;
+
+static UART_Port_Type* uart_port(UART_Sel uart);
+static void uart_port_init(UART_Port_Type* port, uint32_t baud);
+static uint16_t uart_rx_waiting(UARTBuffer_Type* rx);
+static void uart_rx_update(UART_Port_Type* port);
+static void uart_tx_start(UART_Port_Type* port);
 
 /*** UART_CalcBRR
  * From ST reference manual RM0091:
@@ -66,12 +84,13 @@ uint16_t UART_CalcBRR(uint32_t fck, uint32_t baud, uint8_t over8) {
     if(baud > fck) {
         return 0;
     }
+    // Rounded to the nearest step, so the error is never more than half
     if(over8) {
-        usartdiv = (2*fck)/baud;
+        usartdiv = ((2*fck) + (baud/2))/baud;
         brr = (usartdiv&(0xFFF0)) + ((usartdiv&(0x000F)) >> 1);
         return brr;
     } else {
-        usartdiv = fck/baud;
+        usartdiv = (fck + (baud/2))/baud;
         return usartdiv;
     }
 }
@@ -84,6 +103,8 @@ void UART_Init(void) {
     GPIO_Clk(BMS_UART_PORT);
     BMS_UART_CLK_ENABLE();
 
+    UART_DMA_CLK_ENABLE();
+
     // Set up the GPIOs
     GPIO_AF(HBD_UART_PORT, HBD_UART_TX_PIN, HBD_UART_AF);
     GPIO_AF(HBD_UART_PORT, HBD_UART_RX_PIN, HBD_UART_AF);
@@ -91,278 +112,485 @@ void UART_Init(void) {
     GPIO_AF(BMS_UART_PORT, BMS_UART_TX_PIN, BMS_UART_AF);
     GPIO_AF(BMS_UART_PORT, BMS_UART_RX_PIN, BMS_UART_AF);
 
-    // Initialize the UART peripherals
-    HBD_UART->CR1 = USART_CR1_RE | USART_CR1_RXNEIE | USART_CR1_TE;
-    HBD_UART->CR2 = 0;
-    HBD_UART->CR3 = 0;
-    HBD_UART->BRR = HBD_BRR;
-
-    BMS_UART->CR1 = USART_CR1_RE | USART_CR1_RXNEIE | USART_CR1_TE;
-    BMS_UART->CR2 = 0;
-    BMS_UART->CR3 = 0;
-    BMS_UART->BRR = BMS_BRR;
-
-    // Startup values in the buffers
-    BMSRxBuffer.Done = 0;
-    BMSRxBuffer.RdPos = 0;
-    BMSRxBuffer.WrPos = 0;
-    BMSTxBuffer.Done = 1;
-
-    HBDRxBuffer.Done = 0;
-    HBDRxBuffer.RdPos = 0;
-    HBDRxBuffer.WrPos = 0;
-    HBDTxBuffer.Done = 1;
-
-    // Enable the UARTS
-    HBD_UART->CR1 |= USART_CR1_UE;
-    BMS_UART->CR1 |= USART_CR1_UE;
+    // Which hardware and buffers belong to each port
+    HBDPort.Uart = HBD_UART;
+    HBDPort.RxDma = HBD_RX_DMA;
+    HBDPort.RxDmaIFCR = &(HBD_RX_DMA_IFCR);
+    HBDPort.RxDmaFlags = HBD_RX_DMA_FLAGS;
+    HBDPort.Rx.Buffer = HBDRxData;
+    HBDPort.Rx.Length = HBD_UART_RX_LENGTH;
+    HBDPort.Tx.Buffer = HBDTxData;
+    HBDPort.Tx.Length = HBD_UART_TX_LENGTH;
+    HBDPort.TxDma = HBD_TX_DMA;
+    HBDPort.TxDmaIFCR = &(HBD_TX_DMA_IFCR);
+    HBDPort.TxDmaFlags = HBD_TX_DMA_FLAGS;
+    HBDPort.RxDma->CR = HBD_RX_DMA_CHANNEL;
+    HBDPort.TxDma->CR = HBD_TX_DMA_CHANNEL;
+    uart_port_init(&HBDPort, HBD_BAUDRATE);
+
+    BMSPort.Uart = BMS_UART;
+    BMSPort.RxDma = BMS_RX_DMA;
+    BMSPort.RxDmaIFCR = &(BMS_RX_DMA_IFCR);
+    BMSPort.RxDmaFlags = BMS_RX_DMA_FLAGS;
+    BMSPort.Rx.Buffer = BMSRxData;
+    BMSPort.Rx.Length = BMS_UART_RX_LENGTH;
+    BMSPort.Tx.Buffer = BMSTxData;
+    BMSPort.Tx.Length = BMS_UART_TX_LENGTH;
+    BMSPort.TxDma = BMS_TX_DMA;
+    BMSPort.TxDmaIFCR = &(BMS_TX_DMA_IFCR);
+    BMSPort.TxDmaFlags = BMS_TX_DMA_FLAGS;
+    BMSPort.RxDma->CR = BMS_RX_DMA_CHANNEL;
+    BMSPort.TxDma->CR = BMS_TX_DMA_CHANNEL;
+    uart_port_init(&BMSPort, BMS_BAUDRATE);
 
     // Interrupt config
     NVIC_SetPriority(HBD_IRQn, PRIO_HBD_UART);
     NVIC_SetPriority(BMS_IRQn, PRIO_BMS_UART);
+    NVIC_SetPriority(HBD_RX_DMA_IRQn, PRIO_HBD_UART);
+    NVIC_SetPriority(BMS_RX_DMA_IRQn, PRIO_BMS_UART);
+    NVIC_SetPriority(HBD_TX_DMA_IRQn, PRIO_HBD_UART);
+    NVIC_SetPriority(BMS_TX_DMA_IRQn, PRIO_BMS_UART);
     NVIC_EnableIRQ(HBD_IRQn);
     NVIC_EnableIRQ(BMS_IRQn);
+    NVIC_EnableIRQ(HBD_RX_DMA_IRQn);
+    NVIC_EnableIRQ(BMS_RX_DMA_IRQn);
+    NVIC_EnableIRQ(HBD_TX_DMA_IRQn);
+    NVIC_EnableIRQ(BMS_TX_DMA_IRQn);
 }
 
 int32_t UART_InWaiting(UART_Sel uart) {
-    UARTBuffer_Type* p_RxBuffer;
-    uint32_t buffer_length;
-    int32_t in_waiting = 0;
-    if(uart == SELECT_BMS_UART) {
-        p_RxBuffer = &BMSRxBuffer;
-        buffer_length = BMS_BUFFER_LENGTH;
-    } else if(uart == SELECT_HBD_UART) {
-        p_RxBuffer = &HBDRxBuffer;
-        buffer_length = HBD_BUFFER_LENGTH;
-    } else {
+    UART_Port_Type* port = uart_port(uart);
+    if (port == 0) {
         return 0;
     }
-    if (p_RxBuffer->WrPos > p_RxBuffer->RdPos) {
-        // Write is past read...everything past the read
-        // pointer up to the write pointer is available to read.
-        in_waiting = p_RxBuffer->WrPos - p_RxBuffer->RdPos;
-    } else if (p_RxBuffer->WrPos < p_RxBuffer->RdPos) {
-        // Read is past write...that means write wrapped around.
-        // Lots to read. From the read pointer to the end, then
-        // from zero up to the write pointer.
-        in_waiting = buffer_length - p_RxBuffer->RdPos + p_RxBuffer->WrPos;
-    } else if (p_RxBuffer->WrPos == p_RxBuffer->RdPos) {
-        // Depends if an overflow occurred. If it did, then the buffer
-        // has been filled up to the buffer length. If it did not, then
-        // the buffer is empty.
-        if((p_RxBuffer->Done & 0x02)==0) {
-            in_waiting = 0;
-        } else {
-            in_waiting = buffer_length;
-        }
-    }
-    return in_waiting;
+    return uart_rx_waiting(&(port->Rx));
 }
 
+/**
+ * @brief  UART Is Finished Transmit
+ * @retval 1 if everything queued has been handed to the UART, 0 if not
+ */
 uint8_t UART_IsFinishedTx(UART_Sel uart) {
-    if(uart == SELECT_BMS_UART) {
-        return BMSTxBuffer.Done;
-    } else if(uart == SELECT_HBD_UART) {
-        return HBDTxBuffer.Done;
+    UART_Port_Type* port = uart_port(uart);
+    if (port == 0) {
+        return 0;
     }
-    return 0;
+    return port->Tx.Done;
 }
 
+/**
+ * @brief  UART Read
+ *         Copies out what the DMA had written at the last interrupt (end of
+ *         a packet, or half way around the buffer).
+ * @param  uart - which port
+ * @param  buf - destination
+ * @param  count - most bytes to copy
+ * @retval Number of bytes copied
+ */
 int32_t UART_Read(UART_Sel uart, void* buf, uint32_t count) {
     uint8_t* buf8b = buf;
-    UARTBuffer_Type* p_RxBuffer;
-    uint32_t buffer_remaining = 0;
+    UART_Port_Type* port = uart_port(uart);
+    UARTBuffer_Type* rx;
     uint32_t place = 0;
-    uint32_t buffer_length;
-
-    // Select the BMS or HBD UART
-    if(uart == SELECT_BMS_UART) {
-        p_RxBuffer = &BMSRxBuffer;
-        buffer_length = BMS_BUFFER_LENGTH;
-    } else if(uart == SELECT_HBD_UART) {
-        p_RxBuffer = &HBDRxBuffer;
-        buffer_length = HBD_BUFFER_LENGTH;
-    } else {
-        return 0;
-    }
 
-    // Copy up to "count" bytes from the read buffer
-    if ((p_RxBuffer->Done & 0x01) == 0) {
-        // No bytes read, return zero.
+    if ((port == 0) || (count == 0)) {
         return 0;
     }
-    if(count == 0) {
-        return 0;
+    rx = &(port->Rx);
+    uint16_t waiting = uart_rx_waiting(rx);
+    if (count > waiting) {
+        count = waiting;
     }
-
-    if(p_RxBuffer->WrPos > p_RxBuffer->RdPos){
-        // Write is past read...this means some bytes have been written
-        // that have yet to be read. The remaining space from the write pointer
-        // up to the end of the buffer, plus whatever bytes have already
-        // been read.
-        buffer_remaining = buffer_length - p_RxBuffer->WrPos
-                + p_RxBuffer->RdPos;
-    } else if(p_RxBuffer->WrPos < p_RxBuffer->RdPos) {
-        // Read is past write...this means write pointer wrapped around.
-        // Remaining space is what's in front of the write pointer before
-        // it hits the read pointer.
-        buffer_remaining = p_RxBuffer->RdPos - p_RxBuffer->WrPos;
-    } else if(p_RxBuffer->WrPos == p_RxBuffer->RdPos) {
-        // Weird case. If overflow has occurred, then the entire buffer is
-        // remaining. If it hasn't, then there are zero bytes remaining.
-        if((p_RxBuffer->Done & 0x02) == 0) {
-            buffer_remaining = 0;
-        } else {
-            buffer_remaining = buffer_length;
-            p_RxBuffer->Done &= ~0x02;
+    uint16_t rdpos = rx->RdPos;
+    while (place < count) {
+        // Up to the end of the buffer, then from the start
+        uint32_t chunk = rx->Length - rdpos;
+        if (chunk > (count - place)) {
+            chunk = count - place;
+        }
+        memcpy(&(buf8b[place]), &(rx->Buffer[rdpos]), chunk);
+        place += chunk;
+        rdpos += chunk;
+        if (rdpos >= rx->Length) {
+            rdpos = 0;
         }
     }
-
-
-    while ((place < count) && (place < buffer_remaining)) {
-        buf8b[place++] = p_RxBuffer->Buffer[p_RxBuffer->RdPos++];
-        if (p_RxBuffer->RdPos >= buffer_length)
-            p_RxBuffer->RdPos = 0;
+    // Hand the space back to the DMA in one go
+    __disable_irq();
+    rx->RdPos = rdpos;
+    if (place > 0) {
+        rx->Done &= ~0x02;
+    }
+    if (rx->RdPos == rx->WrPos && ((rx->Done & 0x02) == 0)) {
+        rx->Done &= ~0x01;
     }
-    // Clear "done" flag if no more bytes to read
-    if (count >= buffer_remaining)
-        p_RxBuffer->Done &= ~0x01;
+    __enable_irq();
     // Return the number of read bytes.
     return place;
 }
 
+/**
+ * @brief  UART Write
+ *         Queues the whole buffer for sending, or none of it.
+ * @retval count, or 0 if there wasn't room
+ */
 int32_t UART_Write(UART_Sel uart, void* buf, uint32_t count) {
-    uint8_t* buf8b = buf;
-    uint32_t place = 0;
-    UARTBuffer_Type* p_TxBuffer;
-    uint32_t timeout_limit;
-    USART_TypeDef* uart_hw;
-    uint32_t buffer_length;
-
-    if(uart == SELECT_BMS_UART) {
-        p_TxBuffer = &BMSTxBuffer;
-        timeout_limit = HBD_TXMT_TIMEOUT;
-        uart_hw = BMS_UART;
-        buffer_length = BMS_BUFFER_LENGTH;
-
-    } else if(uart == SELECT_HBD_UART) {
-        p_TxBuffer = &HBDTxBuffer;
-        timeout_limit = BMS_TXMT_TIMEOUT;
-        uart_hw = HBD_UART;
-        buffer_length = HBD_BUFFER_LENGTH;
-    } else {
+    UART_TxSegment seg;
+    if (count > 0xFFFF) {
         return 0;
     }
+    seg.Data = buf;
+    seg.Length = count;
+    return UART_WriteGather(uart, &seg, 1, 0, 0);
+}
 
-    if(count == 0) {
+/**
+ * @brief  UART Write Gather
+ *         Queues several buffers (several packets, or the pieces of one)
+ *         as a single write, all or nothing. The buffers can be reused as
+ *         soon as this returns.
+ * @param  uart - which port
+ * @param  segs - the buffers, sent in order
+ * @param  nsegs - number of buffers
+ * @param  callback - called from the DMA interrupt once the last byte is
+ *                    handed to the UART, can be null
+ * @param  context - passed to the callback
+ * @retval Number of bytes queued, 0 if there wasn't room. Check
+ *         UART_TxSpace first to know if a write will fit.
+ */
+int32_t UART_WriteGather(UART_Sel uart, const UART_TxSegment* segs,
+        uint8_t nsegs, UART_TxCallback callback, void* context) {
+    UART_Port_Type* port = uart_port(uart);
+    UARTBuffer_Type* tx;
+    uint32_t total = 0;
+
+    if (port == 0) {
+        return 0;
+    }
+    tx = &(port->Tx);
+    for (uint8_t i = 0; i < nsegs; i++) {
+        total += segs[i].Length;
+    }
+    if (total == 0) {
+        return 0;
+    }
+    // The interrupt only ever makes more room, so this can't go stale
+    if ((total > (uint32_t) (tx->Length - port->TxCount))
+            || ((callback != 0) && (((port->TxNotifyWr + 1) % UART_TX_CALLBACKS)
+                    == port->TxNotifyRd))) {
+        port->TxRejected++;
         return 0;
     }
 
-    if (p_TxBuffer->Done) {
-        // In the rare chance that the transmitter is just finishing,
-        // wait for the shift register to empty
-        uint32_t timeout = GetTick();
-        while (!(uart_hw->SR & USART_SR_TXE)) {
-            if (GetTick() > (timeout + timeout_limit)) {
-                // Timeout fail
-                return 0;
+    // Only this side moves the write position
+    uint16_t wrpos = tx->WrPos;
+    for (uint8_t i = 0; i < nsegs; i++) {
+        uint16_t done = 0;
+        while (done < segs[i].Length) {
+            uint16_t chunk = tx->Length - wrpos;
+            if (chunk > (segs[i].Length - done)) {
+                chunk = segs[i].Length - done;
+            }
+            memcpy(&(tx->Buffer[wrpos]), &(segs[i].Data[done]), chunk);
+            done += chunk;
+            wrpos += chunk;
+            if (wrpos >= tx->Length) {
+                wrpos = 0;
             }
         }
+    }
+    tx->WrPos = wrpos;
+
+    __disable_irq();
+    port->TxCount += total;
+    port->TxQueued += total;
+    if (callback != 0) {
+        UART_TxNotify* note = &(port->TxNotify[port->TxNotifyWr]);
+        note->End = port->TxQueued;
+        note->Callback = callback;
+        note->Context = context;
+        port->TxNotifyWr = (port->TxNotifyWr + 1) % UART_TX_CALLBACKS;
+    }
+    tx->Done = 0;
+    if ((port->TxRun == 0) && (port->PendingBaud == 0)) {
+        uart_tx_start(port);
+    }
+    __enable_irq();
+    return total;
+}
 
-        // Safe to simply restart the buffer
-        p_TxBuffer->RdPos = 0;
-        p_TxBuffer->WrPos = 0;
-        while ((place < buffer_length) && (place < count)) {
-            p_TxBuffer->Buffer[p_TxBuffer->WrPos++] = buf8b[place++];
-        }
-        // Start the transfer
+/**
+ * @brief  UART Transmit Space
+ * @retval Largest write that would be accepted right now
+ */
+uint16_t UART_TxSpace(UART_Sel uart) {
+    UART_Port_Type* port = uart_port(uart);
+    if (port == 0) {
+        return 0;
+    }
+    return port->Tx.Length - port->TxCount;
+}
 
-        uart_hw->DR = p_TxBuffer->Buffer[p_TxBuffer->RdPos++];
-        uart_hw->CR1 |= (USART_CR1_TXEIE);
-        p_TxBuffer->Done = 0;
-    } else {
-        // Can we fit more data in the buffer?
-        uint8_t buffer_used;
-        if (p_TxBuffer->WrPos < p_TxBuffer->RdPos) {
-            buffer_used = buffer_length - p_TxBuffer->RdPos
-                    + p_TxBuffer->WrPos;
-        } else {
-            buffer_used = p_TxBuffer->WrPos - p_TxBuffer->RdPos;
-        }
-        uint8_t buffer_remaining = buffer_length - buffer_used;
+/**
+ * @brief  UART Set Baud
+ *         Changes the baud rate once everything queued so far has been
+ *         sent, so a reply can go out at the old rate first. Anything
+ *         queued after this call goes at the new rate.
+ * @param  uart - which port
+ * @param  baud - new rate
+ * @retval 1 if the rate can be set, 0 if not
+ */
+uint8_t UART_SetBaud(UART_Sel uart, uint32_t baud) {
+    UART_Port_Type* port = uart_port(uart);
+    if ((port == 0) || (UART_CalcBRR(USART_CLK, baud, 0) < 16)) {
+        return 0;
+    }
+    __disable_irq();
+    port->PendingBaud = baud;
+    port->BaudAfter = port->TxQueued;
+    if ((int32_t) (port->TxSent - port->BaudAfter) >= 0) {
+        // Only the last bytes in the UART itself left, wait for those
+        port->Uart->CR1 |= USART_CR1_TCIE;
+    }
+    __enable_irq();
+    return 1;
+}
 
-        if (count <= buffer_remaining) {
-            while ((place < buffer_remaining) && (place < count)) {
-                p_TxBuffer->Buffer[p_TxBuffer->WrPos++] = buf8b[place++];
-            }
-        } else {
-            // Buffer was full, fail.
-            return 0;
-        }
+uint32_t UART_GetBaud(UART_Sel uart) {
+    UART_Port_Type* port = uart_port(uart);
+    if (port == 0) {
+        return 0;
     }
-    // Return the number of written bytes.
-    return place;
+    return port->Baud;
 }
 
 void UART_IRQ(UART_Sel uart) {
-    UARTBuffer_Type* p_RxBuffer;
-    UARTBuffer_Type* p_TxBuffer;
-    USART_TypeDef* uart_hw;
-    uint32_t buffer_length;
-    uint8_t comm_dummy;
-
-    if(uart == SELECT_BMS_UART) {
-        p_RxBuffer = &BMSRxBuffer;
-        p_TxBuffer = &BMSTxBuffer;
-        uart_hw = BMS_UART;
-        buffer_length = BMS_BUFFER_LENGTH;
-    } else if(uart == SELECT_HBD_UART) {
-        p_RxBuffer = &HBDRxBuffer;
-        p_TxBuffer = &HBDTxBuffer;
-        uart_hw = HBD_UART;
-        buffer_length = HBD_BUFFER_LENGTH;
-    } else {
+    UART_Port_Type* port = uart_port(uart);
+    if (port == 0) {
         return;
     }
-
-    // Character received!
-    if ((uart_hw->SR & USART_SR_RXNE) != 0) {
-        // Receive the new character, this clears the interrupt
-        comm_dummy = uart_hw->DR;
-        // Add it to our buffer
-        p_RxBuffer->Buffer[p_RxBuffer->WrPos++] = comm_dummy;
-        p_RxBuffer->Done |= 0x01;
-        if (p_RxBuffer->WrPos >= buffer_length) {
-            // Wrap around the circular buffer
-            p_RxBuffer->WrPos = 0;
-        }
-        if(p_RxBuffer->WrPos == p_RxBuffer->RdPos) {
-            p_RxBuffer->Done |= 0x02; // Overflow!
+    // Last byte before a baud change has left the shift register
+    if (((port->Uart->CR1 & USART_CR1_TCIE) != 0)
+            && ((port->Uart->SR & USART_SR_TC) != 0)) {
+        port->Uart->CR1 &= ~USART_CR1_TCIE;
+        if ((port->PendingBaud != 0) && (port->TxRun == 0)) {
+            port->Uart->BRR = UART_CalcBRR(USART_CLK, port->PendingBaud, 0);
+            port->Baud = port->PendingBaud;
+            port->PendingBaud = 0;
+            uart_tx_start(port);
         }
     }
-    if (((uart_hw->SR & USART_SR_TXE) != 0)
-            && ((uart_hw->CR1 & USART_CR1_TXEIE) != 0)) {
-        // Check if more data to send
-        if (((p_TxBuffer->RdPos + 1U) == p_TxBuffer->WrPos)
-                || (((p_TxBuffer->RdPos + 1U) == buffer_length)
-                        && (p_TxBuffer->WrPos == 0))) {
-            // We are done after this byte!
-            p_TxBuffer->Done = 1;
-            // Turn off the transmit data register empty interrupt
-            uart_hw->CR1 &= ~(USART_CR1_TXEIE);
-            // Turn on the transmit complete interrupt
-            uart_hw->CR1 |= USART_CR1_TCIE;
+    // Line went idle, the end of a packet (or an overrun)
+    uint32_t status = port->Uart->SR;
+    if ((status & (USART_SR_IDLE | USART_SR_ORE)) != 0) {
+        // Reading SR then DR clears the flags, the DMA has the data already
+        (void) port->Uart->DR;
+        uart_rx_update(port);
+    }
+}
+
+/**
+ * @brief  UART Receive DMA Interrupt
+ *         Half and full transfer of the circular receive buffer. Only
+ *         happens when data keeps coming without a break long enough for
+ *         the idle-line interrupt.
+ */
+void UART_RxDMA_IRQ(UART_Sel uart) {
+    UART_Port_Type* port = uart_port(uart);
+    if (port == 0) {
+        return;
+    }
+    *(port->RxDmaIFCR) = port->RxDmaFlags;
+    uart_rx_update(port);
+}
+
+/**
+ * @brief  UART Transmit DMA Interrupt
+ *         A run has been sent. Runs the callbacks of any writes that are
+ *         now finished, then starts on the rest of the queue.
+ */
+void UART_TxDMA_IRQ(UART_Sel uart) {
+    UART_Port_Type* port = uart_port(uart);
+    UARTBuffer_Type* tx;
+    if (port == 0) {
+        return;
+    }
+    tx = &(port->Tx);
+    *(port->TxDmaIFCR) = port->TxDmaFlags;
+    if (port->TxRun == 0) {
+        return;
+    }
+    tx->RdPos += port->TxRun;
+    if (tx->RdPos >= tx->Length) {
+        tx->RdPos = 0;
+    }
+    port->TxCount -= port->TxRun;
+    port->TxSent += port->TxRun;
+    port->TxRun = 0;
+    while (port->TxNotifyRd != port->TxNotifyWr) {
+        UART_TxNotify* note = &(port->TxNotify[port->TxNotifyRd]);
+        if ((int32_t) (port->TxSent - note->End) < 0) {
+            break;
         }
-        // Load the next data. This clears the empty interrupt
-        uart_hw->DR = p_TxBuffer->Buffer[p_TxBuffer->RdPos++];
-        if (p_TxBuffer->RdPos >= buffer_length) {
-            // Wrap around the read pointer
-            p_TxBuffer->RdPos = 0;
+        port->TxNotifyRd = (port->TxNotifyRd + 1) % UART_TX_CALLBACKS;
+        note->Callback(note->Context);
+    }
+    if ((port->PendingBaud != 0)
+            && ((int32_t) (port->TxSent - port->BaudAfter) >= 0)) {
+        // Hold the rest of the queue until the rate has changed
+        port->Uart->CR1 |= USART_CR1_TCIE;
+        return;
+    }
+    uart_tx_start(port);
+}
+
+uint32_t UART_GetRxOverflows(UART_Sel uart) {
+    UART_Port_Type* port = uart_port(uart);
+    if (port == 0) {
+        return 0;
+    }
+    return port->RxOverflows;
+}
+
+uint32_t UART_GetTxRejected(UART_Sel uart) {
+    UART_Port_Type* port = uart_port(uart);
+    if (port == 0) {
+        return 0;
+    }
+    return port->TxRejected;
+}
+
+static UART_Port_Type* uart_port(UART_Sel uart) {
+    if (uart == SELECT_BMS_UART) {
+        return &BMSPort;
+    } else if (uart == SELECT_HBD_UART) {
+        return &HBDPort;
+    }
+    return 0;
+}
+
+/**
+ * @brief  UART Port Init
+ *         Starts the receive DMA going around the buffer, and the UART
+ *         with idle-line detection instead of the per byte interrupt.
+ *         Sets up the transmit DMA, which only runs while there is
+ *         something queued. The DMA channels have to be set in the CR
+ *         registers already.
+ */
+static void uart_port_init(UART_Port_Type* port, uint32_t baud) {
+    // Startup values in the buffers
+    port->Rx.RdPos = 0;
+    port->Rx.WrPos = 0;
+    port->Rx.Done = 0;
+    port->Tx.RdPos = 0;
+    port->Tx.WrPos = 0;
+    port->Tx.Done = 1;
+    port->TxCount = 0;
+    port->TxRun = 0;
+    port->TxQueued = 0;
+    port->TxSent = 0;
+    port->TxNotifyRd = 0;
+    port->TxNotifyWr = 0;
+    port->Baud = baud;
+    port->PendingBaud = 0;
+    port->RxOverflows = 0;
+    port->TxRejected = 0;
+
+    // Peripheral to memory, bytes, around and around the buffer
+    port->RxDma->CR |= DMA_SxCR_MINC | DMA_SxCR_CIRC | DMA_SxCR_HTIE
+            | DMA_SxCR_TCIE;
+    port->RxDma->PAR = (uint32_t) (&(port->Uart->DR));
+    port->RxDma->M0AR = (uint32_t) port->Rx.Buffer;
+    port->RxDma->NDTR = port->Rx.Length;
+    *(port->RxDmaIFCR) = port->RxDmaFlags;
+    port->RxDma->CR |= DMA_SxCR_EN;
+
+    // Memory to peripheral, enabled for each run
+    port->TxDma->CR |= DMA_SxCR_MINC | DMA_SxCR_DIR_0 | DMA_SxCR_TCIE;
+    port->TxDma->PAR = (uint32_t) (&(port->Uart->DR));
+
+    port->Uart->CR1 = USART_CR1_RE | USART_CR1_IDLEIE | USART_CR1_TE;
+    port->Uart->CR2 = 0;
+    port->Uart->CR3 = USART_CR3_DMAR | USART_CR3_DMAT;
+    port->Uart->BRR = UART_CalcBRR(USART_CLK, baud, 0);
+    port->Uart->CR1 |= USART_CR1_UE;
+}
+
+static uint16_t uart_rx_waiting(UARTBuffer_Type* rx) {
+    uint16_t wrpos = rx->WrPos;
+    uint16_t rdpos = rx->RdPos;
+    if (wrpos > rdpos) {
+        return wrpos - rdpos;
+    } else if (wrpos < rdpos) {
+        // Write wrapped around
+        return rx->Length - rdpos + wrpos;
+    } else if (rx->Done & 0x02) {
+        return rx->Length;
+    }
+    return 0;
+}
+
+/**
+ * @brief  UART Receive Update
+ *         Moves the write position up to where the DMA has got to. Called
+ *         from the interrupts, which come at least every half buffer, so
+ *         the DMA can't have gone all the way around since the last call.
+ *         If it has caught up with the reader the oldest bytes are lost,
+ *         the read position skips to the oldest byte still in the buffer.
+ */
+static void uart_rx_update(UART_Port_Type* port) {
+    UARTBuffer_Type* rx = &(port->Rx);
+    uint16_t wrpos = rx->Length - port->RxDma->NDTR;
+    if (wrpos >= rx->Length) {
+        wrpos = 0;
+    }
+    uint16_t received = (wrpos >= rx->WrPos) ? (wrpos - rx->WrPos)
+            : (rx->Length - rx->WrPos + wrpos);
+    if (received == 0) {
+        return;
+    }
+    uint16_t space = rx->Length - uart_rx_waiting(rx);
+    rx->WrPos = wrpos;
+    rx->Done |= 0x01;
+    if (received >= space) {
+        if (received > space) {
+            port->RxOverflows += received - space;
         }
+        rx->RdPos = wrpos;
+        rx->Done |= 0x02; // Full
     }
-    if (((uart_hw->SR & USART_SR_TC) != 0)
-            && ((uart_hw->CR1 & USART_CR1_TCIE) != 0)) {
-        // Transmission complete, turn off the interrupt
-        uart_hw->CR1 &= ~(USART_CR1_TCIE);
+}
+
+/**
+ * @brief  UART Transmit Start
+ *         Sends the next contiguous run of the queue, up to the end of the
+ *         buffer, or marks the port finished if the queue is empty. Called
+ *         with interrupts off or from the DMA interrupt.
+ */
+static void uart_tx_start(UART_Port_Type* port) {
+    UARTBuffer_Type* tx = &(port->Tx);
+    uint16_t run = port->TxCount;
+
+    if (run == 0) {
+        tx->Done = 1;
+        return;
+    }
+    if (run > (tx->Length - tx->RdPos)) {
+        run = tx->Length - tx->RdPos;
+    }
+    if ((port->PendingBaud != 0) && (run > (port->BaudAfter - port->TxSent))) {
+        // Stop where the new baud rate starts
+        run = port->BaudAfter - port->TxSent;
+        if (run == 0) {
+            return;
+        }
     }
+    port->TxRun = run;
+    *(port->TxDmaIFCR) = port->TxDmaFlags;
+    // TC is set out of reset and DMA writes don't reliably clear it. Clear
+    // it here, so a baud change waiting on TC only sees this run finish.
+    port->Uart->SR = ~USART_SR_TC;
+    port->TxDma->M0AR = (uint32_t) (&(tx->Buffer[tx->RdPos]));
+    port->TxDma->NDTR = run;
+    port->TxDma->CR |= DMA_SxCR_EN;
 }
@@ -38,6 +38,10 @@ int32_t USB_Data_Comm_RxBuffer_WrPlace;
 #endif
 uint8_t USB_Data_Comm_DataBuffer[PACKET_MAX_DATA_LENGTH];
 Data_Packet_Type USB_Data_Comm_Packet;
+// Packet part way out of the endpoint. Everything sent over USB goes
+// through here a whole packet at a time, so packets can't interleave.
+const uint8_t* USB_Data_Comm_TxPending;
+uint16_t USB_Data_Comm_TxPendingLen = 0;
 
 // Private functions
 static void USB_Data_Comm_Process_Command(void);
@@ -56,6 +60,8 @@ void USB_Data_Comm_Init(void) {
     USB_Data_Comm_Packet.TxBuffer = USB_Data_Comm_TxBuffer;
     USB_Data_Comm_Packet.TxReady = 0;
     USB_Data_Comm_Packet.RxReady = 0;
+    USB_Data_Comm_Packet.Framing = DATA_PACKET_FRAMING_SOP;
+    USB_Data_Comm_TxPendingLen = 0;
 #if 0
     USB_Data_Comm_RxBuffer_WrPlace = 0;
 #endif
@@ -66,31 +72,104 @@ void USB_Data_Comm_Init(void) {
  * @brief  USB Data Communications One Byte Check
  *         Handles the USB serial port incoming data. Determines
  *         if a properly encoded packet has been received, and
- *         sends to the appropriate handler if it has. Operates
- *         one byte at a time using an internal state machine.
+ *         sends to the appropriate handler if it has. Reads the
+ *         port in blocks and scans each block for whole packets,
+ *         packets split between blocks are finished off by the
+ *         state machine.
  * @param  None
  * @retval None
  */
 void USB_Data_Comm_OneByte_Check(void) {
-    // Loop through each incoming byte
+    // Take in whatever has arrived in blocks, and find the packets in each
+    uint8_t rxbuf[DATA_PACKET_RX_CHUNK];
     int32_t numbytes = VCP_InWaiting();
-    uint8_t this_byte;
+    // Keep any packet that's part way out moving
+    USB_Data_Comm_Tx_Service();
     while(numbytes > 0) {
-        // Load one new byte
-        if(VCP_Read(&this_byte, 1) != 1) {
-            // Check that a byte was really received
+        int32_t count = (numbytes > DATA_PACKET_RX_CHUNK) ? DATA_PACKET_RX_CHUNK : numbytes;
+        count = VCP_Read(rxbuf, count);
+        if(count <= 0) {
+            // Nothing was really received
             return;
         }
-        numbytes--;
-        if(data_packet_extract_one_byte(&USB_Data_Comm_Packet, this_byte) == DATA_PACKET_SUCCESS) {
-            if(USB_Data_Comm_Packet.RxReady == 1) {
-                // Double checked and good to go
-                USB_Data_Comm_Process_Command();
+        numbytes -= count;
+        uint16_t place = 0;
+        while(place < count) {
+            uint16_t used;
+            if(data_packet_extract_span(&USB_Data_Comm_Packet, &rxbuf[place], count - place, &used) == DATA_PACKET_SUCCESS) {
+                if(USB_Data_Comm_Packet.RxReady == 1) {
+                    // Double checked and good to go
+                    USB_Data_Comm_Process_Command();
+                }
             }
+            place += used;
         }
     }
 }
 
+/**
+ * @brief  USB Data Communications Get Framing
+ *         Framing mode the host picked for this link (SET_FRAMING). Other
+ *         packets sent on the link have to use the same one.
+ * @retval DATA_PACKET_FRAMING_SOP or DATA_PACKET_FRAMING_COBS
+ */
+uint8_t USB_Data_Comm_Get_Framing(void) {
+    return USB_Data_Comm_Packet.Framing;
+}
+
+/**
+ * @brief  USB Data Communications Send
+ *         Starts sending a whole packet. The rest of it goes out on later
+ *         calls to USB_Data_Comm_Tx_Service, and nothing else is sent
+ *         until it's done. The buffer has to stay untouched until then.
+ * @param  data - the packet, framing and all
+ * @param  len - length of the packet in bytes
+ * @retval 1 if the packet was taken, 0 if another one is still going out
+ */
+uint8_t USB_Data_Comm_Send(const uint8_t* data, uint16_t len) {
+    if (USB_Data_Comm_TxPendingLen > 0) {
+        return 0;
+    }
+    USB_Data_Comm_TxPending = data;
+    USB_Data_Comm_TxPendingLen = len;
+    USB_Data_Comm_Tx_Service();
+    return 1;
+}
+
+/**
+ * @brief  USB Data Communications Transmit Service
+ *         Feeds the next piece of the pending packet to the endpoint, which
+ *         takes at most one USB packet's worth at a time. A packet left
+ *         over from before the host went away is dropped.
+ * @retval Number of bytes sent this time
+ */
+uint16_t USB_Data_Comm_Tx_Service(void) {
+    int32_t sent;
+
+    if (USB_Data_Comm_TxPendingLen == 0) {
+        return 0;
+    }
+    if (USB_GetDevState() != USB_STATE_CONFIGURED) {
+        USB_Data_Comm_TxPendingLen = 0;
+        return 0;
+    }
+    sent = VCP_Write(USB_Data_Comm_TxPending, USB_Data_Comm_TxPendingLen);
+    if (sent <= 0) {
+        return 0;
+    }
+    USB_Data_Comm_TxPending += sent;
+    USB_Data_Comm_TxPendingLen -= sent;
+    return (uint16_t) sent;
+}
+
+/**
+ * @brief  USB Data Communications Transmit Busy
+ * @retval 1 while a packet is still going out, 0 once the link is free
+ */
+uint8_t USB_Data_Comm_Tx_Busy(void) {
+    return (USB_Data_Comm_TxPendingLen > 0);
+}
+
 #if 0
 
 /**
@@ -176,13 +255,15 @@ void USB_Data_Comm_Periodic_Check(void) {
 static void USB_Data_Comm_Process_Command(void) {
     uint16_t errCode = data_process_command(&USB_Data_Comm_Packet);
     if ((errCode == DATA_PACKET_SUCCESS) && USB_Data_Comm_Packet.TxReady) {
-        uint8_t* send_buffer = USB_Data_Comm_Packet.TxBuffer;
-        uint16_t len_to_send = USB_Data_Comm_Packet.TxLength;
-        uint16_t actually_sent = 0;
-        while (len_to_send > 0) {
-            actually_sent = VCP_Write(send_buffer, len_to_send);
-            len_to_send -= actually_sent;
-            send_buffer += actually_sent;
+        // Whatever packet is part way out has to finish first, then the
+        // reply goes out whole before the next command can reuse the buffer
+        while (USB_Data_Comm_Tx_Busy()) {
+            USB_Data_Comm_Tx_Service();
+        }
+        USB_Data_Comm_Send(USB_Data_Comm_Packet.TxBuffer,
+                USB_Data_Comm_Packet.TxLength);
+        while (USB_Data_Comm_Tx_Busy()) {
+            USB_Data_Comm_Tx_Service();
         }
         USB_Data_Comm_Packet.TxReady = 0;
     }
@@ -0,0 +1,53 @@
+/******************************************************************************
+ * Filename: main.h
+ * Description: Stand-in for the firmware's umbrella header when the shared
+ *              packet code (data_packet.c), the BMS chain code
+ *              (bms_data_comm.c) and the configuration record code
+ *              (data_registry.c, config_blob.c) are compiled for the host.
+ *              Only declares what that code uses.
+ *
+ ******************************************************************************
+
+ Copyright (c) 2019 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#ifndef _MAIN_H_
+#define _MAIN_H_
+
+#include <stdint.h>
+#include <string.h>
+#include "stm32f4xx.h"
+#include "project_parameters.h"
+#include "crc32.h"
+#include "data_packet.h"
+#include "uart.h"
+#include "eeprom_emulation.h"
+#include "data_registry.h"
+#include "config_blob.h"
+
+#define MAIN_FAULT_BMS_COMM         ((uint32_t)0x00000040)
+
+// Milliseconds, used for packet reception timeouts. See host_port.c
+uint32_t GetTick(void);
+// See bms_sim.c
+void MAIN_SetError(uint32_t errorCode);
+
+#endif //_MAIN_H_
@@ -0,0 +1,94 @@
+/******************************************************************************
+ * Filename: stm32f4xx.h
+ * Description: Host stand-in for the device header. The shared firmware
+ *              headers only need the fixed width types and __IO, and the
+ *              EEPROM emulation needs the flash registers and the cycle
+ *              counter, which are simulated in ee_sim.c.
+ *
+ ******************************************************************************
+
+ Copyright (c) 2019 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#ifndef _STM32F4XX_H_
+#define _STM32F4XX_H_
+
+#include <stdint.h>
+
+#define __IO    volatile
+
+typedef enum {
+    RESET = 0, SET = !RESET
+} FlagStatus, ITStatus;
+
+typedef struct {
+    __IO uint32_t ACR;
+    __IO uint32_t KEYR;
+    __IO uint32_t OPTKEYR;
+    __IO uint32_t SR;
+    __IO uint32_t CR;
+    __IO uint32_t OPTCR;
+} FLASH_TypeDef;
+
+#define FLASH_CR_PG         ((uint32_t)0x00000001)
+#define FLASH_CR_SER        ((uint32_t)0x00000002)
+#define FLASH_CR_STRT       ((uint32_t)0x00010000)
+#define FLASH_CR_LOCK       ((uint32_t)0x80000000)
+
+// Every register access goes through the simulation, so it can carry out
+// whatever the last write started. See ee_sim.c
+FLASH_TypeDef* ee_sim_flash(void);
+#define FLASH               (ee_sim_flash())
+
+typedef struct {
+    __IO uint32_t CTRL;
+    __IO uint32_t CYCCNT;
+} DWT_Type;
+
+typedef struct {
+    __IO uint32_t DEMCR;
+} CoreDebug_Type;
+
+#define DWT_CTRL_CYCCNTENA_Msk          (1UL)
+#define CoreDebug_DEMCR_TRCENA_Msk      (1UL << 24)
+
+// The cycle counter follows the host clock, at SystemCoreClock
+extern uint32_t SystemCoreClock;
+DWT_Type* ee_sim_dwt(void);
+extern CoreDebug_Type EeSimCoreDebug;
+#define DWT                 (ee_sim_dwt())
+#define CoreDebug           (&EeSimCoreDebug)
+
+// No interrupts on the host, the simulations call the handlers themselves
+static inline void __disable_irq(void) {
+}
+static inline void __enable_irq(void) {
+}
+static inline uint32_t __get_PRIMASK(void) {
+    return 0;
+}
+static inline void __set_PRIMASK(uint32_t primask) {
+    (void) primask;
+}
+static inline void __WFI(void) {
+}
+
+#endif //_STM32F4XX_H_
@@ -0,0 +1,46 @@
+/******************************************************************************
+ * Filename: uart.h
+ * Description: Host stand-in for the firmware's serial ports. The BMS port
+ *              is the simulated chain in bms_sim.c.
+ *
+ ******************************************************************************
+
+ Copyright (c) 2019 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#ifndef UART_H_
+#define UART_H_
+
+#include "stm32f4xx.h"
+
+#define HBD_BAUDRATE            38400
+#define BMS_BAUDRATE            115200
+
+typedef enum _uart_sel{
+    SELECT_HBD_UART,
+    SELECT_BMS_UART
+} UART_Sel;
+
+int32_t UART_InWaiting(UART_Sel uart);
+int32_t UART_Read(UART_Sel uart, void* buf, uint32_t count);
+int32_t UART_Write(UART_Sel uart, void* buf, uint32_t count);
+
+#endif // UART_H_
@@ -0,0 +1,372 @@
+/******************************************************************************
+ * Filename: bms_sim.c
+ * Description: Simulated chain of BMS boards on the controller's BMS port, for
+ *              running the firmware's bms_data_comm.c on the host.
+ *
+ *              Each board repeats what it hears down the chain a byte time
+ *              later, and answers what's addressed to it after
+ *              BMS_SIM_PROCESS_US. Answers share the one line back to the
+ *              controller, so they queue up behind each other. A board marked
+ *              legacy is an older one that NACKs GET_RAM_BATCH.
+ *
+ ******************************************************************************
+
+ Copyright (c) 2019 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <math.h>
+#include "main.h"
+#include "bms_data_comm.h"
+#include "data_commands.h"
+#include "host_port.h"
+#include "bms_sim.h"
+
+#define BMS_SIM_MAX_REPLIES     (64)
+
+typedef struct _bms_sim_board {
+    uint8_t Address; // Zero until addressed
+    uint8_t Legacy;
+} Bms_Sim_Board;
+
+typedef struct _bms_sim_reply {
+    double Done; // When the last byte reaches the controller, us
+    uint16_t Length;
+    uint8_t Data[PACKET_MAX_LENGTH];
+} Bms_Sim_Reply;
+
+typedef struct _bms_sim {
+    double Now; // us
+    double ByteUs; // Time for one byte on the wire
+    double TxFree; // When the line to the chain is next free
+    double RxFree; // When the line back from the chain is next free
+    Bms_Sim_Board Boards[MAX_BMS_BOARDS];
+    uint8_t NumBoards;
+    Bms_Sim_Reply Replies[BMS_SIM_MAX_REPLIES];
+    uint16_t ReplyRd, ReplyWr;
+    uint16_t ReplyPos; // Bytes of the oldest reply already read
+    Data_Packet_Type Parser; // Board side
+    uint8_t ParserData[PACKET_MAX_DATA_LENGTH];
+    uint32_t Requests;
+    uint32_t TxBytes;
+    uint32_t RxBytes;
+    uint32_t Errors; // MAIN_SetError calls
+    uint32_t Refresh; // Voltages change a little with each refresh
+} Bms_Sim;
+
+// *** Global variables ***
+Bms_Sim BmsSim;
+
+// Which cell is highest or lowest moves around from one refresh to the next
+static float bms_sim_voltage(uint8_t board, uint8_t cell) {
+    return 3.3f + (0.05f * board) + (0.01f * cell)
+            + (0.03f * ((cell + BmsSim.Refresh) % 3));
+}
+
+static uint32_t bms_sim_status(uint8_t board, uint8_t cell) {
+    return ((uint32_t) board << 8) | cell;
+}
+
+/**
+ * Reads a variable the way a board would.
+ * @retval DATA_PACKET_SUCCESS, or DATA_PACKET_FAIL for an unknown ID
+ */
+static uint8_t bms_sim_read(uint8_t board, uint16_t id, uint32_t* value) {
+    if ((id >= R_VOLT_BATT1) && (id < (R_VOLT_BATT1 + BMS_SIM_CELLS))) {
+        *value = (uint32_t) (bms_sim_voltage(board, id - R_VOLT_BATT1 + 1)
+                * 65536.0f);
+        return DATA_PACKET_SUCCESS;
+    }
+    if ((id >= R_STAT_BATT1) && (id < (R_STAT_BATT1 + BMS_SIM_CELLS))) {
+        *value = bms_sim_status(board, id - R_STAT_BATT1 + 1);
+        return DATA_PACKET_SUCCESS;
+    }
+    return DATA_PACKET_FAIL;
+}
+
+/**
+ * Queues an answer from the board at this position in the chain (0 is the
+ * one next to the controller) to a request that finished arriving at the
+ * first board at time sent.
+ */
+static void bms_sim_reply(uint8_t pos, double sent, uint8_t type,
+        uint8_t* data, uint16_t len) {
+    Bms_Sim_Reply* reply = &BmsSim.Replies[BmsSim.ReplyWr];
+    uint16_t next = (BmsSim.ReplyWr + 1) % BMS_SIM_MAX_REPLIES;
+    Data_Packet_Type pkt;
+    // Out along the chain, the board's turnaround, and back again
+    double ready = sent + (2 * pos * BmsSim.ByteUs) + BMS_SIM_PROCESS_US;
+
+    if (next == BmsSim.ReplyRd) {
+        return; // Lost, the controller hasn't been reading
+    }
+    memset(&pkt, 0, sizeof(pkt));
+    pkt.TxBuffer = reply->Data;
+    data_packet_create(&pkt, type, data, len);
+    if (ready < BmsSim.RxFree) {
+        ready = BmsSim.RxFree;
+    }
+    reply->Length = pkt.TxLength;
+    reply->Done = ready + (pkt.TxLength * BmsSim.ByteUs);
+    BmsSim.RxFree = reply->Done;
+    BmsSim.ReplyWr = next;
+}
+
+/**
+ * Every board sees every packet. Handles one that finished arriving at the
+ * first board at time sent.
+ */
+static void bms_sim_request(Data_Packet_Type* req, double sent) {
+    uint8_t out[PACKET_MAX_DATA_LENGTH];
+    uint8_t addr = req->Data[0];
+    uint8_t pos;
+
+    BmsSim.Requests++;
+    if ((req->PacketType == SET_RAM_VARIABLE) && (req->DataLength == 4)
+            && (data_packet_extract_16b(&req->Data[1]) == R_ADDRESS)) {
+        if (addr == BROADCAST_ADDRESS) {
+            for (pos = 0; pos < BmsSim.NumBoards; pos++) {
+                BmsSim.Boards[pos].Address = req->Data[3];
+            }
+            return;
+        }
+        if (addr == 0) {
+            // First board still without an address takes it
+            for (pos = 0; pos < BmsSim.NumBoards; pos++) {
+                if (BmsSim.Boards[pos].Address == 0) {
+                    BmsSim.Boards[pos].Address = req->Data[3];
+                    bms_sim_reply(pos, sent, CONTROLLER_ACK, 0, 0);
+                    return;
+                }
+            }
+            return;
+        }
+    }
+
+    for (pos = 0; pos < BmsSim.NumBoards; pos++) {
+        if ((addr != 0) && (BmsSim.Boards[pos].Address == addr)) {
+            break;
+        }
+    }
+    if (pos == BmsSim.NumBoards) {
+        return; // Nobody there
+    }
+
+    if ((req->PacketType == GET_RAM_VARIABLE) && (req->DataLength == 3)) {
+        uint16_t id = data_packet_extract_16b(&req->Data[1]);
+        uint32_t value;
+        if (id == R_NUM_BATTS) {
+            data_packet_pack_16b(out, BMS_SIM_CELLS);
+            bms_sim_reply(pos, sent, GET_RAM_RESULT, out, 2);
+            return;
+        }
+        if (bms_sim_read(addr, id, &value) == DATA_PACKET_SUCCESS) {
+            data_packet_pack_32b(out, value);
+            bms_sim_reply(pos, sent, GET_RAM_RESULT, out, 4);
+            return;
+        }
+    } else if ((req->PacketType == GET_RAM_BATCH)
+            && (!BmsSim.Boards[pos].Legacy)) {
+        uint16_t place = 1;
+        out[0] = addr;
+        for (uint16_t i = 1; (i + 4) <= req->DataLength; i += 4) {
+            uint16_t first = data_packet_extract_16b(&req->Data[i]);
+            uint16_t last = data_packet_extract_16b(&req->Data[i + 2]);
+            for (uint16_t id = first; (id <= last) && ((place + 7)
+                    <= PACKET_MAX_DATA_LENGTH); id++) {
+                uint32_t value;
+                data_packet_pack_16b(&out[place], id);
+                if (bms_sim_read(addr, id, &value) == DATA_PACKET_SUCCESS) {
+                    out[place + 2] = BATCH_STATUS_OK;
+                    data_packet_pack_32b(&out[place + 3], value);
+                    place += 7;
+                } else {
+                    out[place + 2] = BATCH_STATUS_UNKNOWN_ID;
+                    place += 3;
+                }
+            }
+        }
+        bms_sim_reply(pos, sent, GET_RAM_BATCH_RESULT, out, place);
+        return;
+    }
+    bms_sim_reply(pos, sent, CONTROLLER_NACK, 0, 0);
+}
+
+int32_t UART_Write(UART_Sel uart, void* buf, uint32_t count) {
+    uint8_t* bytes = buf;
+    uint32_t place = 0;
+    double start = (BmsSim.TxFree > BmsSim.Now) ? BmsSim.TxFree : BmsSim.Now;
+
+    if (uart != SELECT_BMS_UART) {
+        return count;
+    }
+    BmsSim.TxFree = start + (count * BmsSim.ByteUs);
+    BmsSim.TxBytes += count;
+    while (place < count) {
+        uint16_t used;
+        if ((data_packet_extract_span(&BmsSim.Parser, &bytes[place],
+                count - place, &used) == DATA_PACKET_SUCCESS)
+                && BmsSim.Parser.RxReady) {
+            bms_sim_request(&BmsSim.Parser, BmsSim.TxFree);
+            BmsSim.Parser.RxReady = 0;
+        }
+        place += used;
+    }
+    return count;
+}
+
+int32_t UART_InWaiting(UART_Sel uart) {
+    int32_t count = 0;
+    if (uart != SELECT_BMS_UART) {
+        return 0;
+    }
+    for (uint16_t i = BmsSim.ReplyRd; i != BmsSim.ReplyWr;
+            i = (i + 1) % BMS_SIM_MAX_REPLIES) {
+        if (BmsSim.Replies[i].Done > BmsSim.Now) {
+            break;
+        }
+        count += BmsSim.Replies[i].Length;
+    }
+    return count - BmsSim.ReplyPos;
+}
+
+int32_t UART_Read(UART_Sel uart, void* buf, uint32_t count) {
+    uint8_t* dest = buf;
+    uint32_t place = 0;
+    if (uart != SELECT_BMS_UART) {
+        return 0;
+    }
+    while ((place < count) && (BmsSim.ReplyRd != BmsSim.ReplyWr)) {
+        Bms_Sim_Reply* reply = &BmsSim.Replies[BmsSim.ReplyRd];
+        if (reply->Done > BmsSim.Now) {
+            break;
+        }
+        uint32_t n = reply->Length - BmsSim.ReplyPos;
+        if (n > (count - place)) {
+            n = count - place;
+        }
+        memcpy(&dest[place], &reply->Data[BmsSim.ReplyPos], n);
+        place += n;
+        BmsSim.ReplyPos += n;
+        BmsSim.RxBytes += n;
+        if (BmsSim.ReplyPos == reply->Length) {
+            BmsSim.ReplyPos = 0;
+            BmsSim.ReplyRd = (BmsSim.ReplyRd + 1) % BMS_SIM_MAX_REPLIES;
+        }
+    }
+    return place;
+}
+
+void MAIN_SetError(uint32_t errorCode) {
+    BmsSim.Errors++;
+}
+
+/**
+ * Runs the controller's main loop until the BMS code is idle again.
+ * @retval Simulated time taken, us
+ */
+static double bms_sim_wait(void) {
+    double start = BmsSim.Now;
+    // Nothing should take anywhere near this long
+    double limit = start + 10e6;
+    do {
+        BmsSim.Now += BMS_SIM_STEP_US;
+        host_port_set_tick((uint32_t) (BmsSim.Now / 1000.0));
+        BMS_OneByte_Check();
+    } while (BMS_Busy() && (BmsSim.Now < limit));
+    return BmsSim.Now - start;
+}
+
+/**
+ * Addresses a simulated chain with the firmware's code, refreshes it a
+ * number of times and checks the cell data that comes back.
+ * @param  boards - how many boards in the chain
+ * @param  legacy - bit (n-1) set makes board n one without GET_RAM_BATCH
+ * @param  refreshes - number of full refreshes to average over
+ * @retval 0 if everything read back correctly
+ */
+int bms_sim_run(uint8_t boards, uint16_t legacy, uint32_t baud,
+        uint32_t refreshes, Bms_Sim_Result* result) {
+    memset(&BmsSim, 0, sizeof(BmsSim));
+    memset(result, 0, sizeof(*result));
+    if ((boards == 0) || (boards > MAX_BMS_BOARDS) || (baud == 0)) {
+        return 1;
+    }
+    BmsSim.ByteUs = 10e6 / baud;
+    BmsSim.NumBoards = boards;
+    for (uint8_t i = 0; i < boards; i++) {
+        BmsSim.Boards[i].Legacy = (legacy >> i) & 1;
+    }
+    BmsSim.Parser.Data = BmsSim.ParserData;
+    BmsSim.Parser.State = DATA_COMM_IDLE;
+    host_port_set_tick(0);
+
+    BMS_Data_Comm_Init();
+    BMS_Restart_Chain();
+    result->AddressingMs = bms_sim_wait() / 1000.0;
+    result->Connected = BMS_Is_Connected();
+    result->Cells = BMS_Get_Num_Batts();
+    if ((!result->Connected) || (result->Cells != boards * BMS_SIM_CELLS)) {
+        host_port_real_tick();
+        return 1;
+    }
+
+    BmsSim.Requests = 0;
+    BmsSim.TxBytes = 0;
+    BmsSim.RxBytes = 0;
+    for (uint32_t n = 0; n < refreshes; n++) {
+        BmsSim.Refresh = n;
+        BMS_Refresh_Data();
+        result->RefreshMs += bms_sim_wait() / 1000.0;
+    }
+    host_port_real_tick();
+    if (refreshes > 0) {
+        result->RefreshMs /= refreshes;
+        result->Requests = BmsSim.Requests / refreshes;
+        result->TxBytes = BmsSim.TxBytes / refreshes;
+        result->RxBytes = BmsSim.RxBytes / refreshes;
+    }
+
+    // Cells are kept to the millivolt
+    float vmin = 100.0f, vmax = -100.0f, vsum = 0.0f;
+    for (uint8_t b = 1; b <= boards; b++) {
+        for (uint8_t c = 1; c <= BMS_SIM_CELLS; c++) {
+            uint16_t cell = ((b - 1) * BMS_SIM_CELLS) + (c - 1);
+            float expected = bms_sim_voltage(b, c);
+            float v = BMS_Get_Batt_Voltage(cell) - expected;
+            if ((v > 0.0006f) || (v < -0.0006f)
+                    || (BMS_Get_Batt_Status(cell) != bms_sim_status(b, c))) {
+                result->BadValues++;
+            }
+            vmin = (expected < vmin) ? expected : vmin;
+            vmax = (expected > vmax) ? expected : vmax;
+            vsum += expected;
+        }
+    }
+    if ((refreshes > 0)
+            && ((fabsf(BMS_Get_Min_Cell_Voltage() - vmin) > 0.0006f)
+            || (fabsf(BMS_Get_Max_Cell_Voltage() - vmax) > 0.0006f)
+            || (fabsf(BMS_Get_Avg_Cell_Voltage() - (vsum / result->Cells))
+                    > 0.0006f))) {
+        result->BadValues++;
+    }
+    return ((result->BadValues > 0) || (BmsSim.Errors > 0)) ? 1 : 0;
+}
@@ -0,0 +1,54 @@
+/******************************************************************************
+ * Filename: bms_sim.h
+ * Description: Simulated chain of BMS boards on the controller's BMS port, for
+ *              running the firmware's bms_data_comm.c on the host. Time is
+ *              simulated too, so refresh times come out as they would on the
+ *              wire rather than as fast as the host can go.
+ *
+ ******************************************************************************
+
+ Copyright (c) 2019 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#ifndef _BMS_SIM_H_
+#define _BMS_SIM_H_
+
+#include "main.h"
+
+#define BMS_SIM_CELLS           (4) // Per board
+#define BMS_SIM_PROCESS_US      (200) // Board's time to turn a request around
+#define BMS_SIM_STEP_US         (50) // One pass of the controller's main loop
+
+typedef struct _bms_sim_result {
+    uint8_t Connected;
+    uint16_t Cells;
+    uint32_t BadValues; // Cells that didn't read back what the boards hold
+    double AddressingMs;
+    double RefreshMs; // Average over the refreshes
+    uint32_t Requests; // Per refresh
+    uint32_t TxBytes; // Per refresh, controller to chain
+    uint32_t RxBytes; // Per refresh, chain to controller
+} Bms_Sim_Result;
+
+int bms_sim_run(uint8_t boards, uint16_t legacy, uint32_t baud,
+        uint32_t refreshes, Bms_Sim_Result* result);
+
+#endif //_BMS_SIM_H_
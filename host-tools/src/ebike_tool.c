@@ -0,0 +1,1160 @@
+/******************************************************************************
+ * Filename: ebike_tool.c
+ * Description: Command line tool for the controller's data link. Decodes the
+ *              packet stream from a file or serial port, records telemetry to
+ *              the columnar format in recording.h, replays recordings,
+ *              benchmarks the decoder with a synthetic 20kHz stream,
+ *              compares how the two framings cope with bit errors (fuzz),
+ *              times BMS refreshes on a simulated chain (bms), times the
+ *              EEPROM emulation on simulated flash (eeprom), times the
+ *              main loop tasks with simulated interrupts (sched), and checks
+ *              the shared firmware code (selftest).
+ *
+ ******************************************************************************
+
+ Copyright (c) 2019 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+#include <time.h>
+#include <poll.h>
+#include "main.h"
+#include "stream_decoder.h"
+#include "recording.h"
+#include "selftest.h"
+#include "host_port.h"
+#include "bms_sim.h"
+#include "ee_sim.h"
+#include "sched_sim.h"
+#include "config_blob.h"
+
+#define READ_CHUNK          (4096)
+#define DEFAULT_PWM_FREQ    (20000)
+#define FUZZ_CHUNK          (64) // About what one USB packet brings in
+#define BMS_REFRESHES       (10)
+#define EE_BOOTS            (100)
+#define REPLY_TIMEOUT_MS    (1000)
+// The controller only takes PACKET_MAX_DATA_LENGTH (64) bytes of data, two
+// of which are the offset
+#define CONFIG_PUT_CHUNK    (64 - 2)
+// Mode byte, then six bytes per channel
+#define SUBSCRIBE_PER_PACKET ((64 - 1) / 6)
+
+static volatile sig_atomic_t stop_requested = 0;
+
+typedef struct _tool_options {
+    const char* Types;
+    uint32_t Baud;
+    uint8_t Quiet;
+    double Seconds;
+    uint8_t Channels;
+    const char* Output;
+    uint32_t PWMFreq;
+    uint8_t Framing;
+    uint32_t Errors;
+    const char* Vars;
+} Tool_Options;
+
+static void usage(void) {
+    fprintf(stderr,
+            "Usage:\n"
+            "  ebike_tool dump <file|tty> [-t types | -v vars] [-b baud] [-c]\n"
+            "  ebike_tool record <file|tty> <out.ebtl> [-t types | -v vars] [-b baud] [-c]\n"
+            "  ebike_tool replay <in.ebtl> [-q] [-f pwm_hz]\n"
+            "  ebike_tool bench [-s seconds] [-n channels] [-o out.ebtl]\n"
+            "  ebike_tool fuzz [-s seconds] [-n channels] [-e errors]\n"
+            "  ebike_tool bms [-n boards] [-b baud]\n"
+            "  ebike_tool eeprom\n"
+            "  ebike_tool sched [-s seconds]\n"
+            "  ebike_tool config-get <tty> <out.bin> [-b baud] [-c]\n"
+            "  ebike_tool config-put <in.bin> <tty> [-b baud] [-c]\n"
+            "  ebike_tool selftest\n"
+            "Types are one letter per subscribed channel, in order:\n"
+            "  b = I8, h = I16, i = I32, f = F32 (default: all F32)\n"
+            "Vars are subscribed on a serial port, types come from the controller:\n"
+            "  id[:decimation[:index]],... e.g. 0x0201,0x0203:20\n"
+            "-c uses COBS framing (asked for on a serial port, assumed in a file)\n");
+}
+
+static void handle_sigint(int sig) {
+    (void) sig;
+    stop_requested = 1;
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + (ts.tv_nsec * 1e-9);
+}
+
+static speed_t baud_to_speed(uint32_t baud) {
+    switch (baud) {
+    case 9600:
+        return B9600;
+    case 57600:
+        return B57600;
+    case 230400:
+        return B230400;
+    case 460800:
+        return B460800;
+    case 921600:
+        return B921600;
+    case 1000000:
+        return B1000000;
+    default:
+        return B115200;
+    }
+}
+
+// Sends a command packet to a live port
+static void send_command(int fd, uint8_t framing, uint8_t type, uint8_t* data,
+        uint16_t len) {
+    uint8_t txbuf[PACKET_MAX_LENGTH];
+    Data_Packet_Type pkt;
+
+    pkt.TxBuffer = txbuf;
+    pkt.Framing = framing;
+    if (data_packet_create(&pkt, type, data, len) == DATA_PACKET_SUCCESS) {
+        if (write(fd, txbuf, pkt.TxLength) != pkt.TxLength) {
+            fprintf(stderr, "Couldn't send command 0x%02X\n", type);
+        }
+    }
+}
+
+// Feature commands start and stop streaming
+static void send_feature(int fd, uint8_t framing, uint8_t type,
+        uint16_t feature) {
+    uint8_t data[2];
+    data_packet_pack_16b(data, feature);
+    send_command(fd, framing, type, data, 2);
+}
+
+/**
+ * Opens a file or serial device for reading. Serial devices are put in raw
+ * mode, switched to the requested framing, and if stream is set the
+ * controller is told to start streaming.
+ */
+static int link_open(const char* path, uint32_t baud, uint8_t framing,
+        uint8_t stream, uint8_t* is_tty) {
+    int fd = open(path, O_RDWR | O_NOCTTY);
+    if (fd < 0) {
+        fd = open(path, O_RDONLY);
+    }
+    if (fd < 0) {
+        return -1;
+    }
+    *is_tty = isatty(fd);
+    if (*is_tty) {
+        struct termios tio;
+        tcgetattr(fd, &tio);
+        cfmakeraw(&tio);
+        cfsetispeed(&tio, baud_to_speed(baud));
+        cfsetospeed(&tio, baud_to_speed(baud));
+        tio.c_cc[VMIN] = 1;
+        tio.c_cc[VTIME] = 0;
+        tcsetattr(fd, TCSANOW, &tio);
+        tcflush(fd, TCIFLUSH);
+        if (framing != DATA_PACKET_FRAMING_SOP) {
+            // The ACK comes back in SOP framing and is skipped as noise
+            send_command(fd, DATA_PACKET_FRAMING_SOP, SET_FRAMING, &framing, 1);
+        }
+        if (stream) {
+            send_feature(fd, framing, ENABLE_FEATURE, FEATURE_SERIAL_DATA);
+        }
+    }
+    return fd;
+}
+
+// Stops streaming and leaves the link in SOP framing for other tools
+static void link_close(int fd, uint8_t framing, uint8_t is_tty) {
+    if (is_tty) {
+        send_feature(fd, framing, DISABLE_FEATURE, FEATURE_SERIAL_DATA);
+        if (framing != DATA_PACKET_FRAMING_SOP) {
+            uint8_t sop = DATA_PACKET_FRAMING_SOP;
+            send_command(fd, framing, SET_FRAMING, &sop, 1);
+        }
+    }
+    close(fd);
+}
+
+/*** requests ***/
+// Request and reply over a live port, for -v and the config commands
+typedef struct _config_link {
+    int Fd;
+    uint8_t Framing;
+    Stream_Decoder Dec;
+    uint8_t Replied;
+    uint8_t ReplyType;
+    uint16_t ReplyLength;
+    uint8_t Reply[PACKET_MAX_LENGTH];
+} Config_Link;
+
+// Keeps the first packet that isn't stream data
+static void config_packet(void* ctx, Data_Packet_Type* pkt) {
+    Config_Link* link = (Config_Link*) ctx;
+    if ((pkt->PacketType != CONTROLLER_STREAM_DATA) && !link->Replied) {
+        link->Replied = 1;
+        link->ReplyType = pkt->PacketType;
+        link->ReplyLength = pkt->DataLength;
+        memcpy(link->Reply, pkt->Data, pkt->DataLength);
+    }
+}
+
+static int config_link_open(Config_Link* link, const char* path,
+        const Tool_Options* opt) {
+    Data_Type types[1] = { Data_Type_Float };
+    Stream_Decoder_Callbacks cb = { link, config_packet, NULL, NULL };
+    uint8_t is_tty;
+
+    link->Fd = link_open(path, opt->Baud, opt->Framing, 0, &is_tty);
+    if (link->Fd < 0) {
+        perror(path);
+        return 1;
+    }
+    if (!is_tty) {
+        fprintf(stderr, "%s: not a serial port\n", path);
+        close(link->Fd);
+        return 1;
+    }
+    link->Framing = opt->Framing;
+    stream_decoder_init(&(link->Dec), 1, types, &cb);
+    link->Dec.Pkt.Framing = opt->Framing;
+    return 0;
+}
+
+// Sends a request and waits for the answer. Returns the reply packet type,
+// or 0 if nothing came back in time.
+static uint8_t config_request(Config_Link* link, uint8_t type, uint8_t* data,
+        uint16_t len) {
+    uint8_t buf[READ_CHUNK];
+    double deadline = now_seconds() + (REPLY_TIMEOUT_MS / 1000.0);
+    struct pollfd pfd = { link->Fd, POLLIN, 0 };
+
+    link->Replied = 0;
+    send_command(link->Fd, link->Framing, type, data, len);
+    while (!link->Replied) {
+        int wait_ms = (int) ((deadline - now_seconds()) * 1000.0);
+        if ((wait_ms <= 0) || (poll(&pfd, 1, wait_ms) <= 0)) {
+            return 0;
+        }
+        ssize_t n = read(link->Fd, buf, sizeof(buf));
+        if (n <= 0) {
+            return 0;
+        }
+        stream_decoder_feed(&(link->Dec), buf, (size_t) n);
+    }
+    return link->ReplyType;
+}
+
+/**
+ * Subscribes the channels listed with -v, "id[:decimation[:index]],..."
+ * (decimation 1 if left out), and reads each one's type from the
+ * controller's variable list. The stream is then decoded with the layout
+ * the controller really uses.
+ * @retval Number of channels, zero if it couldn't be done
+ */
+static uint8_t subscribe_channels(const char* path, const Tool_Options* opt,
+        Data_Type* types) {
+    static Config_Link link;
+    uint16_t ids[TELEMETRY_MAX_CHANNELS];
+    uint16_t decimation[TELEMETRY_MAX_CHANNELS];
+    uint16_t index[TELEMETRY_MAX_CHANNELS];
+    uint8_t req[1 + (SUBSCRIBE_PER_PACKET * 6)];
+    uint16_t first = 0, total = 1;
+    uint8_t numchan = 0;
+    const char* p = opt->Vars;
+    char* end;
+
+    while (*p) {
+        if (numchan >= TELEMETRY_MAX_CHANNELS) {
+            fprintf(stderr, "Too many channels, %u at most\n",
+                    TELEMETRY_MAX_CHANNELS);
+            return 0;
+        }
+        ids[numchan] = (uint16_t) strtoul(p, &end, 0);
+        decimation[numchan] = 1;
+        index[numchan] = 0;
+        if ((end != p) && (*end == ':')) {
+            decimation[numchan] = (uint16_t) strtoul(end + 1, &end, 0);
+            if (*end == ':') {
+                index[numchan] = (uint16_t) strtoul(end + 1, &end, 0);
+            }
+        }
+        if ((end == p) || ((*end != ',') && (*end != 0))) {
+            fprintf(stderr, "Bad channel list: %s\n", opt->Vars);
+            return 0;
+        }
+        types[numchan++] = Data_Type_None;
+        p = (*end == ',') ? (end + 1) : end;
+    }
+    if ((numchan == 0) || (config_link_open(&link, path, opt) != 0)) {
+        return 0;
+    }
+
+    // Look the types up a page of the list at a time
+    while (first < total) {
+        uint8_t page[2];
+        uint8_t count;
+        data_packet_pack_16b(page, first);
+        if ((config_request(&link, GET_VARIABLE_LIST, page, 2)
+                != GET_VARIABLE_LIST_RESULT) || (link.ReplyLength < 5)) {
+            fprintf(stderr, "No variable list (at entry %u)\n", first);
+            close(link.Fd);
+            return 0;
+        }
+        total = data_packet_extract_16b(link.Reply);
+        count = link.Reply[4];
+        if ((count == 0) || ((5 + (count * DATA_REG_LIST_ENTRY_BYTES))
+                > link.ReplyLength)) {
+            break;
+        }
+        for (uint8_t e = 0; e < count; e++) {
+            uint8_t* entry = &link.Reply[5 + (e * DATA_REG_LIST_ENTRY_BYTES)];
+            for (uint8_t i = 0; i < numchan; i++) {
+                if (ids[i] == data_packet_extract_16b(entry)) {
+                    types[i] = (Data_Type) entry[2];
+                }
+            }
+        }
+        first += count;
+    }
+    for (uint8_t i = 0; i < numchan; i++) {
+        if (data_packet_type_size(types[i]) == 0) {
+            fprintf(stderr, "0x%04X isn't a variable\n", ids[i]);
+            close(link.Fd);
+            return 0;
+        }
+    }
+
+    // The first packet replaces the old channels, any more are added on
+    for (uint8_t i = 0; i < numchan;) {
+        uint16_t len = 1;
+        req[0] = (i == 0) ? TELEMETRY_REPLACE : TELEMETRY_APPEND;
+        while ((i < numchan) && (len < sizeof(req))) {
+            data_packet_pack_16b(&req[len], ids[i]);
+            data_packet_pack_16b(&req[len + 2], index[i]);
+            data_packet_pack_16b(&req[len + 4], decimation[i]);
+            len += 6;
+            i++;
+        }
+        if (config_request(&link, TELEMETRY_SUBSCRIBE, req, len)
+                != CONTROLLER_ACK) {
+            fprintf(stderr, "Subscription refused\n");
+            close(link.Fd);
+            return 0;
+        }
+    }
+    close(link.Fd);
+    return numchan;
+}
+
+static uint8_t get_types(const char* path, const Tool_Options* opt,
+        Data_Type* types) {
+    if (opt->Vars != NULL) {
+        return subscribe_channels(path, opt, types);
+    }
+    if (opt->Types == NULL) {
+        for (uint8_t i = 0; i < TELEMETRY_MAX_CHANNELS; i++) {
+            types[i] = Data_Type_Float;
+        }
+        return TELEMETRY_MAX_CHANNELS;
+    }
+    return stream_decoder_parse_types(opt->Types, types);
+}
+
+static void print_stats(const Stream_Decoder_Stats* st) {
+    fprintf(stderr, "%llu bytes, %u packets, %u CRC errors, %u framing errors\n",
+            (unsigned long long) st->Bytes, st->Packets, st->CrcErrors,
+            st->FramingErrors);
+    fprintf(stderr, "%u frames, %u lost, %u bad, %llu records\n", st->Frames,
+            st->FramesLost, st->BadFrames, (unsigned long long) st->Records);
+}
+
+// Reads the whole input through the decoder
+static int run_decoder(const char* path, const Tool_Options* opt,
+        Stream_Decoder* dec) {
+    uint8_t buf[READ_CHUNK];
+    uint8_t is_tty;
+    int fd = link_open(path, opt->Baud, opt->Framing, 1, &is_tty);
+
+    if (fd < 0) {
+        perror(path);
+        return 1;
+    }
+    dec->Pkt.Framing = opt->Framing;
+    signal(SIGINT, handle_sigint);
+    while (!stop_requested) {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n <= 0) {
+            break;
+        }
+        stream_decoder_feed(dec, buf, (size_t) n);
+    }
+    link_close(fd, opt->Framing, is_tty);
+    print_stats(&(dec->Stats));
+    return 0;
+}
+
+/*** dump ***/
+static void dump_packet(void* ctx, Data_Packet_Type* pkt) {
+    (void) ctx;
+    if (pkt->PacketType != CONTROLLER_STREAM_DATA) {
+        printf("packet 0x%02X, %u bytes\n", pkt->PacketType, pkt->DataLength);
+    }
+}
+
+static void dump_frame(void* ctx, const Stream_Frame_Header* hdr) {
+    (void) ctx;
+    printf("frame %u, sample %u, %u us\n", hdr->Sequence, hdr->SampleIndex,
+            hdr->Timestamp);
+}
+
+static void dump_sample(void* ctx, uint8_t chan, uint32_t sample_index,
+        const uint8_t* value) {
+    Stream_Decoder* dec = (Stream_Decoder*) ctx;
+    uint8_t copy[4];
+    double v;
+
+    memcpy(copy, value, dec->Sizes[chan]);
+    switch (dec->Types[chan]) {
+    case Data_Type_Int8:
+        v = (int8_t) copy[0];
+        break;
+    case Data_Type_Int16:
+        v = (int16_t) data_packet_extract_16b(copy);
+        break;
+    case Data_Type_Int32:
+        v = (int32_t) data_packet_extract_32b(copy);
+        break;
+    default:
+        v = data_packet_extract_float(copy);
+        break;
+    }
+    printf("  %u ch%u %g\n", sample_index, chan, v);
+}
+
+static int cmd_dump(const char* path, const Tool_Options* opt) {
+    static Stream_Decoder dec;
+    Data_Type types[TELEMETRY_MAX_CHANNELS];
+    Stream_Decoder_Callbacks cb = { &dec, dump_packet, dump_frame, dump_sample };
+    uint8_t numchan = get_types(path, opt, types);
+
+    if (numchan == 0) {
+        // A failed subscription has already said why
+        if (opt->Vars == NULL) {
+            usage();
+        }
+        return 1;
+    }
+    stream_decoder_init(&dec, numchan, types, &cb);
+    return run_decoder(path, opt, &dec);
+}
+
+/*** record ***/
+static void record_frame(void* ctx, const Stream_Frame_Header* hdr) {
+    recording_add_frame((Recording*) ctx, hdr->Sequence, hdr->SampleIndex,
+            hdr->Timestamp);
+}
+
+static void record_sample(void* ctx, uint8_t chan, uint32_t sample_index,
+        const uint8_t* value) {
+    recording_add_sample((Recording*) ctx, chan, sample_index, value);
+}
+
+static int cmd_record(const char* path, const char* out, const Tool_Options* opt) {
+    static Stream_Decoder dec;
+    static Recording rec;
+    Data_Type types[TELEMETRY_MAX_CHANNELS];
+    Stream_Decoder_Callbacks cb = { &rec, NULL, record_frame, record_sample };
+    uint8_t numchan = get_types(path, opt, types);
+    int err;
+
+    if (numchan == 0) {
+        // A failed subscription has already said why
+        if (opt->Vars == NULL) {
+            usage();
+        }
+        return 1;
+    }
+    if (recording_create(&rec, out, numchan, types) == DATA_PACKET_FAIL) {
+        perror(out);
+        return 1;
+    }
+    stream_decoder_init(&dec, numchan, types, &cb);
+    err = run_decoder(path, opt, &dec);
+    if (recording_close(&rec) == DATA_PACKET_FAIL) {
+        perror(out);
+        return 1;
+    }
+    return err;
+}
+
+/*** replay ***/
+/**
+ * Plays a recording back as fast as it can be read. Channels are merged by
+ * sample index into CSV rows on stdout (empty where a channel wasn't sampled).
+ * With -q only the rate is reported.
+ */
+static int cmd_replay(const char* path, const Tool_Options* opt) {
+    static Recording rec;
+    uint32_t pos[TELEMETRY_MAX_CHANNELS];
+    uint64_t samples = 0, rows = 0;
+    uint32_t first = 0, last = 0;
+    uint8_t have_first = 0;
+    int32_t got;
+    double start;
+
+    if (recording_open(&rec, path) == DATA_PACKET_FAIL) {
+        fprintf(stderr, "%s: not a recording\n", path);
+        return 1;
+    }
+    if (!opt->Quiet) {
+        printf("sample");
+        for (uint8_t i = 0; i < rec.NumChannels; i++) {
+            printf(",ch%u", i);
+        }
+        printf("\n");
+    }
+    start = now_seconds();
+    while ((got = recording_read_block(&rec)) > 0) {
+        samples += got;
+        if (rec.NumFrames && !have_first) {
+            first = rec.FrameSampleIndex[0];
+            have_first = 1;
+        }
+        memset(pos, 0, sizeof(pos));
+        for (;;) {
+            // Next row is the lowest sample index left in any column
+            uint8_t any = 0;
+            uint32_t next = 0;
+            for (uint8_t i = 0; i < rec.NumChannels; i++) {
+                Recording_Column* col = &(rec.Columns[i]);
+                if (pos[i] < col->Count) {
+                    int32_t diff = (int32_t) (col->SampleIndex[pos[i]] - next);
+                    if ((!any) || (diff < 0)) {
+                        next = col->SampleIndex[pos[i]];
+                        any = 1;
+                    }
+                }
+            }
+            if (!any) {
+                break;
+            }
+            if (!opt->Quiet) {
+                printf("%u", next);
+            }
+            for (uint8_t i = 0; i < rec.NumChannels; i++) {
+                Recording_Column* col = &(rec.Columns[i]);
+                if ((pos[i] < col->Count) && (col->SampleIndex[pos[i]] == next)) {
+                    if (!opt->Quiet) {
+                        printf(",%g", recording_value(&rec, i, pos[i]));
+                    }
+                    pos[i]++;
+                } else if (!opt->Quiet) {
+                    printf(",");
+                }
+            }
+            if (!opt->Quiet) {
+                printf("\n");
+            }
+            last = next;
+            rows++;
+        }
+    }
+    double elapsed = now_seconds() - start;
+    fclose(rec.File);
+    if (got < 0) {
+        fprintf(stderr, "%s: damaged block, stopped early\n", path);
+    }
+
+    double span = (double) (last - first) / opt->PWMFreq;
+    fprintf(stderr, "%llu rows, %llu samples in %.3f s (%.0f rows/s)",
+            (unsigned long long) rows, (unsigned long long) samples, elapsed,
+            (elapsed > 0) ? rows / elapsed : 0.0);
+    if ((elapsed > 0) && (span > 0)) {
+        fprintf(stderr, ", %.1fx real time", span / elapsed);
+    }
+    fprintf(stderr, "\n");
+    return (got < 0) ? 1 : 0;
+}
+
+/*** bench ***/
+/**
+ * Builds frames the way telemetry.c does, with every channel sampled every
+ * PWM cycle (a sine per channel), and wraps them in packets with
+ * data_packet_create.
+ * @param  len - set to the length of the stream
+ * @param  packets - set to the number of packets in it
+ * @retval The stream, to be freed by the caller. NULL if out of memory.
+ */
+static uint8_t* build_stream(uint8_t numchan, uint32_t cycles, uint8_t framing,
+        size_t* len, uint32_t* packets) {
+    uint16_t reclen = TELEMETRY_RECORD_HEADER + (numchan * 4);
+    uint16_t per_frame = (TELEMETRY_FRAME_LENGTH - TELEMETRY_FRAME_HEADER)
+            / reclen;
+    uint32_t num_frames = (cycles + per_frame - 1) / per_frame;
+    uint8_t* stream = malloc((size_t) num_frames * PACKET_MAX_LENGTH);
+    uint8_t frame[TELEMETRY_FRAME_LENGTH];
+    Data_Packet_Type pkt;
+    size_t pos = 0;
+    uint32_t cycle = 0;
+    uint16_t seq = 0;
+
+    if (stream == NULL) {
+        return NULL;
+    }
+    pkt.Framing = framing;
+    while (cycle < cycles) {
+        uint16_t flen = TELEMETRY_FRAME_HEADER;
+        data_packet_pack_16b(frame, seq++);
+        data_packet_pack_32b(&frame[2], cycle);
+        data_packet_pack_32b(&frame[6], cycle * (1000000 / DEFAULT_PWM_FREQ));
+        for (uint16_t r = 0; (r < per_frame) && (cycle < cycles); r++) {
+            data_packet_pack_16b(&frame[flen], (r == 0) ? 0 : 1);
+            data_packet_pack_16b(&frame[flen + 2], (1 << numchan) - 1);
+            flen += TELEMETRY_RECORD_HEADER;
+            for (uint8_t i = 0; i < numchan; i++) {
+                float v = (float) (i + 1) * (float) ((cycle + i * 97) % 400) / 400.0f;
+                data_packet_pack_float(&frame[flen], v);
+                flen += 4;
+            }
+            cycle++;
+        }
+        pkt.TxBuffer = &stream[pos];
+        data_packet_create(&pkt, CONTROLLER_STREAM_DATA, frame, flen);
+        pos += pkt.TxLength;
+    }
+    *len = pos;
+    *packets = seq;
+    return stream;
+}
+
+/**
+ * Times decoding and recording a synthetic stream, then the parser and CRC
+ * on their own.
+ */
+static int cmd_bench(const Tool_Options* opt) {
+    static Stream_Decoder dec;
+    static Recording rec;
+    Data_Type types[TELEMETRY_MAX_CHANNELS];
+    Stream_Decoder_Callbacks cb = { &rec, NULL, record_frame, record_sample };
+    uint8_t numchan = opt->Channels;
+    uint32_t cycles = (uint32_t) (opt->Seconds * DEFAULT_PWM_FREQ);
+    Data_Packet_Type pkt;
+    uint8_t* stream;
+    size_t pos;
+    uint32_t num_packets;
+
+    if ((numchan == 0) || (numchan > TELEMETRY_MAX_CHANNELS)) {
+        usage();
+        return 1;
+    }
+    stream = build_stream(numchan, cycles, DATA_PACKET_FRAMING_SOP, &pos,
+            &num_packets);
+    if (stream == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    for (uint8_t i = 0; i < numchan; i++) {
+        types[i] = Data_Type_Float;
+    }
+
+    if (recording_create(&rec, opt->Output, numchan, types) == DATA_PACKET_FAIL) {
+        perror(opt->Output);
+        free(stream);
+        return 1;
+    }
+    stream_decoder_init(&dec, numchan, types, &cb);
+    double start = now_seconds();
+    for (size_t i = 0; i < pos; i += READ_CHUNK) {
+        size_t n = ((pos - i) < READ_CHUNK) ? (pos - i) : READ_CHUNK;
+        stream_decoder_feed(&dec, &stream[i], n);
+    }
+    recording_close(&rec);
+    double elapsed = now_seconds() - start;
+
+    print_stats(&(dec.Stats));
+    fprintf(stderr, "%u samples x %u channels (%.1f s at %u Hz) in %.3f s\n",
+            cycles, numchan, opt->Seconds, DEFAULT_PWM_FREQ, elapsed);
+    if (elapsed > 0) {
+        fprintf(stderr, "%.1f MB/s, %.0f records/s, %.1fx real time\n",
+                pos / elapsed / 1e6, cycles / elapsed, opt->Seconds / elapsed);
+    }
+    // Parser alone, the byte at a time method against the block method
+    uint8_t rxdata[PACKET_MAX_DATA_LENGTH];
+    uint32_t found = 0;
+    memset(&pkt, 0, sizeof(pkt));
+    pkt.Data = rxdata;
+    start = now_seconds();
+    for (size_t i = 0; i < pos; i++) {
+        found += data_packet_extract_one_byte(&pkt, stream[i]);
+    }
+    elapsed = now_seconds() - start;
+    fprintf(stderr, "Parser, one byte: %.1f MB/s (%u packets)\n",
+            pos / elapsed / 1e6, found);
+    found = 0;
+    memset(&pkt, 0, sizeof(pkt));
+    pkt.Data = rxdata;
+    start = now_seconds();
+    for (size_t i = 0; i < pos; i += READ_CHUNK) {
+        uint16_t n = ((pos - i) < READ_CHUNK) ? (pos - i) : READ_CHUNK;
+        uint16_t place = 0;
+        while (place < n) {
+            uint16_t used;
+            found += data_packet_extract_span(&pkt, &stream[i + place],
+                    n - place, &used);
+            place += used;
+        }
+    }
+    elapsed = now_seconds() - start;
+    fprintf(stderr, "Parser, blocks:   %.1f MB/s (%u packets)\n",
+            pos / elapsed / 1e6, found);
+
+    // Same CRC the parser runs, on its own
+    CRC32_Context crc;
+    start = now_seconds();
+    CRC32_Start(&crc);
+    for (size_t i = 0; i < pos; i += PACKET_MAX_LENGTH) {
+        size_t n = ((pos - i) < PACKET_MAX_LENGTH) ? (pos - i) : PACKET_MAX_LENGTH;
+        CRC32_UpdateBuffer(&crc, &stream[i], n);
+    }
+    CRC32_Final(&crc);
+    elapsed = now_seconds() - start;
+    if (elapsed > 0) {
+        fprintf(stderr, "CRC: %.1f bytes/us\n", pos / elapsed / 1e6);
+    }
+    free(stream);
+
+    // Everything that went in has to come out
+    if ((dec.Stats.Records != cycles) || (dec.Stats.Packets != num_packets)
+            || dec.Stats.CrcErrors
+            || dec.Stats.FramesLost || dec.Stats.BadFrames) {
+        fprintf(stderr, "Decoded stream doesn't match what was generated\n");
+        return 1;
+    }
+    return 0;
+}
+
+/*** fuzz ***/
+/**
+ * Feeds a stream with bit errors to the packet parser in USB sized chunks,
+ * with the tick following the stream rate so the parser timeouts behave
+ * as they would on the controller.
+ * @param  blocks - use data_packet_extract_span rather than one byte at a time
+ * @retval Number of packets decoded
+ */
+static uint32_t fuzz_decode(const uint8_t* stream, size_t len, uint8_t framing,
+        uint8_t blocks, double ms_per_byte) {
+    static uint8_t rxdata[PACKET_MAX_DATA_LENGTH];
+    uint8_t chunk[FUZZ_CHUNK];
+    Data_Packet_Type pkt;
+    uint32_t found = 0;
+
+    memset(&pkt, 0, sizeof(pkt));
+    pkt.Data = rxdata;
+    pkt.Framing = framing;
+    for (size_t i = 0; i < len; i += FUZZ_CHUNK) {
+        uint16_t n = ((len - i) < FUZZ_CHUNK) ? (len - i) : FUZZ_CHUNK;
+        host_port_set_tick((uint32_t) (i * ms_per_byte));
+        memcpy(chunk, &stream[i], n);
+        if (blocks) {
+            uint16_t place = 0;
+            while (place < n) {
+                uint16_t used;
+                found += data_packet_extract_span(&pkt, &chunk[place],
+                        n - place, &used);
+                place += used;
+            }
+        } else {
+            for (uint16_t j = 0; j < n; j++) {
+                found += data_packet_extract_one_byte(&pkt, chunk[j]);
+            }
+        }
+    }
+    host_port_real_tick();
+    return found;
+}
+
+/**
+ * Flips single random bits in the same telemetry stream sent with each
+ * framing, and reports how many packets each error costs with both parser
+ * methods. A flip can only ever ruin the packet it lands in, anything lost
+ * beyond that is the framing failing to resync.
+ */
+static int cmd_fuzz(const Tool_Options* opt) {
+    const uint8_t framings[2] = { DATA_PACKET_FRAMING_SOP,
+            DATA_PACKET_FRAMING_COBS };
+    const char* names[2] = { "SOP", "COBS" };
+    const char* methods[2] = { "one byte", "blocks" };
+    uint32_t cycles = (uint32_t) (opt->Seconds * DEFAULT_PWM_FREQ);
+
+    if ((opt->Channels == 0) || (opt->Channels > TELEMETRY_MAX_CHANNELS)
+            || (opt->Errors == 0)) {
+        usage();
+        return 1;
+    }
+    for (uint8_t f = 0; f < 2; f++) {
+        size_t len;
+        uint32_t packets;
+        uint8_t* stream = build_stream(opt->Channels, cycles, framings[f], &len,
+                &packets);
+        if (stream == NULL) {
+            fprintf(stderr, "Out of memory\n");
+            return 1;
+        }
+        double ms_per_byte = (opt->Seconds * 1000.0) / len;
+        if (fuzz_decode(stream, len, framings[f], 1, ms_per_byte) != packets) {
+            fprintf(stderr, "%s stream didn't decode cleanly\n", names[f]);
+            free(stream);
+            return 1;
+        }
+
+        // Same error positions for both framings, relative to the length
+        srand(1234);
+        for (uint32_t e = 0; e < opt->Errors; e++) {
+            size_t at = (size_t) (((double) rand() / ((double) RAND_MAX + 1)) * len);
+            stream[at] ^= (uint8_t) (1 << (rand() % 8));
+        }
+        fprintf(stderr, "%s: %u packets, %zu bytes, %u bit errors\n", names[f],
+                packets, len, opt->Errors);
+        for (uint8_t m = 0; m < 2; m++) {
+            uint32_t found = fuzz_decode(stream, len, framings[f], m, ms_per_byte);
+            fprintf(stderr, "  %-8s: %u lost, %.3f packets per error\n",
+                    methods[m], packets - found,
+                    (double) (packets - found) / opt->Errors);
+        }
+        free(stream);
+    }
+    return 0;
+}
+
+/*** bms ***/
+/**
+ * Runs the firmware's BMS code against a simulated chain, once with boards
+ * that only take single reads and once with boards that take batch reads.
+ */
+static int cmd_bms(const Tool_Options* opt) {
+    static const char* kinds[2] = { "single reads", "batch reads" };
+    int failed = 0;
+
+    printf("%u boards of %u cells at %u baud, %u refreshes\n",
+            opt->Channels, BMS_SIM_CELLS, opt->Baud, BMS_REFRESHES);
+    for (uint8_t k = 0; k < 2; k++) {
+        Bms_Sim_Result res;
+        uint16_t legacy = (k == 0) ? 0xFFFF : 0;
+        if (bms_sim_run(opt->Channels, legacy, opt->Baud, BMS_REFRESHES, &res)
+                != 0) {
+            fprintf(stderr, "%s: connected %u, cells %u, bad values %u\n",
+                    kinds[k], res.Connected, res.Cells, res.BadValues);
+            failed = 1;
+            continue;
+        }
+        printf("%-13s refresh %7.2f ms (%5.1f Hz max), %3u requests, "
+                "%5u bytes out, %5u bytes in, addressing %.0f ms\n",
+                kinds[k], res.RefreshMs, 1000.0 / res.RefreshMs, res.Requests,
+                res.TxBytes, res.RxBytes, res.AddressingMs);
+    }
+    return failed;
+}
+
+/*** eeprom ***/
+/**
+ * Boots from a page that has seen more and more saves of every variable,
+ * through to one that has been transferred to the other sector.
+ */
+static int cmd_eeprom(void) {
+    static const uint16_t saves[] = { 1, 8, 16, 28, 40, 100, 365, 1000 };
+    int failed = 0;
+
+    printf("%u variables, boot time averaged over %u boots\n", TOTAL_EE_VARS,
+            EE_BOOTS);
+    for (uint8_t i = 0; i < (sizeof(saves) / sizeof(saves[0])); i++) {
+        Ee_Sim_Result res;
+        if (ee_sim_run(saves[i], EE_BOOTS, &res) != 0) {
+            fprintf(stderr, "%u saves: bad values %u, bad programs %u\n",
+                    saves[i], res.BadValues, res.BadPrograms);
+            failed = 1;
+            continue;
+        }
+        printf("%3u saves: %4u records in the page, boot %6.1f us, "
+                "%5u writes skipped, %5u programs, %2u erases, "
+                "flash busy %6.0f ms, worst save %5.1f ms\n", saves[i],
+                res.Records, res.BootUs, res.Skipped, res.Programs, res.Erases,
+                res.FlashMs, res.WorstSaveMs);
+    }
+    return failed;
+}
+
+/*** sched ***/
+/**
+ * Runs the controller's main loop tasks on the scheduler, with the run time
+ * budgets in sched_sim.c, and prints how long each waited to start.
+ */
+static int cmd_sched(const Tool_Options* opt) {
+    Sched_Sim_Result res;
+    uint32_t ms = (uint32_t) (opt->Seconds * 1000.0);
+    uint32_t bound = sched_sim_latency_bound(SchedSimFirmware);
+    int failed = sched_sim_run(SchedSimFirmware, ms, &res);
+
+    printf("%.1f s, %u ticks, %u signals, idle %.1f%% of the time, "
+            "latency bound %u us\n", ms / 1000.0, res.Ticks, res.Events,
+            res.IdleShare * 100.0, bound);
+    printf("%-15s %6s %8s %6s %8s %8s %8s %8s %6s\n", "task", "period",
+            "deadline", "budget", "runs", "latency", "run", "overruns",
+            "misses");
+    for (uint8_t id = 0; id < SCHED_MAX_TASKS; id++) {
+        const Sched_Sim_Task* t = &SchedSimFirmware[id];
+        const Sched_Task* task = sched_get_task(id);
+        if (t->Name == NULL) {
+            continue;
+        }
+        printf("%-15s %4u ms %5u us %3u us %8u %5u us %5u us %8u %6u\n",
+                t->Name, t->PeriodMs, t->DeadlineUs, t->CostUs, task->Runs,
+                task->MaxLatencyUs, task->MaxRunUs, task->Overruns,
+                task->DeadlineMisses);
+    }
+    if (failed) {
+        fprintf(stderr, "%u signals lost, %u idles with a task ready\n",
+                res.LostEvents, res.BadIdles);
+    }
+    return failed;
+}
+
+/*** config-get / config-put ***/
+// Same checks as config_blob_check, apart from the layout, which only the
+// controller knows
+static uint8_t config_blob_ok(const uint8_t* blob, uint16_t len) {
+    CRC32_Context ctx;
+    uint8_t crc[4];
+    uint16_t body = len - CONFIG_BLOB_CRC_BYTES;
+
+    if ((len < (CONFIG_BLOB_HEADER_BYTES + CONFIG_BLOB_CRC_BYTES))
+            || (len > CONFIG_BLOB_MAX_BYTES)
+            || (data_packet_extract_16b((uint8_t*) blob) != CONFIG_BLOB_VERSION)
+            || (data_packet_extract_16b((uint8_t*) &blob[2]) != len)) {
+        return 0;
+    }
+    CRC32_Start(&ctx);
+    CRC32_UpdateBuffer(&ctx, blob, body);
+    data_packet_pack_32b(crc, CRC32_Final(&ctx));
+    return memcmp(crc, &blob[body], 4) == 0;
+}
+
+/**
+ * Reads the controller's configuration record a piece at a time and writes
+ * it to a file once it's all there and the CRC checks out.
+ */
+static int cmd_config_get(const char* path, const char* out,
+        const Tool_Options* opt) {
+    static Config_Link link;
+    uint8_t blob[CONFIG_BLOB_MAX_BYTES];
+    uint16_t total = 0, have = 0;
+    uint8_t req[2];
+    FILE* f;
+
+    if (config_link_open(&link, path, opt) != 0) {
+        return 1;
+    }
+    do {
+        data_packet_pack_16b(req, have);
+        if ((config_request(&link, GET_CONFIG_BLOB, req, 2)
+                != GET_CONFIG_BLOB_RESULT) || (link.ReplyLength <= 4)) {
+            fprintf(stderr, "No configuration record (at offset %u)\n", have);
+            close(link.Fd);
+            return 1;
+        }
+        uint16_t count = link.ReplyLength - 4;
+        total = data_packet_extract_16b(link.Reply);
+        if ((data_packet_extract_16b(&link.Reply[2]) != have)
+                || (total > CONFIG_BLOB_MAX_BYTES) || ((have + count) > total)) {
+            fprintf(stderr, "Bad reply at offset %u\n", have);
+            close(link.Fd);
+            return 1;
+        }
+        memcpy(&blob[have], &link.Reply[4], count);
+        have += count;
+    } while (have < total);
+    close(link.Fd);
+
+    if (!config_blob_ok(blob, total)) {
+        fprintf(stderr, "Configuration record failed its check\n");
+        return 1;
+    }
+    f = fopen(out, "wb");
+    if ((f == NULL) || (fwrite(blob, 1, total, f) != total)) {
+        perror(out);
+        if (f != NULL) {
+            fclose(f);
+        }
+        return 1;
+    }
+    fclose(f);
+    printf("%u bytes, sequence %u\n", total,
+            data_packet_extract_32b(&blob[4]));
+    return 0;
+}
+
+/**
+ * Sends a configuration record from a file. The controller saves it once
+ * the last piece is in, all or nothing, and answers that piece with an ACK
+ * only if it did.
+ */
+static int cmd_config_put(const char* in, const char* path,
+        const Tool_Options* opt) {
+    static Config_Link link;
+    uint8_t blob[CONFIG_BLOB_MAX_BYTES + 1];
+    uint8_t req[2 + CONFIG_PUT_CHUNK];
+    uint16_t total, sent = 0;
+    FILE* f = fopen(in, "rb");
+
+    if (f == NULL) {
+        perror(in);
+        return 1;
+    }
+    total = (uint16_t) fread(blob, 1, sizeof(blob), f);
+    fclose(f);
+    if (!config_blob_ok(blob, total)) {
+        fprintf(stderr, "%s: not a configuration record\n", in);
+        return 1;
+    }
+    if (config_link_open(&link, path, opt) != 0) {
+        return 1;
+    }
+    while (sent < total) {
+        uint16_t count = total - sent;
+        if (count > CONFIG_PUT_CHUNK) {
+            count = CONFIG_PUT_CHUNK;
+        }
+        data_packet_pack_16b(req, sent);
+        memcpy(&req[2], &blob[sent], count);
+        if (config_request(&link, SET_CONFIG_BLOB, req, count + 2)
+                != CONTROLLER_ACK) {
+            fprintf(stderr, "Refused at offset %u, nothing was saved\n", sent);
+            close(link.Fd);
+            return 1;
+        }
+        sent += count;
+    }
+    close(link.Fd);
+    printf("%u bytes saved, run ROUTINE_LOAD_ALL_EEPROM or reset to use them\n",
+            total);
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    Tool_Options opt = { NULL, 115200, 0, 10.0, 4, "/dev/null", DEFAULT_PWM_FREQ,
+            DATA_PACKET_FRAMING_SOP, 1000, NULL };
+    const char* args[2] = { NULL, NULL };
+    uint8_t numargs = 0;
+
+    if (argc < 2) {
+        usage();
+        return 1;
+    }
+    for (int i = 2; i < argc; i++) {
+        if ((argv[i][0] == '-') && (argv[i][1] != 0) && (argv[i][2] == 0)) {
+            char flag = argv[i][1];
+            if (flag == 'q') {
+                opt.Quiet = 1;
+                continue;
+            }
+            if (flag == 'c') {
+                opt.Framing = DATA_PACKET_FRAMING_COBS;
+                continue;
+            }
+            if (i + 1 >= argc) {
+                usage();
+                return 1;
+            }
+            const char* val = argv[++i];
+            switch (flag) {
+            case 't':
+                opt.Types = val;
+                break;
+            case 'v':
+                opt.Vars = val;
+                break;
+            case 'b':
+                opt.Baud = strtoul(val, NULL, 0);
+                break;
+            case 's':
+                opt.Seconds = strtod(val, NULL);
+                break;
+            case 'n':
+                opt.Channels = strtoul(val, NULL, 0);
+                break;
+            case 'o':
+                opt.Output = val;
+                break;
+            case 'f':
+                opt.PWMFreq = strtoul(val, NULL, 0);
+                break;
+            case 'e':
+                opt.Errors = strtoul(val, NULL, 0);
+                break;
+            default:
+                usage();
+                return 1;
+            }
+        } else if (numargs < 2) {
+            args[numargs++] = argv[i];
+        } else {
+            usage();
+            return 1;
+        }
+    }
+    if (opt.PWMFreq == 0) {
+        opt.PWMFreq = DEFAULT_PWM_FREQ;
+    }
+
+    CRC32_Init();
+    if ((strcmp(argv[1], "dump") == 0) && (numargs == 1)) {
+        return cmd_dump(args[0], &opt);
+    } else if ((strcmp(argv[1], "record") == 0) && (numargs == 2)) {
+        return cmd_record(args[0], args[1], &opt);
+    } else if ((strcmp(argv[1], "replay") == 0) && (numargs == 1)) {
+        return cmd_replay(args[0], &opt);
+    } else if ((strcmp(argv[1], "bench") == 0) && (numargs == 0)) {
+        return cmd_bench(&opt);
+    } else if ((strcmp(argv[1], "fuzz") == 0) && (numargs == 0)) {
+        return cmd_fuzz(&opt);
+    } else if ((strcmp(argv[1], "bms") == 0) && (numargs == 0)) {
+        return cmd_bms(&opt);
+    } else if ((strcmp(argv[1], "eeprom") == 0) && (numargs == 0)) {
+        return cmd_eeprom();
+    } else if ((strcmp(argv[1], "sched") == 0) && (numargs == 0)) {
+        return cmd_sched(&opt);
+    } else if ((strcmp(argv[1], "config-get") == 0) && (numargs == 2)) {
+        return cmd_config_get(args[0], args[1], &opt);
+    } else if ((strcmp(argv[1], "config-put") == 0) && (numargs == 2)) {
+        return cmd_config_put(args[0], args[1], &opt);
+    } else if ((strcmp(argv[1], "selftest") == 0) && (numargs == 0)) {
+        return selftest_run();
+    }
+    usage();
+    return 1;
+}
@@ -0,0 +1,541 @@
+/******************************************************************************
+ * Filename: ee_sim.c
+ * Description: Simulated flash sectors for running the firmware's EEPROM
+ *              emulation on the host, with a history of saves to read back.
+ *
+ *              The two sectors are mapped at the address the firmware uses, so
+ *              eeprom_emulation.c runs unchanged. Every access to the FLASH
+ *              registers lands in ee_sim_flash, which carries out a sector erase
+ *              once it's started, and checks each half word that was programmed
+ *              only clears bits, as real flash would.
+ *
+ ******************************************************************************
+
+ Copyright (c) 2019 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <time.h>
+#include <sys/mman.h>
+#include "main.h"
+#include "eeprom_emulation.h"
+#include "wdt.h"
+#include "ee_sim.h"
+#include "config_blob.h"
+
+#define EE_SIM_BYTES        (2 * PAGE_SIZE)
+#define EE_SIM_FIRST_ID     (0x0101)
+#define EE_SIM_CHANGE_EVERY (8) // Saves between changes to a variable
+
+typedef struct _ee_sim {
+    uint8_t* Image; // At EEPROM_START_ADDRESS
+    uint8_t Copy[EE_SIM_BYTES]; // What the image held after the last check
+    FLASH_TypeDef Regs;
+    uint8_t Programming;
+    uint32_t Programs;
+    uint32_t Erases;
+    uint32_t BadPrograms;
+} Ee_Sim;
+
+// *** Global variables ***
+Ee_Sim EeSim;
+uint16_t EeSimAddrTab[TOTAL_EE_ADDRESSES];
+uint32_t SystemCoreClock = 168000000;
+DWT_Type EeSimDwt;
+CoreDebug_Type EeSimCoreDebug;
+
+// The firmware writes the flash directly, so find what changed
+static void ee_sim_check_programs(void) {
+    uint16_t* now = (uint16_t*) EeSim.Image;
+    uint16_t* was = (uint16_t*) EeSim.Copy;
+    for (uint32_t i = 0; i < (EE_SIM_BYTES / 2); i++) {
+        if (now[i] != was[i]) {
+            EeSim.Programs++;
+            if ((now[i] & ~was[i]) != 0) {
+                EeSim.BadPrograms++;
+            }
+            was[i] = now[i];
+        }
+    }
+}
+
+FLASH_TypeDef* ee_sim_flash(void) {
+    uint32_t cr = EeSim.Regs.CR;
+
+    if ((cr & FLASH_CR_SER) && (cr & FLASH_CR_STRT)) {
+        uint32_t sector = cr & ~SECTOR_MASK;
+        if ((sector == PAGE0_ID) || (sector == PAGE1_ID)) {
+            uint32_t offset = (sector == PAGE0_ID) ? 0 : PAGE_SIZE;
+            memset(&EeSim.Image[offset], 0xFF, PAGE_SIZE);
+            memset(&EeSim.Copy[offset], 0xFF, PAGE_SIZE);
+            EeSim.Erases++;
+        }
+        EeSim.Regs.CR &= ~FLASH_CR_STRT;
+    }
+    // The half word is written between setting PG and the first status read
+    if (cr & FLASH_CR_PG) {
+        if (!EeSim.Programming) {
+            EeSim.Programming = 1;
+            ee_sim_check_programs();
+        }
+    } else {
+        EeSim.Programming = 0;
+    }
+    return &EeSim.Regs;
+}
+
+void WDT_feed(void) {
+}
+
+static double ee_sim_now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec * 1e6) + (ts.tv_nsec * 1e-3);
+}
+
+DWT_Type* ee_sim_dwt(void) {
+    EeSimDwt.CYCCNT = (uint32_t) (uint64_t) (ee_sim_now_us()
+            * (SystemCoreClock / 1e6));
+    return &EeSimDwt;
+}
+
+// Erased flash, mapped the first time
+static int ee_sim_erase_all(void) {
+    if (EeSim.Image == NULL) {
+        void* want = (void*) (uintptr_t) EEPROM_START_ADDRESS;
+        void* got = mmap(want, EE_SIM_BYTES, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+        if (got != want) {
+            if (got != MAP_FAILED) {
+                munmap(got, EE_SIM_BYTES);
+            }
+            return 1;
+        }
+        EeSim.Image = got;
+    }
+    memset(EeSim.Image, 0xFF, EE_SIM_BYTES);
+    memset(EeSim.Copy, 0xFF, EE_SIM_BYTES);
+    memset(&EeSim.Regs, 0, sizeof(EeSim.Regs));
+    EeSim.Regs.CR = FLASH_CR_LOCK;
+    EeSim.Programming = 0;
+    EeSim.Programs = 0;
+    EeSim.Erases = 0;
+    EeSim.BadPrograms = 0;
+    return 0;
+}
+
+// Some variables are never saved, so they read back the default
+static uint8_t ee_sim_saved(uint16_t var) {
+    return (var % 7) != 6;
+}
+
+// Like a bit of tuning between saves, an eighth of the variables change
+static float ee_sim_value(uint16_t var, uint16_t save) {
+    return (var * 1000.0f) + ((save + (var % EE_SIM_CHANGE_EVERY))
+            / EE_SIM_CHANGE_EVERY) + 0.25f;
+}
+
+// A configuration record like config_blob_save writes, every variable as a
+// float, to the slot the last one isn't in
+static void ee_sim_save_record(uint16_t save) {
+    uint8_t blob[CONFIG_BLOB_MAX_BYTES];
+    uint16_t place = CONFIG_BLOB_HEADER_BYTES;
+    uint16_t base = (save & 1) ? CONFIG_BLOB_SLOT_A_ADDR : CONFIG_BLOB_SLOT_B_ADDR;
+    CRC32_Context ctx;
+
+    for (uint16_t v = 0; v < TOTAL_EE_VARS; v++) {
+        data_packet_pack_float(&blob[place],
+                ee_sim_saved(v) ? ee_sim_value(v, save) : -1.0f);
+        place += 4;
+    }
+    data_packet_pack_16b(blob, CONFIG_BLOB_VERSION);
+    data_packet_pack_16b(&blob[2], place + CONFIG_BLOB_CRC_BYTES);
+    data_packet_pack_32b(&blob[4], save + 1);
+    data_packet_pack_32b(&blob[8], 0x5EED5EED);
+    CRC32_Start(&ctx);
+    CRC32_UpdateBuffer(&ctx, blob, place);
+    data_packet_pack_32b(&blob[place], CRC32_Final(&ctx));
+    place += CONFIG_BLOB_CRC_BYTES;
+    for (uint16_t i = 0; i < (place / 2); i++) {
+        EE_WriteVariable(base + i, data_packet_extract_16b(&blob[2 * i]));
+    }
+}
+
+// Same as ROUTINE_SAVE_ALL_EEPROM, one batch with the configuration record
+static uint16_t ee_sim_save_all(uint16_t save) {
+    EE_BeginBatch();
+    for (uint16_t v = 0; v < TOTAL_EE_VARS; v++) {
+        if (ee_sim_saved(v)) {
+            EE_SaveFloat(EE_SIM_FIRST_ID + v, ee_sim_value(v, save));
+        }
+    }
+    ee_sim_save_record(save);
+    return EE_CommitBatch();
+}
+
+static double ee_sim_busy_ms(uint32_t programs, uint32_t erases) {
+    return (programs * (EE_SIM_PROGRAM_US / 1000.0))
+            + (erases * EE_SIM_ERASE_MS);
+}
+
+static void ee_sim_set_table(void) {
+    for (uint16_t v = 0; v < TOTAL_EE_VARS; v++) {
+        EeSimAddrTab[v * 2] = (EE_SIM_FIRST_ID + v) | EE_LOBYTE_FLAG;
+        EeSimAddrTab[v * 2 + 1] = (EE_SIM_FIRST_ID + v) | EE_HIBYTE_FLAG;
+    }
+    // Then both configuration record slots, as config_blob_fill_ee_table
+    for (uint16_t i = 0; i < CONFIG_BLOB_SLOT_WORDS; i++) {
+        EeSimAddrTab[(TOTAL_EE_VARS * 2) + i] = CONFIG_BLOB_SLOT_A_ADDR + i;
+        EeSimAddrTab[(TOTAL_EE_VARS * 2) + CONFIG_BLOB_SLOT_WORDS + i] =
+                CONFIG_BLOB_SLOT_B_ADDR + i;
+    }
+}
+
+// As if the power went before the last records in the valid page were written
+static void ee_sim_power_lost(uint16_t lost) {
+    uint32_t* page = (uint32_t*) EeSim.Image;
+    uint32_t end = 1;
+
+    if (*(uint16_t*) EeSim.Image != VALID_PAGE) {
+        page = (uint32_t*) &EeSim.Image[PAGE_SIZE];
+    }
+    while ((end < (PAGE_SIZE / 4)) && (page[end] != 0xFFFFFFFF)) {
+        end++;
+    }
+    for (uint16_t i = 0; i < lost; i++) {
+        page[end - 1 - i] = 0xFFFFFFFF;
+    }
+    memcpy(EeSim.Copy, EeSim.Image, EE_SIM_BYTES);
+}
+
+// Number of variables that don't read back the given save
+static uint32_t ee_sim_check_values(int32_t save) {
+    uint32_t bad = 0;
+    for (uint16_t v = 0; v < TOTAL_EE_VARS; v++) {
+        float expected = -1.0f;
+        if (ee_sim_saved(v) && (save >= 0)) {
+            expected = ee_sim_value(v, save);
+        }
+        if (EE_ReadFloatWithDefault(EE_SIM_FIRST_ID + v, -1.0f) != expected) {
+            bad++;
+        }
+    }
+    return bad;
+}
+
+/**
+ * Formats the simulated flash, saves every variable as a float a number of
+ * times the way ROUTINE_SAVE_ALL_EEPROM does, with a pass of the main loop
+ * (motor off) after each, then times booting from it and checks every
+ * variable reads back its last value.
+ * @param  saves - how many times all the variables are saved
+ * @param  boots - number of boots to average the time over
+ * @retval 0 if everything read back correctly
+ */
+int ee_sim_run(uint16_t saves, uint32_t boots, Ee_Sim_Result* result) {
+    memset(result, 0, sizeof(*result));
+    if (ee_sim_erase_all() != 0) {
+        return 1;
+    }
+    result->Vars = TOTAL_EE_VARS;
+    ee_sim_set_table();
+
+    EE_Init(EeSimAddrTab);
+    uint32_t skipped = EE_GetSkipCount();
+    for (uint16_t s = 0; s < saves; s++) {
+        ee_sim_flash();
+        uint32_t programs = EeSim.Programs;
+        uint32_t erases = EeSim.Erases;
+        ee_sim_save_all(s);
+        ee_sim_flash();
+        double busy = ee_sim_busy_ms(EeSim.Programs - programs,
+                EeSim.Erases - erases);
+        if (busy > result->WorstSaveMs) {
+            result->WorstSaveMs = busy;
+        }
+        EE_Service(1);
+    }
+    ee_sim_flash();
+    result->Skipped = EE_GetSkipCount() - skipped;
+    result->Programs = EeSim.Programs;
+    result->Erases = EeSim.Erases;
+    result->BadPrograms = EeSim.BadPrograms;
+    result->FlashMs = ee_sim_busy_ms(EeSim.Programs, EeSim.Erases);
+
+    uint32_t* page = (uint32_t*) EeSim.Image;
+    if (*(uint16_t*) EeSim.Image != VALID_PAGE) {
+        page = (uint32_t*) &EeSim.Image[PAGE_SIZE];
+    }
+    for (uint32_t i = 1; (i < (PAGE_SIZE / 4)) && (page[i] != 0xFFFFFFFF); i++) {
+        result->Records++;
+    }
+
+    for (uint32_t b = 0; b < boots; b++) {
+        double start = ee_sim_now_us();
+        EE_Init(EeSimAddrTab);
+        result->BadValues += ee_sim_check_values(saves - 1);
+        result->BootUs += ee_sim_now_us() - start;
+    }
+    if (boots > 0) {
+        result->BootUs /= boots;
+    }
+    return ((result->BadValues > 0) || (result->BadPrograms > 0)) ? 1 : 0;
+}
+
+/**
+ * Cuts a save of every variable short, as if the power went before the
+ * last few records were written, and checks that none of the batch took
+ * effect. Then checks a write made after that is kept.
+ * @param  lost - records of the batch that never made it, 1 is just the
+ *                commit record
+ * @retval Number of variables that read back wrong
+ */
+uint32_t ee_sim_torn_batch(uint16_t lost) {
+    uint32_t bad = 0;
+
+    if (ee_sim_erase_all() != 0) {
+        return 1;
+    }
+    ee_sim_set_table();
+    EE_Init(EeSimAddrTab);
+    ee_sim_save_all(0);
+    ee_sim_save_all(EE_SIM_CHANGE_EVERY);
+
+    ee_sim_power_lost(lost);
+    EE_Init(EeSimAddrTab);
+    EE_SaveFloat(EE_SIM_FIRST_ID, -2.0f);
+    EE_Init(EeSimAddrTab);
+    for (uint16_t v = 0; v < TOTAL_EE_VARS; v++) {
+        float expected = ee_sim_saved(v) ? ee_sim_value(v, 0) : -1.0f;
+        if (v == 0) {
+            expected = -2.0f;
+        }
+        if (EE_ReadFloatWithDefault(EE_SIM_FIRST_ID + v, -1.0f) != expected) {
+            bad++;
+        }
+    }
+    ee_sim_flash();
+    return bad + EeSim.BadPrograms;
+}
+
+/**
+ * Saves every variable over and over with the motor running, so the old
+ * page of a transfer can't be erased, and checks nothing is erased and the
+ * latest values read back all along. Once both pages fill, saves wait in
+ * RAM. Then either the motor stops and the main loop finishes the transfer,
+ * or the power goes and the next boot does.
+ * @param  saves - saves while the motor runs
+ * @param  reboot - power lost instead of the motor stopping. Saves still
+ *                  waiting in RAM are lost then, so keep them few enough.
+ * @retval Number of problems found
+ */
+uint32_t ee_sim_deferred_erase(uint16_t saves, uint8_t reboot) {
+    uint32_t bad = 0;
+
+    if (ee_sim_erase_all() != 0) {
+        return 1;
+    }
+    ee_sim_set_table();
+    EE_Init(EeSimAddrTab);
+    ee_sim_flash();
+    uint32_t erases = EeSim.Erases;
+    for (uint16_t s = 0; s < saves; s++) {
+        ee_sim_save_all(s);
+        EE_Service(0);
+    }
+    ee_sim_flash();
+    if (EeSim.Erases != erases) {
+        bad++;
+    }
+    bad += ee_sim_check_values(saves - 1);
+
+    if (reboot) {
+        if (EE_GetQueued() > 0) {
+            bad++;
+        }
+    } else {
+        EE_Service(1);
+        if (EE_GetQueued() > 0) {
+            bad++;
+        }
+    }
+    EE_Init(EeSimAddrTab);
+    bad += ee_sim_check_values(saves - 1);
+    ee_sim_flash();
+    return bad + EeSim.BadPrograms;
+}
+
+// Stand-ins for a few of the firmware's variables, one of each type the
+// configuration record holds. The state of charge is range checked and
+// starts out unknown (-1), like soc.c.
+static uint32_t EeSimCounts = 0;
+static uint8_t EeSimSpeed = 0;
+static float EeSimSoc = -1.0f;
+
+static uint32_t ee_sim_get_counts(void) {
+    return EeSimCounts;
+}
+
+static uint8_t ee_sim_set_counts(uint32_t counts) {
+    EeSimCounts = counts;
+    return DATA_PACKET_SUCCESS;
+}
+
+static uint8_t ee_sim_get_speed(void) {
+    return EeSimSpeed;
+}
+
+static uint8_t ee_sim_set_speed(uint8_t speed) {
+    EeSimSpeed = speed;
+    return DATA_PACKET_SUCCESS;
+}
+
+static float ee_sim_get_soc(void) {
+    return EeSimSoc;
+}
+
+static uint8_t ee_sim_set_soc(float percent) {
+    if (!((percent >= -1.0f) && (percent <= 100.0f))) {
+        return DATA_PACKET_FAIL;
+    }
+    EeSimSoc = (percent < 0.0f) ? -1.0f : percent;
+    return DATA_PACKET_SUCCESS;
+}
+
+static float ee_sim_get_range(void) {
+    return -1.0f;
+}
+
+/**
+ * Takes the place of data_registry_table.c, whose accessors are all over
+ * the firmware. Entries copied from there, sorted by ID.
+ */
+const Data_Reg_Entry data_registry[] = {
+    { CONFIG_MAIN_COUNTS_TO_FOC, Data_Type_Int32, DATA_REG_EEPROM, Data_Access_U32, 0,
+        { .u32 = ee_sim_get_counts }, { .u32 = ee_sim_set_counts }, 0.0f, 0.0f },
+    { CONFIG_MAIN_USB_SPEED, Data_Type_Int16, DATA_REG_EEPROM | DATA_REG_RANGE, Data_Access_U8, 0,
+        { .u8 = ee_sim_get_speed }, { .u8 = ee_sim_set_speed }, 0, 5 },
+    { CONFIG_BATT_SOC, Data_Type_Float, DATA_REG_EEPROM | DATA_REG_RANGE, Data_Access_Float, 0,
+        { .f = ee_sim_get_soc }, { .f = ee_sim_set_soc }, -1.0f, 100.0f },
+    { CONFIG_TRIP_RANGE_KM, Data_Type_Float, DATA_REG_READONLY, Data_Access_Float, 0,
+        { .f = ee_sim_get_range }, { .u8 = 0 }, 0.0f, 0.0f },
+};
+
+const uint16_t data_registry_length =
+        sizeof(data_registry) / sizeof(data_registry[0]);
+
+// Sequence number of the valid record in a slot, 0 if there isn't one
+static uint32_t ee_sim_slot_sequence(uint16_t addr) {
+    uint16_t words[CONFIG_BLOB_SLOT_WORDS];
+    uint8_t blob[CONFIG_BLOB_MAX_BYTES];
+    uint16_t length = config_blob_length();
+
+    if (EE_ReadBlock(addr, words, (length + 1) / 2) != READ_SUCCESS) {
+        return 0;
+    }
+    for (uint16_t i = 0; i < ((length + 1) / 2); i++) {
+        data_packet_pack_16b(&blob[2 * i], words[i]);
+    }
+    if (config_blob_check(blob, length) != DATA_PACKET_SUCCESS) {
+        return 0;
+    }
+    return data_packet_extract_32b(&blob[4]);
+}
+
+/**
+ * Runs the configuration record on simulated flash with the table above.
+ * Saves twice, so there is a record in each slot, and reads both back.
+ * Sends the record it read back in pieces, unchanged, the way the host's
+ * SET_CONFIG_BLOB does, and loads it. Then cuts a save short, and checks
+ * the record before it is the one loaded.
+ * @retval Number of problems found
+ */
+uint32_t ee_sim_config_blob(void) {
+    uint8_t blob[CONFIG_BLOB_MAX_BYTES];
+    uint32_t bad = 0;
+    uint16_t length;
+
+    if (ee_sim_erase_all() != 0) {
+        return 1;
+    }
+    // Simulated variables past the ones in the table, then the slots
+    ee_sim_set_table();
+    data_registry_fill_ee_table(EeSimAddrTab);
+    EE_Init(EeSimAddrTab);
+    config_blob_init();
+    EeSimCounts = 1000;
+    EeSimSpeed = 3;
+    EeSimSoc = -1.0f;
+    if (config_blob_read(blob) != 0) {
+        bad++;
+    }
+
+    // Sequence 1 goes to slot B, 2 to slot A
+    config_blob_save();
+    EeSimSpeed = 4;
+    config_blob_save();
+    if ((ee_sim_slot_sequence(CONFIG_BLOB_SLOT_A_ADDR) != 2)
+            || (ee_sim_slot_sequence(CONFIG_BLOB_SLOT_B_ADDR) != 1)) {
+        bad++;
+    }
+    EE_Init(EeSimAddrTab);
+    length = config_blob_read(blob);
+    if ((length != config_blob_length()) || (config_blob_get_sequence() != 2)
+            || (data_packet_extract_16b(&blob[CONFIG_BLOB_HEADER_BYTES + 4])
+                    != 4)) {
+        bad++;
+    }
+
+    // Upload what was read, 10 bytes at a time
+    for (uint16_t offset = 0; offset < length; offset += 10) {
+        uint16_t piece = ((length - offset) < 10) ? (length - offset) : 10;
+        if (config_blob_upload(offset, &blob[offset], piece)
+                != DATA_PACKET_SUCCESS) {
+            bad++;
+        }
+    }
+    if ((config_blob_get_sequence() != 3)
+            || (ee_sim_slot_sequence(CONFIG_BLOB_SLOT_B_ADDR) != 3)) {
+        bad++;
+    }
+    EeSimCounts = 0;
+    EeSimSpeed = 0;
+    EeSimSoc = 50.0f;
+    if ((config_blob_load() != DATA_PACKET_SUCCESS) || (EeSimCounts != 1000)
+            || (EeSimSpeed != 4) || (EeSimSoc != -1.0f)) {
+        bad++;
+    }
+
+    // A save to slot A that never got its commit record
+    EeSimSpeed = 5;
+    config_blob_save();
+    ee_sim_power_lost(1);
+    EE_Init(EeSimAddrTab);
+    EeSimSpeed = 0;
+    if ((config_blob_load() != DATA_PACKET_SUCCESS)
+            || (config_blob_get_sequence() != 3) || (EeSimSpeed != 4)
+            || (ee_sim_slot_sequence(CONFIG_BLOB_SLOT_A_ADDR) != 2)) {
+        bad++;
+    }
+    ee_sim_flash();
+    return bad + EeSim.BadPrograms;
+}
@@ -0,0 +1,55 @@
+/******************************************************************************
+ * Filename: ee_sim.h
+ * Description: Simulated flash sectors for running the firmware's EEPROM
+ *              emulation on the host, with a history of saves to read back.
+ *
+ ******************************************************************************
+
+ Copyright (c) 2019 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#ifndef _EE_SIM_H_
+#define _EE_SIM_H_
+
+#include "main.h"
+
+#define EE_SIM_PROGRAM_US       (16) // Half word program time, typical
+#define EE_SIM_ERASE_MS         (250) // 16 KB sector erase time, typical
+
+typedef struct _ee_sim_result {
+    uint16_t Vars; // Variables in the address table (each is two half words)
+    uint32_t Records; // Value/address pairs in the valid page after the saves
+    uint32_t BadValues; // Variables that didn't read back what was saved
+    uint32_t Skipped; // Writes left out because the value was already there
+    uint32_t Programs; // Half words
+    uint32_t Erases;
+    uint32_t BadPrograms; // Programs that tried to set a bit back to 1
+    double FlashMs; // Simulated time the flash was busy during the saves
+    double WorstSaveMs; // Longest the flash was busy in a single save call
+    double BootUs; // EE_Init and reading every variable once, host time
+} Ee_Sim_Result;
+
+int ee_sim_run(uint16_t saves, uint32_t boots, Ee_Sim_Result* result);
+uint32_t ee_sim_torn_batch(uint16_t lost);
+uint32_t ee_sim_deferred_erase(uint16_t saves, uint8_t reboot);
+uint32_t ee_sim_config_blob(void);
+
+#endif //_EE_SIM_H_
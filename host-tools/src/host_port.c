@@ -0,0 +1,85 @@
+/******************************************************************************
+ * Filename: host_port.c
+ * Description: Host versions of the firmware functions that the shared
+ *              packet code depends on: the whole buffer CRC (in software,
+ *              matching the STM32 CRC unit bit for bit) and the
+ *              millisecond tick, which can be simulated.
+ *
+ ******************************************************************************
+
+ Copyright (c) 2019 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#include <time.h>
+#include "main.h"
+#include "host_port.h"
+
+// *** Global variables ***
+uint8_t HostTickSimulated = 0;
+uint32_t HostTick = 0;
+
+void CRC32_Init(void) {
+    // Nothing to turn on
+}
+
+// The controller uses its CRC unit here, the host uses the same software
+// CRC that the packet parser runs (crc32_table.c).
+uint32_t CRC32_Generate(uint8_t *buf, uint16_t len) {
+    CRC32_Context ctx;
+    CRC32_Start(&ctx);
+    CRC32_UpdateBuffer(&ctx, buf, len);
+    return CRC32_Final(&ctx);
+}
+
+uint32_t GetTick(void) {
+    struct timespec ts;
+    if (HostTickSimulated) {
+        return HostTick;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t) ((ts.tv_sec * 1000) + (ts.tv_nsec / 1000000));
+}
+
+/**
+ * @brief  Host Port Set Tick
+ *            Makes GetTick return this value from now on, until
+ *            host_port_real_tick is called.
+ * @param  ms - simulated time in milliseconds
+ */
+void host_port_set_tick(uint32_t ms) {
+    HostTick = ms;
+    HostTickSimulated = 1;
+}
+
+void host_port_real_tick(void) {
+    HostTickSimulated = 0;
+}
+
+// data_packet.h has C99 inline functions, one file has to hold the
+// external definitions in case the compiler decides not to inline.
+extern inline void data_packet_pack_8b(uint8_t* array, uint8_t value);
+extern inline uint8_t data_packet_extract_8b(uint8_t* array);
+extern inline void data_packet_pack_16b(uint8_t* array, uint16_t value);
+extern inline uint16_t data_packet_extract_16b(uint8_t* array);
+extern inline void data_packet_pack_32b(uint8_t* array, uint32_t value);
+extern inline uint32_t data_packet_extract_32b(uint8_t* array);
+extern inline void data_packet_pack_float(uint8_t* array, float value);
+extern inline float data_packet_extract_float(uint8_t* array);
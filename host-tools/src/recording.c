@@ -0,0 +1,276 @@
+/******************************************************************************
+ * Filename: recording.c
+ * Description: Columnar on-disk format for recorded telemetry. Each channel
+ *              is stored as its own column of sample indexes and values, so
+ *              a channel can be read back without touching the others.
+ *
+ ******************************************************************************
+
+ Copyright (c) 2019 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#include "recording.h"
+#include "stream_decoder.h"
+
+// Columns are written straight from memory
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "Recording format is little endian, host must be too"
+#endif
+
+static const char recording_magic[4] = { 'E', 'B', 'T', 'L' };
+static const char recording_block_magic[4] = { 'B', 'L', 'K', '1' };
+
+static uint8_t recording_write(Recording* rec, const void* data, size_t len) {
+    if (len == 0) {
+        return DATA_PACKET_SUCCESS;
+    }
+    return (fwrite(data, len, 1, rec->File) == 1) ?
+            DATA_PACKET_SUCCESS : DATA_PACKET_FAIL;
+}
+
+static uint8_t recording_read(Recording* rec, void* data, size_t len) {
+    if (len == 0) {
+        return DATA_PACKET_SUCCESS;
+    }
+    return (fread(data, len, 1, rec->File) == 1) ?
+            DATA_PACKET_SUCCESS : DATA_PACKET_FAIL;
+}
+
+static void recording_set_types(Recording* rec, uint8_t numchan,
+        const Data_Type* types) {
+    rec->NumChannels = numchan;
+    for (uint8_t i = 0; i < numchan; i++) {
+        rec->Types[i] = types[i];
+        rec->Sizes[i] = data_packet_type_size(types[i]);
+        rec->Columns[i].Count = 0;
+    }
+    rec->NumFrames = 0;
+}
+
+uint8_t recording_create(Recording* rec, const char* path, uint8_t numchan,
+        const Data_Type* types) {
+    uint16_t u16;
+
+    rec->File = fopen(path, "wb");
+    if (rec->File == NULL) {
+        return DATA_PACKET_FAIL;
+    }
+    recording_set_types(rec, numchan, types);
+    recording_write(rec, recording_magic, 4);
+    u16 = RECORDING_VERSION;
+    recording_write(rec, &u16, 2);
+    u16 = numchan;
+    recording_write(rec, &u16, 2);
+    for (uint8_t i = 0; i < numchan; i++) {
+        uint8_t t = (uint8_t) types[i];
+        if (recording_write(rec, &t, 1) == DATA_PACKET_FAIL) {
+            return DATA_PACKET_FAIL;
+        }
+    }
+    return DATA_PACKET_SUCCESS;
+}
+
+uint8_t recording_add_frame(Recording* rec, uint16_t seq, uint32_t sample_index,
+        uint32_t timestamp) {
+    // Start a new block here if the frame might not fit, that way a
+    // frame's samples always end up in the same block
+    uint8_t full = (rec->NumFrames >= RECORDING_BLOCK_ROWS);
+    for (uint8_t i = 0; i < rec->NumChannels; i++) {
+        if (rec->Columns[i].Count
+                > (RECORDING_BLOCK_ROWS - RECORDING_FRAME_MAX_RECORDS)) {
+            full = 1;
+        }
+    }
+    if (full) {
+        if (recording_flush(rec) == DATA_PACKET_FAIL) {
+            return DATA_PACKET_FAIL;
+        }
+    }
+    rec->FrameSequence[rec->NumFrames] = seq;
+    rec->FrameSampleIndex[rec->NumFrames] = sample_index;
+    rec->FrameTimestamp[rec->NumFrames] = timestamp;
+    rec->NumFrames++;
+    return DATA_PACKET_SUCCESS;
+}
+
+/**
+ * @brief  Recording Add Sample
+ *            Adds one value to a channel's column, converting from the wire
+ *            byte order.
+ */
+uint8_t recording_add_sample(Recording* rec, uint8_t chan, uint32_t sample_index,
+        const uint8_t* wire_value) {
+    Recording_Column* col = &(rec->Columns[chan]);
+    uint8_t size = rec->Sizes[chan];
+
+    if (col->Count >= RECORDING_BLOCK_ROWS) {
+        if (recording_flush(rec) == DATA_PACKET_FAIL) {
+            return DATA_PACKET_FAIL;
+        }
+    }
+    uint8_t* dest = &(col->Values[col->Count * size]);
+    for (uint8_t i = 0; i < size; i++) {
+        dest[i] = wire_value[size - 1 - i];
+    }
+    col->SampleIndex[col->Count] = sample_index;
+    col->Count++;
+    return DATA_PACKET_SUCCESS;
+}
+
+/**
+ * @brief  Recording Flush
+ *            Writes everything collected so far as one block.
+ */
+uint8_t recording_flush(Recording* rec) {
+    uint8_t ok = DATA_PACKET_SUCCESS;
+    uint8_t empty = (rec->NumFrames == 0);
+
+    for (uint8_t i = 0; i < rec->NumChannels; i++) {
+        if (rec->Columns[i].Count) {
+            empty = 0;
+        }
+    }
+    if (empty) {
+        return DATA_PACKET_SUCCESS;
+    }
+
+    ok &= recording_write(rec, recording_block_magic, 4);
+    ok &= recording_write(rec, &(rec->NumFrames), 4);
+    ok &= recording_write(rec, rec->FrameSequence, rec->NumFrames * 2);
+    ok &= recording_write(rec, rec->FrameSampleIndex, rec->NumFrames * 4);
+    ok &= recording_write(rec, rec->FrameTimestamp, rec->NumFrames * 4);
+    rec->NumFrames = 0;
+    for (uint8_t i = 0; i < rec->NumChannels; i++) {
+        Recording_Column* col = &(rec->Columns[i]);
+        ok &= recording_write(rec, &(col->Count), 4);
+        ok &= recording_write(rec, col->SampleIndex, col->Count * 4);
+        ok &= recording_write(rec, col->Values, col->Count * rec->Sizes[i]);
+        col->Count = 0;
+    }
+    return ok;
+}
+
+uint8_t recording_close(Recording* rec) {
+    uint8_t ok = recording_flush(rec);
+    if (fclose(rec->File) != 0) {
+        ok = DATA_PACKET_FAIL;
+    }
+    rec->File = NULL;
+    return ok;
+}
+
+uint8_t recording_open(Recording* rec, const char* path) {
+    char magic[4];
+    uint16_t version, numchan;
+    Data_Type types[TELEMETRY_MAX_CHANNELS];
+
+    rec->File = fopen(path, "rb");
+    if (rec->File == NULL) {
+        return DATA_PACKET_FAIL;
+    }
+    if ((recording_read(rec, magic, 4) == DATA_PACKET_FAIL)
+            || (memcmp(magic, recording_magic, 4) != 0)
+            || (recording_read(rec, &version, 2) == DATA_PACKET_FAIL)
+            || (version != RECORDING_VERSION)
+            || (recording_read(rec, &numchan, 2) == DATA_PACKET_FAIL)
+            || (numchan > TELEMETRY_MAX_CHANNELS)) {
+        fclose(rec->File);
+        rec->File = NULL;
+        return DATA_PACKET_FAIL;
+    }
+    for (uint8_t i = 0; i < numchan; i++) {
+        uint8_t t;
+        if (recording_read(rec, &t, 1) == DATA_PACKET_FAIL) {
+            fclose(rec->File);
+            rec->File = NULL;
+            return DATA_PACKET_FAIL;
+        }
+        types[i] = (Data_Type) t;
+    }
+    recording_set_types(rec, numchan, types);
+    return DATA_PACKET_SUCCESS;
+}
+
+/**
+ * @brief  Recording Read Block
+ *            Loads the next block into the frame and channel columns.
+ * @retval Number of samples in the block (all channels), zero at the end
+ *         of the file, -1 if the file is damaged
+ */
+int32_t recording_read_block(Recording* rec) {
+    char magic[4];
+    int32_t total = 0;
+
+    if (recording_read(rec, magic, 4) == DATA_PACKET_FAIL) {
+        return 0;
+    }
+    if ((memcmp(magic, recording_block_magic, 4) != 0)
+            || (recording_read(rec, &(rec->NumFrames), 4) == DATA_PACKET_FAIL)
+            || (rec->NumFrames > RECORDING_BLOCK_ROWS)) {
+        return -1;
+    }
+    if ((recording_read(rec, rec->FrameSequence, rec->NumFrames * 2)
+            == DATA_PACKET_FAIL)
+            || (recording_read(rec, rec->FrameSampleIndex, rec->NumFrames * 4)
+                    == DATA_PACKET_FAIL)
+            || (recording_read(rec, rec->FrameTimestamp, rec->NumFrames * 4)
+                    == DATA_PACKET_FAIL)) {
+        return -1;
+    }
+    for (uint8_t i = 0; i < rec->NumChannels; i++) {
+        Recording_Column* col = &(rec->Columns[i]);
+        if ((recording_read(rec, &(col->Count), 4) == DATA_PACKET_FAIL)
+                || (col->Count > RECORDING_BLOCK_ROWS)
+                || (recording_read(rec, col->SampleIndex, col->Count * 4)
+                        == DATA_PACKET_FAIL)
+                || (recording_read(rec, col->Values, col->Count * rec->Sizes[i])
+                        == DATA_PACKET_FAIL)) {
+            return -1;
+        }
+        total += col->Count;
+    }
+    return total;
+}
+
+double recording_value(const Recording* rec, uint8_t chan, uint32_t row) {
+    const uint8_t* src = &(rec->Columns[chan].Values[row * rec->Sizes[chan]]);
+    int8_t i8;
+    int16_t i16;
+    int32_t i32;
+    float f;
+
+    switch (rec->Types[chan]) {
+    case Data_Type_Int8:
+        memcpy(&i8, src, 1);
+        return i8;
+    case Data_Type_Int16:
+        memcpy(&i16, src, 2);
+        return i16;
+    case Data_Type_Int32:
+        memcpy(&i32, src, 4);
+        return i32;
+    case Data_Type_Float:
+        memcpy(&f, src, 4);
+        return f;
+    default:
+        return 0.0;
+    }
+}
@@ -0,0 +1,90 @@
+/******************************************************************************
+ * Filename: recording.h
+ * Description: Columnar on-disk format for recorded telemetry. Each channel
+ *              is stored as its own column of sample indexes and values, so
+ *              a channel can be read back without touching the others.
+ *
+ ******************************************************************************
+
+ Copyright (c) 2019 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#ifndef _RECORDING_H_
+#define _RECORDING_H_
+
+#include <stdio.h>
+#include "main.h"
+#include "telemetry.h"
+
+/**
+ * File format, all values little endian:
+ * Header
+ * - 4 bytes: "EBTL"
+ * - U16: Format version (RECORDING_VERSION)
+ * - U16: Number of channels
+ * - U8 per channel: Data_Type
+ * Then blocks until the end of the file, each one being
+ * - 4 bytes: "BLK1"
+ * - U32: Number of frames, then that many U16 sequence numbers, U32 sample
+ *        indexes and U32 timestamps (three columns)
+ * - Per channel: U32 number of samples, then that many U32 sample indexes
+ *        followed by that many values (1, 2 or 4 bytes each depending on
+ *        the type, floats as IEEE-754 single)
+ */
+#define RECORDING_VERSION       (1)
+#define RECORDING_BLOCK_ROWS    (4096) // Block is written when a column fills
+#define RECORDING_FRAME_MAX_RECORDS \
+    ((TELEMETRY_FRAME_LENGTH - TELEMETRY_FRAME_HEADER) / TELEMETRY_RECORD_HEADER)
+
+typedef struct _recording_column {
+    uint32_t Count;
+    uint32_t SampleIndex[RECORDING_BLOCK_ROWS];
+    uint8_t Values[RECORDING_BLOCK_ROWS * 4];
+} Recording_Column;
+
+typedef struct _recording {
+    FILE* File;
+    uint8_t NumChannels;
+    Data_Type Types[TELEMETRY_MAX_CHANNELS];
+    uint8_t Sizes[TELEMETRY_MAX_CHANNELS];
+    // Frame columns
+    uint32_t NumFrames;
+    uint16_t FrameSequence[RECORDING_BLOCK_ROWS];
+    uint32_t FrameSampleIndex[RECORDING_BLOCK_ROWS];
+    uint32_t FrameTimestamp[RECORDING_BLOCK_ROWS];
+    Recording_Column Columns[TELEMETRY_MAX_CHANNELS];
+} Recording;
+
+// Writing
+uint8_t recording_create(Recording* rec, const char* path, uint8_t numchan,
+        const Data_Type* types);
+uint8_t recording_add_frame(Recording* rec, uint16_t seq, uint32_t sample_index,
+        uint32_t timestamp);
+uint8_t recording_add_sample(Recording* rec, uint8_t chan, uint32_t sample_index,
+        const uint8_t* wire_value);
+uint8_t recording_flush(Recording* rec);
+uint8_t recording_close(Recording* rec);
+// Reading
+uint8_t recording_open(Recording* rec, const char* path);
+int32_t recording_read_block(Recording* rec);
+double recording_value(const Recording* rec, uint8_t chan, uint32_t row);
+
+#endif //_RECORDING_H_
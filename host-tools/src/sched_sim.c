@@ -0,0 +1,233 @@
+/******************************************************************************
+ * Filename: sched_sim.c
+ * Description: Runs the firmware's main loop scheduler on the host, with the
+ *              tick and the interrupts that signal tasks simulated, and tasks
+ *              that take a set time to run. Time is simulated, so latencies come
+ *              out as they would on the controller for those run times.
+ *
+ *              Interrupts are delivered while a task is running (it is
+ *              preempted, as on the controller) and from the idle hook, which
+ *              skips ahead to the next one instead of sleeping.
+ *
+ ******************************************************************************
+
+ Copyright (c) 2019 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "main.h"
+#include "scheduler.h"
+#include "sched_sim.h"
+
+typedef struct _sched_sim {
+    const Sched_Sim_Task* Tasks;
+    uint64_t NowUs;
+    uint64_t EndUs;
+    uint64_t NextTickUs;
+    uint64_t NextEventUs[SCHED_MAX_TASKS];
+    uint8_t EventWaiting[SCHED_MAX_TASKS]; // Signalled, no run started since
+    uint8_t Stopped; // No more interrupts
+    uint64_t IdleUs;
+    Sched_Sim_Result Result;
+} Sched_Sim;
+
+// *** Global variables ***
+Sched_Sim SchedSim;
+
+/**
+ * The controller's tasks, with run time budgets for the worst case of each:
+ * a full packet to answer on a link, a telemetry frame to hand over, and so
+ * on. These are estimates, CONFIG_DIAG_TASK_RUN_US gives the real ones.
+ * USB is signalled for every packet the host polls for, the BMS chain
+ * answers while a refresh is running, the display asks a few times a second.
+ */
+const Sched_Sim_Task SchedSimFirmware[SCHED_MAX_TASKS] = {
+    [TASK_USB_COMM] = { "USB comm", TASK_COMM_PERIOD_MS,
+            TASK_COMM_DEADLINE_US, 60, 1000 },
+    [TASK_BMS_COMM] = { "BMS comm", TASK_COMM_PERIOD_MS,
+            TASK_COMM_DEADLINE_US, 40, 5000 },
+    [TASK_HBD_COMM] = { "HBD comm", TASK_COMM_PERIOD_MS,
+            TASK_COMM_DEADLINE_US, 40, 20000 },
+    [TASK_TELEMETRY] = { "telemetry", TASK_COMM_PERIOD_MS,
+            TASK_COMM_DEADLINE_US, 30, 1000 },
+    [TASK_HALL_DETECT] = { "Hall detect", TASK_HALL_DETECT_PERIOD_MS,
+            TASK_HALL_DETECT_DEADLINE_US, 2, 0 },
+    [TASK_ROUTINE_RESULT] = { "routine result", TASK_RESULT_PERIOD_MS,
+            TASK_RESULT_DEADLINE_US, 20, 0 },
+    [TASK_DASHBOARD] = { "dashboard", TASK_DASHBOARD_PERIOD_MS,
+            TASK_DASHBOARD_DEADLINE_US, 25, 0 },
+    [TASK_PUSHBUTTON] = { "pushbutton", TASK_PUSHBUTTON_PERIOD_MS,
+            TASK_PUSHBUTTON_DEADLINE_US, 1, 0 },
+    [TASK_BMS_REFRESH] = { "BMS refresh", TASK_BMS_REFRESH_PERIOD_MS,
+            TASK_BMS_REFRESH_DEADLINE_US, 15, 0 },
+    [TASK_TEMPERATURE] = { "temperature", TASK_TEMPERATURE_PERIOD_MS,
+            TASK_TEMPERATURE_DEADLINE_US, 5, 0 },
+    [TASK_SOC_SAVE] = { "SoC save", TASK_SOC_SAVE_PERIOD_MS,
+            SCHED_NO_DEADLINE, 3, 0 },
+    [TASK_EEPROM] = { "EEPROM", TASK_EEPROM_PERIOD_MS,
+            SCHED_NO_DEADLINE, 2, 0 },
+    [TASK_BMS_DEBUG] = { "BMS debug", TASK_BMS_DEBUG_PERIOD_MS,
+            SCHED_NO_DEADLINE, 1, 0 },
+    [TASK_WATCHDOG] = { "watchdog", TASK_WATCHDOG_PERIOD_MS,
+            TASK_WATCHDOG_DEADLINE_US, 1, 0 },
+};
+
+static uint32_t sched_sim_now(void) {
+    return (uint32_t) SchedSim.NowUs;
+}
+
+// Earliest interrupt still to come, and whose it is (SCHED_MAX_TASKS: tick)
+static uint64_t sched_sim_next(uint8_t* source) {
+    uint64_t next = SchedSim.NextTickUs;
+
+    *source = SCHED_MAX_TASKS;
+    for (uint8_t id = 0; id < SCHED_MAX_TASKS; id++) {
+        if ((SchedSim.Tasks[id].Name != NULL) && (SchedSim.Tasks[id].EventUs > 0)
+                && (SchedSim.NextEventUs[id] < next)) {
+            next = SchedSim.NextEventUs[id];
+            *source = id;
+        }
+    }
+    return next;
+}
+
+// Moves time on to when, taking every interrupt on the way
+static void sched_sim_advance(uint64_t when) {
+    uint8_t source;
+
+    while (!SchedSim.Stopped && (sched_sim_next(&source) <= when)) {
+        SchedSim.NowUs = sched_sim_next(&source);
+        if (SchedSim.NowUs > SchedSim.EndUs) {
+            SchedSim.Stopped = 1;
+            break;
+        }
+        if (source == SCHED_MAX_TASKS) {
+            SchedSim.NextTickUs += SCHED_SIM_TICK_US;
+            SchedSim.Result.Ticks++;
+            sched_tick();
+        } else {
+            SchedSim.NextEventUs[source] += SchedSim.Tasks[source].EventUs;
+            SchedSim.EventWaiting[source] = 1;
+            SchedSim.Result.Events++;
+            sched_signal(source);
+        }
+    }
+    if (when > SchedSim.NowUs) {
+        SchedSim.NowUs = when;
+    }
+}
+
+static void sched_sim_task(uint8_t id) {
+    SchedSim.EventWaiting[id] = 0;
+    sched_sim_advance(SchedSim.NowUs + SchedSim.Tasks[id].CostUs);
+}
+
+// The scheduler only takes plain functions
+#define SCHED_SIM_TASK(n)   static void sched_sim_task_##n(void) { sched_sim_task(n); }
+SCHED_SIM_TASK(0) SCHED_SIM_TASK(1) SCHED_SIM_TASK(2) SCHED_SIM_TASK(3)
+SCHED_SIM_TASK(4) SCHED_SIM_TASK(5) SCHED_SIM_TASK(6) SCHED_SIM_TASK(7)
+SCHED_SIM_TASK(8) SCHED_SIM_TASK(9) SCHED_SIM_TASK(10) SCHED_SIM_TASK(11)
+SCHED_SIM_TASK(12) SCHED_SIM_TASK(13) SCHED_SIM_TASK(14)
+
+static void (* const SchedSimRun[SCHED_MAX_TASKS])(void) = {
+    sched_sim_task_0, sched_sim_task_1, sched_sim_task_2, sched_sim_task_3,
+    sched_sim_task_4, sched_sim_task_5, sched_sim_task_6, sched_sim_task_7,
+    sched_sim_task_8, sched_sim_task_9, sched_sim_task_10, sched_sim_task_11,
+    sched_sim_task_12, sched_sim_task_13, sched_sim_task_14
+};
+
+// Sleeps until the next interrupt, like the WFI would
+static void sched_sim_idle(void) {
+    uint8_t source;
+    uint64_t was = SchedSim.NowUs;
+
+    for (uint8_t id = 0; id < SCHED_MAX_TASKS; id++) {
+        if (sched_get_task(id)->Pending) {
+            SchedSim.Result.BadIdles++;
+            return;
+        }
+    }
+    if (SchedSim.Stopped) {
+        return;
+    }
+    sched_sim_advance(sched_sim_next(&source));
+    SchedSim.IdleUs += SchedSim.NowUs - was;
+}
+
+/**
+ * @brief  Scheduler Simulation Run
+ *         Runs the scheduler with the given tasks for a while.
+ * @param  tasks - SCHED_MAX_TASKS of them, in task number order
+ * @param  ms - simulated time
+ * @param  result - what happened, the scheduler keeps the task statistics
+ * @retval 0 if every signal was followed by a run and the idle hook was only
+ *         called with nothing ready
+ */
+int sched_sim_run(const Sched_Sim_Task* tasks, uint32_t ms,
+        Sched_Sim_Result* result) {
+    memset(&SchedSim, 0, sizeof(SchedSim));
+    SchedSim.Tasks = tasks;
+    SchedSim.EndUs = (uint64_t) ms * 1000;
+    SchedSim.NextTickUs = SCHED_SIM_TICK_US;
+
+    sched_init(sched_sim_now);
+    sched_set_idle(sched_sim_idle);
+    for (uint8_t id = 0; id < SCHED_MAX_TASKS; id++) {
+        if (tasks[id].Name != NULL) {
+            sched_set_task(id, SchedSimRun[id], tasks[id].PeriodMs,
+                    tasks[id].DeadlineUs);
+            // Spread the events out, so they don't all land on a tick
+            SchedSim.NextEventUs[id] = (tasks[id].EventUs / 2) + (7 * id) + 1;
+        }
+    }
+    while (!SchedSim.Stopped) {
+        sched_run_once();
+    }
+    // Whatever the last interrupts released
+    sched_run_once();
+
+    for (uint8_t id = 0; id < SCHED_MAX_TASKS; id++) {
+        SchedSim.Result.LostEvents += SchedSim.EventWaiting[id];
+    }
+    SchedSim.Result.Idles = sched_get_idles();
+    SchedSim.Result.IdleShare = (double) SchedSim.IdleUs / SchedSim.EndUs;
+    *result = SchedSim.Result;
+    return ((result->LostEvents != 0) || (result->BadIdles != 0));
+}
+
+/**
+ * @brief  Scheduler Simulation Latency Bound
+ *         Longest a task can wait to start: released just after a pass went
+ *         by it, it waits for the rest of that pass and the start of the
+ *         next one, no more than one run of every task. Leaves out the time
+ *         taken by interrupts, which is none in the simulation.
+ */
+uint32_t sched_sim_latency_bound(const Sched_Sim_Task* tasks) {
+    uint32_t bound = 0;
+
+    for (uint8_t id = 0; id < SCHED_MAX_TASKS; id++) {
+        if (tasks[id].Name != NULL) {
+            bound += tasks[id].CostUs;
+        }
+    }
+    return bound;
+}
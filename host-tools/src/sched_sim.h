@@ -0,0 +1,62 @@
+/******************************************************************************
+ * Filename: sched_sim.h
+ * Description: Runs the firmware's main loop scheduler on the host, with the
+ *              tick and the interrupts that signal tasks simulated, and tasks
+ *              that take a set time to run. Time is simulated, so latencies come
+ *              out as they would on the controller for those run times.
+ *
+ ******************************************************************************
+
+ Copyright (c) 2019 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#ifndef _SCHED_SIM_H_
+#define _SCHED_SIM_H_
+
+#include "main.h"
+#include "scheduler.h"
+
+#define SCHED_SIM_TICK_US       (1000) // SysTick
+
+typedef struct _sched_sim_task {
+    const char* Name; // NULL if not used
+    uint32_t PeriodMs;
+    uint32_t DeadlineUs;
+    uint32_t CostUs; // Time each run takes
+    uint32_t EventUs; // Signalled by an interrupt this often, 0 for never
+} Sched_Sim_Task;
+
+typedef struct _sched_sim_result {
+    uint32_t Ticks;
+    uint32_t Events; // Signals from the simulated interrupts
+    uint32_t LostEvents; // Signals that no run started after
+    uint32_t BadIdles; // Idle hook called with a task ready
+    uint32_t Idles;
+    double IdleShare; // Of the simulated time
+} Sched_Sim_Result;
+
+extern const Sched_Sim_Task SchedSimFirmware[SCHED_MAX_TASKS];
+
+int sched_sim_run(const Sched_Sim_Task* tasks, uint32_t ms,
+        Sched_Sim_Result* result);
+uint32_t sched_sim_latency_bound(const Sched_Sim_Task* tasks);
+
+#endif //_SCHED_SIM_H_
@@ -0,0 +1,434 @@
+/******************************************************************************
+ * Filename: selftest.c
+ * Description: Checks of the shared firmware code that can run on the host:
+ *              CRC test vectors and packet round trips.
+ *
+ ******************************************************************************
+
+ Copyright (c) 2019 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "main.h"
+#include "selftest.h"
+#include "bms_sim.h"
+#include "ee_sim.h"
+#include "sched_sim.h"
+
+typedef struct _crc_vector {
+    const char* Data;
+    uint16_t Length;
+    uint32_t Crc;
+} CRC_Vector;
+
+// Expected values are the standard CRC-32 of the data zero padded to a
+// multiple of 4 bytes, which is what the STM32 CRC unit produces.
+static const CRC_Vector crc_vectors[] = {
+    { "", 0, 0x00000000 },
+    { "a", 1, 0xA2DE4F7A },
+    { "ab", 2, 0xE98D5034 },
+    { "abc", 3, 0xA75D6850 },
+    { "abcd", 4, 0xED82CD11 },
+    { "123456789", 9, 0x77D55834 },
+    { "\x9A\xCC\x91\x6E\x00\x00", 6, 0x20E78E65 }, // CONTROLLER_ACK header
+};
+
+#define NUM_CRC_VECTORS     (sizeof(crc_vectors) / sizeof(crc_vectors[0]))
+
+static int failures = 0;
+
+static void check(int ok, const char* what, unsigned int n) {
+    if (!ok) {
+        fprintf(stderr, "FAIL: %s (%u)\n", what, n);
+        failures++;
+    }
+}
+
+// Bit at a time reference, shares nothing with crc32_table.c
+static uint32_t reference_crc(const uint8_t* buf, uint16_t len) {
+    uint32_t crc = 0xFFFFFFFF;
+    uint16_t padded = (len + 3) & ~0x03;
+    for (uint16_t i = 0; i < padded; i++) {
+        crc ^= (i < len) ? buf[i] : 0;
+        for (uint8_t bit = 0; bit < 8; bit++) {
+            crc = (crc & 1) ? ((crc >> 1) ^ 0xEDB88320) : (crc >> 1);
+        }
+    }
+    return crc ^ 0xFFFFFFFF;
+}
+
+static void test_crc_vectors(void) {
+    for (unsigned int i = 0; i < NUM_CRC_VECTORS; i++) {
+        const CRC_Vector* v = &crc_vectors[i];
+        CRC32_Context ctx;
+
+        check(CRC32_Generate((uint8_t*) v->Data, v->Length) == v->Crc,
+                "CRC vector, whole buffer", i);
+        CRC32_Start(&ctx);
+        for (uint16_t j = 0; j < v->Length; j++) {
+            CRC32_Update(&ctx, (uint8_t) v->Data[j]);
+        }
+        check(CRC32_Final(&ctx) == v->Crc, "CRC vector, byte at a time", i);
+        check(reference_crc((const uint8_t*) v->Data, v->Length) == v->Crc,
+                "CRC vector, reference", i);
+    }
+}
+
+static void test_crc_random(void) {
+    uint8_t buf[PACKET_MAX_LENGTH];
+
+    srand(1234);
+    for (unsigned int n = 0; n < 1000; n++) {
+        uint16_t len = rand() % sizeof(buf);
+        uint16_t split = (len > 0) ? (rand() % len) : 0;
+        CRC32_Context ctx;
+
+        for (uint16_t i = 0; i < len; i++) {
+            buf[i] = rand();
+        }
+        uint32_t expected = reference_crc(buf, len);
+        CRC32_Start(&ctx);
+        CRC32_UpdateBuffer(&ctx, buf, split);
+        // Final doesn't disturb the running CRC
+        CRC32_Final(&ctx);
+        CRC32_UpdateBuffer(&ctx, &buf[split], len - split);
+        check(CRC32_Final(&ctx) == expected, "CRC random, split buffer", n);
+    }
+}
+
+/**
+ * Creates packets of every length, runs them back through the receive
+ * parser, and checks that a corrupted byte anywhere is never accepted.
+ */
+static void test_packets(void) {
+    uint8_t data[PACKET_MAX_LENGTH];
+    uint8_t txbuf[PACKET_MAX_LENGTH];
+    uint8_t rxdata[PACKET_MAX_DATA_LENGTH];
+    Data_Packet_Type tx, rx;
+
+    tx.TxBuffer = txbuf;
+    for (uint16_t len = 0; len <= PACKET_MAX_DATA_LENGTH; len++) {
+        for (uint16_t i = 0; i < len; i++) {
+            data[i] = (uint8_t) (len * 7 + i);
+        }
+        if (data_packet_create(&tx, CONTROLLER_STREAM_DATA, data, len)
+                != DATA_PACKET_SUCCESS) {
+            check(0, "packet create", len);
+            continue;
+        }
+
+        uint8_t found = 0;
+        memset(&rx, 0, sizeof(rx));
+        rx.Data = rxdata;
+        for (uint16_t i = 0; i < tx.TxLength; i++) {
+            found += data_packet_extract_one_byte(&rx, txbuf[i]);
+        }
+        check(found == 1, "packet round trip", len);
+        check((rx.PacketType == CONTROLLER_STREAM_DATA)
+                && (rx.DataLength == len) && (memcmp(rxdata, data, len) == 0),
+                "packet contents", len);
+
+        // Flip one bit in a different place each time
+        uint16_t pos = len % tx.TxLength;
+        txbuf[pos] ^= 0x10;
+        found = 0;
+        memset(&rx, 0, sizeof(rx));
+        rx.Data = rxdata;
+        for (uint16_t i = 0; i < tx.TxLength; i++) {
+            found += data_packet_extract_one_byte(&rx, txbuf[i]);
+        }
+        check(found == 0, "corrupted packet rejected", len);
+    }
+}
+
+/**
+ * Builds a stream of packets with noise in between (including stray start
+ * bytes and a corrupted packet), then checks the block method finds exactly
+ * the same packets as the byte at a time method, however the stream is cut
+ * into blocks.
+ */
+static void test_span(void) {
+    static uint8_t stream[16384];
+    uint8_t data[PACKET_MAX_LENGTH];
+    uint8_t rxdata[PACKET_MAX_DATA_LENGTH];
+    Data_Packet_Type tx, rx;
+    size_t len = 0;
+    uint32_t expected = 0;
+
+    srand(4321);
+    while (len + 2 * PACKET_MAX_LENGTH < sizeof(stream)) {
+        uint16_t noise = rand() % 8;
+        for (uint16_t i = 0; i < noise; i++) {
+            // Never a whole start sequence, that could hide a real packet
+            uint8_t b = (rand() & 1) ? PACKET_START_0 : rand();
+            stream[len++] = (b == PACKET_START_1) ? 0 : b;
+        }
+        uint16_t datalen = rand() % (PACKET_MAX_DATA_LENGTH + 1);
+        for (uint16_t i = 0; i < datalen; i++) {
+            data[i] = rand();
+        }
+        tx.TxBuffer = &stream[len];
+        data_packet_create(&tx, GET_RAM_RESULT, data, datalen);
+        if ((rand() % 10) == 0) {
+            stream[len + PACKET_NONCRC_OVHD_BYTES + (datalen / 2)] ^= 0x01;
+        } else {
+            expected++;
+        }
+        len += tx.TxLength;
+    }
+
+    for (unsigned int trial = 0; trial < 20; trial++) {
+        uint32_t found = 0;
+        size_t place = 0;
+        memset(&rx, 0, sizeof(rx));
+        rx.Data = rxdata;
+        while (place < len) {
+            // Trial 0 is one block per byte, then random block sizes
+            uint16_t block = (trial == 0) ? 1 : (1 + rand() % 300);
+            if (block > len - place) {
+                block = len - place;
+            }
+            uint16_t done = 0;
+            while (done < block) {
+                uint16_t used;
+                found += data_packet_extract_span(&rx, &stream[place + done],
+                        block - done, &used);
+                done += used;
+            }
+            place += block;
+        }
+        check(found == expected, "block parser packet count", trial);
+    }
+
+    uint32_t found = 0;
+    memset(&rx, 0, sizeof(rx));
+    rx.Data = rxdata;
+    for (size_t i = 0; i < len; i++) {
+        found += data_packet_extract_one_byte(&rx, stream[i]);
+    }
+    check(found == expected, "byte parser packet count", 0);
+}
+
+/**
+ * COBS framing: every packet length round trips, with zero heavy data, the
+ * encoded packet has no zero but the delimiter, and a stream with noise and
+ * corrupted packets (in the data or a code byte) loses only those packets,
+ * however it is cut into blocks.
+ */
+static void test_cobs(void) {
+    static uint8_t stream[16384];
+    uint8_t data[PACKET_MAX_LENGTH];
+    uint8_t txbuf[PACKET_MAX_LENGTH];
+    uint8_t rxdata[PACKET_MAX_DATA_LENGTH];
+    Data_Packet_Type tx, rx;
+    const uint16_t maxlen = PACKET_MAX_LENGTH - PACKET_OVERHEAD_BYTES
+            - PACKET_COBS_OVERHEAD_BYTES;
+    size_t len = 0;
+    uint32_t expected = 0;
+
+    srand(5678);
+    tx.Framing = DATA_PACKET_FRAMING_COBS;
+    for (uint16_t datalen = 0; datalen <= maxlen; datalen++) {
+        uint32_t found = 0;
+        for (uint16_t i = 0; i < datalen; i++) {
+            data[i] = (rand() & 1) ? 0 : rand();
+        }
+        tx.TxBuffer = txbuf;
+        if (data_packet_create(&tx, GET_RAM_RESULT, data, datalen)
+                == DATA_PACKET_FAIL) {
+            check(0, "COBS create", datalen);
+            continue;
+        }
+        check(memchr(txbuf, 0, tx.TxLength - 1) == NULL, "COBS no zeros", datalen);
+        check(txbuf[tx.TxLength - 1] == PACKET_COBS_DELIMITER, "COBS delimiter",
+                datalen);
+        memset(&rx, 0, sizeof(rx));
+        rx.Data = rxdata;
+        rx.Framing = DATA_PACKET_FRAMING_COBS;
+        for (uint16_t i = 0; i < tx.TxLength; i++) {
+            found += data_packet_extract_one_byte(&rx, txbuf[i]);
+        }
+        check((found == 1) && (rx.DataLength == datalen)
+                && (memcmp(rxdata, data, datalen) == 0), "COBS round trip",
+                datalen);
+    }
+    tx.TxBuffer = txbuf;
+    check(data_packet_create(&tx, GET_RAM_RESULT, data, maxlen + 1)
+            == DATA_PACKET_FAIL, "COBS oversize refused", maxlen + 1);
+
+    while (len + 2 * PACKET_MAX_LENGTH < sizeof(stream)) {
+        uint16_t noise = rand() % 8;
+        for (uint16_t i = 0; i < noise; i++) {
+            stream[len++] = (rand() & 1) ? PACKET_START_0 : rand();
+        }
+        if (noise) {
+            stream[len++] = PACKET_COBS_DELIMITER;
+        }
+        uint16_t datalen = rand() % (PACKET_MAX_DATA_LENGTH
+                - PACKET_COBS_OVERHEAD_BYTES + 1);
+        for (uint16_t i = 0; i < datalen; i++) {
+            data[i] = (rand() & 3) ? rand() : 0;
+        }
+        tx.TxBuffer = &stream[len];
+        data_packet_create(&tx, GET_RAM_RESULT, data, datalen);
+        switch (rand() % 10) {
+        case 0:
+            // Code byte, throws the block boundaries out
+            stream[len] ^= 0x10;
+            break;
+        case 1:
+            stream[len + (tx.TxLength / 2)] ^= 0x01;
+            break;
+        default:
+            expected++;
+            break;
+        }
+        len += tx.TxLength;
+    }
+
+    for (unsigned int trial = 0; trial < 20; trial++) {
+        uint32_t found = 0;
+        size_t place = 0;
+        memset(&rx, 0, sizeof(rx));
+        rx.Data = rxdata;
+        rx.Framing = DATA_PACKET_FRAMING_COBS;
+        while (place < len) {
+            uint16_t block = (trial == 0) ? 1 : (1 + rand() % 300);
+            if (block > len - place) {
+                block = len - place;
+            }
+            uint16_t done = 0;
+            while (done < block) {
+                uint16_t used;
+                found += data_packet_extract_span(&rx, &stream[place + done],
+                        block - done, &used);
+                done += used;
+            }
+            place += block;
+        }
+        check(found == expected, "COBS block parser packet count", trial);
+    }
+}
+
+/**
+ * Reads a simulated BMS chain with the firmware's code, with every mix of
+ * boards that take batch reads and boards that only take single reads.
+ */
+static void test_bms_chain(void) {
+    Bms_Sim_Result res;
+    for (uint16_t legacy = 0; legacy < 8; legacy++) {
+        check(bms_sim_run(3, legacy, BMS_BAUDRATE, 2, &res) == 0,
+                "BMS chain read back", legacy);
+    }
+}
+
+/**
+ * Saves to the EEPROM emulation on simulated flash and boots from it, from
+ * an empty page through to after page transfers, and boots from saves that
+ * were cut short. Saves with the motor running never erase, through to
+ * both pages filling up. The configuration record survives a round trip
+ * through the host and a save cut short.
+ */
+static void test_eeprom(void) {
+    Ee_Sim_Result res;
+    for (uint16_t saves = 0; saves <= 300; saves += 50) {
+        check(ee_sim_run(saves, 1, &res) == 0, "EEPROM read back", saves);
+    }
+    check(ee_sim_run(1000, 1, &res) == 0, "EEPROM read back", 1000);
+    for (uint16_t lost = 1; lost <= 5; lost++) {
+        check(ee_sim_torn_batch(lost) == 0, "EEPROM torn batch", lost);
+    }
+    check(ee_sim_deferred_erase(200, 1) == 0, "EEPROM erase at boot", 200);
+    for (uint16_t saves = 100; saves <= 600; saves += 250) {
+        check(ee_sim_deferred_erase(saves, 0) == 0, "EEPROM deferred erase",
+                saves);
+    }
+    check(ee_sim_config_blob() == 0, "configuration record", 0);
+}
+
+/**
+ * Runs the main loop scheduler with simulated interrupts. With the
+ * controller's tasks every periodic task runs once per period, no task
+ * waits longer than one run of all of them and none misses its deadline.
+ * With more work than time, the periodic tasks overrun but nothing that
+ * was signalled is forgotten.
+ */
+static void test_scheduler(void) {
+    Sched_Sim_Task tasks[SCHED_MAX_TASKS];
+    Sched_Sim_Result res;
+    uint32_t bound = sched_sim_latency_bound(SchedSimFirmware);
+
+    check(sched_sim_run(SchedSimFirmware, 1000, &res) == 0,
+            "scheduler events and idles", 0);
+    for (uint8_t id = 0; id < SCHED_MAX_TASKS; id++) {
+        const Sched_Sim_Task* t = &SchedSimFirmware[id];
+        const Sched_Task* task = sched_get_task(id);
+        if (t->Name == NULL) {
+            check(task->Runs == 0, "scheduler unused task", id);
+            continue;
+        }
+        if (t->EventUs == 0) {
+            check(task->Runs == (1000 / t->PeriodMs), "scheduler periodic runs",
+                    id);
+        }
+        check(task->MaxLatencyUs <= bound, "scheduler latency bound", id);
+        check((task->Overruns == 0) && (task->DeadlineMisses == 0),
+                "scheduler deadlines", id);
+    }
+    check(res.Idles > 0, "scheduler idles", 0);
+
+    // Three 1ms tasks that take 400us each, the last one signalled as well
+    memset(tasks, 0, sizeof(tasks));
+    for (uint8_t id = 0; id < 3; id++) {
+        tasks[id].Name = "busy";
+        tasks[id].PeriodMs = 1;
+        tasks[id].DeadlineUs = 1000;
+        tasks[id].CostUs = 400;
+    }
+    tasks[2].EventUs = 300;
+    check(sched_sim_run(tasks, 1000, &res) == 0,
+            "overloaded scheduler events and idles", 0);
+    check(res.Events > 0, "overloaded scheduler events", 0);
+    check((sched_get_task(2)->Overruns > 0)
+            && (sched_get_task(2)->DeadlineMisses > 0),
+            "overloaded scheduler overruns", 2);
+    check(res.IdleShare < 0.01, "overloaded scheduler idle", 0);
+}
+
+int selftest_run(void) {
+    failures = 0;
+    test_crc_vectors();
+    test_crc_random();
+    test_packets();
+    test_span();
+    test_cobs();
+    test_bms_chain();
+    test_eeprom();
+    test_scheduler();
+    if (failures) {
+        fprintf(stderr, "%d checks failed\n", failures);
+        return 1;
+    }
+    fprintf(stderr, "All checks passed\n");
+    return 0;
+}
@@ -0,0 +1,188 @@
+/******************************************************************************
+ * Filename: stream_decoder.c
+ * Description: Turns a raw byte stream from the controller into packets,
+ *              using the firmware's own parser, and splits telemetry frames
+ *              (CONTROLLER_STREAM_DATA) into per-channel samples.
+ *
+ ******************************************************************************
+
+ Copyright (c) 2019 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#include "stream_decoder.h"
+
+/**
+ * @brief  Stream Decoder Parse Types
+ *            Reads the channel types from a string, one letter per channel
+ *            in subscription order: b = I8, h = I16, i = I32, f = F32
+ * @param  str - type string, e.g. "ffhf"
+ * @param  types - filled with up to TELEMETRY_MAX_CHANNELS types
+ * @retval Number of channels, zero if the string is invalid
+ */
+uint8_t stream_decoder_parse_types(const char* str, Data_Type* types) {
+    uint8_t num = 0;
+    while (*str) {
+        if (num >= TELEMETRY_MAX_CHANNELS) {
+            return 0;
+        }
+        switch (*str) {
+        case 'b':
+            types[num] = Data_Type_Int8;
+            break;
+        case 'h':
+            types[num] = Data_Type_Int16;
+            break;
+        case 'i':
+            types[num] = Data_Type_Int32;
+            break;
+        case 'f':
+            types[num] = Data_Type_Float;
+            break;
+        default:
+            return 0;
+        }
+        num++;
+        str++;
+    }
+    return num;
+}
+
+void stream_decoder_init(Stream_Decoder* dec, uint8_t numchan,
+        const Data_Type* types, const Stream_Decoder_Callbacks* cb) {
+    memset(dec, 0, sizeof(Stream_Decoder));
+    dec->Pkt.Data = dec->RxData;
+    dec->Pkt.State = DATA_COMM_IDLE;
+    dec->NumChannels = numchan;
+    for (uint8_t i = 0; i < numchan; i++) {
+        dec->Types[i] = types[i];
+        dec->Sizes[i] = data_packet_type_size(types[i]);
+    }
+    dec->Cb = *cb;
+}
+
+/**
+ * @brief  Stream Decoder Feed
+ *            Pushes raw bytes through the packet parser, calling back for
+ *            every good packet and every telemetry sample.
+ */
+void stream_decoder_feed(Stream_Decoder* dec, const uint8_t* buf, size_t len) {
+    Data_Packet_Type* pkt = &(dec->Pkt);
+    size_t place = 0;
+
+    dec->Stats.Bytes += len;
+    while (place < len) {
+        size_t count = len - place;
+        uint16_t used;
+        if (count > 0xFFFF) {
+            count = 0xFFFF;
+        }
+        pkt->FaultCode = NO_FAULT;
+        uint8_t found = data_packet_extract_span(pkt, (uint8_t*) &buf[place],
+                (uint16_t) count, &used);
+        place += used;
+        // Only the last fault in each call is seen
+        if (pkt->FaultCode == BAD_CRC) {
+            dec->Stats.CrcErrors++;
+        } else if (pkt->FaultCode != NO_FAULT) {
+            dec->Stats.FramingErrors++;
+        }
+        if (found == DATA_PACKET_SUCCESS) {
+            dec->Stats.Packets++;
+            if (dec->Cb.Packet) {
+                dec->Cb.Packet(dec->Cb.Context, pkt);
+            }
+            if (pkt->PacketType == CONTROLLER_STREAM_DATA) {
+                if (stream_decoder_frame(dec, pkt->Data, pkt->DataLength)
+                        == DATA_PACKET_FAIL) {
+                    dec->Stats.BadFrames++;
+                }
+            }
+            pkt->RxReady = 0;
+        }
+    }
+}
+
+/**
+ * @brief  Stream Decoder Frame
+ *            Splits one telemetry frame into samples. See telemetry.h for
+ *            the format. The whole frame is checked before any callbacks so
+ *            a frame that doesn't match the channel list adds nothing.
+ * @retval DATA_PACKET_SUCCESS or DATA_PACKET_FAIL
+ */
+uint8_t stream_decoder_frame(Stream_Decoder* dec, uint8_t* data, uint16_t len) {
+    Stream_Frame_Header hdr;
+    uint16_t pos;
+
+    if (len < TELEMETRY_FRAME_HEADER) {
+        return DATA_PACKET_FAIL;
+    }
+    // Check pass
+    pos = TELEMETRY_FRAME_HEADER;
+    while (pos < len) {
+        if ((pos + TELEMETRY_RECORD_HEADER) > len) {
+            return DATA_PACKET_FAIL;
+        }
+        uint16_t mask = data_packet_extract_16b(&data[pos + 2]);
+        pos += TELEMETRY_RECORD_HEADER;
+        for (uint8_t i = 0; i < TELEMETRY_MAX_CHANNELS; i++) {
+            if (mask & (1 << i)) {
+                if (i >= dec->NumChannels) {
+                    return DATA_PACKET_FAIL;
+                }
+                pos += dec->Sizes[i];
+            }
+        }
+        if (pos > len) {
+            return DATA_PACKET_FAIL;
+        }
+    }
+
+    hdr.Sequence = data_packet_extract_16b(data);
+    hdr.SampleIndex = data_packet_extract_32b(&data[2]);
+    hdr.Timestamp = data_packet_extract_32b(&data[6]);
+    if (dec->HaveSequence && (hdr.Sequence != dec->NextSequence)) {
+        dec->Stats.FramesLost += (uint16_t) (hdr.Sequence - dec->NextSequence);
+    }
+    dec->HaveSequence = 1;
+    dec->NextSequence = hdr.Sequence + 1;
+    dec->Stats.Frames++;
+    if (dec->Cb.Frame) {
+        dec->Cb.Frame(dec->Cb.Context, &hdr);
+    }
+
+    uint32_t sample = hdr.SampleIndex;
+    pos = TELEMETRY_FRAME_HEADER;
+    while (pos < len) {
+        sample += data_packet_extract_16b(&data[pos]);
+        uint16_t mask = data_packet_extract_16b(&data[pos + 2]);
+        pos += TELEMETRY_RECORD_HEADER;
+        for (uint8_t i = 0; i < dec->NumChannels; i++) {
+            if (mask & (1 << i)) {
+                if (dec->Cb.Sample) {
+                    dec->Cb.Sample(dec->Cb.Context, i, sample, &data[pos]);
+                }
+                pos += dec->Sizes[i];
+            }
+        }
+        dec->Stats.Records++;
+    }
+    return DATA_PACKET_SUCCESS;
+}
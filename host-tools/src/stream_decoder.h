@@ -0,0 +1,81 @@
+/******************************************************************************
+ * Filename: stream_decoder.h
+ * Description: Turns a raw byte stream from the controller into packets,
+ *              using the firmware's own parser, and splits telemetry frames
+ *              (CONTROLLER_STREAM_DATA) into per-channel samples.
+ *
+ ******************************************************************************
+
+ Copyright (c) 2019 David Miller
+
+ Permission is hereby granted, free of charge, to any person obtaining a copy
+ of this software and associated documentation files (the "Software"), to deal
+ in the Software without restriction, including without limitation the rights
+ to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ copies of the Software, and to permit persons to whom the Software is
+ furnished to do so, subject to the following conditions:
+
+ The above copyright notice and this permission notice shall be included in all
+ copies or substantial portions of the Software.
+
+ THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ SOFTWARE.
+ */
+
+#ifndef _STREAM_DECODER_H_
+#define _STREAM_DECODER_H_
+
+#include "main.h"
+#include "telemetry.h"
+
+typedef struct _stream_frame_header {
+    uint16_t Sequence;
+    uint32_t SampleIndex; // PWM cycle count of the first record
+    uint32_t Timestamp; // Microseconds
+} Stream_Frame_Header;
+
+typedef struct _stream_decoder_callbacks {
+    void* Context;
+    // Any good packet, including stream data
+    void (*Packet)(void* ctx, Data_Packet_Type* pkt);
+    void (*Frame)(void* ctx, const Stream_Frame_Header* hdr);
+    // Value is still in wire format (big endian), Size bytes long
+    void (*Sample)(void* ctx, uint8_t chan, uint32_t sample_index,
+            const uint8_t* value);
+} Stream_Decoder_Callbacks;
+
+typedef struct _stream_decoder_stats {
+    uint64_t Bytes;
+    uint32_t Packets;
+    uint32_t CrcErrors;
+    uint32_t FramingErrors; // Bad start, type or length
+    uint32_t Frames;
+    uint32_t FramesLost; // Gaps in the frame sequence number
+    uint32_t BadFrames; // Frame didn't match the channel list
+    uint64_t Records;
+} Stream_Decoder_Stats;
+
+typedef struct _stream_decoder {
+    Data_Packet_Type Pkt;
+    uint8_t RxData[PACKET_MAX_DATA_LENGTH];
+    uint8_t NumChannels;
+    Data_Type Types[TELEMETRY_MAX_CHANNELS];
+    uint8_t Sizes[TELEMETRY_MAX_CHANNELS];
+    uint8_t HaveSequence;
+    uint16_t NextSequence;
+    Stream_Decoder_Callbacks Cb;
+    Stream_Decoder_Stats Stats;
+} Stream_Decoder;
+
+uint8_t stream_decoder_parse_types(const char* str, Data_Type* types);
+void stream_decoder_init(Stream_Decoder* dec, uint8_t numchan,
+        const Data_Type* types, const Stream_Decoder_Callbacks* cb);
+void stream_decoder_feed(Stream_Decoder* dec, const uint8_t* buf, size_t len);
+uint8_t stream_decoder_frame(Stream_Decoder* dec, uint8_t* data, uint16_t len);
+
+#endif //_STREAM_DECODER_H_